@@ -94,7 +94,8 @@ int main(int argc, char **argv)
   char searchResult[5];
   mdbBtreeNode* node;
   mdbBtree* t = NULL;
-  mdbDatatype mdbString = { "STRING", 4, sizeof(byte), (CompareKeysPtr)&strncmp };
+  mdbDatatype mdbString = { "STRING", 4, sizeof(byte), (CompareKeysPtr)&strncmp,
+      MDB_ENCODING_NONE };
 
   mdbBtreeTraversal *trv = (mdbBtreeTraversal*)malloc(sizeof(mdbBtreeTraversal));
 
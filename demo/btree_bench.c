@@ -0,0 +1,222 @@
+/*
+ * btree_bench.c
+ *
+ * Compares the key search inside B-tree nodes: sequential scan, binary
+ * search and the branch-free search used for INT keys.
+ *
+ * Usage: btree_bench [records] [order] (order 0 = optimal order)
+ *
+ * The generic binary search (any key type) needs about log2(n) comparison
+ * calls per node, the sequential scan about n/2. The INT search compares
+ * the keys inline (no calls), its key comparisons are counted by
+ * mdbBtreeFindKey itself (mdbIntCompares).
+ */
+
+#include "mdb/mdb.h"
+#include "mdb/mdbbtree_util.h"
+
+#include <stdlib.h>
+#include <time.h>
+
+#define BENCH_RECORD_SIZE   8
+#define BENCH_KEY_POSITION  0
+#define BENCH_LOOKUPS       100000
+
+char* node_data = NULL;
+uint32 node_count = 0;
+uint32 node_capacity = 0;
+unsigned long compares = 0;
+
+/* Nodes are accessed in place (like with the memory-mapped storage) */
+mdbBtreeNode* ReadNode(const uint32 position, mdbBtree* tree)
+{
+  mdbBtreeNode* node = (mdbBtreeNode*) malloc(sizeof(mdbBtreeNode));
+
+  mdbInitializeNode(node, tree, node_data + position * tree->nodeSize);
+  node->position = position;
+  node->frame = NULL;
+  node->mapped = 1;
+  return node;
+}
+
+uint32 WriteNode(mdbBtreeNode* node)
+{
+  char* data;
+
+  if (node->mapped)
+  {
+    return node->position;
+  }
+  if (node->position == 0L)
+  {
+    if (node_count + 1 >= node_capacity)
+    {
+      fprintf(stderr, "node capacity exceeded\n");
+      exit(1);
+    }
+    node->position = ++node_count;
+  }
+
+  data = node_data + node->position * node->T->nodeSize;
+  memcpy(data, node->data, node->T->nodeSize);
+  free(node->data);
+  mdbInitializeNode(node, node->T, data);
+  node->mapped = 1;
+  return node->position;
+}
+
+void DeleteNode(mdbBtreeNode* node)
+{
+  (void)node;
+}
+
+/* memcmp with a comparison counter (forces the generic binary search) */
+int CountingCompare(const void* key1, const void* key2, size_t size)
+{
+  compares++;
+  return memcmp(key1, key2, size);
+}
+
+/* Reference search: sequential scan inside the nodes */
+int SequentialSearch(const char* key, mdbBtree* t)
+{
+  mdbBtreeNode* node = t->root;
+  mdbBtreeNode* next;
+  int found = 0;
+  uint32 i;
+
+  while (1)
+  {
+    i = 0;
+    while (i < BT_COUNT(node) && t->key_type->compare(key, BT_KEY(node,i), 4) > 0)
+    {
+      i++;
+    }
+    if (i < BT_COUNT(node) && t->key_type->compare(key, BT_KEY(node,i), 4) == 0)
+    {
+      found = 1;
+      break;
+    }
+    if (BT_LEAF(node))
+    {
+      break;
+    }
+    next = ReadNode(node->children[i], t);
+    if (node != t->root) mdbFreeNode(node, 0);
+    node = next;
+  }
+
+  if (node != t->root) mdbFreeNode(node, 0);
+  return found;
+}
+
+/* Stores a key so that memcmp orders the keys numerically */
+void MakeRecord(char* record, uint32 key)
+{
+  record[0] = (char)(key >> 24);
+  record[1] = (char)(key >> 16);
+  record[2] = (char)(key >> 8);
+  record[3] = (char)key;
+  memcpy(record + 4, &key, sizeof(uint32));
+}
+
+double Elapsed(clock_t start)
+{
+  return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+int main(int argc, char **argv)
+{
+  uint32 records = (argc > 1) ? (uint32)atol(argv[1]) : 1000000;
+  uint32 order = (argc > 2) ? (uint32)atol(argv[2]) : 255;
+  mdbDatatype intType = { "INT-32", 0, 4, (CompareKeysPtr)&memcmp,
+      MDB_ENCODING_NONE };
+  mdbDatatype countingType = { "INT-32", 0, 4, &CountingCompare,
+      MDB_ENCODING_NONE };
+  char record[BENCH_RECORD_SIZE];
+  char result[BENCH_RECORD_SIZE];
+  uint32* keys;
+  mdbBtree* t = NULL;
+  clock_t start;
+  double elapsed;
+  uint32 found;
+  uint32 i;
+
+  mdbBtreeCreate(&t, order, BENCH_RECORD_SIZE, BENCH_KEY_POSITION);
+  t->key_type = &intType;
+  t->ReadNode = &ReadNode;
+  t->WriteNode = &WriteNode;
+  t->DeleteNode = &DeleteNode;
+
+  /* every node is at least half full */
+  node_capacity = 2 * (records / t->meta.order + 1) + 2;
+  node_data = (char*) calloc(node_capacity, t->nodeSize);
+  node_count = 1;
+
+  t->root = ReadNode(1, t);
+  *t->root->is_leaf = 1;
+
+  keys = (uint32*) malloc(records * sizeof(uint32));
+  srand(42);
+  for (i = 0; i < records; i++)
+  {
+    keys[i] = ((uint32)rand() << 16) ^ (uint32)rand();
+    MakeRecord(record, keys[i]);
+    mdbBtreeInsert(record, t);
+  }
+
+  printf("records: %lu, order: %lu, nodes: %lu\n", (unsigned long)records,
+      (unsigned long)t->meta.order, (unsigned long)node_count);
+
+  /* sequential scan */
+  t->key_type = &countingType;
+  compares = 0;
+  found = 0;
+  start = clock();
+  for (i = 0; i < BENCH_LOOKUPS; i++)
+  {
+    MakeRecord(record, keys[i % records]);
+    found += SequentialSearch(record, t);
+  }
+  printf("sequential: %8.3f s, %8.1f compares/lookup, found %lu\n",
+      Elapsed(start), (double)compares / BENCH_LOOKUPS, (unsigned long)found);
+
+  /* binary search (generic comparison function) */
+  compares = 0;
+  found = 0;
+  start = clock();
+  for (i = 0; i < BENCH_LOOKUPS; i++)
+  {
+    MakeRecord(record, keys[i % records]);
+    found += (mdbBtreeSearch(record, result, t) == MDB_NO_ERROR);
+  }
+  printf("binary:     %8.3f s, %8.1f compares/lookup, found %lu\n",
+      Elapsed(start), (double)compares / BENCH_LOOKUPS, (unsigned long)found);
+
+  /* branch-free binary search (INT keys compared with memcmp) */
+  t->key_type = &intType;
+  found = 0;
+  start = clock();
+  for (i = 0; i < BENCH_LOOKUPS; i++)
+  {
+    MakeRecord(record, keys[i % records]);
+    found += (mdbBtreeSearch(record, result, t) == MDB_NO_ERROR);
+  }
+  elapsed = Elapsed(start);
+  compares = 0;
+  mdbIntCompares = &compares;
+  for (i = 0; i < BENCH_LOOKUPS; i++)
+  {
+    MakeRecord(record, keys[i % records]);
+    mdbBtreeSearch(record, result, t);
+  }
+  mdbIntCompares = NULL;
+  printf("int:        %8.3f s, %8.1f compares/lookup, found %lu\n",
+      elapsed, (double)compares / BENCH_LOOKUPS, (unsigned long)found);
+
+  free(keys);
+  free(node_data);
+  free(t->root);
+  free(t);
+  return 0;
+}
@@ -0,0 +1,1298 @@
+/*
+ * mdb_check.c
+ *
+ * Consistency checks of the storage engine against a reference model of
+ * its tables, under concurrency and crashes:
+ *
+ *  - inserts and deletes in a pseudo-random order down to an empty table,
+ *    the table is compared with the expected keys after each step and
+ *    after the database is reopened (forward and backward traversals,
+ *    cursors with range bounds and searches), also for tables built by the
+ *    bulk loader, with STRING keys of varying length, with variable-length
+ *    and long (overflow) values and with compressed nodes
+ *  - concurrent writers and readers (searches, multi-key searches and
+ *    cursors) of one table, the final table is compared before and after
+ *    the database is reopened
+ *  - snapshot visibility: a snapshot reads the records of the writes which
+ *    ended before it was opened while a writer keeps changing the table
+ *  - write-ahead log replay: after a crash the committed records are
+ *    recovered from the -wal file, the records written after the last
+ *    commit are not
+ *  - copy-on-write publish: a process killed while it commits leaves the
+ *    tree of its last or of its next commit, never a mix of both
+ *
+ * Usage: mdb_check [directory] (default: the current directory)
+ *
+ * Prints one line per check and storage mode, exits with 1 if any check
+ * found a mismatch.
+ */
+
+#include "mdb/mdb.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+#define CHECK_RECORD_SIZE   8
+#define CHECK_KEYS          20000   /* keys of a table                */
+#define CHECK_WRITERS       3
+#define CHECK_WRITES        10000   /* per writer                     */
+#define CHECK_SEARCHES      32      /* keys of a multi-key search     */
+#define CHECK_BATCH         500     /* keys of a crash test batch     */
+#define CHECK_REPORTED      5       /* mismatches printed per check   */
+#define CHECK_KEY_LENGTH    120     /* STRING keys                    */
+#define CHECK_VALUE_LENGTH  200     /* values stored in the records   */
+#define CHECK_LONG_LENGTH   6000    /* values in overflow pages       */
+#define CHECK_RECORD_MAX    (8 + CHECK_KEY_LENGTH + CHECK_VALUE_LENGTH)
+#define CHECK_RANGES        4       /* cursor ranges per comparison   */
+
+char filename[512];
+mdbColumn columns[2];
+mdbDatabase* db = NULL;
+mdbBtree* table = NULL;
+uint8 present[CHECK_KEYS];
+volatile int stop = 0;
+unsigned long mismatches = 0;
+unsigned int random_state = 1;  /* reference model checks */
+
+/* Columns of the checked table: K INT-32 or STRING, V INT-32 or STRING */
+uint32 key_length = 0;          /* STRING key length (0: INT-32 keys)    */
+uint32 value_length = 0;        /* STRING value length (0: INT-32 values)*/
+uint32 value_position = 0;      /* V column in the records               */
+uint32 record_size = 0;
+uint32 order[CHECK_KEYS];       /* keys in the order of the table        */
+
+/* table "CHECK" (K, V) */
+const char* TABLE_NAME = "\x005\0\0\0CHECK";
+
+mdbColumn* GetColumn(uint8 c, void* cls)
+{
+  (void)cls;
+  return &columns[c];
+}
+
+void LoadColumn(mdbColumn* column, void* cls)
+{
+  (void)column;
+  (void)cls;
+}
+
+/* The values of the V column are stored out of line (mdbColumnOverflows) */
+int ValueOverflows(void)
+{
+  return value_length > 0 &&
+      sizeof(uint32) + value_length > MDB_OVERFLOW_THRESHOLD;
+}
+
+/* Selects the columns of the tables created next */
+void SetColumns(const uint32 key, const uint32 value)
+{
+  key_length = key;
+  value_length = value;
+  value_position = sizeof(uint32) + key;
+  record_size = value_position + ((value == 0) ? sizeof(uint32) :
+      ValueOverflows() ? MDB_OVERFLOW_SIZE : sizeof(uint32) + value);
+}
+
+/* An INT-32 key is stored big-endian (compared with memcmp), a STRING key
+ * is the number behind one of a few common prefixes (prefix compression,
+ * keys of varying length) */
+void MakeKey(char* record, const uint32 key)
+{
+  static const char* prefixes[4] = { "", "ab", "ab/cd/", "ab/cd/ef/gh/" };
+  uint32 length;
+
+  if (key_length == 0)
+  {
+    record[0] = (char)(key >> 24);
+    record[1] = (char)(key >> 16);
+    record[2] = (char)(key >> 8);
+    record[3] = (char)key;
+    return;
+  }
+  memset(record, 0, sizeof(uint32) + key_length);
+  length = sprintf(record + 4, "%s%lu", prefixes[key % 4],
+      (unsigned long)key);
+  memcpy(record, &length, sizeof(uint32));
+}
+
+/* The value is derived from the key so a torn record is detected: the
+ * INT-32 value is the flipped key, a STRING value has a length derived from
+ * the key (long values: up to a few overflow pages) */
+uint32 MakeValue(char* value, const uint32 key)
+{
+  uint32 length = (key * 7) % (value_length + 1);
+  uint32 i;
+
+  if (value_length == 0)
+  {
+    length = key ^ 0x5a5a5a5a;
+    memcpy(value, &length, sizeof(uint32));
+    return sizeof(uint32);
+  }
+  memcpy(value, &length, sizeof(uint32));
+  for (i = 0; i < length; i++)
+  {
+    value[sizeof(uint32) + i] = (char)('a' + (key + i) % 26);
+  }
+  return sizeof(uint32) + length;
+}
+
+/* Makes the record of a key (a long value is written to overflow pages) */
+void MakeRecord(char* record, const uint32 key)
+{
+  char* value;
+
+  memset(record, 0, record_size);
+  MakeKey(record, key);
+  if (!ValueOverflows())
+  {
+    MakeValue(record + value_position, key);
+    return;
+  }
+  value = (char*)malloc(sizeof(uint32) + value_length);
+  MakeValue(value, key);
+  mdbStoreLongValue(table, &db->datatypes[4], value_length,
+      record + value_position, value);
+  free(value);
+}
+
+/* Releases the overflow pages of a record */
+void FreeRecord(const char* record)
+{
+  uint32 first;
+
+  if (ValueOverflows())
+  {
+    memcpy(&first, record + value_position + sizeof(uint32), sizeof(uint32));
+    mdbOverflowFree(table, first);
+  }
+}
+
+uint32 RecordKey(const char* record)
+{
+  char text[CHECK_KEY_LENGTH + 1];
+  uint32 length;
+
+  if (key_length == 0)
+  {
+    return ((uint32)(byte)record[0] << 24) |
+        ((uint32)(byte)record[1] << 16) |
+        ((uint32)(byte)record[2] << 8) | (uint32)(byte)record[3];
+  }
+  memcpy(&length, record, sizeof(uint32));
+  if (length > key_length)
+  {
+    return CHECK_KEYS;
+  }
+  memcpy(text, record + 4, length);
+  text[length] = '\0';
+  return (uint32)strtoul(text + strcspn(text, "0123456789"), NULL, 10);
+}
+
+int RecordValid(const char* record)
+{
+  char expected[sizeof(uint32) + CHECK_LONG_LENGTH];
+  char value[sizeof(uint32) + CHECK_LONG_LENGTH];
+  const uint32 k = RecordKey(record);
+  uint32 size;
+
+  if (k >= CHECK_KEYS)
+  {
+    return 0;
+  }
+  MakeKey(expected, k);
+  if (memcmp(record, expected, value_position) != 0)
+  {
+    return 0;
+  }
+  size = MakeValue(expected, k);
+  if (!ValueOverflows())
+  {
+    return memcmp(record + value_position, expected, size) == 0;
+  }
+  mdbLoadLongValue(table, &db->datatypes[4], value,
+      record + value_position);
+  return memcmp(value, expected, size) == 0;
+}
+
+/* Orders two records like the table (INT-32 keys: memcmp) */
+int CompareKeys(const char* record1, const char* record2)
+{
+  if (key_length == 0)
+  {
+    return memcmp(record1, record2, sizeof(uint32));
+  }
+  return mdbCompareValues(&db->datatypes[4], record1, record2);
+}
+
+int CompareOrder(const void* k1, const void* k2)
+{
+  char record1[sizeof(uint32) + CHECK_KEY_LENGTH];
+  char record2[sizeof(uint32) + CHECK_KEY_LENGTH];
+
+  MakeKey(record1, *(const uint32*)k1);
+  MakeKey(record2, *(const uint32*)k2);
+  return CompareKeys(record1, record2);
+}
+
+/* Sorts the first "keys" keys like the table */
+void SortKeys(const uint32 keys)
+{
+  uint32 i;
+
+  for (i = 0; i < keys; i++)
+  {
+    order[i] = i;
+  }
+  qsort(order, keys, sizeof(uint32), &CompareOrder);
+}
+
+void Mismatch(const char* check, const char* what, const uint32 key)
+{
+  if (__sync_fetch_and_add(&mismatches, 1) < CHECK_REPORTED)
+  {
+    fprintf(stderr, "  %s: %s (key %lu)\n", check, what, (unsigned long)key);
+  }
+}
+
+void Report(const char* check, const uint32 flags, const unsigned long before)
+{
+  printf("%-13s flags 0x%04lx: %s\n", check, (unsigned long)flags,
+      (mismatches == before) ? "ok" : "MISMATCH");
+}
+
+void RemoveFiles(void)
+{
+  char wal[520];
+
+  sprintf(wal, "%s-wal", filename);
+  unlink(filename);
+  unlink(wal);
+}
+
+/* Creates the database file with an empty table, "flags" are the open
+ * flags (MDB_OPEN_*) */
+mdbError CreateTable(const uint32 flags)
+{
+  mdbError ret;
+
+  RemoveFiles();
+  memset(columns, 0, sizeof(columns));
+  memcpy(columns[0].name, "\x001\0\0\0K", 6);
+  memcpy(columns[1].name, "\x001\0\0\0V", 6);
+  columns[0].type = (key_length > 0) ? 4 : 2;
+  columns[0].length = key_length;
+  columns[1].type = (value_length > 0) ? 4 : 2;
+  columns[1].length = value_length;
+
+  if ((ret = mdbCreateDatabase(&db, filename, flags)) != MDB_NO_ERROR)
+  {
+    return ret;
+  }
+  return mdbCreateTable(db, TABLE_NAME, 2, record_size, &table, NULL,
+      &GetColumn);
+}
+
+mdbError OpenTable(const uint32 flags)
+{
+  mdbError ret;
+
+  if ((ret = mdbOpenDatabase(&db, filename, flags)) != MDB_NO_ERROR)
+  {
+    return ret;
+  }
+  return mdbLoadTable(db, TABLE_NAME, &table, NULL, &LoadColumn);
+}
+
+void CloseTable(void)
+{
+  mdbFreeNode(table->root, 0);
+  free(table);
+  table = NULL;
+  mdbCloseDatabase(db);
+  db = NULL;
+}
+
+/* Compares the table with the expected keys (forward cursor, backward
+ * cursor and point searches) */
+void CompareTable(const char* check, const uint8* expected,
+    const mdbSnapshot* snapshot)
+{
+  mdbBtreeCursor* cursor;
+  char record[CHECK_RECORD_SIZE];
+  char key[CHECK_RECORD_SIZE];
+  uint32 count = 0;
+  uint32 found = 0;
+  long previous = -1;
+  uint32 k;
+
+  if (mdbBtreeCursorOpen(&cursor, table, NULL, NULL, 0) != MDB_NO_ERROR ||
+      mdbBtreeCursorSnapshot(cursor, snapshot) != MDB_NO_ERROR)
+  {
+    Mismatch(check, "cursor not opened", 0);
+    return;
+  }
+  while (mdbBtreeCursorNext(cursor, record) == MDB_NO_ERROR)
+  {
+    k = RecordKey(record);
+    if (!RecordValid(record) || (long)k <= previous)
+    {
+      Mismatch(check, "record out of order or torn", k);
+      break;
+    }
+    if (!expected[k])
+    {
+      Mismatch(check, "cursor returns a key not written", k);
+    }
+    previous = k;
+    count++;
+  }
+  while (mdbBtreeCursorPrev(cursor, record) == MDB_NO_ERROR)
+  {
+    count--;
+  }
+  if (count != 0)
+  {
+    Mismatch(check, "forward and backward cursor differ", 0);
+  }
+  mdbBtreeCursorClose(cursor);
+
+  for (k = 0; k < CHECK_KEYS; k++)
+  {
+    MakeRecord(key, k);
+    found = (snapshot != NULL) ?
+        (mdbBtreeSearchSnapshot(key, record, table, snapshot) == MDB_NO_ERROR) :
+        (mdbBtreeSearch(key, record, table) == MDB_NO_ERROR);
+    if (found != expected[k])
+    {
+      Mismatch(check, found ? "search finds a deleted key" :
+          "search misses a key", k);
+    }
+    else if (found && (!RecordValid(record) || RecordKey(record) != k))
+    {
+      Mismatch(check, "search returns a wrong record", k);
+    }
+  }
+}
+
+/* ********************************************************* *
+ *    Reference model
+ * ********************************************************* */
+
+/* Compares the records of a cursor on a range of the table with the
+ * expected keys: the bounds are keys of the table or not, inclusive or
+ * exclusive, the cursor is also placed by a seek and read backwards from
+ * the end of the range */
+void CompareRange(const char* check, const uint32 keys)
+{
+  mdbBtreeCursor* cursor;
+  char lower[CHECK_RECORD_MAX];
+  char upper[CHECK_RECORD_MAX];
+  char record[CHECK_RECORD_MAX];
+  const uint32 first = rand_r(&random_state) % keys;
+  const uint32 last = first + rand_r(&random_state) % (keys - first);
+  const uint32 seek = rand_r(&random_state) % keys;
+  const uint8 flags = (uint8)(rand_r(&random_state) % 4);
+  const int bounded = rand_r(&random_state) % 4;
+  uint32 from = 0;        /* first and last position of the range */
+  uint32 to = keys;
+  uint32 i;
+
+  MakeKey(lower, order[first]);
+  MakeKey(upper, order[last]);
+  if (bounded & 1)
+  {
+    from = first + ((flags & MDB_CURSOR_LOWER_EXCLUSIVE) ? 1 : 0);
+  }
+  if (bounded & 2)
+  {
+    to = last + ((flags & MDB_CURSOR_UPPER_EXCLUSIVE) ? 0 : 1);
+  }
+  if (mdbBtreeCursorOpen(&cursor, table, (bounded & 1) ? lower : NULL,
+      (bounded & 2) ? upper : NULL, flags) != MDB_NO_ERROR)
+  {
+    Mismatch(check, "cursor not opened", order[first]);
+    return;
+  }
+
+  for (i = from; i < to; i++)
+  {
+    if (present[order[i]] && (mdbBtreeCursorNext(cursor, record) !=
+        MDB_NO_ERROR || RecordKey(record) != order[i]))
+    {
+      Mismatch(check, "cursor misses a key of its range", order[i]);
+      break;
+    }
+  }
+  if (i == to && mdbBtreeCursorNext(cursor, record) == MDB_NO_ERROR)
+  {
+    Mismatch(check, "cursor returns a key out of its range",
+        RecordKey(record));
+  }
+  for (i = to; i > from; i--)
+  {
+    if (present[order[i - 1]] && (mdbBtreeCursorPrev(cursor, record) !=
+        MDB_NO_ERROR || RecordKey(record) != order[i - 1]))
+    {
+      Mismatch(check, "backward cursor misses a key of its range",
+          order[i - 1]);
+      break;
+    }
+  }
+
+  /* a seek before the range places the cursor at its start, behind the
+   * range at its end */
+  MakeKey(record, order[seek]);
+  mdbBtreeCursorSeek(cursor, record);
+  for (i = (seek > from) ? seek : from; i < to && !present[order[i]]; i++);
+  if (i < to && (mdbBtreeCursorNext(cursor, record) != MDB_NO_ERROR ||
+      RecordKey(record) != order[i]))
+  {
+    Mismatch(check, "seek misses the next key of the range", order[i]);
+  }
+  else if (i == to && mdbBtreeCursorNext(cursor, record) == MDB_NO_ERROR)
+  {
+    Mismatch(check, "seek leaves the range", RecordKey(record));
+  }
+
+  /* the end of the range read backwards */
+  mdbBtreeCursorLast(cursor);
+  for (i = to; i > from && !present[order[i - 1]]; i--);
+  if (i > from && (mdbBtreeCursorPrev(cursor, record) != MDB_NO_ERROR ||
+      RecordKey(record) != order[i - 1]))
+  {
+    Mismatch(check, "cursor misses the last key of the range", order[i - 1]);
+  }
+  else if (i == from && mdbBtreeCursorPrev(cursor, record) == MDB_NO_ERROR)
+  {
+    Mismatch(check, "last record out of the range", RecordKey(record));
+  }
+  mdbBtreeCursorClose(cursor);
+}
+
+/* Compares the table with the expected keys of the first "keys" keys:
+ * traversals return them in order (forwards and backwards), searches find
+ * them and cursors return the keys of their ranges */
+void CompareRecords(const char* check, const uint32 keys)
+{
+  static uint32 scanned[CHECK_KEYS];
+  mdbBtreeTraversal* trv;
+  char record[CHECK_RECORD_MAX];
+  char previous[CHECK_RECORD_MAX];
+  char key[CHECK_RECORD_MAX];
+  uint32 expected = 0;
+  uint32 count = 0;
+  uint32 found;
+  uint32 k;
+
+  trv = (mdbBtreeTraversal*)calloc(1, sizeof(mdbBtreeTraversal));
+  trv->node = table->root;
+  while (mdbBtreeTraverse(&trv, record) == MDB_NO_ERROR)
+  {
+    k = RecordKey(record);
+    if (!RecordValid(record) ||
+        (count > 0 && CompareKeys(previous, record) >= 0))
+    {
+      Mismatch(check, "record out of order or torn", k);
+    }
+    else if (k >= keys || !present[k])
+    {
+      Mismatch(check, "traversal returns a key not written", k);
+    }
+    memcpy(previous, record, record_size);
+    scanned[count++] = k;
+  }
+
+  /* the backward traversal returns the same records in reverse order */
+  mdbBtreeTraverseLast(&trv);
+  for (k = count; k > 0; k--)
+  {
+    if (mdbBtreeTraversePrev(&trv, record) != MDB_NO_ERROR ||
+        RecordKey(record) != scanned[k - 1])
+    {
+      Mismatch(check, "backward traversal differs", scanned[k - 1]);
+      break;
+    }
+  }
+  if (k == 0 && mdbBtreeTraversePrev(&trv, record) == MDB_NO_ERROR)
+  {
+    Mismatch(check, "backward traversal returns more records",
+        RecordKey(record));
+  }
+  mdbBtreeTraverseReset(&trv);
+  free(trv);
+
+  for (k = 0; k < keys; k++)
+  {
+    MakeKey(key, k);
+    found = (mdbBtreeSearch(key, record, table) == MDB_NO_ERROR);
+    if (found != present[k])
+    {
+      Mismatch(check, found ? "search finds a deleted key" :
+          "search misses a key", k);
+    }
+    else if (found && (!RecordValid(record) || RecordKey(record) != k))
+    {
+      Mismatch(check, "search returns a wrong record", k);
+    }
+    expected += present[k];
+  }
+  if (count != expected)
+  {
+    Mismatch(check, "traversal misses keys", expected - count);
+  }
+
+  for (k = 0; k < CHECK_RANGES; k++)
+  {
+    CompareRange(check, keys);
+  }
+}
+
+/* Inserts the record of a key (the overflow pages of a rejected record are
+ * released) */
+mdbError InsertKey(const uint32 key)
+{
+  char record[CHECK_RECORD_MAX];
+  mdbError ret;
+
+  MakeRecord(record, key);
+  if ((ret = mdbBtreeInsert(record, table)) != MDB_NO_ERROR)
+  {
+    FreeRecord(record);
+  }
+  return ret;
+}
+
+/* Deletes the record of a key and its overflow pages */
+mdbError DeleteKey(const uint32 key)
+{
+  char record[CHECK_RECORD_MAX];
+  char found[CHECK_RECORD_MAX];
+  mdbError ret;
+
+  MakeKey(record, key);
+  if (ValueOverflows() &&
+      mdbBtreeSearch(record, found, table) != MDB_NO_ERROR)
+  {
+    return MDB_BTREE_KEY_NOT_FOUND;
+  }
+  if ((ret = mdbBtreeDelete(record, table)) == MDB_NO_ERROR)
+  {
+    FreeRecord(found);
+  }
+  return ret;
+}
+
+/* Bulk loader source: the keys k % 3 != 0 in the order of the table, the
+ * given record (0: none) is replaced by the first one (unsorted) */
+typedef struct
+{
+  uint32 keys;
+  uint32 position;
+  uint32 delivered;
+  uint32 unsorted;
+} CheckSource;
+
+int NextRecord(char* record, void* cls)
+{
+  CheckSource* source = (CheckSource*)cls;
+  uint32 k;
+
+  do
+  {
+    if (source->position >= source->keys)
+    {
+      return 0;
+    }
+    k = order[source->position++];
+  }
+  while (k % 3 == 0);
+
+  if (++source->delivered == source->unsorted)
+  {
+    k = order[1];
+  }
+  MakeRecord(record, k);
+  return 1;
+}
+
+/* Builds the table (inserts in a pseudo-random order, or the bulk loader
+ * with the given fill factor), deletes half of the keys, reopens it,
+ * inserts the missing keys and deletes all, the table is compared with the
+ * expected keys after each step */
+void CheckUpdates(const char* check, const uint32 flags, const uint32 keys,
+    const uint8 fill)
+{
+  unsigned long before = mismatches;
+  CheckSource source = { keys, 0, 0, 0 };
+  mdbError ret;
+  uint32 step;
+  uint32 k;
+  uint32 i;
+
+  memset(present, 0, sizeof(present));
+  if (CreateTable(flags) != MDB_NO_ERROR)
+  {
+    Mismatch(check, "table not created", 0);
+    Report(check, flags, before);
+    return;
+  }
+  SortKeys(keys);
+  step = (keys % 7919 != 0) ? 7919 : 7907;
+
+  if (fill == 0)
+  {
+    for (i = 0; i < keys; i++)
+    {
+      k = (uint32)(((uint64_t)i * step) % keys);
+      if (k % 3 != 0 && InsertKey(k) != MDB_NO_ERROR)
+      {
+        Mismatch(check, "insert fails", k);
+      }
+      present[k] = (k % 3 != 0);
+    }
+  }
+  else
+  {
+    /* unsorted records leave the table empty */
+    source.unsorted = keys / 2;
+    if (mdbBtreeBulkLoad(table, &NextRecord, &source, fill) !=
+        MDB_BTREE_NOT_SORTED)
+    {
+      Mismatch(check, "bulk load of unsorted records", 0);
+    }
+    CompareRecords(check, keys);
+
+    source.position = 0;
+    source.delivered = 0;
+    source.unsorted = 0;
+    if ((ret = mdbBtreeBulkLoad(table, &NextRecord, &source, fill)) !=
+        MDB_NO_ERROR)
+    {
+      Mismatch(check, "bulk load fails", ret);
+    }
+    for (k = 0; k < keys; k++)
+    {
+      present[k] = (k % 3 != 0);
+    }
+    source.position = 0;
+    source.delivered = 0;
+    if (mdbBtreeBulkLoad(table, &NextRecord, &source, fill) !=
+        MDB_BTREE_NOT_EMPTY)
+    {
+      Mismatch(check, "bulk load into a loaded table", 0);
+    }
+  }
+  CompareRecords(check, keys);
+
+  /* an existing key is not inserted again, a missing one not deleted */
+  for (k = 0; k < keys; k += 97)
+  {
+    if (present[k] ? (InsertKey(k) == MDB_NO_ERROR) :
+        (DeleteKey(k) == MDB_NO_ERROR))
+    {
+      Mismatch(check, "insert or delete disagrees with the table", k);
+    }
+  }
+  for (i = 0; i < keys; i++)
+  {
+    k = (uint32)(((uint64_t)i * step) % keys);
+    if ((k & 1) && present[k])
+    {
+      if (DeleteKey(k) != MDB_NO_ERROR)
+      {
+        Mismatch(check, "delete fails", k);
+      }
+      present[k] = 0;
+    }
+  }
+  CompareRecords(check, keys);
+
+  CloseTable();
+  if (OpenTable(flags) != MDB_NO_ERROR)
+  {
+    Mismatch(check, "table not reopened", 0);
+    Report(check, flags, before);
+    return;
+  }
+  CompareRecords(check, keys);
+  for (k = 0; k < keys; k += 3)
+  {
+    if (InsertKey(k) != MDB_NO_ERROR)
+    {
+      Mismatch(check, "insert after the reopen fails", k);
+    }
+    present[k] = 1;
+  }
+  CompareRecords(check, keys);
+
+  /* down to an empty table, which is still empty after a reopen and can
+   * grow again */
+  for (i = 0; i < keys; i++)
+  {
+    k = (uint32)(((uint64_t)(keys - 1 - i) * step) % keys);
+    if (present[k] && DeleteKey(k) != MDB_NO_ERROR)
+    {
+      Mismatch(check, "delete fails", k);
+    }
+    present[k] = 0;
+  }
+  CompareRecords(check, keys);
+  CloseTable();
+  if (OpenTable(flags) != MDB_NO_ERROR)
+  {
+    Mismatch(check, "empty table not reopened", 0);
+    Report(check, flags, before);
+    return;
+  }
+  CompareRecords(check, keys);
+  for (k = 0; k < keys; k += 5)
+  {
+    InsertKey(k);
+    present[k] = 1;
+  }
+  CompareRecords(check, keys);
+  CloseTable();
+  Report(check, flags, before);
+}
+
+/* The reference model checks of one kind of table in the given storage
+ * modes, with inserts and with the bulk loader */
+void CheckTables(const char* check, const uint32* flags, const uint32 modes,
+    const uint32 keys)
+{
+  char bulk[16];
+  uint32 i;
+
+  sprintf(bulk, "%.10s-bulk", check);
+  for (i = 0; i < modes; i++)
+  {
+    CheckUpdates(check, flags[i], keys, 0);
+    CheckUpdates(bulk, flags[i], keys, MDB_BTREE_FILL_DEFAULT);
+    CheckUpdates(bulk, flags[i], keys, 50);
+  }
+}
+
+/* ********************************************************* *
+ *    Concurrent writers and readers
+ * ********************************************************* */
+
+/* Each writer inserts and deletes its own odd keys */
+void* Writer(void* arg)
+{
+  uint32 id = (uint32)(size_t)arg;
+  unsigned int seed = id + 1;
+  char record[CHECK_RECORD_SIZE];
+  mdbError ret;
+  uint32 k;
+  uint32 i;
+
+  for (i = 0; i < CHECK_WRITES; i++)
+  {
+    k = 2 * ((rand_r(&seed) % (CHECK_KEYS / 2 / CHECK_WRITERS)) *
+        CHECK_WRITERS + id) + 1;
+    MakeRecord(record, k);
+    if (rand_r(&seed) % 2)
+    {
+      ret = mdbBtreeInsert(record, table);
+      if ((ret == MDB_NO_ERROR) == present[k])
+      {
+        Mismatch("readwrite", "insert disagrees with the table", k);
+      }
+      present[k] = 1;
+    }
+    else
+    {
+      ret = mdbBtreeDelete(record, table);
+      if ((ret == MDB_NO_ERROR) != present[k])
+      {
+        Mismatch("readwrite", "delete disagrees with the table", k);
+      }
+      present[k] = 0;
+    }
+  }
+  return NULL;
+}
+
+/* Searches and multi-key searches of the even keys always find them */
+void* Searcher(void* arg)
+{
+  unsigned int seed = (unsigned int)(size_t)arg;
+  char keys[CHECK_SEARCHES][CHECK_RECORD_SIZE];
+  char records[CHECK_SEARCHES][CHECK_RECORD_SIZE];
+  const char* key_list[CHECK_SEARCHES];
+  char* record_list[CHECK_SEARCHES];
+  mdbError results[CHECK_SEARCHES];
+  uint32 k;
+  uint32 j;
+
+  while (!stop)
+  {
+    for (j = 0; j < CHECK_SEARCHES; j++)
+    {
+      k = 2 * (rand_r(&seed) % (CHECK_KEYS / 2));
+      MakeRecord(keys[j], k);
+      key_list[j] = keys[j];
+      record_list[j] = records[j];
+      if (mdbBtreeSearch(keys[j], records[j], table) != MDB_NO_ERROR ||
+          !RecordValid(records[j]) || RecordKey(records[j]) != k)
+      {
+        Mismatch("readwrite", "search misses a stable key", k);
+      }
+    }
+    mdbBtreeSearchKeys(key_list, record_list, results, CHECK_SEARCHES, table);
+    for (j = 0; j < CHECK_SEARCHES; j++)
+    {
+      if (results[j] != MDB_NO_ERROR || !RecordValid(records[j]) ||
+          RecordKey(records[j]) != RecordKey(keys[j]))
+      {
+        Mismatch("readwrite", "multi-key search misses a stable key",
+            RecordKey(keys[j]));
+      }
+    }
+  }
+  return NULL;
+}
+
+/* A cursor sees every even key once, in order, while the odd keys change */
+void* Scanner(void* arg)
+{
+  mdbBtreeCursor* cursor;
+  char record[CHECK_RECORD_SIZE];
+  uint32 even;
+  long previous;
+  uint32 k;
+
+  (void)arg;
+  while (!stop)
+  {
+    if (mdbBtreeCursorOpen(&cursor, table, NULL, NULL, 0) != MDB_NO_ERROR)
+    {
+      Mismatch("readwrite", "cursor not opened", 0);
+      return NULL;
+    }
+    even = 0;
+    previous = -1;
+    while (mdbBtreeCursorNext(cursor, record) == MDB_NO_ERROR)
+    {
+      k = RecordKey(record);
+      if (!RecordValid(record) || (long)k <= previous)
+      {
+        Mismatch("readwrite", "cursor record out of order or torn", k);
+        break;
+      }
+      if (!(k & 1) && k != 2 * even++)
+      {
+        Mismatch("readwrite", "cursor skips a stable key", 2 * (even - 1));
+        break;
+      }
+      previous = k;
+    }
+    if (even != CHECK_KEYS / 2)
+    {
+      Mismatch("readwrite", "cursor misses stable keys", even);
+    }
+    mdbBtreeCursorClose(cursor);
+  }
+  return NULL;
+}
+
+void CheckReadWrite(const uint32 flags)
+{
+  unsigned long before = mismatches;
+  pthread_t threads[CHECK_WRITERS + 3];
+  char record[CHECK_RECORD_SIZE];
+  uint32 k;
+  int i;
+
+  memset(present, 0, sizeof(present));
+  if (CreateTable(flags) != MDB_NO_ERROR)
+  {
+    Mismatch("readwrite", "table not created", 0);
+    Report("readwrite", flags, before);
+    return;
+  }
+  for (k = 0; k < CHECK_KEYS; k += 2)
+  {
+    MakeRecord(record, k);
+    mdbBtreeInsert(record, table);
+    present[k] = 1;
+  }
+
+  stop = 0;
+  for (i = 0; i < CHECK_WRITERS; i++)
+  {
+    pthread_create(&threads[i], NULL, &Writer, (void*)(size_t)i);
+  }
+  pthread_create(&threads[CHECK_WRITERS], NULL, &Searcher, (void*)11);
+  pthread_create(&threads[CHECK_WRITERS + 1], NULL, &Searcher, (void*)12);
+  pthread_create(&threads[CHECK_WRITERS + 2], NULL, &Scanner, NULL);
+  for (i = 0; i < CHECK_WRITERS; i++)
+  {
+    pthread_join(threads[i], NULL);
+  }
+  stop = 1;
+  for (i = CHECK_WRITERS; i < CHECK_WRITERS + 3; i++)
+  {
+    pthread_join(threads[i], NULL);
+  }
+
+  CompareTable("readwrite", present, NULL);
+  mdbCommitDatabase(db);
+  CloseTable();
+
+  if (OpenTable(flags) != MDB_NO_ERROR)
+  {
+    Mismatch("readwrite", "table not reopened", 0);
+  }
+  else
+  {
+    CompareTable("reopen", present, NULL);
+    CloseTable();
+  }
+  Report("readwrite", flags, before);
+}
+
+/* ********************************************************* *
+ *    Snapshot visibility
+ * ********************************************************* */
+
+/* Moves the keys k % 4 == 1 to k % 4 == 3 and back */
+void* SnapshotWriter(void* arg)
+{
+  char record[CHECK_RECORD_SIZE];
+  uint32 round;
+  uint32 k;
+
+  (void)arg;
+  for (round = 0; round < 5; round++)
+  {
+    for (k = 1; k < CHECK_KEYS; k += 4)
+    {
+      MakeRecord(record, (round % 2) ? k + 2 : k);
+      mdbBtreeDelete(record, table);
+      present[RecordKey(record)] = 0;
+      MakeRecord(record, (round % 2) ? k : k + 2);
+      mdbBtreeInsert(record, table);
+      present[RecordKey(record)] = 1;
+    }
+  }
+  stop = 1;
+  return NULL;
+}
+
+void CheckSnapshot(const uint32 flags)
+{
+  unsigned long before = mismatches;
+  uint8 opened[CHECK_KEYS];
+  char record[CHECK_RECORD_SIZE];
+  mdbSnapshot* snapshot;
+  mdbSnapshot* later;
+  pthread_t writer;
+  uint32 k;
+
+  memset(present, 0, sizeof(present));
+  if (CreateTable(flags) != MDB_NO_ERROR)
+  {
+    Mismatch("snapshot", "table not created", 0);
+    Report("snapshot", flags, before);
+    return;
+  }
+  for (k = 0; k < CHECK_KEYS; k++)
+  {
+    if (!(k & 1) || k % 4 == 1)
+    {
+      MakeRecord(record, k);
+      mdbBtreeInsert(record, table);
+      present[k] = 1;
+    }
+  }
+  memcpy(opened, present, sizeof(opened));
+
+  /* the snapshot keeps the table as it was opened while the writer runs */
+  mdbSnapshotOpen(&snapshot, db);
+  stop = 0;
+  pthread_create(&writer, NULL, &SnapshotWriter, NULL);
+  while (!stop)
+  {
+    CompareTable("snapshot", opened, snapshot);
+  }
+  pthread_join(writer, NULL);
+  CompareTable("snapshot", opened, snapshot);
+
+  /* a snapshot opened after the writes reads them, so does a plain read */
+  mdbSnapshotOpen(&later, db);
+  CompareTable("snapshot", present, later);
+  CompareTable("snapshot", present, NULL);
+  mdbSnapshotClose(later);
+  mdbSnapshotClose(snapshot);
+
+  CloseTable();
+  Report("snapshot", flags, before);
+}
+
+/* ********************************************************* *
+ *    Write-ahead log replay
+ * ********************************************************* */
+
+void CheckWal(const uint32 flags)
+{
+  unsigned long before = mismatches;
+  char record[CHECK_RECORD_SIZE];
+  pid_t child;
+  uint32 k;
+
+  /* committed: the even keys (half of them before a checkpoint), written
+   * after the last commit: the odd keys, deletions of the even keys */
+  memset(present, 0, sizeof(present));
+  for (k = 0; k < CHECK_KEYS; k += 2)
+  {
+    present[k] = 1;
+  }
+
+  if ((child = fork()) == 0)
+  {
+    if (CreateTable(flags) != MDB_NO_ERROR)
+    {
+      _exit(1);
+    }
+    for (k = 0; k < CHECK_KEYS; k += 2)
+    {
+      MakeRecord(record, k);
+      mdbBtreeInsert(record, table);
+      if (k == CHECK_KEYS / 2)
+      {
+        mdbCommitDatabase(db);
+        mdbCheckpointDatabase(db);
+      }
+    }
+    mdbCommitDatabase(db);
+    for (k = 1; k < CHECK_KEYS; k += 2)
+    {
+      MakeRecord(record, k);
+      mdbBtreeInsert(record, table);
+    }
+    for (k = 0; k < CHECK_KEYS; k += 6)
+    {
+      MakeRecord(record, k);
+      mdbBtreeDelete(record, table);
+    }
+    /* the uncommitted nodes reach the log, the process dies before the
+     * commit */
+    mdbBufferPoolFlush(db->pool);
+    _exit(0);
+  }
+  waitpid(child, NULL, 0);
+
+  if (OpenTable(flags) != MDB_NO_ERROR)
+  {
+    Mismatch("wal", "table not recovered", 0);
+  }
+  else
+  {
+    CompareTable("wal", present, NULL);
+    CloseTable();
+  }
+  Report("wal", flags, before);
+}
+
+/* ********************************************************* *
+ *    Crash during a copy-on-write publish
+ * ********************************************************* */
+
+/* Keys of the table after the given batch (-1: before the first batch):
+ * batch b inserts its keys and deletes the odd keys of batch b - 1 */
+void BatchKeys(uint8* keys, const long batch)
+{
+  uint32 k;
+
+  memset(keys, 0, CHECK_KEYS);
+  for (k = 0; (long)k < (batch + 1) * CHECK_BATCH && k < CHECK_KEYS; k++)
+  {
+    keys[k] = !((long)(k / CHECK_BATCH) < batch && (k & 1));
+  }
+}
+
+/* Commits the batches in a child process: the message 2b is sent before
+ * batch b is committed, 2b + 1 after it */
+void CommitBatches(const uint32 flags, const int pipe)
+{
+  char record[CHECK_RECORD_SIZE];
+  uint32 message;
+  uint32 batch;
+  uint32 k;
+
+  if (OpenTable(flags) != MDB_NO_ERROR)
+  {
+    _exit(1);
+  }
+  for (batch = 0; (batch + 1) * CHECK_BATCH <= CHECK_KEYS; batch++)
+  {
+    for (k = batch * CHECK_BATCH; k < (batch + 1) * CHECK_BATCH; k++)
+    {
+      MakeRecord(record, k);
+      mdbBtreeInsert(record, table);
+    }
+    for (k = (batch > 0) ? (batch - 1) * CHECK_BATCH + 1 : CHECK_KEYS;
+        k < batch * CHECK_BATCH; k += 2)
+    {
+      MakeRecord(record, k);
+      mdbBtreeDelete(record, table);
+    }
+    message = 2 * batch;
+    if (write(pipe, &message, sizeof(message)) != sizeof(message))
+    {
+      _exit(1);
+    }
+    mdbCommitDatabase(db);
+    message = 2 * batch + 1;
+    if (write(pipe, &message, sizeof(message)) != sizeof(message))
+    {
+      _exit(1);
+    }
+  }
+  /* every batch was committed: wait for the kill */
+  pause();
+  _exit(0);
+}
+
+/* The child is killed after the given message of CommitBatches: an even
+ * message kills it while the batch is being committed */
+void CheckShadowCrash(const uint32 flags, const uint32 kill_after)
+{
+  unsigned long before = mismatches;
+  char record[CHECK_RECORD_SIZE];
+  mdbBtreeCursor* cursor;
+  long committed = -1;
+  long recovered = -1;
+  uint32 message;
+  int pipes[2];
+  pid_t child;
+
+  if (CreateTable(flags) != MDB_NO_ERROR || pipe(pipes) != 0)
+  {
+    Mismatch("shadow", "table not created", 0);
+    Report("shadow", flags, before);
+    return;
+  }
+  mdbCommitDatabase(db);
+  CloseTable();
+
+  if ((child = fork()) == 0)
+  {
+    close(pipes[0]);
+    CommitBatches(flags, pipes[1]);
+  }
+  close(pipes[1]);
+  while (read(pipes[0], &message, sizeof(message)) == sizeof(message))
+  {
+    if (message & 1)
+    {
+      committed = message / 2;
+    }
+    if (message >= kill_after)
+    {
+      break;
+    }
+  }
+  kill(child, SIGKILL);
+  waitpid(child, NULL, 0);
+  close(pipes[0]);
+
+  /* the highest key tells the batch of the recovered root */
+  if (OpenTable(flags) != MDB_NO_ERROR)
+  {
+    Mismatch("shadow", "table not reopened", 0);
+    Report("shadow", flags, before);
+    return;
+  }
+  if (mdbBtreeCursorOpen(&cursor, table, NULL, NULL, 0) == MDB_NO_ERROR)
+  {
+    while (mdbBtreeCursorNext(cursor, record) == MDB_NO_ERROR)
+    {
+      recovered = RecordKey(record) / CHECK_BATCH;
+    }
+    mdbBtreeCursorClose(cursor);
+  }
+  if (recovered < committed || recovered > committed + 1)
+  {
+    Mismatch("shadow", "recovered root is not the last commit", recovered);
+  }
+  BatchKeys(present, recovered);
+  CompareTable("shadow", present, NULL);
+  CloseTable();
+
+  printf("%-13s flags 0x%04lx: committed %ld, recovered %ld\n", "shadow",
+      (unsigned long)flags, committed, recovered);
+  Report("shadow", flags, before);
+}
+
+int main(int argc, char **argv)
+{
+  const uint32 updates[] = {
+    MDB_OPEN_DEFAULT, MDB_OPEN_MMAP, MDB_OPEN_BPLUS, MDB_OPEN_COMPRESS,
+    MDB_OPEN_BPLUS | MDB_OPEN_COMPRESS
+  };
+  const uint32 strings[] = {
+    MDB_OPEN_DEFAULT, MDB_OPEN_BPLUS, MDB_OPEN_BPLUS | MDB_OPEN_COMPRESS
+  };
+  const uint32 readwrite[] = {
+    MDB_OPEN_DEFAULT, MDB_OPEN_MMAP, MDB_OPEN_BPLUS, MDB_OPEN_WAL,
+    MDB_OPEN_SHADOW, MDB_OPEN_SHADOW | MDB_OPEN_MMAP,
+    MDB_OPEN_SHADOW | MDB_OPEN_WAL
+  };
+  const uint32 snapshot[] = {
+    MDB_OPEN_DEFAULT, MDB_OPEN_BPLUS, MDB_OPEN_WAL
+  };
+  const uint32 wal[] = {
+    MDB_OPEN_WAL, MDB_OPEN_WAL | MDB_OPEN_BPLUS
+  };
+  const uint32 shadow[] = {
+    MDB_OPEN_SHADOW, MDB_OPEN_SHADOW | MDB_OPEN_MMAP,
+    MDB_OPEN_SHADOW | MDB_OPEN_WAL
+  };
+  /* messages of CommitBatches after which the child is killed */
+  const uint32 kills[] = { 0, 7, 24, 51, 78 };
+  uint32 i;
+  uint32 j;
+
+  sprintf(filename, "%.480s/mdb_check.mrdb", (argc > 1) ? argv[1] : ".");
+
+  SetColumns(0, CHECK_VALUE_LENGTH);
+  CheckTables("updates", updates, sizeof(updates) / sizeof(uint32),
+      CHECK_KEYS);
+  SetColumns(CHECK_KEY_LENGTH, 0);
+  CheckTables("strings", strings, sizeof(strings) / sizeof(uint32),
+      CHECK_KEYS);
+  SetColumns(CHECK_KEY_LENGTH, CHECK_VALUE_LENGTH);
+  CheckTables("slotted", strings, sizeof(strings) / sizeof(uint32), 10000);
+  SetColumns(CHECK_KEY_LENGTH, CHECK_LONG_LENGTH);
+  CheckTables("overflow", strings, sizeof(strings) / sizeof(uint32), 3000);
+  SetColumns(0, 0);
+
+  for (i = 0; i < sizeof(readwrite) / sizeof(uint32); i++)
+  {
+    CheckReadWrite(readwrite[i]);
+  }
+  for (i = 0; i < sizeof(snapshot) / sizeof(uint32); i++)
+  {
+    CheckSnapshot(snapshot[i]);
+  }
+  for (i = 0; i < sizeof(wal) / sizeof(uint32); i++)
+  {
+    CheckWal(wal[i]);
+  }
+  for (i = 0; i < sizeof(shadow) / sizeof(uint32); i++)
+  {
+    for (j = 0; j < sizeof(kills) / sizeof(uint32); j++)
+    {
+      CheckShadowCrash(shadow[i], kills[j]);
+    }
+  }
+
+  RemoveFiles();
+  printf("%lu mismatches\n", mismatches);
+  return (mismatches == 0) ? 0 : 1;
+}
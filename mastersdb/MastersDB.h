@@ -24,6 +24,16 @@
  *  Initial version of file.
  * 09.09.2010
  *  Added GetColumnCount, GetColumnName, GetColumnType methods.
+ * 17.10.2026
+ *  Added the database open options (MdbOpenOptions).
+ *  Added MdbDatabase::BulkLoad and the MdbRecordSource interface.
+ *  Added the B+-tree open option (MDB_OPTION_BPLUS).
+ *  Added the direct I/O open option (MDB_OPTION_DIRECT).
+ *  Added the node compression open option (MDB_OPTION_COMPRESS).
+ *  Added the write-ahead log open option (MDB_OPTION_WAL).
+ *  Added MdbDatabase::SetCheckpointInterval.
+ *  Added MdbDatabase::SetReadAhead.
+ *  Added the copy-on-write open option (MDB_OPTION_SHADOW).
  */
 
 
@@ -46,9 +56,25 @@ enum MdbDatatypes
   MDB_STRING
 };
 
+// MastersDB database open options (can be combined)
+enum MdbOpenOptions
+{
+  MDB_OPTION_NONE = 0x0000,     // stdio node I/O through the node cache
+  MDB_OPTION_MMAP = 0x0001,     // nodes accessed in the memory-mapped file
+  MDB_OPTION_BPLUS = 0x0002,    // new tables are stored in B+-trees
+  MDB_OPTION_DIRECT = 0x0004,   // node I/O bypasses the OS page cache
+  MDB_OPTION_COMPRESS = 0x0008, // new tables store compressed nodes
+  MDB_OPTION_WAL = 0x0010,      // writes go to a write-ahead log (commits)
+  MDB_OPTION_SHADOW = 0x0020    // new tables are copy-on-write B-trees
+};
+
+// Default node fill factor (percent) of MdbDatabase::BulkLoad
+const uint8_t MDB_FILL_DEFAULT = 100;
+
 // forward declarations of the MastersDB classes
 class MdbDatabase;
 class MdbResultSet;
+class MdbRecordSource;
 
 class MdbDatabase
 {
@@ -65,13 +91,31 @@ private:
 
 public:
   virtual ~MdbDatabase() { Close(); }
-  static MdbDatabase* CreateDatabase(std::string filename);
-  static MdbDatabase* OpenDatabase(std::string filename);
+  static MdbDatabase* CreateDatabase(std::string filename,
+      uint32_t options = MDB_OPTION_NONE);
+  static MdbDatabase* OpenDatabase(std::string filename,
+      uint32_t options = MDB_OPTION_NONE);
   MdbResultSet* ExecuteMQL(std::string statement);
   std::string ExplainMQL(std::string statement);
+  bool BulkLoad(std::string table, MdbRecordSource *source,
+      uint8_t fill = MDB_FILL_DEFAULT);
+  void SetCheckpointInterval(uint32_t seconds);
+  void SetReadAhead(uint32_t nodes);
   void Close();
 };
 
+// Record source for MdbDatabase::BulkLoad (implemented by the application).
+// The records have to be sorted by the first (key) column, STRING columns
+// are read by GetStringValue, all other columns by GetIntValue.
+class MdbRecordSource
+{
+public:
+  virtual ~MdbRecordSource() {}
+  virtual bool ToNext() = 0;
+  virtual int32_t GetIntValue(uint8_t column) = 0;
+  virtual std::string GetStringValue(uint8_t column) = 0;
+};
+
 class MdbResultSet
 {
 private:
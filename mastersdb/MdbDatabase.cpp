@@ -22,6 +22,12 @@
  * ----------------
  * 20.08.2010
  *  Initial version of file.
+ * 17.10.2026
+ *  The database open options are passed to the storage layer.
+ *  Added the BulkLoad method.
+ *  Each statement and bulk load is committed (write-ahead log).
+ *  Added the SetCheckpointInterval method.
+ *  Added the SetReadAhead method.
  */
 
 #include "MastersDB.h"
@@ -34,7 +40,56 @@ using namespace MDB;
 namespace MastersDB
 {
 
-MdbDatabase* MdbDatabase::CreateDatabase(string filename)
+// Bulk loading context (the application's record source and the table)
+struct MdbBulkLoadContext
+{
+  MdbRecordSource *source;
+  mdbVirtualTable *table;
+};
+
+// Record source call-back of mdbBtreeBulkLoad, builds the table records
+static int BulkLoadSource(char *record, void *cls)
+{
+  MdbBulkLoadContext *ctx = (MdbBulkLoadContext*)cls;
+  mdbVirtualTable *tbl = ctx->table;
+  mdbColumn *col;
+  vector<char> value;
+  string s;
+  int32_t v;
+  uint8 c;
+
+  if (!ctx->source->ToNext())
+  {
+    return 0;
+  }
+
+  for (c = 0; c < tbl->getColumnCount(); c++)
+  {
+    col = tbl->getColumn(c);
+    if (col->type == MDB_STRING)
+    {
+      s = ctx->source->GetStringValue(c);
+      if (s.length() > col->length)
+      {
+        s.resize(col->length);
+      }
+      value.resize(s.length() + 4);
+      *((uint32*)&value[0]) = s.length();
+      s.copy(&value[4], s.length());
+      tbl->addValue(&value[0]);
+    }
+    else
+    {
+      v = ctx->source->GetIntValue(c);
+      tbl->addValue((char*)&v);
+    }
+  }
+
+  memcpy(record, tbl->getValue((uint8)0), tbl->getRecordSize());
+  return 1;
+}
+
+MdbDatabase* MdbDatabase::CreateDatabase(string filename, uint32_t options)
 {
   mdbVirtualMachine *vm;
   MdbDatabase *db;
@@ -44,7 +99,7 @@ MdbDatabase* MdbDatabase::CreateDatabase(string filename)
 
   // create the database
   db = new MdbDatabase();
-  ret = mdbCreateDatabase((mdbDatabase**)&db->DB, filename.c_str());
+  ret = mdbCreateDatabase((mdbDatabase**)&db->DB, filename.c_str(), options);
 
   // create a new Parser and MQLSelect AST
   vm = new mdbVirtualMachine((mdbDatabase*)db->DB);
@@ -61,7 +116,7 @@ MdbDatabase* MdbDatabase::CreateDatabase(string filename)
   return db;
 }
 
-MdbDatabase* MdbDatabase::OpenDatabase(string filename)
+MdbDatabase* MdbDatabase::OpenDatabase(string filename, uint32_t options)
 {
   mdbVirtualMachine *vm;
   MdbDatabase *db;
@@ -71,7 +126,7 @@ MdbDatabase* MdbDatabase::OpenDatabase(string filename)
 
   // create the database
   db = new MdbDatabase();
-  ret = mdbOpenDatabase((mdbDatabase**)&db->DB, filename.c_str());
+  ret = mdbOpenDatabase((mdbDatabase**)&db->DB, filename.c_str(), options);
 
   // create a new Parser and MQLSelect AST
   vm = new mdbVirtualMachine((mdbDatabase*)db->DB);
@@ -98,7 +153,11 @@ MdbResultSet* MdbDatabase::ExecuteMQL(string statement)
   if (vm != NULL)
   {
     p->Parse((uint8_t*) statement.c_str(), statement.length());
-    if ((rs = vm->Execute()) != NULL)
+    rs = vm->Execute();
+
+    // the changes of the statement are durable before its results are used
+    mdbCommitDatabase((mdbDatabase*) DB);
+    if (rs != NULL)
     {
       mrs = new MdbResultSet();
       mrs->rs = rs;
@@ -128,6 +187,49 @@ std::string MdbDatabase::ExplainMQL(string statement)
   return "";
 }
 
+bool MdbDatabase::BulkLoad(string table, MdbRecordSource *source, uint8_t fill)
+{
+  MdbBulkLoadContext ctx;
+  mdbError ret;
+  vector<char> name(table.length() + 4);
+
+  if (DB == NULL || source == NULL)
+  {
+    return false;
+  }
+
+  *((uint32*)&name[0]) = table.length();
+  table.copy(&name[4], table.length());
+
+  // the table must be empty, its B-tree is built bottom-up
+  ctx.source = source;
+  ctx.table = new mdbVirtualTable((mdbDatabase*)DB);
+  ctx.table->LoadTable(&name[0]);
+  ret = ctx.table->BulkLoad(&BulkLoadSource, &ctx, fill);
+  delete ctx.table;
+  mdbCommitDatabase((mdbDatabase*) DB);
+
+  return (ret == MDB_NO_ERROR);
+}
+
+// Seconds between two checkpoints (0 = only when the database is closed)
+void MdbDatabase::SetCheckpointInterval(uint32_t seconds)
+{
+  if (DB != NULL)
+  {
+    mdbSetCheckpointInterval((mdbDatabase*) DB, seconds);
+  }
+}
+
+// Nodes read ahead by the table scans (0 = no read-ahead)
+void MdbDatabase::SetReadAhead(uint32_t nodes)
+{
+  if (DB != NULL)
+  {
+    mdbSetReadAhead((mdbDatabase*) DB, nodes);
+  }
+}
+
 void MdbDatabase::Close()
 {
   int ret;
@@ -24,6 +24,8 @@
  *  Initial version of file.
  * 09.09.2010
  *  Implemented GetColumnCount, GetColumnName, GetColumnType methods.
+ * 17.10.2026
+ *  GetIntValue decodes the values (order-preserving encoding).
  */
 
 #include "MastersDB.h"
@@ -127,6 +129,7 @@ int32_t MdbResultSet::GetIntValue(uint8_t column)
 {
   mdbQueryResults *results;
   mdbDatatype *type;
+  char value[sizeof(int32_t)];
   int32_t val = 0;
 
   if (rs != NULL)
@@ -136,8 +139,19 @@ int32_t MdbResultSet::GetIntValue(uint8_t column)
     {
       type = ((mdbDatabase*)DB)->datatypes +
           results->getColumn(column)->type;
-      memcpy(&val, results->GetRecord(r) +
-          results->getColumnOffset(column), type->size);
+      if (type->header == 0)
+      {
+        mdbDecodeValue(type, value, results->GetRecord(r) +
+            results->getColumnOffset(column));
+
+        // INT-8 and INT-16 values are sign-extended
+        switch (type->size)
+        {
+          case 1:  val = *((int8_t*)value); break;
+          case 2:  val = *((int16_t*)value); break;
+          default: memcpy(&val, value, sizeof(int32_t)); break;
+        }
+      }
     }
   }
   return val;
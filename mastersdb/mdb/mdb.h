@@ -28,6 +28,56 @@
  * 02.09.2010
  *  Moved all function return values and error codes to a new enumerator.
  *  Removed the mdbTable structure. It will be handled by the virtual machine.
+ * 17.10.2026
+ *  Added the buffer pool functions.
+ *  Added the memory-mapped node storage functions and database open flags.
+ *  Added mdbBtreeFindKey (binary search inside a node, branch-free for
+ *  the INT keys) and its comparison counter (mdbIntCompares).
+ *  Added the B-tree path structures (iterative insertion/deletion).
+ *  Added mdbBtreeBulkLoad and its error codes.
+ *  Added the B+-tree variant (mdbBtreeCreatePlus, MDB_OPEN_BPLUS).
+ *  Added the free space management functions.
+ *  Node positions are block numbers, the file offsets are 64-bit (0.10).
+ *  The blocks are pages (4 KB), node sizes are multiples of the page size
+ *  and the direct I/O open flag was added (MDB_OPEN_DIRECT, 0.11).
+ *  Added the order-preserving value encoding functions (0.12).
+ *  Added the packed B+-tree internal nodes (mdbBtreePackKeys, 0.13).
+ *  Added the slotted B+-tree leaves (mdbBtreeSlotRecords, 0.14).
+ *  Added the overflow pages (long values stored out of line, 0.15).
+ *  Added the compressed nodes (mdbBtreeCompressNodes, MDB_OPEN_COMPRESS,
+ *  0.16).
+ *  Added the write-ahead log functions (MDB_OPEN_WAL, mdbCommitDatabase),
+ *  the transactions keep their block images until they commit
+ *  (MDB_WAL_PENDING, mdbWalTable).
+ *  The buffer pool keeps dirty nodes until the next checkpoint
+ *  (mdbBufferPoolFlush, mdbCheckpointDatabase), the checkpoints are done
+ *  by a timer thread (mdbSetCheckpointInterval).
+ *  Added the positioned file I/O functions (mdbFileRead, mdbFileWrite).
+ *  Added the asynchronous batched I/O functions (mdbAioSubmit), the batched
+ *  node reads of the buffer pool (mdbBufferPrefetch) and the multi-key
+ *  B-tree search (mdbBtreeSearchKeys).
+ *  Added the read-ahead of the B-tree traversal (MDB_BTREE_READAHEAD,
+ *  mdbSetReadAhead).
+ *  Added the B-tree cursors (mdbBtreeCursorOpen, mdbBtreeCursorSeek,
+ *  mdbBtreeCursorNext, mdbBtreeCursorPrev, mdbBtreeCursorClose).
+ *  Added the node latches (mdbLatchNode, mdbUnlatchNode), the end of a
+ *  traversal (mdbBtreeTraverseReset), the free space lock (mdbSpaceLock,
+ *  mdbSpaceUnlock) and the growth of a pinned buffer pool
+ *  (MDB_BUFFER_POOL_GROWTH).
+ *  Added the latches of the mapped nodes (mdbMmapLatch) and mdbLatchInit,
+ *  mdbLatchDestroy (writer-preferring latches, MDB_LATCH_HELD).
+ *  Added the optimistic node reads (mdbNodeVersion, mdbValidateNode,
+ *  mdbCopyNode, MDB_BTREE_RESTARTS) and mdbBufferFind (unpinned reads of
+ *  the optimistic searches).
+ *  Added the snapshots (mdbSnapshotOpen, mdbSnapshotClose,
+ *  mdbBtreeSearchSnapshot, mdbBtreeCursorSnapshot) and the node versions
+ *  (mdbversion.c).
+ *  Added the copy-on-write B-trees (mdbBtreeShadowPages, MDB_OPEN_SHADOW,
+ *  mdbshadow.c), they release their replaced pages and write their roots
+ *  at the commits (mdbShadowEnter, mdbShadowWriteRoots, mdbShadowReclaim,
+ *  mdbShadowFree).
+ *  Added the backward traversal (mdbBtreeTraversePrev,
+ *  mdbBtreeTraverseLast, mdbBtreeCursorLast).
 */
 
 #ifndef MDB_H_
@@ -36,6 +86,7 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include <pthread.h>
 
 #ifndef __clang__
 	#include <malloc.h>
@@ -46,8 +97,25 @@
 /* MastersDB format signature (magic number) */
 #define MDB_MAGIC_NUMBER  0xEEDB
 
-/* MastersDB version signature (0.8) */
-#define MDB_VERSION       0x0008
+/* MastersDB version signature (0.16) */
+#define MDB_VERSION       0x0010
+
+/* The database file is divided into blocks: node positions and all other
+ * pointers stored in the file are 32-bit block numbers (compact child
+ * pointers), the file offsets computed from them are 64-bit */
+#define MDB_BLOCK_SHIFT   12
+#define MDB_BLOCK_SIZE    (1UL << MDB_BLOCK_SHIFT)
+
+/* A block is one page of the file: the nodes of database B-trees start at
+ * page boundaries, their sizes and buffers are page aligned (direct I/O) */
+#define MDB_PAGE_SIZE     MDB_BLOCK_SIZE
+#define MDB_PAGE_ALIGN(size) \
+  (((uint32)(size) + MDB_PAGE_SIZE - 1) & ~(uint32)(MDB_PAGE_SIZE - 1))
+
+/* File offset of a block, first block at or after a file offset */
+#define MDB_OFFSET(block)   ((uint64)(block) << MDB_BLOCK_SHIFT)
+#define MDB_BLOCK(offset) \
+  ((uint32)(((uint64)(offset) + MDB_BLOCK_SIZE - 1) >> MDB_BLOCK_SHIFT))
 
 /* MastersDB error codes enumerator*/
 typedef enum mdbError
@@ -60,13 +128,20 @@ typedef enum mdbError
   MDB_BTREE_NO_MORE_RECORDS,
   MDB_CANNOT_CREATE_FILE,
   MDB_INVALID_FILE,
-  MDB_TABLE_NOT_FOUND
+  MDB_TABLE_NOT_FOUND,
+  MDB_CANNOT_MAP_FILE,
+  MDB_BTREE_NOT_EMPTY,
+  MDB_BTREE_NOT_SORTED,
+  MDB_CANNOT_OPEN_DIRECT,
+  MDB_CANNOT_OPEN_WAL,
+  MDB_CANNOT_OPEN_SNAPSHOT
 }  mdbError;
 
 /* ********************************************************* *
  *    Common type definitions and data structures
  * ********************************************************* */
 /* unsigned integer types */
+typedef uint64_t uint64;
 typedef uint32_t uint32;
 typedef uint16_t uint16;
 typedef uint8_t  uint8;
@@ -77,8 +152,38 @@ typedef struct mdbBtreeMeta       mdbBtreeMeta;
 typedef struct mdbBtree           mdbBtree;
 typedef struct mdbBtreeNode       mdbBtreeNode;
 typedef struct mdbBtreeTraversal  mdbBtreeTraversal;
+typedef struct mdbBtreeCursorLevel mdbBtreeCursorLevel;
+typedef struct mdbBtreeCursor     mdbBtreeCursor;
+typedef struct mdbBtreePathEntry  mdbBtreePathEntry;
+typedef struct mdbBtreePath       mdbBtreePath;
+typedef struct mdbBtreeField      mdbBtreeField;
+typedef struct mdbLatch           mdbLatch;
 typedef struct mdbDatatype        mdbDatatype;
 
+/* forward declarations of the buffer pool structures */
+typedef struct mdbBufferFrame     mdbBufferFrame;
+typedef struct mdbBufferPool      mdbBufferPool;
+
+/* forward declaration of the memory-mapped file structure */
+typedef struct mdbMmap            mdbMmap;
+
+/* forward declarations of the write-ahead log structures */
+typedef struct mdbWalTable        mdbWalTable;
+typedef struct mdbWal             mdbWal;
+
+/* forward declarations of the asynchronous I/O structures */
+typedef struct mdbAioRequest      mdbAioRequest;
+typedef struct mdbAio             mdbAio;
+
+/* forward declarations of the copy-on-write structures */
+typedef struct mdbShadowPage      mdbShadowPage;
+typedef struct mdbShadow          mdbShadow;
+
+/* forward declarations of the multi-version structures */
+typedef struct mdbNodeImage       mdbNodeImage;
+typedef struct mdbSnapshot        mdbSnapshot;
+typedef struct mdbVersionStore    mdbVersionStore;
+
 /* forward declarations of the database structures */
 typedef struct mdbFreeEntry mdbFreeEntry;
 typedef struct mdbDatabaseMeta mdbDatabaseMeta;
@@ -103,42 +208,675 @@ mdbError mdbBtreeCreate(mdbBtree** tree,
     const uint32 record_size,
     const uint32 key_position);
 
+/* B-tree variant flags (mdbBtreeMeta) */
+#define MDB_BTREE_PLUS  0x0001  /* B+-tree: keys in internal nodes only, */
+                                /* records in linked leaves              */
+#define MDB_BTREE_PACKED 0x0002 /* B+-tree: the STRING keys of internal  */
+                                /* nodes are packed on their pages       */
+#define MDB_BTREE_SLOTTED 0x0004 /* B+-tree: the leaves are slotted pages */
+                                /* with variable-length records          */
+#define MDB_BTREE_COMPRESSED 0x0008 /* the node pages are compressed     */
+#define MDB_BTREE_SHADOW 0x0010 /* copy-on-write: the pages never change, */
+                                /* a write publishes a new root          */
+
+/* Tests whether a (leaf or internal) node has another layout on its page
+ * than in memory */
+#define MDB_BTREE_PACKED_PAGE(tree,is_leaf) \
+  (((tree)->meta.flags & \
+  ((is_leaf) ? MDB_BTREE_SLOTTED : MDB_BTREE_PACKED)) > 0)
+
+/* B+-tree allocation and initialization */
+mdbError mdbBtreeCreatePlus(mdbBtree** tree,
+    uint32 order,
+    const uint32 record_size,
+    const uint32 key_position,
+    const uint32 key_size);
+
+/* Packs the (STRING) keys of the internal nodes of an empty B+-tree */
+mdbError mdbBtreePackKeys(mdbBtree* tree);
+
+/* Sets the variable-length fields of the records of a B-tree */
+void mdbBtreeSetFields(mdbBtree* tree, const mdbBtreeField* fields,
+    const uint32 count);
+
+/* Stores the records of an empty B+-tree in slotted leaves (variable-length
+ * fields with their actual length) */
+mdbError mdbBtreeSlotRecords(mdbBtree* tree);
+
+/* Stores the nodes of an empty B-tree compressed */
+mdbError mdbBtreeCompressNodes(mdbBtree* tree);
+
+/* Makes an empty B-tree copy-on-write (not the B+-trees and compressed
+ * B-trees, they keep changing their pages) */
+mdbError mdbBtreeShadowPages(mdbBtree* tree);
+
+/* Allocates a node buffer (page sized buffers are page aligned) */
+char* mdbBtreeAllocateBuffer(const uint32 size);
+
+/* Calculates the size of the node buffers of a B-tree */
+void mdbBtreeBufferSize(mdbBtree* tree);
+
+/* Most keys (records) a packed internal node (slotted leaf) holds in memory
+ * (multiple of the number of unpacked ones fitting into its page) */
+#define MDB_BTREE_PACKED_EXPANSION  4
+
+/* Size of the fixed part of a packed internal node (record count, is leaf
+ * and the length of the common key prefix) */
+#define MDB_BTREE_PACKED_HEADER     (2 * sizeof(uint32) + sizeof(uint16))
+
+/* Size of the fixed part of a slotted leaf (record count, is leaf and the
+ * next leaf), followed by the slots (record offsets) */
+#define MDB_BTREE_SLOTTED_HEADER    (3 * sizeof(uint32))
+
+/* Converts a packed internal node (slotted leaf) between its page and its
+ * memory layout */
+void mdbBtreePackNode(const mdbBtreeNode* node, char* page);
+void mdbBtreeUnpackNode(mdbBtreeNode* node, const char* page);
+
 /* B-tree node allocation function */
 mdbError mdbAllocateNode(mdbBtreeNode** node, mdbBtree *tree);
 
+/* Sets up the data pointers of a node for the given raw node data */
+void mdbInitializeNode(mdbBtreeNode* node, mdbBtree *tree, char *data);
+
+/* Sets up the layout of a node after its leaf/internal information changed */
+void mdbLayoutNode(mdbBtreeNode* node);
+
 /* Frees up the memory used by a B-tree node (with eventual save) */
 mdbError mdbFreeNode(mdbBtreeNode* node, uint8 save);
 
+/* Latch modes: readers share a node, a writer holds it exclusively (a
+ * node being read from the file is held exclusively, but not changed) */
+#define MDB_LATCH_SHARED     0
+#define MDB_LATCH_EXCLUSIVE  1
+#define MDB_LATCH_LOAD       2
+
+/* Shared latches a thread can hold at once (a node latched shared again
+ * by the thread is only counted) */
+#define MDB_LATCH_HELD       64
+
+/* Initializes/destroys a latch (a waiting writer is not overtaken by new
+ * readers) */
+void mdbLatchInit(mdbLatch* latch);
+void mdbLatchDestroy(mdbLatch* latch);
+
+/* Latches/unlatches a node (the nodes cached by a buffer pool, the nodes
+ * of a mapped file and the uncached root of a B-tree are shared by
+ * threads, the other private nodes are not latched) */
+void mdbLatchNode(mdbBtreeNode* node, const uint8 mode);
+void mdbUnlatchNode(mdbBtreeNode* node);
+
+/* Returns the version of a node (waits while the node is latched
+ * exclusively, 0 if the node is not latched) */
+uint32 mdbNodeVersion(const mdbBtreeNode* node);
+
+/* Checks that a node was not latched exclusively since its version was
+ * taken */
+int mdbValidateNode(const mdbBtreeNode* node, const uint32 version);
+
+/* Copies a node without latching it: returns the copy, NULL if the node
+ * changed since the given version (the private nodes are not copied, the
+ * node itself is returned) */
+mdbBtreeNode* mdbCopyNode(mdbBtreeNode* copy, mdbBtreeNode* node,
+    const uint32 version);
+
+/* Number of times an optimistic search starts over before it latches */
+#define MDB_BTREE_RESTARTS  4
+
+/* Reads the data of a node from the B-tree file (uncached) */
+void mdbLoadNode(mdbBtreeNode* node);
+
+/* Lays out the data of a node read from its page (packed pages are
+ * expanded) */
+void mdbPrepareNode(mdbBtreeNode* node);
+
+/* Writes the data of a node to the B-tree file (uncached) */
+uint32 mdbStoreNode(mdbBtreeNode* node);
+
+/* Reads a node through the buffer pool of its B-tree (uncached if it has
+ * none, see mdbBufferPin) */
+mdbBtreeNode* mdbReadNode(const uint32 position, mdbBtree* tree);
+
+/* Writes existing nodes (sorted by position) to the B-tree file, the pages
+ * of adjacent nodes are written at once */
+void mdbStoreNodes(mdbBtreeNode** nodes, const uint32 count);
+
+/* Searches a node for a key (position of the first key >= the given key) */
+uint32 mdbBtreeFindKey(const char* key, const mdbBtreeNode* node, int* found);
+
+/* Counts the key comparisons of the INT node search if set (benchmarks,
+ * not synchronized between threads) */
+extern unsigned long* mdbIntCompares;
+
 /* B-tree search */
 mdbError mdbBtreeSearch(const char* key, char* record, mdbBtree* t);
 
+/* B-tree search in a snapshot (the record as it was when the snapshot was
+ * opened) */
+mdbError mdbBtreeSearchSnapshot(const char* key, char* record, mdbBtree* t,
+    const mdbSnapshot* snapshot);
+
+/* Searches several keys at once: the nodes of each level are read in one
+ * batch, the result of each key is stored in "results" */
+mdbError mdbBtreeSearchKeys(const char* const* keys, char* const* records,
+    mdbError* results, const uint32 count, mdbBtree* t);
+
+/* Reads the nodes at the given positions in one batch (buffer pool),
+ * returns the number of nodes read */
+uint32 mdbBtreePrefetch(mdbBtree* t, const uint32* positions,
+    const uint32 count);
+
 /* B-tree insertion */
 mdbError mdbBtreeInsert(const char* record, mdbBtree* t);
 
 /* B-tree deletion */
 mdbError mdbBtreeDelete(const char* key, mdbBtree* t);
 
-/* B-tree traversal */
+/* Default number of children read ahead by a scan (mdbBtreeTraverse) */
+#define MDB_BTREE_READAHEAD  8
+
+/* B-tree traversal (the nodes of a running traversal are latched) */
 mdbError mdbBtreeTraverse(mdbBtreeTraversal **t, char *record);
 
+/* Ends a traversal: releases its nodes but the root, the next call of
+ * mdbBtreeTraverse starts over */
+void mdbBtreeTraverseReset(mdbBtreeTraversal **t);
+
+/* Backward B-tree traversal: returns the record before the current
+ * position of the traversal (the calls can be mixed with mdbBtreeTraverse) */
+mdbError mdbBtreeTraversePrev(mdbBtreeTraversal **t, char *record);
+
+/* Positions a traversal after the last record of the B-tree (the next
+ * mdbBtreeTraversePrev returns the last record) */
+void mdbBtreeTraverseLast(mdbBtreeTraversal **t);
+
+/* Cursor flags: the bound keys themselves are outside of the range */
+#define MDB_CURSOR_INCLUSIVE        0x00
+#define MDB_CURSOR_LOWER_EXCLUSIVE  0x01
+#define MDB_CURSOR_UPPER_EXCLUSIVE  0x02
+
+/* Opens a cursor on the records with keys between the lower and the upper
+ * bound (NULL: no bound), placed before the first record of the range (the
+ * cursor does not latch its path, see mdbCopyNode; a copy-on-write B-tree
+ * is read as it was when the cursor was opened) */
+mdbError mdbBtreeCursorOpen(mdbBtreeCursor **cursor, mdbBtree *t,
+    const char *lower, const char *upper, const uint8 flags);
+
+/* Makes a cursor read a snapshot (NULL: the current B-tree), the cursor is
+ * placed before the first record of the range */
+mdbError mdbBtreeCursorSnapshot(mdbBtreeCursor *cursor,
+    const mdbSnapshot *snapshot);
+
+/* Places a cursor before the first record with a key greater than or equal
+ * to the given key (NULL: start of the range), kept within the range */
+mdbError mdbBtreeCursorSeek(mdbBtreeCursor *cursor, const char *key);
+
+/* Places a cursor after the last record of the range (descending scans) */
+mdbError mdbBtreeCursorLast(mdbBtreeCursor *cursor);
+
+/* Returns the record after/before a cursor and moves the cursor over it
+ * (MDB_BTREE_NO_MORE_RECORDS at the end/start of the range) */
+mdbError mdbBtreeCursorNext(mdbBtreeCursor *cursor, char *record);
+mdbError mdbBtreeCursorPrev(mdbBtreeCursor *cursor, char *record);
+
+/* Closes a cursor (releases the nodes of its path) */
+mdbError mdbBtreeCursorClose(mdbBtreeCursor *cursor);
+
+/* Default node fill factor of the bulk loader (percent) */
+#define MDB_BTREE_FILL_DEFAULT  100
+
+/* Builds an (empty) B-tree bottom-up from records sorted by their keys */
+mdbError mdbBtreeBulkLoad(mdbBtree* t, mdbRecordSourcePtr source, void* cls,
+    uint8 fill);
+
+/* ********************************************************* */
+/* ********************************************************* */
+
+/* ********************************************************* *
+ *    Buffer pool related functions and defines
+ * ********************************************************* */
+/* Default number of frames (cached nodes) of a database buffer pool */
+#define MDB_BUFFER_POOL_SIZE  64
+
+/* A pool whose frames are all pinned (by concurrent threads) grows up to
+ * this multiple of its number of frames */
+#define MDB_BUFFER_POOL_GROWTH  4
+
+/* Creates a buffer pool with the given number of frames */
+mdbError mdbBufferPoolCreate(mdbBufferPool **pool, uint32 capacity);
+
+/* Frees the buffer pool and all cached nodes */
+mdbError mdbBufferPoolFree(mdbBufferPool *pool);
+
+/* Returns the pinned node at the given position (loads it if needed) */
+mdbBtreeNode* mdbBufferPin(mdbBufferPool *pool, const uint32 position,
+    mdbBtree *tree);
+
+/* Releases a node obtained by mdbBufferPin */
+void mdbBufferUnpin(mdbBufferPool *pool, mdbBtreeNode *node);
+
+/* Finds a cached node without pinning it (optimistic readers): returns the
+ * node and the version of its frame, NULL if it is not cached */
+mdbBtreeNode* mdbBufferFind(mdbBufferPool *pool, const uint32 position,
+    uint32 *version);
+
+/* Largest write of the checkpoints (pages of adjacent nodes) */
+#define MDB_BUFFER_BATCH_SIZE  (64 * MDB_PAGE_SIZE)
+
+/* Marks the cached copy of an existing node as dirty (a private copy is
+ * copied into it), returns 0 if the node has to be written immediately */
+int mdbBufferMarkDirty(mdbBufferPool *pool, mdbBtreeNode *node);
+
+/* Writes the dirty nodes back, sorted by their positions */
+mdbError mdbBufferPoolFlush(mdbBufferPool *pool);
+
+/* Drops the cached copy of the node at the given position */
+void mdbBufferInvalidate(mdbBufferPool *pool, const uint32 position);
+
+/* Reads the uncached nodes at the given positions with one batch of
+ * asynchronous reads (the nodes are cached unpinned), returns the number
+ * of nodes read */
+uint32 mdbBufferPrefetch(mdbBufferPool *pool, mdbBtree *tree,
+    const uint32 *positions, const uint32 count);
+
+/* ********************************************************* */
+/* ********************************************************* */
+
+/* ********************************************************* *
+ *    Memory-mapped node storage functions and defines
+ * ********************************************************* */
+/* Address space reserved for a mapped file: the largest file which can be
+ * mapped (a larger database has to be opened without MDB_OPEN_MMAP), not the
+ * whole block number range, so that many databases fit into the address
+ * space of a process */
+#define MDB_MMAP_RESERVE  (256ULL << 30)
+
+/* Granularity of the mapping growth (multiple of the OS page size) */
+#define MDB_MMAP_CHUNK    (16UL << 20)
+
+/* Maps the database file (the mapping grows with the file) */
+mdbError mdbMmapOpen(mdbMmap **map, FILE *file);
+
+/* Un-maps the database file */
+mdbError mdbMmapClose(mdbMmap *map);
+
+/* Writes the changed pages of the mapped file to the disk */
+void mdbMmapSync(mdbMmap *map);
+
+/* Node functions accessing the nodes in place in the mapped file */
+mdbBtreeNode* mdbMmapReadNode(const uint32 position, mdbBtree* tree);
+uint32 mdbMmapWriteNode(mdbBtreeNode* node);
+void mdbMmapDeleteNode(mdbBtreeNode* node);
+
+/* Returns the address of a file range (the file and mapping grow if needed) */
+char* mdbMmapAddress(mdbMmap *map, const uint64 offset, const uint32 size);
+
+/* Latches of the blocks of a mapped file (one per block of a chunk) */
+#define MDB_MMAP_LATCHES  (MDB_MMAP_CHUNK >> MDB_BLOCK_SHIFT)
+
+/* Returns the latch of the node at the given position of a mapped file */
+mdbLatch* mdbMmapLatch(mdbMmap *map, const uint32 position);
+
+/* ********************************************************* */
+/* ********************************************************* */
+
+/* ********************************************************* *
+ *    Free space management functions
+ * ********************************************************* */
+/* Returns the position of a free block for a new node (0 = append) */
+uint32 mdbAllocateBlock(mdbBtree *tree);
+
+/* Adds the block of a deleted node to the free list of its size */
+void mdbReleaseBlock(mdbBtree *tree, const uint32 position);
+
+/* Returns the position of free blocks of the given size (0 = append) */
+uint32 mdbAllocateBlocks(mdbBtree *tree, const uint32 size);
+
+/* Adds blocks of the given size to the free list of their size */
+void mdbReleaseBlocks(mdbBtree *tree, const uint32 position,
+    const uint32 size);
+
+/* Reads/writes data at the given file position (log, mapped file or
+ * positioned I/O) */
+void mdbSpaceRead(mdbBtree *tree, const uint64 offset, void *data,
+    const uint32 size);
+void mdbSpaceWrite(mdbBtree *tree, const uint64 offset,
+    const void *data, const uint32 size);
+
+/* Returns the first block after the end of the file (new blocks) */
+uint32 mdbSpaceEnd(mdbBtree *tree);
+
+/* Locks/unlocks the free blocks table and the end of the file of a B-tree
+ * (held from the allocation of new blocks until they are written) */
+void mdbSpaceLock(mdbBtree *tree);
+void mdbSpaceUnlock(mdbBtree *tree);
+
+/* ********************************************************* */
+/* ********************************************************* */
+
+/* ********************************************************* *
+ *    Overflow page functions and defines
+ * ********************************************************* */
+/* A value stored out of line occupies a chain of overflow pages (one block
+ * each): the position of the next page is followed by the value bytes */
+#define MDB_OVERFLOW_PAGE_DATA  (MDB_PAGE_SIZE - sizeof(uint32))
+
+/* Bytes of an out-of-line value kept in the record (values not longer than
+ * that do not need overflow pages) */
+#define MDB_OVERFLOW_PREFIX     56
+
+/* Size of an out-of-line value in a record: length, first overflow page
+ * and the prefix of the value */
+#define MDB_OVERFLOW_SIZE       (2 * sizeof(uint32) + MDB_OVERFLOW_PREFIX)
+
+/* Variable-length columns whose values can be longer than this (bytes) are
+ * stored out of line (except the key column) */
+#define MDB_OVERFLOW_THRESHOLD  256
+
+/* Stores data in a new chain of overflow pages, returns the first page */
+uint32 mdbOverflowWrite(mdbBtree *tree, const char *data, const uint32 size);
+
+/* Reads data from a chain of overflow pages */
+void mdbOverflowRead(mdbBtree *tree, uint32 position, char *data,
+    uint32 size);
+
+/* Releases the pages of a chain of overflow pages */
+void mdbOverflowFree(mdbBtree *tree, uint32 position);
+
+/* Stores a variable-length value out of line (in the record: its length,
+ * first overflow page and prefix), at most "length" elements */
+void mdbStoreLongValue(mdbBtree *tree, const mdbDatatype *type,
+    const uint32 length, char *dest, const char *value);
+
+/* Restores a value stored out of line (length header and value) */
+void mdbLoadLongValue(mdbBtree *tree, const mdbDatatype *type, char *dest,
+    const char *field);
+
+/* ********************************************************* */
+/* ********************************************************* */
+
+/* ********************************************************* *
+ *    Node compression functions and defines
+ * ********************************************************* */
+/* Node size of the compressed tables (a node occupies as many blocks as
+ * its compressed page needs) */
+#define MDB_COMPRESS_NODE_SIZE  (8 * MDB_PAGE_SIZE)
+
+/* Compresses data, returns the compressed size (0 = does not fit into the
+ * given capacity) */
+uint32 mdbCompress(const char *src, const uint32 size, char *dest,
+    const uint32 capacity);
+
+/* Decompresses data, returns the decompressed size (0 = corrupted data or
+ * too small capacity) */
+uint32 mdbDecompress(const char *src, const uint32 size, char *dest,
+    const uint32 capacity);
+
+/* Reads the page of a compressed node into its buffer */
+void mdbLoadCompressedNode(mdbBtreeNode *node);
+
+/* Compresses and writes the page of a node (a new node gets a position),
+ * returns the position of the node */
+uint32 mdbStoreCompressedNode(mdbBtreeNode *node, const char *page);
+
+/* Releases the head block and the tail of a compressed node */
+void mdbReleaseCompressedNode(mdbBtreeNode *node);
+
+/* ********************************************************* */
+/* ********************************************************* */
+
+/* ********************************************************* *
+ *    Positioned file I/O functions and defines
+ * ********************************************************* */
+/* Descriptor of the node pages of a B-tree (direct I/O if used) */
+#define MDB_NODE_FD(tree) (((tree)->direct >= 0) ? (tree)->direct : (tree)->fd)
+
+/* Reads data at the given offset (the part after the end of the file is
+ * zero filled), returns the number of bytes read */
+uint32 mdbFileRead(const int fd, const uint64 offset, void *data,
+    const uint32 size);
+
+/* Writes data at the given offset, returns the number of bytes written */
+uint32 mdbFileWrite(const int fd, const uint64 offset, const void *data,
+    const uint32 size);
+
+/* Returns the first block after the end of a file */
+uint32 mdbFileEnd(const int fd);
+
+/* Writes the data of a file to the disk */
+void mdbFileSync(const int fd);
+
+/* ********************************************************* */
+/* ********************************************************* */
+
+/* ********************************************************* *
+ *    Asynchronous I/O functions and defines
+ * ********************************************************* */
+/* Requests in flight at most (io_uring queue size) */
+#define MDB_AIO_DEPTH    64
+
+/* Number of worker threads when io_uring is not available */
+#define MDB_AIO_THREADS  4
+
+/* Creates the asynchronous I/O of a database (io_uring if available,
+ * worker threads otherwise) */
+mdbError mdbAioCreate(mdbAio **aio, const uint32 depth);
+
+/* Frees the asynchronous I/O (no batch may be running) */
+mdbError mdbAioFree(mdbAio *aio);
+
+/* Executes a batch of requests, the requests are started at once and
+ * "complete" is called for each of them in the order they finish (a
+ * call-back must not submit another batch); returns after the last one */
+mdbError mdbAioSubmit(mdbAio *aio, mdbAioRequest *requests,
+    const uint32 count, mdbAioCompletePtr complete, void *cls);
+
+/* ********************************************************* */
+/* ********************************************************* */
+
+/* ********************************************************* *
+ *    Write-ahead log functions and defines
+ * ********************************************************* */
+/* Size of the log which is copied into the database file by the next commit
+ * (checkpoint) */
+#define MDB_WAL_CHECKPOINT_SIZE  (16UL << 20)
+
+/* Blocks whose images a transaction keeps in memory until it commits (the
+ * images of larger transactions are logged before the commit) */
+#define MDB_WAL_PENDING  1024
+
+/* Opens (creates) the log of a database, the committed transactions of an
+ * existing log are recovered */
+mdbError mdbWalOpen(mdbWal **wal, const int fd, const char *filename,
+    const uint8 create);
+
+/* Recovers the log of a database opened without one (if it exists) */
+mdbError mdbWalRecover(const int fd, const char *filename);
+
+/* Checkpoints the log and removes it */
+mdbError mdbWalClose(mdbWal *wal);
+
+/* Reads data of the database file (logged blocks are read from the log) */
+void mdbWalRead(mdbWal *wal, const uint64 offset, void *data,
+    const uint32 size);
+
+/* Writes data of the database file (the latest image of every block the
+ * transaction wrote is logged by the commit) */
+void mdbWalWrite(mdbWal *wal, const uint64 offset, const void *data,
+    const uint32 size);
+
+/* Returns the first block after the end of the database file (including
+ * the blocks only written to the log) */
+uint32 mdbWalEnd(mdbWal *wal);
+
+/* Ends a transaction: the log is synced before the function returns (one
+ * sync for all transactions committing meanwhile) */
+mdbError mdbWalCommit(mdbWal *wal);
+
+/* Copies the latest committed block images of the log into the database
+ * file and starts a new log (unless a running transaction has logged
+ * images) */
+mdbError mdbWalCheckpoint(mdbWal *wal);
+
+/* ********************************************************* */
+/* ********************************************************* */
+
+/* ********************************************************* *
+ *    Multi-version (snapshot) functions and defines
+ * ********************************************************* */
+/* Number of hash buckets of the node images of a database */
+#define MDB_VERSION_BUCKETS  4096
+
+/* Creates/frees the node versions of a database (no snapshot may be open) */
+mdbError mdbVersionStoreCreate(mdbVersionStore **store);
+mdbError mdbVersionStoreFree(mdbVersionStore *store);
+
+/* Begins/ends a write (insertion or deletion) of a B-tree (NULL: the
+ * B-tree has no versions) */
+void mdbVersionBegin(mdbVersionStore *store);
+void mdbVersionEnd(mdbVersionStore *store);
+
+/* Keeps the image of a node latched exclusively by a write, if an open
+ * snapshot still needs the node as it is */
+void mdbVersionSave(mdbBtreeNode *node);
+
+/* Opens a snapshot of a database: the B-trees read through it keep the
+ * records of the writes which ended before it was opened */
+mdbError mdbSnapshotOpen(mdbSnapshot **snapshot, mdbDatabase *db);
+
+/* Closes a snapshot (the node images no snapshot needs are released) */
+mdbError mdbSnapshotClose(mdbSnapshot *snapshot);
+
+/* Copies a node as it was when the snapshot was opened, returns the copy
+ * (the private nodes are not copied, see mdbCopyNode) */
+mdbBtreeNode* mdbSnapshotNode(const mdbSnapshot *snapshot,
+    mdbBtreeNode *node, mdbBtreeNode *copy);
+
+/* ********************************************************* */
+/* ********************************************************* */
+
+/* ********************************************************* *
+ *    Copy-on-write (shadow paging) functions
+ * ********************************************************* */
+/* Node I/O of the copy-on-write B-trees: the nodes are private copies of
+ * their pages, a written node gets a new page, the replaced and deleted
+ * pages are released once no reader can reach them */
+mdbBtreeNode* mdbShadowReadNode(const uint32 position, mdbBtree* tree);
+uint32 mdbShadowWriteNode(mdbBtreeNode* node);
+void mdbShadowDeleteNode(mdbBtreeNode* node);
+
+/* Takes a reader slot of a copy-on-write B-tree before its root is read
+ * (the pages below the root stay until mdbShadowLeave) */
+uint32 mdbShadowEnter(mdbBtree* tree);
+void mdbShadowLeave(mdbBtree* tree, const uint32 reader);
+
+/* Reads the root node published last (released by mdbFreeNode), the nodes
+ * below it never change while the reader holds its slot */
+mdbBtreeNode* mdbShadowRoot(mdbBtree* tree);
+
+/* Publishes the position of the root node after a write (the readers see
+ * it at once, the descriptor is written by the next commit) */
+void mdbShadowPublish(mdbBtree* tree);
+
+/* Writes the published roots of the copy-on-write B-trees of a database
+ * into their descriptors (the pages are synced first, without a log),
+ * returns the number of descriptors written */
+uint32 mdbShadowWriteRoots(mdbDatabase* db);
+
+/* Marks the written descriptors durable and releases the pages no reader
+ * and no descriptor refers to (after the commit or sync) */
+void mdbShadowReclaim(mdbDatabase* db);
+
+/* Frees the copy-on-write states of a database */
+void mdbShadowFree(mdbDatabase* db);
+
 /* ********************************************************* */
 /* ********************************************************* */
 
 /* ********************************************************* *
  *    Database related functions and defines
  * ********************************************************* */
+/* Database open flags (mdbCreateDatabase, mdbOpenDatabase) */
+#define MDB_OPEN_DEFAULT  0x0000  /* stdio node I/O through the buffer pool */
+#define MDB_OPEN_MMAP     0x0001  /* nodes accessed in the mapped file      */
+#define MDB_OPEN_BPLUS    0x0002  /* new tables are stored in B+-trees      */
+#define MDB_OPEN_DIRECT   0x0004  /* node I/O bypasses the OS page cache    */
+#define MDB_OPEN_COMPRESS 0x0008  /* new tables store compressed nodes      */
+#define MDB_OPEN_WAL      0x0010  /* writes go to the write-ahead log       */
+#define MDB_OPEN_SHADOW   0x0020  /* new tables are copy-on-write B-trees   */
+
+/* File layout: the header (block 0) is followed by the B-tree descriptors
+ * of the three system tables (one block each) */
+#define MDB_SYSTEM_DESCRIPTOR(t)  ((t) + 1)
+#define MDB_HEADER_BLOCKS         4
+
 /* Creates an empty MastersDB database */
-mdbError mdbCreateDatabase(mdbDatabase **db, const char *filename);
+mdbError mdbCreateDatabase(mdbDatabase **db, const char *filename,
+    uint32 flags);
 
 /* Loads an existing MastersDB database, including header check */
-mdbError mdbOpenDatabase(mdbDatabase **db, const char *filename);
+mdbError mdbOpenDatabase(mdbDatabase **db, const char *filename,
+    uint32 flags);
 
 /* Loads an existing MastersDB database, including header check */
 mdbError mdbCloseDatabase(mdbDatabase *db);
 
+/* Ends the current transaction of a database (write-ahead log) */
+mdbError mdbCommitDatabase(mdbDatabase *db);
+
+/* Default number of seconds between two checkpoints (0 = only when the
+ * database is closed) */
+#define MDB_CHECKPOINT_INTERVAL  30
+
+/* Writes the dirty nodes back and makes the database file durable */
+mdbError mdbCheckpointDatabase(mdbDatabase *db);
+
+/* Sets the number of seconds between two checkpoints (done by a timer
+ * thread of a database with a buffer pool, 0 = only when the database is
+ * closed) */
+void mdbSetCheckpointInterval(mdbDatabase *db, const uint32 seconds);
+
+/* Sets the number of nodes read ahead by the scans of the B-trees bound to
+ * the database afterwards (0 = no read-ahead) */
+void mdbSetReadAhead(mdbDatabase *db, const uint32 nodes);
+
+/* Reads/writes data at the given position of the database file (stdio or
+ * write-ahead log) */
+void mdbDatabaseRead(mdbDatabase *db, const uint64 offset, void *data,
+    const uint32 size);
+void mdbDatabaseWrite(mdbDatabase *db, const uint64 offset, const void *data,
+    const uint32 size);
+
+/* Returns the first block after the end of the database file */
+uint32 mdbDatabaseEnd(mdbDatabase *db);
+
+/* Binds a B-tree to the database file and buffer pool */
+void mdbInitializeBtree(mdbDatabase *db, mdbBtree *tree);
+
 /* Data-type count */
 #define MDB_DATATYPE_COUNT  5
 
+/* Value encodings of the data types: the encoded values of a data type are
+ * ordered like their byte strings (memcmp), the INT-8/16/32 and FLOAT
+ * values are stored big-endian with a flipped sign bit (negative FLOAT
+ * values: all bits flipped) */
+#define MDB_ENCODING_NONE   0   /* bytes and strings (stored as they are) */
+#define MDB_ENCODING_INT    1   /* two's complement integers              */
+#define MDB_ENCODING_FLOAT  2   /* IEEE 754 single precision              */
+
+/* Compares two encoded FLOAT values */
+int mdbCompareFloat(const void* v1, const void* v2, size_t size);
+
+/* Compares two encoded values of a data type (variable-length values: the
+ * common prefix, then the length) */
+int mdbCompareValues(const mdbDatatype *type, const char *v1, const char *v2);
+
+/* Stores a value (host representation) in the encoding of its data type */
+void mdbEncodeValue(const mdbDatatype *type, char *dest, const char *value);
+
+/* Restores the host representation of an encoded value */
+void mdbDecodeValue(const mdbDatatype *type, char *dest, const char *value);
+
 /* ********************************************************* */
 /* ********************************************************* */
 
@@ -159,6 +897,15 @@ mdbError mdbCreateTable(
     void *cls,
     mdbColumnRetrievalPtr cb);
 
+/* Tests whether the values of the c-th column of a table are stored out of
+ * line (overflow pages) */
+int mdbColumnOverflows(const mdbDatabase *db, const mdbColumn *col,
+    const uint8 c);
+
+/* Size of the values of the c-th column of a table in its records */
+uint32 mdbColumnSize(const mdbDatabase *db, const mdbColumn *col,
+    const uint8 c);
+
 /* Loads the meta data, B-tree descriptor and root node of a table */
 mdbError mdbLoadTable(
     mdbDatabase *db,
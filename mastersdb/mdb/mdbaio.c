@@ -0,0 +1,385 @@
+/*
+ * mdbaio.c
+ *
+ * Asynchronous batched I/O (io_uring, worker threads as a fallback)
+ *
+ * Copyright (C) 2010, Dinko Hasanbasic (dinko.hasanbasic@gmail.com)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ * Revision history
+ * ----------------
+ * 17.10.2026
+ *  Initial version of file.
+ *  A batch of reads/writes is started at once and completed out of order:
+ *  io_uring queue (MDB_HAVE_IO_URING) or worker threads with positioned I/O.
+ *  The batches of threads sharing a database are executed one at a time.
+ */
+
+#include "mdb.h"
+
+#include <stdlib.h>
+
+#ifdef MDB_HAVE_IO_URING
+  #include <errno.h>
+  #include <linux/io_uring.h>
+  #include <sys/mman.h>
+  #include <sys/syscall.h>
+  #include <unistd.h>
+#endif
+
+/* marks a request which has not finished yet */
+#define MDB_AIO_PENDING  0xFFFFFFFF
+
+/* Finishes a request synchronously from the given number of transferred
+ * bytes on (short transfers, failed or unsupported asynchronous requests) */
+static void mdbAioFinish(mdbAioRequest *request, uint32 done)
+{
+  if (done < request->size)
+  {
+    if (request->write)
+    {
+      done += mdbFileWrite(request->fd, request->offset + done,
+          request->data + done, request->size - done);
+    }
+    else
+    {
+      /* the part after the end of the file is zero filled */
+      done += mdbFileRead(request->fd, request->offset + done,
+          request->data + done, request->size - done);
+    }
+  }
+  request->done = done;
+}
+
+#ifdef MDB_HAVE_IO_URING
+
+/* Sets up an io_uring queue (no libraries needed, only the system calls),
+ * returns -1 if the kernel does not support (or allow) io_uring */
+static int mdbAioSetupRing(mdbAio *aio, const uint32 depth)
+{
+  struct io_uring_params params;
+  char *sq;
+  char *cq;
+  int ring;
+
+  memset(&params, 0, sizeof(params));
+  if ((ring = (int)syscall(__NR_io_uring_setup, depth, &params)) < 0)
+  {
+    return -1;
+  }
+
+  aio->sq_ring_size = params.sq_off.array +
+      params.sq_entries * sizeof(uint32);
+  aio->cq_ring_size = params.cq_off.cqes +
+      params.cq_entries * sizeof(struct io_uring_cqe);
+  aio->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+  aio->sq_ring = mmap(NULL, aio->sq_ring_size, PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_SQ_RING);
+  aio->cq_ring = mmap(NULL, aio->cq_ring_size, PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_CQ_RING);
+  aio->sqes = mmap(NULL, aio->sqes_size, PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_SQES);
+
+  if (aio->sq_ring == MAP_FAILED || aio->cq_ring == MAP_FAILED ||
+      aio->sqes == MAP_FAILED)
+  {
+    if (aio->sq_ring != MAP_FAILED) munmap(aio->sq_ring, aio->sq_ring_size);
+    if (aio->cq_ring != MAP_FAILED) munmap(aio->cq_ring, aio->cq_ring_size);
+    if (aio->sqes != MAP_FAILED) munmap(aio->sqes, aio->sqes_size);
+    close(ring);
+    return -1;
+  }
+
+  sq = (char*)aio->sq_ring;
+  cq = (char*)aio->cq_ring;
+  aio->sq_head = (uint32*)(sq + params.sq_off.head);
+  aio->sq_tail = (uint32*)(sq + params.sq_off.tail);
+  aio->sq_mask = (uint32*)(sq + params.sq_off.ring_mask);
+  aio->sq_array = (uint32*)(sq + params.sq_off.array);
+  aio->cq_head = (uint32*)(cq + params.cq_off.head);
+  aio->cq_tail = (uint32*)(cq + params.cq_off.tail);
+  aio->cq_mask = (uint32*)(cq + params.cq_off.ring_mask);
+  aio->cqes = cq + params.cq_off.cqes;
+
+  aio->ring = ring;
+  aio->depth = params.sq_entries;
+  return 0;
+}
+
+/* Releases the io_uring queue */
+static void mdbAioFreeRing(mdbAio *aio)
+{
+  munmap(aio->sqes, aio->sqes_size);
+  munmap(aio->cq_ring, aio->cq_ring_size);
+  munmap(aio->sq_ring, aio->sq_ring_size);
+  close(aio->ring);
+}
+
+/*
+ * Executes a batch with the io_uring queue: the submission queue is kept
+ * filled (at most "depth" requests in flight), each system call submits
+ * the new requests and waits for at least one completion.
+ */
+static void mdbAioSubmitRing(mdbAio *aio, mdbAioRequest *requests,
+    const uint32 count, mdbAioCompletePtr complete, void *cls)
+{
+  struct io_uring_sqe *sqes = (struct io_uring_sqe*)aio->sqes;
+  struct io_uring_cqe *cqes = (struct io_uring_cqe*)aio->cqes;
+  struct io_uring_sqe *sqe;
+  struct io_uring_cqe *cqe;
+  mdbAioRequest *request;
+  uint32 next = 0;
+  uint32 flight = 0;
+  uint32 tail;
+  uint32 head;
+  uint32 i;
+  int ret;
+
+  while (next < count || flight > 0)
+  {
+    /* the submission queue is only written by this thread */
+    tail = *aio->sq_tail;
+    while (next < count && flight < aio->depth)
+    {
+      request = &requests[next];
+      sqe = &sqes[tail & *aio->sq_mask];
+      memset(sqe, 0, sizeof(*sqe));
+      sqe->opcode = request->write ? IORING_OP_WRITE : IORING_OP_READ;
+      sqe->fd = request->fd;
+      sqe->addr = (uint64)(uintptr_t)request->data;
+      sqe->len = request->size;
+      sqe->off = request->offset;
+      sqe->user_data = next;
+      aio->sq_array[tail & *aio->sq_mask] = tail & *aio->sq_mask;
+      tail++;
+      next++;
+      flight++;
+    }
+    __atomic_store_n(aio->sq_tail, tail, __ATOMIC_RELEASE);
+
+    ret = (int)syscall(__NR_io_uring_enter, aio->ring,
+        tail - __atomic_load_n(aio->sq_head, __ATOMIC_ACQUIRE), 1,
+        IORING_ENTER_GETEVENTS, NULL, 0);
+
+    if (ret < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+    {
+      /* the queue does not work, the rest of the batch is done with
+       * positioned I/O */
+      for (i = 0; i < count; i++)
+      {
+        if (requests[i].done == MDB_AIO_PENDING)
+        {
+          mdbAioFinish(&requests[i], 0);
+          if (complete != NULL) complete(&requests[i], cls);
+        }
+      }
+      return;
+    }
+
+    /* the completions are reaped in the order the requests finished */
+    head = *aio->cq_head;
+    while (head != __atomic_load_n(aio->cq_tail, __ATOMIC_ACQUIRE))
+    {
+      cqe = &cqes[head & *aio->cq_mask];
+      request = &requests[cqe->user_data];
+      mdbAioFinish(request, cqe->res > 0 ? (uint32)cqe->res : 0);
+      if (complete != NULL) complete(request, cls);
+      head++;
+      flight--;
+    }
+    __atomic_store_n(aio->cq_head, head, __ATOMIC_RELEASE);
+  }
+}
+
+#endif /* MDB_HAVE_IO_URING */
+
+/* Worker thread: executes the requests of the current batch one by one */
+static void* mdbAioWorker(void *arg)
+{
+  mdbAio *aio = (mdbAio*)arg;
+  uint32 i;
+
+  pthread_mutex_lock(&aio->lock);
+  for (;;)
+  {
+    while (!aio->stop && aio->next >= aio->queued)
+    {
+      pthread_cond_wait(&aio->work_cond, &aio->lock);
+    }
+    if (aio->stop)
+    {
+      break;
+    }
+    i = aio->next++;
+    pthread_mutex_unlock(&aio->lock);
+
+    mdbAioFinish(&aio->queue[i], 0);
+
+    pthread_mutex_lock(&aio->lock);
+    aio->completed[aio->completed_count++] = i;
+    pthread_cond_signal(&aio->done_cond);
+  }
+  pthread_mutex_unlock(&aio->lock);
+  return NULL;
+}
+
+/* Executes a batch with the worker threads, the call-backs are called by
+ * the submitting thread */
+static void mdbAioSubmitThreads(mdbAio *aio, mdbAioRequest *requests,
+    const uint32 count, mdbAioCompletePtr complete, void *cls)
+{
+  uint32 reaped = 0;
+  uint32 end;
+
+  pthread_mutex_lock(&aio->lock);
+  aio->completed = (uint32*) malloc(count * sizeof(uint32));
+  aio->completed_count = 0;
+  aio->queue = requests;
+  aio->queued = count;
+  aio->next = 0;
+  pthread_cond_broadcast(&aio->work_cond);
+
+  while (reaped < count)
+  {
+    while (aio->completed_count == reaped)
+    {
+      pthread_cond_wait(&aio->done_cond, &aio->lock);
+    }
+
+    /* the finished entries are not changed by the workers any more */
+    end = aio->completed_count;
+    pthread_mutex_unlock(&aio->lock);
+    for (; reaped < end; reaped++)
+    {
+      if (complete != NULL) complete(&requests[aio->completed[reaped]], cls);
+    }
+    pthread_mutex_lock(&aio->lock);
+  }
+
+  free(aio->completed);
+  aio->completed = NULL;
+  aio->queue = NULL;
+  aio->queued = 0;
+  aio->next = 0;
+  pthread_mutex_unlock(&aio->lock);
+}
+
+mdbError mdbAioCreate(mdbAio **aio, const uint32 depth)
+{
+  mdbAio *l_aio = (mdbAio*)calloc(1, sizeof(mdbAio));
+  uint32 i;
+
+  l_aio->ring = -1;
+  l_aio->depth = depth;
+  pthread_mutex_init(&l_aio->lock, NULL);
+  pthread_mutex_init(&l_aio->submit, NULL);
+  pthread_cond_init(&l_aio->work_cond, NULL);
+  pthread_cond_init(&l_aio->done_cond, NULL);
+
+#ifdef MDB_HAVE_IO_URING
+  if (mdbAioSetupRing(l_aio, depth) == 0)
+  {
+    *aio = l_aio;
+    return MDB_NO_ERROR;
+  }
+#endif
+
+  /* without worker threads the batches are executed synchronously */
+  l_aio->threads = (pthread_t*) malloc(MDB_AIO_THREADS * sizeof(pthread_t));
+  for (i = 0; i < MDB_AIO_THREADS; i++)
+  {
+    if (pthread_create(&l_aio->threads[i], NULL, &mdbAioWorker, l_aio) != 0)
+    {
+      break;
+    }
+    l_aio->thread_count++;
+  }
+
+  *aio = l_aio;
+  return MDB_NO_ERROR;
+}
+
+mdbError mdbAioFree(mdbAio *aio)
+{
+  uint32 i;
+
+#ifdef MDB_HAVE_IO_URING
+  if (aio->ring >= 0)
+  {
+    mdbAioFreeRing(aio);
+  }
+#endif
+
+  pthread_mutex_lock(&aio->lock);
+  aio->stop = 1;
+  pthread_cond_broadcast(&aio->work_cond);
+  pthread_mutex_unlock(&aio->lock);
+
+  for (i = 0; i < aio->thread_count; i++)
+  {
+    pthread_join(aio->threads[i], NULL);
+  }
+  free(aio->threads);
+
+  pthread_cond_destroy(&aio->done_cond);
+  pthread_cond_destroy(&aio->work_cond);
+  pthread_mutex_destroy(&aio->submit);
+  pthread_mutex_destroy(&aio->lock);
+  free(aio);
+
+  return MDB_NO_ERROR;
+}
+
+mdbError mdbAioSubmit(mdbAio *aio, mdbAioRequest *requests,
+    const uint32 count, mdbAioCompletePtr complete, void *cls)
+{
+  uint32 i;
+
+  for (i = 0; i < count; i++)
+  {
+    requests[i].done = MDB_AIO_PENDING;
+  }
+
+  /* the ring (the batch of the workers) belongs to one batch at a time */
+  pthread_mutex_lock(&aio->submit);
+  aio->batches++;
+  aio->requests += count;
+
+#ifdef MDB_HAVE_IO_URING
+  if (aio->ring >= 0)
+  {
+    mdbAioSubmitRing(aio, requests, count, complete, cls);
+    pthread_mutex_unlock(&aio->submit);
+    return MDB_NO_ERROR;
+  }
+#endif
+
+  /* a single request gains nothing from the workers */
+  if (aio->thread_count > 0 && count > 1)
+  {
+    mdbAioSubmitThreads(aio, requests, count, complete, cls);
+    pthread_mutex_unlock(&aio->submit);
+    return MDB_NO_ERROR;
+  }
+  pthread_mutex_unlock(&aio->submit);
+
+  for (i = 0; i < count; i++)
+  {
+    mdbAioFinish(&requests[i], 0);
+    if (complete != NULL) complete(&requests[i], cls);
+  }
+  return MDB_NO_ERROR;
+}
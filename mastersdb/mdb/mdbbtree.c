@@ -51,40 +51,333 @@
  *  Removed "key_size" from mdbBtreeMeta.
  * 09.08.2010
  *  Added mdbBtreeOptimalOrder function.
+ * 17.10.2026
+ *  Node reads and writes go through the database buffer pool (if any).
+ *  Nodes are always released by mdbFreeNode (unpins cached nodes).
+ *  Fixed node leaks in mdbBtreeDeleteRecursive and mdbBtreeTraverse.
+ *  Added mdbInitializeNode function (used by the memory-mapped storage).
+ *  Search, insertion and deletion use a binary search inside a node
+ *  (mdbBtreeFindKey) with a branch-free path for INT-8/16/32 keys.
+ *  Insertion and deletion are iterative: the visited nodes are kept in a
+ *  path and every modified node is written once at the end (children first).
+ *  The root node keeps its position (root split/collapse copy the data).
+ *  Fixed deletion of keys in internal nodes (the predecessor/successor is
+ *  now taken from the leaf instead of the child node).
+ *  Added mdbBtreeBulkLoad (bottom-up construction from sorted records).
+ *  A bulk load failing on unsorted records releases the leaves it has
+ *  written or reserved.
+ *  Added the B+-tree variant (mdbBtreeCreatePlus): the records are stored
+ *  in linked leaves, the internal nodes hold keys (own order).
+ *  The blocks of deleted nodes are reused for new nodes (mdbspace.c).
+ *  Node positions are block numbers (64-bit file offsets).
+ *  Node buffers are page aligned, the optimal order is calculated for
+ *  page multiples and the nodes can be read/written with direct I/O.
+ *  The keys are compared in their order-preserving encoding: all INT-8/16/32
+ *  and FLOAT keys use the branch-free search, STRING keys memcmp.
+ *  Added the packed B+-tree internal nodes (mdbBtreePackKeys): the STRING
+ *  keys are prefix compressed on the pages, the separators copied from the
+ *  leaves are truncated to their shortest distinguishing prefix and the
+ *  nodes are split, merged and re-balanced by the size of their pages.
+ *  Added the slotted B+-tree leaves (mdbBtreeSlotRecords): the variable-
+ *  length fields of the records are stored with their actual length, the
+ *  leaves are split, merged and re-balanced by the size of their pages.
+ *  The nodes of compressed B-trees (mdbBtreeCompressNodes) are compressed
+ *  by mdbStoreNode and decompressed by mdbLoadNode (mdbcompress.c).
+ *  The nodes of a database with a write-ahead log are read from and written
+ *  to the log (mdbwal.c).
+ *  mdbWriteNode marks the cached nodes dirty (written back by checkpoints,
+ *  mdbStoreNodes writes the pages of adjacent nodes at once).
+ *  The nodes are read and written with positioned I/O (mdbfile.c).
+ *  mdbStoreNodes writes its batches with asynchronous I/O (mdbaio.c).
+ *  Added mdbBtreeSearchKeys (the nodes of each level are read in one batch,
+ *  mdbBtreePrefetch).
+ *  mdbBtreeTraverse reads the next children of a node ahead once a scan
+ *  moved on to its second child (read-ahead window of the B-tree), the
+ *  B+-tree leaves are reached through their parents instead of the links.
+ *  Latch coupling: the searches and traversals latch the nodes shared,
+ *  each node until its child is latched (a running traversal keeps its
+ *  path latched). An insertion (deletion) latches only the leaf
+ *  exclusively, unless the leaf is full (would become underfull): then the
+ *  nodes of the path are latched exclusively, a node is released when it
+ *  was passed without being changed. The uncached root of a new B-tree is
+ *  latched by the B-tree structure.
+ *  The latches prefer writers, the shared latches of a thread are counted
+ *  (mdbLatchInit, MDB_LATCH_HELD). The nodes of a mapped file are latched
+ *  by their blocks (mdbMmapLatch).
+ *  Optimistic reads: every exclusive latch changes the version of the node,
+ *  mdbBtreeSearch reads the nodes without latching them and starts over
+ *  if a node changed (it latches the nodes after MDB_BTREE_RESTARTS
+ *  attempts). The cached nodes are read in place: no node is copied,
+ *  allocated or pinned by an optimistic search (mdbBufferFind), only the
+ *  record found is copied. The cached copies of reused blocks are dropped
+ *  when a new node is written there.
+ *  Insertions and deletions are the writes of the database versions: an
+ *  exclusive latch keeps the image of the node for the open snapshots
+ *  (mdbversion.c), added mdbBtreeSearchSnapshot.
+ *  Copy-on-write B-trees (mdbshadow.c): the insertions and deletions keep
+ *  the whole path latched and write it to new pages, the new root is
+ *  published before the root is unlatched. mdbBtreeSearch reads the root
+ *  published last, holding a reader slot (mdbShadowEnter).
+ *  Added mdbBtreeTraversePrev and mdbBtreeTraverseLast (backward
+ *  traversal, the read-ahead follows the children on the left).
  */
 
 #include "mdb.h"
 #include "mdbbtree_util.h"
 
+#include <fcntl.h>
+#include <stdlib.h>
+
+/* Allocates a node buffer (page sized buffers are page aligned) */
+char* mdbBtreeAllocateBuffer(const uint32 size)
+{
+  char *data = NULL;
+
+  if (size % MDB_PAGE_SIZE != 0 ||
+      posix_memalign((void**)&data, MDB_PAGE_SIZE, size) != 0)
+  {
+    data = (char*) malloc(size);
+  }
+  return data;
+}
+
+/* Reads the data of a node from the B-tree file (uncached) */
+void mdbLoadNode(mdbBtreeNode* node)
+{
+  if (BT_COMPRESSED(node->T))
+  {
+    /* the page is decompressed into the node buffer */
+    mdbLoadCompressedNode(node);
+  }
+  else if (node->T->wal != NULL)
+  {
+    mdbWalRead(node->T->wal, MDB_OFFSET(node->position), node->data,
+        node->T->nodeSize);
+  }
+  else
+  {
+    /* direct I/O: page aligned buffer, offset and size */
+    mdbFileRead(MDB_NODE_FD(node->T), MDB_OFFSET(node->position),
+        node->data, node->T->nodeSize);
+  }
+  mdbPrepareNode(node);
+}
+
+void mdbPrepareNode(mdbBtreeNode* node)
+{
+  char *page;
+
+  mdbLayoutNode(node);
+
+  /* the keys of packed internal nodes (records of slotted leaves) are
+   * expanded in the node buffer */
+  if (BT_PACKED_PAGE(node))
+  {
+    page = (char*) malloc(node->T->nodeSize);
+    memcpy(page, node->data, node->T->nodeSize);
+    mdbBtreeUnpackNode(node, page);
+    free(page);
+  }
+}
+
+/* Writes pages at the given position of the B-tree file */
+static void mdbWritePages(mdbBtree* tree, const uint32 position,
+    const char* data, const uint32 size)
+{
+  if (tree->wal != NULL)
+  {
+    mdbWalWrite(tree->wal, MDB_OFFSET(position), data, size);
+  }
+  else
+  {
+    mdbFileWrite(MDB_NODE_FD(tree), MDB_OFFSET(position), data, size);
+  }
+}
+
+/* Writes the data of a node to the B-tree file (uncached) */
+uint32 mdbStoreNode(mdbBtreeNode* node)
+{
+  char *data = node->data;
+  const uint32 position = node->position;
+
+  /* packed internal nodes and slotted leaves are packed into a page first */
+  if (BT_PACKED_PAGE(node))
+  {
+    data = mdbBtreeAllocateBuffer(node->T->nodeSize);
+    mdbBtreePackNode(node, data);
+  }
+
+  /* the pages of compressed B-trees are stored in a head block and a tail
+   * (new nodes get their position there) */
+  if (BT_COMPRESSED(node->T))
+  {
+    mdbStoreCompressedNode(node, data);
+  }
+  else
+  {
+    /* new nodes are appended at the first block after the end of file (the
+     * free space stays locked until the node is written, so the next new
+     * node is appended after it) */
+    if (node->position == 0)
+    {
+      mdbSpaceLock(node->T);
+      if ((node->position = mdbAllocateBlock(node->T)) == 0)
+      {
+        node->position = mdbSpaceEnd(node->T);
+      }
+      mdbWritePages(node->T, node->position, data, node->T->nodeSize);
+      mdbSpaceUnlock(node->T);
+    }
+    else
+    {
+      mdbWritePages(node->T, node->position, data, node->T->nodeSize);
+    }
+  }
+
+  if (data != node->data)
+  {
+    free(data);
+  }
+
+  /* an optimistic reader following a stale child position may have cached
+   * the old contents of a reused block (see mdbBtreeSearchOptimistic) */
+  if (position == 0 && node->T->pool != NULL)
+  {
+    mdbBufferInvalidate(node->T->pool, node->position);
+  }
+  return node->position;
+}
+
+/* Writes the batches of adjacent pages (asynchronous I/O if the B-tree
+ * file is not logged) */
+static void mdbWriteBatches(mdbAioRequest* batches, const uint32 count)
+{
+  mdbBtree *tree;
+  uint32 i;
+
+  if (count == 0)
+  {
+    return;
+  }
+
+  tree = (mdbBtree*)batches[0].cls;
+  if (tree->aio != NULL && tree->wal == NULL)
+  {
+    mdbAioSubmit(tree->aio, batches, count, NULL, NULL);
+    return;
+  }
+
+  for (i = 0; i < count; i++)
+  {
+    tree = (mdbBtree*)batches[i].cls;
+    mdbWritePages(tree, MDB_BLOCK(batches[i].offset), batches[i].data,
+        batches[i].size);
+  }
+}
+
+void mdbStoreNodes(mdbBtreeNode** nodes, const uint32 count)
+{
+  mdbAioRequest *batches;
+  mdbAioRequest *batch = NULL;
+  mdbBtreeNode *node;
+  char *pages;
+  uint64 size = 0;
+  uint32 used = 0;
+  uint32 batch_count = 0;
+  uint32 i;
+
+  /* the pages of all batches are written at once */
+  for (i = 0; i < count; i++)
+  {
+    size += nodes[i]->T->nodeSize;
+  }
+  pages = mdbBtreeAllocateBuffer(MDB_PAGE_ALIGN(size));
+  batches = (mdbAioRequest*) malloc(count * sizeof(mdbAioRequest));
+
+  for (i = 0; i < count; i++)
+  {
+    node = nodes[i];
+
+    /* compressed pages have no fixed size, they are written one by one */
+    if (BT_COMPRESSED(node->T) || node->T->nodeSize > MDB_BUFFER_BATCH_SIZE)
+    {
+      mdbStoreNode(node);
+      continue;
+    }
+
+    /* a batch ends before a gap (or when it is full) */
+    if (batch == NULL ||
+        batch->offset + batch->size != MDB_OFFSET(node->position) ||
+        batch->size + node->T->nodeSize > MDB_BUFFER_BATCH_SIZE ||
+        batch->fd != MDB_NODE_FD(node->T))
+    {
+      batch = &batches[batch_count++];
+      batch->fd = MDB_NODE_FD(node->T);
+      batch->offset = MDB_OFFSET(node->position);
+      batch->data = pages + used;
+      batch->size = 0;
+      batch->write = 1;
+      batch->cls = node->T;
+    }
+
+    if (BT_PACKED_PAGE(node))
+    {
+      mdbBtreePackNode(node, pages + used);
+    }
+    else
+    {
+      memcpy(pages + used, node->data, node->T->nodeSize);
+    }
+    used += node->T->nodeSize;
+    batch->size += node->T->nodeSize;
+  }
+
+  mdbWriteBatches(batches, batch_count);
+  free(batches);
+  free(pages);
+}
+
 mdbBtreeNode* mdbReadNode(const uint32 position, mdbBtree* tree)
 {
   mdbBtreeNode *node;
-  int ret;
+
+  if (tree->pool != NULL)
+  {
+    return mdbBufferPin(tree->pool, position, tree);
+  }
+
   mdbAllocateNode(&node, tree);
   node->position = position;
-  fseek(tree->file, position, SEEK_SET);
-  ret = fread(node->data, tree->nodeSize, 1, tree->file);
+  mdbLoadNode(node);
   return node;
 }
 
 uint32 mdbWriteNode(mdbBtreeNode* node)
 {
-  if (node->position > 0)
+  /* existing nodes are written back by the next checkpoint */
+  if (node->T->pool != NULL && node->position != 0 &&
+      mdbBufferMarkDirty(node->T->pool, node))
   {
-    fseek(node->T->file, node->position, SEEK_SET);
+    return node->position;
   }
-  else
-  {
-    fseek(node->T->file, 0, SEEK_END);
-    node->position = ftell(node->T->file);
-  }
-  fwrite(node->data, node->T->nodeSize, 1, node->T->file);
-  return node->position;
+  return mdbStoreNode(node);
 }
 
 void mdbDeleteNode(mdbBtreeNode* node)
 {
+  if (node->T->pool != NULL)
+  {
+    mdbBufferInvalidate(node->T->pool, node->position);
+  }
 
+  if (BT_COMPRESSED(node->T))
+  {
+    mdbReleaseCompressedNode(node);
+  }
+  else
+  {
+    mdbReleaseBlock(node->T, node->position);
+  }
 }
 
 /*
@@ -99,59 +392,329 @@ void mdbDeleteNode(mdbBtreeNode* node)
  * The node size (in bytes) can be determined as following:
  *  NODE_SIZE = (2 * T) * (RECORD_SIZE + 4) - RECORD_SIZE + 4
  *
+ * The internal nodes of a B+-tree have the same size, but hold keys instead
+ * of records (with the order T calculated for the key size).
+ *
+ * The nodes of a database B-tree occupy whole pages (the node size is
+ * rounded up by mdbInitializeBtree), the node data is page aligned.
+ *
+ * The internal nodes of a packed B+-tree (the leaves of a slotted B+-tree)
+ * hold more keys (records) in memory than their pages, see mdbBtreePackNode,
+ * so the buffers of all nodes of such a B-tree have the size of the larger
+ * unpacked node.
  */
 mdbError mdbAllocateNode(mdbBtreeNode** node, mdbBtree *tree)
 {
+  /* page sized nodes get page aligned buffers (direct I/O) */
+  char *data = mdbBtreeAllocateBuffer(tree->bufferSize);
   *node = (mdbBtreeNode*) malloc(sizeof(mdbBtreeNode));
 
-  /* Allocates the memory */
-  (*node)->data = (char*) malloc(tree->nodeSize);
-  memset((*node)->data, 0, tree->nodeSize);
+  /* Allocates the memory and initializes the data pointers (an empty node
+   * has the layout of an internal node until it is made a leaf) */
+  memset(data, 0, tree->bufferSize);
+  mdbInitializeNode(*node, tree, data);
 
-  /* Initializes the data pointers */
-  (*node)->record_count = (uint32*)(*node)->data;
-  (*node)->is_leaf = (*node)->record_count + 1;
-  (*node)->children = (uint32*)((*node)->is_leaf + 1);
-  (*node)->records = (char*)((*node)->children + (tree->meta.order << 1));
-  (*node)->T = tree;
   (*node)->position = 0L;
-
+  (*node)->frame = NULL;
+  (*node)->mapped = 0;
+  (*node)->tail = 0L;
+  (*node)->tail_size = 0L;
+  (*node)->tail_owner = 0L;
 
   return MDB_NO_ERROR;
 }
 
+/* Sets up the data pointers of a node for the given raw node data */
+void mdbInitializeNode(mdbBtreeNode* node, mdbBtree *tree, char *data)
+{
+  node->data = data;
+  node->record_count = (uint32*)node->data;
+  node->is_leaf = node->record_count + 1;
+  node->children = (uint32*)(node->is_leaf + 1);
+  node->T = tree;
+  mdbLayoutNode(node);
+}
+
+/* Sets up the layout of a node after its leaf/internal information changed */
+void mdbLayoutNode(mdbBtreeNode* node)
+{
+  const mdbBtree *tree = node->T;
+
+  if (BT_PLUS(tree) && BT_INTERNAL(node))
+  {
+    node->order = tree->meta.inner_order;
+    node->entry_size = tree->meta.key_size;
+    node->key_offset = 0;
+  }
+  else
+  {
+    node->order = BT_SLOTTED(tree) ? tree->meta.leaf_order : tree->meta.order;
+    node->entry_size = tree->meta.record_size;
+    node->key_offset = tree->meta.key_position;
+  }
+  node->records = (char*)(node->children + (node->order << 1));
+}
+
 /* Frees up the memory used by a B-tree node (with eventual save) */
 mdbError mdbFreeNode(mdbBtreeNode* node, uint8 save)
 {
-  if (save > 0)
+  /* the nodes of a copy-on-write B-tree are saved by its writes */
+  if (save > 0 && !BT_SHADOW(node->T))
+  {
+    node->position = node->T->WriteNode(node);
+  }
+
+  /* cached nodes are only unpinned, the buffer pool owns them */
+  if (node->frame != NULL)
+  {
+    mdbBufferUnpin(node->T->pool, node);
+    return MDB_NO_ERROR;
+  }
+
+  /* the data of mapped nodes belongs to the mapped file */
+  if (!node->mapped)
   {
-    node->position = mdbWriteNode(node);
+    free (node->data);
   }
-  free (node->data);
   free (node);
 
   return MDB_NO_ERROR;
 }
 
-/* B-tree key comparison based on the data type of the key */
-int mdbBtreeCmp(const char* k1, const char* k2, const mdbBtree *tree)
+/*
+ * The latches prefer writers: a writer waiting for a node is not overtaken
+ * by the readers coming after it. A thread may latch a node shared again
+ * (e.g. a search during its own traversal), so the shared latches held by
+ * a thread are counted in its table and only the first one waits.
+ */
+static __thread mdbLatch* mdbLatchesHeld[MDB_LATCH_HELD];
+static __thread uint32 mdbLatchCounts[MDB_LATCH_HELD];
+static __thread uint32 mdbLatchesCount = 0;
+
+void mdbLatchInit(mdbLatch* latch)
+{
+  pthread_rwlockattr_t attr;
+
+  pthread_rwlockattr_init(&attr);
+#ifdef __GLIBC__
+  pthread_rwlockattr_setkind_np(&attr,
+      PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+#endif
+  pthread_rwlock_init(&latch->lock, &attr);
+  pthread_rwlockattr_destroy(&attr);
+  latch->version = 0;
+}
+
+void mdbLatchDestroy(mdbLatch* latch)
+{
+  pthread_rwlock_destroy(&latch->lock);
+}
+
+/* Returns the index of a latch in the table of the thread (the count of
+ * the table if the thread does not hold it shared) */
+static uint32 mdbLatchHeld(const mdbLatch* latch)
+{
+  uint32 i;
+
+  for (i = 0; i < mdbLatchesCount; i++)
+  {
+    if (mdbLatchesHeld[i] == latch)
+    {
+      break;
+    }
+  }
+  return i;
+}
+
+/*
+ * Latches a node. The latch belongs to the buffer pool frame of the node,
+ * so every thread using the cached node gets the same latch (the node stays
+ * in its frame while it is pinned). The nodes of a mapped file are latched
+ * by the latch of their block. A root node which is not cached (e.g. the
+ * root of a new B-tree) is latched by the B-tree structure. Other private
+ * copies of nodes are not shared by threads, they are not latched.
+ */
+static mdbLatch* mdbNodeLatch(const mdbBtreeNode* node)
+{
+  if (node->frame != NULL)
+  {
+    return &node->frame->latch;
+  }
+  if (node == node->T->root && !node->mapped)
+  {
+    return &node->T->latch;
+  }
+  if (node->T->map != NULL && node->position != 0 && !BT_SHADOW(node->T))
+  {
+    return mdbMmapLatch(node->T->map, node->position);
+  }
+  return NULL;
+}
+
+/*
+ * A private copy of a mapped page (packed or compressed node) may have been
+ * read before a writer changed the page, it is read again once latched
+ */
+static void mdbReloadNode(mdbBtreeNode* node)
+{
+  mdbBtree* tree = node->T;
+  mdbBtreeNode* page;
+
+  if (tree->map == NULL || node->mapped || node->frame != NULL ||
+      node == tree->root)
+  {
+    return;
+  }
+
+  page = tree->ReadNode(node->position, tree);
+  memcpy(node->data, page->data,
+      page->mapped ? tree->nodeSize : tree->bufferSize);
+  node->tail = page->tail;
+  node->tail_size = page->tail_size;
+  node->tail_owner = page->tail_owner;
+  mdbLayoutNode(node);
+  mdbFreeNode(page, 0);
+}
+
+void mdbLatchNode(mdbBtreeNode* node, const uint8 mode)
+{
+  mdbLatch* latch = mdbNodeLatch(node);
+  uint32 i;
+
+  if (latch == NULL)
+  {
+    return;
+  }
+
+  if (mode == MDB_LATCH_EXCLUSIVE)
+  {
+    pthread_rwlock_wrlock(&latch->lock);
+    /* odd version: the node is being changed (before any change is seen) */
+    __atomic_add_fetch(&latch->version, 1, __ATOMIC_SEQ_CST);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    mdbReloadNode(node);
+    mdbVersionSave(node);
+  }
+  else if (mode == MDB_LATCH_LOAD)
+  {
+    pthread_rwlock_wrlock(&latch->lock);
+    __atomic_add_fetch(&latch->version, 1, __ATOMIC_SEQ_CST);
+  }
+  else
+  {
+    /* a latch the thread holds shared is only counted */
+    if ((i = mdbLatchHeld(latch)) < mdbLatchesCount)
+    {
+      mdbLatchCounts[i]++;
+      return;
+    }
+    pthread_rwlock_rdlock(&latch->lock);
+    if (mdbLatchesCount < MDB_LATCH_HELD)
+    {
+      mdbLatchesHeld[mdbLatchesCount] = latch;
+      mdbLatchCounts[mdbLatchesCount++] = 1;
+    }
+    mdbReloadNode(node);
+  }
+}
+
+void mdbUnlatchNode(mdbBtreeNode* node)
+{
+  mdbLatch* latch = mdbNodeLatch(node);
+  uint32 i;
+
+  if (latch == NULL)
+  {
+    return;
+  }
+
+  /* only the exclusive holder sees an odd version */
+  if (__atomic_load_n(&latch->version, __ATOMIC_RELAXED) & 1)
+  {
+    __atomic_add_fetch(&latch->version, 1, __ATOMIC_RELEASE);
+  }
+  else if ((i = mdbLatchHeld(latch)) < mdbLatchesCount)
+  {
+    if (--mdbLatchCounts[i] > 0)
+    {
+      return;
+    }
+    mdbLatchesHeld[i] = mdbLatchesHeld[--mdbLatchesCount];
+    mdbLatchCounts[i] = mdbLatchCounts[mdbLatchesCount];
+  }
+  pthread_rwlock_unlock(&latch->lock);
+}
+
+/*
+ * Optimistic reads: a reader takes the version of a node, copies the node
+ * and uses the copy only if the version did not change meanwhile (the node
+ * was not latched exclusively), the node itself is not written. A node
+ * which is latched exclusively is waited for.
+ */
+static uint32 mdbLatchVersion(mdbLatch* latch)
+{
+  uint32 version;
+
+  while ((version = __atomic_load_n(&latch->version, __ATOMIC_ACQUIRE)) & 1)
+  {
+    pthread_rwlock_rdlock(&latch->lock);
+    pthread_rwlock_unlock(&latch->lock);
+  }
+  return version;
+}
+
+uint32 mdbNodeVersion(const mdbBtreeNode* node)
 {
-  uint32 size1, size2;
-  if (tree->key_type->header > 0)
+  mdbLatch* latch = mdbNodeLatch(node);
+
+  return (latch != NULL) ? mdbLatchVersion(latch) : 0;
+}
+
+int mdbValidateNode(const mdbBtreeNode* node, const uint32 version)
+{
+  mdbLatch* latch = mdbNodeLatch(node);
+
+  if (latch == NULL)
+  {
+    return 1;
+  }
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  return __atomic_load_n(&latch->version, __ATOMIC_RELAXED) == version;
+}
+
+mdbBtreeNode* mdbCopyNode(mdbBtreeNode* copy, mdbBtreeNode* node,
+    const uint32 version)
+{
+  /* the private nodes are not changed by other threads */
+  if (mdbNodeLatch(node) == NULL)
+  {
+    return node;
+  }
+
+  /* the data of a mapped node is only its page */
+  memcpy(copy->data, node->data,
+      node->mapped ? node->T->nodeSize : node->T->bufferSize);
+  if (!mdbValidateNode(node, version))
   {
-    size1 = *((uint32*)k1);
-    size2 = *((uint32*)k2);
-    if (size2 < size1) size1 = size2;
-    return tree->key_type->compare(
-        k1 + tree->key_type->header, k2 + tree->key_type->header, size1);
+    return NULL;
   }
-  return tree->key_type->compare(k1, k2, tree->key_type->size);
+  copy->T = node->T;
+  copy->position = node->position;
+  mdbLayoutNode(copy);
+  return copy;
+}
+
+/* B-tree key comparison based on the data type of the key */
+int mdbBtreeCmp(const char* k1, const char* k2, const mdbBtree *tree)
+{
+  return mdbCompareValues(tree->key_type, k1, k2);
 }
 
-/* Calculates the optimal order of a B-tree for the given record size */
+/* Calculates the optimal order of a B-tree for the given record size (the
+ * node sizes tried are page multiples) */
 uint32 mdbBtreeOptimalOrder(uint32 record_size)
 {
-  const static uint32 LOWER_NS = 1<<10; /* lowest possible node size: 1 KB*/
+  const static uint32 LOWER_NS = MDB_PAGE_SIZE; /* lowest node size: 1 page*/
   const static uint32 UPPER_NS = 1<<20; /* highest possible node size:1 MB*/
   uint32 ideal_ns;                      /* ideal node size                  */
   uint32 real_ns;                       /* real node size                   */
@@ -160,7 +723,7 @@ uint32 mdbBtreeOptimalOrder(uint32 record_size)
   int cur_diff;                         /* current (ideal - real) difference*/
   int min_diff = UPPER_NS;              /* minimum (ideal - real) difference*/
 
-  for (ideal_ns = LOWER_NS; ideal_ns <= UPPER_NS; ideal_ns += 1024)
+  for (ideal_ns = LOWER_NS; ideal_ns <= UPPER_NS; ideal_ns += MDB_PAGE_SIZE)
   {
     if (ideal_ns < record_size) continue;
 
@@ -197,594 +760,2937 @@ mdbError mdbBtreeCreate(mdbBtree** tree,
   (*tree)->meta.record_size = record_size;
   (*tree)->meta.key_position = key_position;
   (*tree)->meta.root_position = 0L;
+  (*tree)->meta.flags = 0;
+  (*tree)->meta.key_size = 0;
+  (*tree)->meta.inner_order = order;
+  (*tree)->meta.leaf_order = order;
 
   /* default node functions */
   (*tree)->ReadNode = &mdbReadNode;
   (*tree)->WriteNode = &mdbWriteNode;
   (*tree)->DeleteNode = &mdbDeleteNode;
 
+  (*tree)->root = NULL;
+  (*tree)->file = NULL;
+  (*tree)->pool = NULL;
+  (*tree)->map = NULL;
+  (*tree)->header = NULL;
+  (*tree)->fd = -1;
+  (*tree)->direct = -1;
+  (*tree)->wal = NULL;
+  (*tree)->aio = NULL;
+  (*tree)->space = NULL;
+  (*tree)->versions = NULL;
+  (*tree)->descriptor = 0L;
+  (*tree)->shadow = NULL;
+  (*tree)->shadows = NULL;
+  mdbLatchInit(&(*tree)->latch);
+  (*tree)->readahead = MDB_BTREE_READAHEAD;
+  (*tree)->field_count = 0;
+
   BT_CALC_NODESIZE(*tree);
+  (*tree)->bufferSize = (*tree)->nodeSize;
 
   return MDB_NO_ERROR;
 }
 
 /*
- * Recursive B-tree search (internal, not visible to the programmer)
+ * B+-tree allocation and initialization: the internal nodes have the size
+ * of the leaves, their order is calculated for the key size.
  */
-mdbError mdbBtreeSearchRecursive(
-    const char* key,
-    char* record,
-    mdbBtreeNode* node)
+mdbError mdbBtreeCreatePlus(mdbBtree** tree,
+    uint32 order,
+    const uint32 record_size,
+    const uint32 key_position,
+    const uint32 key_size)
 {
-  mdbBtreeNode* next = NULL;
-  int result = 0;
-  uint32 i = 0;
+  mdbBtreeCreate(tree, order, record_size, key_position);
+
+  /* 2 * (T + 1) * 4 + (2 * T - 1) * KEY_SIZE <= NODE_SIZE */
+  (*tree)->meta.flags |= MDB_BTREE_PLUS;
+  (*tree)->meta.key_size = key_size;
+  (*tree)->meta.inner_order = ((*tree)->nodeSize - 2 * sizeof(uint32) +
+      key_size) / (2 * (sizeof(uint32) + key_size));
+
+  return MDB_NO_ERROR;
+}
+
+/*
+ * Packed internal nodes (B+-trees with STRING keys)
+ *
+ * The keys of an internal node have their full size in memory, but only
+ * their characters are stored on the page of the node:
+ *
+ * PART     | record count + is leaf | children  | prefix | keys            |
+ * SIZE     | 4 + 4                  | 4 * (N+1) | 2 + P  | N * (2 + L - P) |
+ *
+ * The P characters all keys of the node begin with are stored once, every
+ * key is stored as the length L - P and the characters after the prefix.
+ * The separators copied from the leaves are truncated to the shortest
+ * prefix which still separates the leaves, so the packed keys are short
+ * and a page holds many more of them than unpacked keys. The number of
+ * keys of a node is therefore limited by the size of its packed keys: a
+ * key is only added if the longest possible key still fits into the page.
+ *
+ * All keys of a subtree begin with the common prefix of the separators
+ * bounding it (in its ancestors), the size of a node is calculated with
+ * that prefix, which is never longer than the prefix stored on the page.
+ */
+
+/* Length of the common prefix of two STRING keys (0 if a key is missing) */
+static uint32 mdbBtreeCommonPrefix(const char* k1, const char* k2)
+{
+  uint32 n = 0;
+  uint32 max;
 
-  while (i < BT_COUNT(node) && (mdbBtreeCmp(key,BT_KEY(node,i),node->T) > 0))
+  if (k1 == NULL || k2 == NULL)
   {
-    i++;
+    return 0;
   }
 
-  /* key/record found? */
-  if (i < BT_COUNT(node))
+  max = (BT_KEYLEN(k1) < BT_KEYLEN(k2)) ? BT_KEYLEN(k1) : BT_KEYLEN(k2);
+  k1 += sizeof(uint32);
+  k2 += sizeof(uint32);
+
+  while (n < max && k1[n] == k2[n])
   {
-    if (mdbBtreeCmp(key,BT_KEY(node,i),node->T) == 0)
-    {
-      memcpy(record, BT_RECORD(node,i), BT_RECSIZE(node));
-      return MDB_NO_ERROR;
-    }
+    n++;
   }
+  return n;
+}
 
-  /* if node is a leaf, search for the key and return NULL if not found */
-  if (BT_LEAF(node))
+/* Size of the packed keys (without their common prefix) of a node */
+static uint32 mdbBtreeKeysSize(const mdbBtreeNode* node, const uint32 prefix)
+{
+  uint32 size = 0;
+  uint32 i;
+
+  for (i = 0; i < BT_COUNT(node); i++)
   {
-    result = MDB_BTREE_KEY_NOT_FOUND;
+    size += sizeof(uint16) + BT_KEYLEN(BT_KEY(node,i)) - prefix;
   }
-  /* if node is an internal node, search for the key or recurse to subtree */
-  else
+  return size;
+}
+
+/* Size of the page of a packed internal node whose keys share a prefix */
+static uint32 mdbBtreePackedSize(const mdbBtreeNode* node, const uint32 prefix)
+{
+  return MDB_BTREE_PACKED_HEADER + (BT_COUNT(node) + 1) * sizeof(uint32) +
+      prefix + mdbBtreeKeysSize(node, prefix);
+}
+
+/* Tests whether a packed internal node still fits into its page after "keys"
+ * keys were added and its packed size changed by "bytes" */
+static int mdbBtreeFits(const mdbBtreeNode* node, const uint32 prefix,
+    const uint32 keys, const int bytes)
+{
+  return BT_COUNT(node) + keys <= (BT_ORDER(node) << 1) - 1 &&
+      (int)mdbBtreePackedSize(node, prefix) + bytes <= (int)node->T->nodeSize;
+}
+
+/* Shortens a separator (copy of the first key of a right node) to the
+ * shortest prefix which is still greater than the last key of the left one */
+static void mdbBtreeTruncateKey(char* separator, const char* last)
+{
+  *((uint32*)separator) = mdbBtreeCommonPrefix(separator, last) + 1;
+}
+
+/* Packs an internal node into a page (see above) */
+static void mdbBtreePackKeysPage(const mdbBtreeNode* node, char* page)
+{
+  const uint32 count = BT_COUNT(node);
+  const uint32 prefix = (count > 0) ?
+      mdbBtreeCommonPrefix(BT_KEY(node,0), BT_KEY(node,count - 1)) : 0;
+  char *p = page + 2 * sizeof(uint32);
+  uint16 length = (uint16)prefix;
+  uint32 i;
+
+  memcpy(page, node->data, 2 * sizeof(uint32));
+  memcpy(p, node->children, (count + 1) * sizeof(uint32));
+  p += (count + 1) * sizeof(uint32);
+
+  memcpy(p, &length, sizeof(uint16));
+  if (count > 0)
   {
-    next = node->T->ReadNode(node->children[i], node->T);
-    result = mdbBtreeSearchRecursive(key, record, next);
-    free(next->data);
-    free(next);
+    memcpy(p + sizeof(uint16), BT_KEY(node,0) + sizeof(uint32), prefix);
   }
+  p += sizeof(uint16) + prefix;
 
-  return result;
+  for (i = 0; i < count; i++)
+  {
+    length = (uint16)(BT_KEYLEN(BT_KEY(node,i)) - prefix);
+    memcpy(p, &length, sizeof(uint16));
+    memcpy(p + sizeof(uint16), BT_KEY(node,i) + sizeof(uint32) + prefix,
+        length);
+    p += sizeof(uint16) + length;
+  }
+  memset(p, 0, node->T->nodeSize - (p - page));
 }
 
-/*
- * B-tree search function
- */
-mdbError mdbBtreeSearch(const char* key, char* record, mdbBtree* t)
+/* Unpacks the page of an internal node into the node buffer */
+static void mdbBtreeUnpackKeysPage(mdbBtreeNode* node, const char* page)
 {
-  if (t->root != NULL)
+  const char *p = page + 2 * sizeof(uint32);
+  const char *prefix;
+  uint16 prefix_length;
+  uint16 length;
+  char *key;
+  uint32 i;
+
+  memcpy(node->data, page, 2 * sizeof(uint32));
+  mdbLayoutNode(node);
+  memcpy(node->children, p, (BT_COUNT(node) + 1) * sizeof(uint32));
+  p += (BT_COUNT(node) + 1) * sizeof(uint32);
+
+  memcpy(&prefix_length, p, sizeof(uint16));
+  prefix = p + sizeof(uint16);
+  p = prefix + prefix_length;
+
+  for (i = 0; i < BT_COUNT(node); i++)
   {
-    return mdbBtreeSearchRecursive(key, record, t->root);
+    memcpy(&length, p, sizeof(uint16));
+    key = BT_KEY(node,i);
+    *((uint32*)key) = prefix_length + length;
+    memcpy(key + sizeof(uint32), prefix, prefix_length);
+    memcpy(key + sizeof(uint32) + prefix_length, p + sizeof(uint16), length);
+    p += sizeof(uint16) + length;
   }
-  else
+}
+
+/* Calculates the size of the node buffers of a B-tree (the unpacked
+ * internal nodes of a packed B+-tree and the unpacked leaves of a slotted
+ * B+-tree are larger than their pages) */
+void mdbBtreeBufferSize(mdbBtree* tree)
+{
+  const uint32 inner = 2 * (tree->meta.inner_order + 1) * sizeof(uint32) +
+      (2 * tree->meta.inner_order - 1) * tree->meta.key_size;
+  const uint32 leaf = 2 * (tree->meta.leaf_order + 1) * sizeof(uint32) +
+      (2 * tree->meta.leaf_order - 1) * tree->meta.record_size;
+
+  tree->bufferSize = tree->nodeSize;
+  if (BT_PACKED(tree) && inner > tree->bufferSize)
   {
-    return MDB_BTREE_NO_ROOT;
+    tree->bufferSize = MDB_PAGE_ALIGN(inner);
+  }
+  if (BT_SLOTTED(tree) && leaf > tree->bufferSize)
+  {
+    tree->bufferSize = MDB_PAGE_ALIGN(leaf);
   }
 }
 
 /*
- * Internal function for splitting a full node
+ * Packs the STRING keys of the internal nodes of an empty B+-tree (called
+ * after the node size is known). The internal nodes hold up to
+ * MDB_BTREE_PACKED_EXPANSION times more keys than unpacked ones. A B+-tree
+ * whose longest packed key needs more than a quarter of a page stays
+ * unpacked (a split must always leave room for another key).
  */
-void mdbBtreeSplitNode(mdbBtreeNode* left, mdbBtreeNode* parent,
-    const uint32 position)
+mdbError mdbBtreePackKeys(mdbBtree* tree)
 {
-  mdbBtreeNode* right = NULL;
-  mdbAllocateNode(&right, left->T);
-
-  /* copy the second half parts of the records and child pointers from the
-   * left child node to the new right child node
-   */
-
-  BT_COPYRECORDS(right, 0, left, BT_ORDER(left), BT_ORDER(left) - 1);
-  BT_COPYCHILDREN(right, 0, left, BT_ORDER(left), BT_ORDER(left));
-
-  *right->is_leaf = *left->is_leaf;
-  right->position = 0L;
-  BT_COUNT(right) = BT_ORDER(left) - 1;
-
-  /* update the left child node */
-  BT_COUNT(left) = BT_COUNT(right);
+  const uint32 entry = sizeof(uint32) + sizeof(uint16) + tree->meta.key_size;
+  uint32 order;
+  uint32 max;
 
-  /* move the median record to the parent node, make space for it if needed */
-  if (position < BT_COUNT(parent))
+  if (!BT_PLUS(tree) || tree->meta.key_size > 0xFFFF ||
+      4 * (MDB_BTREE_PACKED_HEADER + entry) > tree->nodeSize)
   {
-    BT_MOVERECORDS(parent, position + 1, position, BT_COUNT(parent) - position);
-    BT_MOVECHILDREN(parent, position + 2, position + 1,
-        BT_COUNT(parent) - position);
+    return MDB_NO_ERROR;
   }
 
-  memcpy(BT_RECORD(parent, position), BT_RECORD(left,BT_ORDER(left) - 1),
-      BT_RECSIZE(parent));
+  /* unpacked keys fitting into a page, the shortest packed key has one
+   * character */
+  order = (tree->nodeSize - 2 * sizeof(uint32) + tree->meta.key_size) /
+      (2 * (sizeof(uint32) + tree->meta.key_size));
+  order *= MDB_BTREE_PACKED_EXPANSION;
+  max = (tree->nodeSize - MDB_BTREE_PACKED_HEADER) /
+      (2 * (sizeof(uint32) + sizeof(uint16) + 1));
 
-  BT_COUNT(parent) = BT_COUNT(parent) + 1;
+  tree->meta.flags |= MDB_BTREE_PACKED;
+  tree->meta.inner_order = (order < max) ? order : max;
+  mdbBtreeBufferSize(tree);
 
-  /* save all changes */
-  parent->children[position] = parent->T->WriteNode(left);
-  parent->children[position + 1] = parent->T->WriteNode(right);
-  parent->position = parent->T->WriteNode(parent);
-  free(right->data);
-  free(right);
+  return MDB_NO_ERROR;
 }
 
 /*
- * Recursive B-tree insertion (internal, not visible to the programmer)
+ * Slotted leaves (B+-trees with variable-length fields)
+ *
+ * The records of a leaf have their full size in memory, but the variable-
+ * length fields of a record (length header and value, e.g. a STRING
+ * column) are stored on the page of the leaf with their actual length:
+ *
+ * PART     | record count + is leaf + next | slots | free space | records |
+ * SIZE     | 4 + 4 + 4                     | 4 * N |            | packed  |
+ *
+ * The slot of a record holds the offset of the packed record in the page,
+ * the records are stored from the end of the page towards the slots. The
+ * number of records of a leaf is therefore limited by their packed size: a
+ * record is only added if a record with full-length fields still fits into
+ * the page.
  */
-mdbError mdbBtreeInsertRecursive(const char* record, mdbBtreeNode* node)
+
+/* Size of a variable-length field of a record (header and actual value) */
+static uint32 mdbBtreeFieldSize(const mdbBtreeField* field,
+    const char* record)
 {
-  mdbBtreeNode* next = NULL;
-  uint32 i = 0;
-  int result = 0;
+  const uint32 max = (field->size - field->header) / field->width;
+  uint32 length;
+
+  memcpy(&length, record + field->offset, sizeof(uint32));
+  return field->header + ((length < max) ? length : max) * field->width;
+}
+
+/* Size of a record on the page of a slotted leaf */
+static uint32 mdbBtreeRecordSize(const mdbBtree* tree, const char* record)
+{
+  uint32 size = tree->meta.record_size;
+  uint32 f;
 
-  while (i < BT_COUNT(node) &&
-      (mdbBtreeCmp(record + BT_KEYPOS(node),BT_KEY(node,i),node->T) > 0))
+  for (f = 0; f < tree->field_count; f++)
   {
-    i++;
+    size -= tree->fields[f].size - mdbBtreeFieldSize(&tree->fields[f], record);
   }
+  return size;
+}
+
+/* Size of the page of a slotted leaf */
+static uint32 mdbBtreeSlottedSize(const mdbBtreeNode* node)
+{
+  uint32 size = MDB_BTREE_SLOTTED_HEADER;
+  uint32 i;
 
-  /* key already exists? */
-  if (i < BT_COUNT(node))
+  for (i = 0; i < BT_COUNT(node); i++)
   {
-    if (mdbBtreeCmp(record + BT_KEYPOS(node),BT_KEY(node,i),node->T) == 0)
-    {
-      return MDB_BTREE_KEY_COLLISION;
-    }
+    size += sizeof(uint32) + mdbBtreeRecordSize(node->T, BT_RECORD(node,i));
   }
+  return size;
+}
 
-  /* if the current node is a leaf, insert the record into it */
-  if (BT_LEAF(node))
+/* Packs a record (the variable-length fields with their actual length) */
+static void mdbBtreePackRecord(const mdbBtree* tree, const char* record,
+    char* p)
+{
+  const mdbBtreeField* field;
+  uint32 position = 0;
+  uint32 size;
+  uint32 f;
+
+  for (f = 0; f < tree->field_count; f++)
   {
-    /* if needed, create space for the new record */
-    if (i < BT_COUNT(node))
-    {
-      BT_MOVERECORDS(node, i+1, i, BT_COUNT(node) - i);
-    }
-    memcpy(BT_RECORD(node, i), record, BT_RECSIZE(node));
-    BT_COUNT(node) = BT_COUNT(node) + 1;
-    node->position = node->T->WriteNode(node);
-    return MDB_NO_ERROR;
+    field = &tree->fields[f];
+    memcpy(p, record + position, field->offset - position);
+    p += field->offset - position;
+
+    size = mdbBtreeFieldSize(field, record);
+    memcpy(p, record + field->offset, size);
+    p += size;
+    position = field->offset + field->size;
   }
+  memcpy(p, record + position, tree->meta.record_size - position);
+}
 
-  /* if node is an internal node recurse to the subtree */
-  else
+/* Unpacks a record (the rest of the variable-length fields is cleared) */
+static void mdbBtreeUnpackRecord(const mdbBtree* tree, const char* p,
+    char* record)
+{
+  const mdbBtreeField* field;
+  uint32 position = 0;
+  uint32 size;
+  uint32 f;
+
+  for (f = 0; f < tree->field_count; f++)
   {
-    next = node->T->ReadNode(node->children[i], node->T);
+    field = &tree->fields[f];
+    memcpy(record + position, p, field->offset - position);
+    p += field->offset - position;
+
+    memcpy(record + field->offset, p, field->header);
+    size = mdbBtreeFieldSize(field, record);
+    memcpy(record + field->offset + field->header, p + field->header,
+        size - field->header);
+    memset(record + field->offset + size, 0, field->size - size);
+    p += size;
+    position = field->offset + field->size;
+  }
+  memcpy(record + position, p, tree->meta.record_size - position);
+}
 
-    /* child node is full, split it */
-    if (BT_COUNT(next) == (BT_ORDER(node) << 1) - 1)
-    {
-      mdbBtreeSplitNode(next, node, i);
+/* Packs a slotted leaf into a page (see above) */
+static void mdbBtreePackRecordsPage(const mdbBtreeNode* node, char* page)
+{
+  char *slots = page + MDB_BTREE_SLOTTED_HEADER;
+  char *p = page + node->T->nodeSize;
+  uint32 offset;
+  uint32 i;
 
-      /* the current key changed and the current subtree maybe smaller than
-       * then the record's key, so determine the direction of the recursion
-       * (left or right) */
-      if (mdbBtreeCmp(record + BT_KEYPOS(node),BT_KEY(node,i),node->T) > 0)
-      {
-        free(next->data);
-        free(next);
-        next = node->T->ReadNode(node->children[i + 1], node->T);
-      }
-      else if (mdbBtreeCmp(record+BT_KEYPOS(node),BT_KEY(node,i),node->T) == 0)
-      {
-        free(next->data);
-        free(next);
-        return MDB_BTREE_KEY_COLLISION;
-      }
-    }
+  memcpy(page, node->data, 2 * sizeof(uint32));
+  memcpy(page + 2 * sizeof(uint32), &BT_NEXT(node), sizeof(uint32));
 
-    result = mdbBtreeInsertRecursive(record, next);
-    free(next->data);
-    free(next);
-    return result;
+  for (i = 0; i < BT_COUNT(node); i++)
+  {
+    p -= mdbBtreeRecordSize(node->T, BT_RECORD(node,i));
+    mdbBtreePackRecord(node->T, BT_RECORD(node,i), p);
+
+    offset = (uint32)(p - page);
+    memcpy(slots + i * sizeof(uint32), &offset, sizeof(uint32));
   }
+  slots += BT_COUNT(node) * sizeof(uint32);
+  memset(slots, 0, p - slots);
 }
 
-/*
- * B-tree insertion function
- */
-mdbError mdbBtreeInsert(const char* record, mdbBtree* t)
+/* Unpacks the page of a slotted leaf into the node buffer */
+static void mdbBtreeUnpackRecordsPage(mdbBtreeNode* node, const char* page)
 {
-  mdbBtreeNode* newRoot = NULL;
+  const char *slots = page + MDB_BTREE_SLOTTED_HEADER;
+  uint32 offset;
+  uint32 i;
 
-  if (t->root != NULL)
-  {
-    /* t->root node is full, split it */
-    if (BT_COUNT(t->root) == (BT_ORDER(t->root) << 1) - 1)
-    {
-      mdbAllocateNode(&newRoot, t);
+  memcpy(node->data, page, 2 * sizeof(uint32));
+  mdbLayoutNode(node);
+  memcpy(&BT_NEXT(node), page + 2 * sizeof(uint32), sizeof(uint32));
 
-      /* the new t->root will be an internal node, while the old t->root
-       * will become a leaf node and get a right sibling
-       */
-      newRoot->position = 0L;
-      *newRoot->is_leaf = 0;
+  for (i = 0; i < BT_COUNT(node); i++)
+  {
+    memcpy(&offset, slots + i * sizeof(uint32), sizeof(uint32));
+    mdbBtreeUnpackRecord(node->T, page + offset, BT_RECORD(node,i));
+  }
+}
 
-      mdbBtreeSplitNode(t->root, newRoot, 0);
+/* Packs a packed internal node or a slotted leaf into a page */
+void mdbBtreePackNode(const mdbBtreeNode* node, char* page)
+{
+  if (BT_LEAF(node))
+  {
+    mdbBtreePackRecordsPage(node, page);
+  }
+  else
+  {
+    mdbBtreePackKeysPage(node, page);
+  }
+}
 
-      /* free up used resources */
-      free(t->root->data);
-      free(t->root);
-      t->root = newRoot;
-    }
-    return mdbBtreeInsertRecursive(record, t->root);
+/* Unpacks the page of a packed internal node or a slotted leaf */
+void mdbBtreeUnpackNode(mdbBtreeNode* node, const char* page)
+{
+  if (((const uint32*)page)[1] > 0)
+  {
+    mdbBtreeUnpackRecordsPage(node, page);
   }
   else
   {
-    return MDB_BTREE_NO_ROOT;
+    mdbBtreeUnpackKeysPage(node, page);
   }
 }
 
+/* Sets the variable-length fields of the records of a B-tree (in the order
+ * of their offsets, only the first MDB_BTREE_FIELDS fields are used) */
+void mdbBtreeSetFields(mdbBtree* tree, const mdbBtreeField* fields,
+    const uint32 count)
+{
+  tree->field_count = (count < MDB_BTREE_FIELDS) ? count : MDB_BTREE_FIELDS;
+  memcpy(tree->fields, fields, tree->field_count * sizeof(mdbBtreeField));
+}
+
 /*
- * Internal function for merging two child nodes with median from parent
+ * Stores the records of an empty B+-tree in slotted leaves (called after the
+ * node size and the variable-length fields are known). The leaves hold up to
+ * MDB_BTREE_PACKED_EXPANSION times more records than unpacked ones. A
+ * B+-tree without variable-length fields, or whose records need more than a
+ * quarter of a page, keeps the fixed-size records.
  */
-void mdbBtreeMergeNodes(mdbBtreeNode* left, mdbBtreeNode* right,
-    mdbBtreeNode* parent, const uint32 median)
+mdbError mdbBtreeSlotRecords(mdbBtree* tree)
 {
-  /* -----------------------------------------------------------------*/
-  /* update the left child node */
-  /* -----------------------------------------------------------------*/
-  /* copy the median key to the left child node */
-  BT_COPYRECORDS(left, BT_ORDER(left) - 1, parent, median, 1);
-
-  /* copy all records from the right child to the left child */
-  BT_COPYRECORDS(left, BT_ORDER(left), right, 0, BT_COUNT(right));
+  const uint32 size = tree->meta.record_size;
+  uint32 minimum = size;
+  uint32 order;
+  uint32 max;
+  uint32 f;
+
+  if (!BT_PLUS(tree) || tree->field_count == 0 ||
+      4 * (MDB_BTREE_SLOTTED_HEADER + sizeof(uint32) + size) > tree->nodeSize)
+  {
+    return MDB_NO_ERROR;
+  }
 
-  /* if needed, copy all child pointers from the right to the left child */
-  if (BT_INTERNAL(right))
+  /* unpacked records fitting into a page, the shortest packed record has
+   * empty variable-length fields */
+  for (f = 0; f < tree->field_count; f++)
   {
-    BT_COPYCHILDREN(left, BT_ORDER(left), right, 0, BT_ORDER(left));
+    minimum -= tree->fields[f].size - tree->fields[f].header;
   }
+  order = (tree->nodeSize - 2 * sizeof(uint32) + size) /
+      (2 * (sizeof(uint32) + size));
+  order *= MDB_BTREE_PACKED_EXPANSION;
+  max = (tree->nodeSize - MDB_BTREE_SLOTTED_HEADER) /
+      (2 * (sizeof(uint32) + minimum));
 
-  BT_COUNT(left) = (BT_ORDER(left) << 1) - 1;
-  /* -----------------------------------------------------------------*/
+  tree->meta.flags |= MDB_BTREE_SLOTTED;
+  tree->meta.leaf_order = (order < max) ? order : max;
+  mdbBtreeBufferSize(tree);
 
-  /* -----------------------------------------------------------------*/
-  /* update the parent node */
-  /* -----------------------------------------------------------------*/
+  return MDB_NO_ERROR;
+}
 
-  /* if there are records (and child pointers) to be shifted */
-  if ((BT_COUNT(parent) - median - 1) > 0)
-  {
-    /* shift the records after the median to left by one */
-    BT_MOVERECORDS(parent, median, median+1, BT_COUNT(parent) - median - 1);
+/* Stores the nodes of an empty B-tree compressed (mdbcompress.c), the nodes
+ * are read and written through the node cache (never accessed in place) */
+mdbError mdbBtreeCompressNodes(mdbBtree* tree)
+{
+  tree->meta.flags |= MDB_BTREE_COMPRESSED;
 
-    /* shift the child pointers after right child to left by one */
-    BT_MOVECHILDREN(parent, median+1, median+2, BT_COUNT(parent) - median - 1);
+  tree->ReadNode = &mdbReadNode;
+  tree->WriteNode = &mdbWriteNode;
+  tree->DeleteNode = &mdbDeleteNode;
+
+  return MDB_NO_ERROR;
+}
+
+/* Loads an INT-8/16/32 key as an unsigned value with memcmp ordering */
+static uint32 mdbBtreeIntKey(const char* k, const uint32 size)
+{
+  const byte* b = (const byte*)k;
+
+  switch (size)
+  {
+    case 1:  return b[0];
+    case 2:  return ((uint32)b[0] << 8) | b[1];
+    default: return ((uint32)b[0] << 24) | ((uint32)b[1] << 16) |
+                    ((uint32)b[2] << 8) | b[3];
   }
+}
 
-  BT_COUNT(parent) = BT_COUNT(parent) - 1;
-  /* -----------------------------------------------------------------*/
+unsigned long* mdbIntCompares = NULL;
+
+/*
+ * Node search for INT-8/16/32 and FLOAT keys (encoded, or compared with
+ * memcmp): a binary search on the keys loaded in place as unsigned words,
+ * without comparison calls. The halving does not branch on the result of a
+ * key comparison (conditional moves), the keys are strided in the records
+ * and are not worth gathering for vector compares.
+ */
+static uint32 mdbBtreeFindIntKey(const char* key, const mdbBtreeNode* node,
+    int* found)
+{
+  const uint32 size = node->T->key_type->size;
+  const uint32 k = mdbBtreeIntKey(key, size);
+  uint32 lo = 0;
+  uint32 n = BT_COUNT(node);
+  uint32 half;
+  uint32 compares = 0;
+
+  while (n > 1)
+  {
+    half = n >> 1;
+    lo = (mdbBtreeIntKey(BT_KEY(node,lo + half - 1), size) < k) ?
+        lo + half : lo;
+    n -= half;
+    compares++;
+  }
+  if (n == 1 && mdbBtreeIntKey(BT_KEY(node,lo), size) < k)
+  {
+    lo++;
+  }
 
-  /* save the changes */
-  parent->children[median] = parent->T->WriteNode(left);
-  parent->position = parent->T->WriteNode(parent);
-  parent->T->DeleteNode(right);
-  free(right->data);
-  free(right);
+  *found = (lo < BT_COUNT(node) && mdbBtreeIntKey(BT_KEY(node,lo), size) == k);
+  if (mdbIntCompares != NULL)
+  {
+    *mdbIntCompares += compares + n + (lo < BT_COUNT(node));
+  }
+  return lo;
 }
 
 /*
- * Internal recursive B-tree deletion function
+ * Searches a node for the given key. Returns the position of the first
+ * key which is greater than or equal to the given key (the number of keys
+ * if there is none) and sets "found" if the keys are equal.
  */
-mdbError mdbBtreeDeleteRecursive(const char* key, mdbBtreeNode* node)
+uint32 mdbBtreeFindKey(const char* key, const mdbBtreeNode* node, int* found)
 {
-  mdbBtreeNode* left = NULL;
-  mdbBtreeNode* right = NULL;
-  mdbBtreeNode* next = NULL;
-  uint32 i = 0;
-  int result = 0;
+  const mdbDatatype *type = node->T->key_type;
+  uint32 lo = 0;
+  uint32 hi = BT_COUNT(node);
+  uint32 mid;
+  uint32 length = 0;
+  int cmp;
+
+  if (type->header == 0 && (type->encoding != MDB_ENCODING_NONE ||
+      type->compare == (CompareKeysPtr)&memcmp) &&
+      (type->size == 1 || type->size == 2 || type->size == 4))
+  {
+    return mdbBtreeFindIntKey(key, node, found);
+  }
 
-  while (i < BT_COUNT(node) && (mdbBtreeCmp(key,BT_KEY(node,i),node->T) > 0))
+  /* longest key of an entry (a length torn by a concurrent change of a
+   * node read optimistically is not followed beyond the entry) */
+  if (type->header > 0)
   {
-    i++;
+    length = (BT_RECSIZE(node) - node->key_offset - type->header) / type->size;
   }
 
-  /* key found? */
-  if (i < BT_COUNT(node) && (mdbBtreeCmp(key,BT_KEY(node,i),node->T) == 0))
+  /* binary search for all other key types */
+  while (lo < hi)
   {
-    /* if current node is a leaf, simply remove the record */
-    if (BT_LEAF(node))
+    mid = lo + ((hi - lo) >> 1);
+    cmp = (type->header > 0 && BT_KEYLEN(BT_KEY(node,mid)) > length) ? 1 :
+        mdbBtreeCmp(key, BT_KEY(node,mid), node->T);
+
+    if (cmp > 0)
     {
-      /* if there are records to be shifted */
-      if ((BT_COUNT(node) - i - 1) > 0)
-      {
-        /* shift the records after the i-th record to left by one */
-        BT_MOVERECORDS(node, i, i+1, BT_COUNT(node) - i - 1);
-      }
-      BT_COUNT(node) = BT_COUNT(node) - 1;
-      node->position = node->T->WriteNode(node);
+      lo = mid + 1;
+    }
+    else if (cmp < 0)
+    {
+      hi = mid;
     }
-    /* otherwise remove the record without destroying the tree's balance */
     else
     {
-      /*
-       * If possible (left child node before the key to be deleted
-       * contains at least T keys), replace the key to be deleted by
-       * its PREDECESSOR
-       */
-      left = node->T->ReadNode(node->children[i], node->T);
-
-      if (BT_COUNT(left) >= BT_ORDER(node))
-      {
-        BT_COPYPREDECESSOR(node, i, left);
-        node->position = node->T->WriteNode(node);
+      *found = 1;
+      return mid;
+    }
+  }
 
-        result
-            = mdbBtreeDeleteRecursive(BT_KEY(left, BT_COUNT(left) - 1), left);
+  *found = 0;
+  return lo;
+}
 
-        free(left->data);
-        free(left);
+/*
+ * Recursive B-tree search (internal, not visible to the programmer), the
+ * node is latched shared by the caller and unlatched by the search (once
+ * the child the search continues in is latched)
+ */
+mdbError mdbBtreeSearchRecursive(
+    const char* key,
+    char* record,
+    mdbBtreeNode* node)
+{
+  mdbBtreeNode* next = NULL;
+  int result = 0;
+  int found;
+  uint32 i = mdbBtreeFindKey(key, node, &found);
 
-        return result;
-      }
+  /* B+-tree internal nodes only hold keys, the records with keys equal to
+   * the separator are in the right subtree */
+  if (found && BT_PLUS(node->T) && BT_INTERNAL(node))
+  {
+    found = 0;
+    i++;
+  }
 
-      /*
-       * Otherwise, if possible (right child node before the key to be
-       * deleted contains at least T keys), replace the key to be deleted
-       * by its SUCCESSOR
-       */
-      right = node->T->ReadNode(node->children[i + 1], node->T);
+  /* key/record found? */
+  if (found)
+  {
+    memcpy(record, BT_RECORD(node,i), BT_RECSIZE(node));
+    mdbUnlatchNode(node);
+    return MDB_NO_ERROR;
+  }
 
-      if (BT_COUNT(right) >= BT_ORDER(node))
-      {
-        BT_COPYSUCCESSOR(node, i, right);
-        node->position = node->T->WriteNode(node);
+  /* if node is a leaf, search for the key and return NULL if not found */
+  if (BT_LEAF(node))
+  {
+    result = MDB_BTREE_KEY_NOT_FOUND;
+    mdbUnlatchNode(node);
+  }
+  /* if node is an internal node, search for the key or recurse to subtree */
+  else
+  {
+    next = node->T->ReadNode(node->children[i], node->T);
+    mdbLatchNode(next, MDB_LATCH_SHARED);
+    mdbUnlatchNode(node);
+    result = mdbBtreeSearchRecursive(key, record, next);
+    mdbFreeNode(next, 0);
+  }
 
-        result = mdbBtreeDeleteRecursive(right->records + BT_KEYPOS(right),
-            right);
+  return result;
+}
 
-        free(right->data);
-        free(right);
-        free(left->data);
-        free(left);
+/*
+ * Sets up the view of a shared node for an optimistic read: the record
+ * count and the leaf flag are read once (a count torn by a concurrent
+ * change is bounded by the order of the node), the keys and records are
+ * read in place. The layout is the one of the reader's B-tree.
+ */
+static void mdbBtreeView(mdbBtreeNode* view, uint32* header,
+    const mdbBtreeNode* node, mdbBtree* t)
+{
+  header[0] = __atomic_load_n(node->record_count, __ATOMIC_RELAXED);
+  header[1] = __atomic_load_n(node->is_leaf, __ATOMIC_RELAXED);
+
+  view->T = t;
+  view->data = node->data;
+  view->record_count = &header[0];
+  view->is_leaf = &header[1];
+  view->children = (uint32*)(node->data + 2 * sizeof(uint32));
+  view->position = node->position;
+  mdbLayoutNode(view);
+
+  if (header[0] > 2 * view->order - 1)
+  {
+    header[0] = 2 * view->order - 1;
+  }
+}
 
-        return result;
-      }
+/*
+ * Returns the node at a position for an optimistic search with its
+ * version: a cached node is read in place without pinning it ("held" is
+ * 0), any other node is read by the B-tree and freed by the search. The
+ * version of a mapped block is taken before the block is read (a private
+ * copy of a packed node is not read in place).
+ */
+static mdbBtreeNode* mdbBtreeOptimisticNode(mdbBtree* t,
+    const uint32 position, uint32* version, uint8* held)
+{
+  mdbBtreeNode* node;
 
-      /* If both the left and right child nodes contains T - 1 keys,
-       * merge them with the key to be deleted as the median key
-       */
-      mdbBtreeMergeNodes(left, right, node, i);
+  if (t->pool != NULL &&
+      (node = mdbBufferFind(t->pool, position, version)) != NULL)
+  {
+    *held = 0;
+    return node;
+  }
 
-      result = mdbBtreeDeleteRecursive(key, left);
-      free(left->data);
-      free(left);
-      return result;
-    }
-    return MDB_NO_ERROR;
+  /* the pages of a copy-on-write B-tree have no latches (never change) */
+  if (t->map != NULL && !BT_SHADOW(t))
+  {
+    *version = mdbLatchVersion(mdbMmapLatch(t->map, position));
+    node = t->ReadNode(position, t);
   }
   else
   {
-    /* if current node is leaf, the record does not exist */
+    node = t->ReadNode(position, t);
+    *version = mdbNodeVersion(node);
+  }
+  *held = 1;
+  return node;
+}
+
+/*
+ * Optimistic B-tree search: the nodes are neither latched nor pinned nor
+ * copied, the search reads them in place (mdbBtreeView) and copies only
+ * the record it found. A child position is used once the parent was
+ * validated, the version of the child is read before the parent is
+ * validated again, so the child was still the child of the unchanged
+ * parent. Returns 0 if a node changed (the search starts over).
+ */
+static int mdbBtreeSearchOptimistic(const char* key, char* record,
+    mdbBtree* t, mdbBtreeNode* node, uint32 version, uint8 held,
+    mdbError* result)
+{
+  mdbBtreeNode view;
+  mdbBtreeNode* next;
+  uint32 header[2];
+  uint32 next_version;
+  uint32 child;
+  uint32 i;
+  uint8 next_held;
+  int found;
+  int valid;
+
+  for (;;)
+  {
+    mdbBtreeView(&view, header, node, t);
+    i = mdbBtreeFindKey(key, &view, &found);
+
+    /* see mdbBtreeSearchRecursive */
+    if (found && BT_PLUS(t) && BT_INTERNAL((&view)))
+    {
+      found = 0;
+      i++;
+    }
+
+    if (found || BT_LEAF((&view)))
+    {
+      if (found)
+      {
+        memcpy(record, BT_RECORD((&view),i), BT_RECSIZE((&view)));
+      }
+      *result = found ? MDB_NO_ERROR : MDB_BTREE_KEY_NOT_FOUND;
+      break;
+    }
+
+    child = __atomic_load_n(&view.children[i], __ATOMIC_RELAXED);
+    valid = mdbValidateNode(node, version);
+    if (valid)
+    {
+      next = mdbBtreeOptimisticNode(t, child, &next_version, &next_held);
+      valid = mdbValidateNode(node, version);
+      if (!valid && next_held)
+      {
+        mdbFreeNode(next, 0);
+      }
+    }
+    if (held)
+    {
+      mdbFreeNode(node, 0);
+    }
+    if (!valid)
+    {
+      return 0;
+    }
+    node = next;
+    version = next_version;
+    held = next_held;
+  }
+
+  valid = mdbValidateNode(node, version);
+  if (held)
+  {
+    mdbFreeNode(node, 0);
+  }
+  return valid;
+}
+
+/*
+ * B-tree search function (optimistic, a search which had to start over
+ * MDB_BTREE_RESTARTS times latches the nodes)
+ */
+mdbError mdbBtreeSearch(const char* key, char* record, mdbBtree* t)
+{
+  mdbBtreeNode* root;
+  mdbError result;
+  uint32 restarts;
+  uint32 version;
+  uint32 reader;
+  uint8 held;
+
+  if (t->root == NULL)
+  {
+    return MDB_BTREE_NO_ROOT;
+  }
+
+  /* the nodes below the published root of a copy-on-write B-tree do not
+   * change while the search holds its reader slot, a search only starts
+   * over if a node left the buffer pool */
+  if (BT_SHADOW(t))
+  {
+    reader = mdbShadowEnter(t);
+    do
+    {
+      root = mdbBtreeOptimisticNode(t, __atomic_load_n(
+          &t->meta.root_position, __ATOMIC_SEQ_CST), &version, &held);
+    }
+    while (!mdbBtreeSearchOptimistic(key, record, t, root, version, held,
+        &result));
+    mdbShadowLeave(t, reader);
+    return result;
+  }
+
+  for (restarts = 0; restarts < MDB_BTREE_RESTARTS; restarts++)
+  {
+    if (mdbBtreeSearchOptimistic(key, record, t, t->root,
+        mdbNodeVersion(t->root), 0, &result))
+    {
+      return result;
+    }
+  }
+
+  mdbLatchNode(t->root, MDB_LATCH_SHARED);
+  return mdbBtreeSearchRecursive(key, record, t->root);
+}
+
+/*
+ * A search in a snapshot reads the nodes as they were when the snapshot
+ * was opened (mdbSnapshotNode copies them), they are not validated
+ */
+mdbError mdbBtreeSearchSnapshot(const char* key, char* record, mdbBtree* t,
+    const mdbSnapshot* snapshot)
+{
+  mdbBtreeNode* buffer;
+  mdbBtreeNode* node = t->root;
+  mdbBtreeNode* copy;
+  mdbBtreeNode* next;
+  mdbError result;
+  uint32 i;
+  int found;
+
+  if (t->root == NULL)
+  {
+    return MDB_BTREE_NO_ROOT;
+  }
+
+  mdbAllocateNode(&buffer, t);
+  copy = mdbSnapshotNode(snapshot, node, buffer);
+
+  for (;;)
+  {
+    i = mdbBtreeFindKey(key, copy, &found);
+
+    /* see mdbBtreeSearchRecursive */
+    if (found && BT_PLUS(t) && BT_INTERNAL(copy))
+    {
+      found = 0;
+      i++;
+    }
+
+    if (found || BT_LEAF(copy))
+    {
+      if (found)
+      {
+        memcpy(record, BT_RECORD(copy,i), BT_RECSIZE(copy));
+      }
+      result = found ? MDB_NO_ERROR : MDB_BTREE_KEY_NOT_FOUND;
+      break;
+    }
+
+    next = t->ReadNode(copy->children[i], t);
+    if (node != t->root)
+    {
+      mdbFreeNode(node, 0);
+    }
+    node = next;
+    copy = mdbSnapshotNode(snapshot, node, buffer);
+  }
+
+  if (node != t->root)
+  {
+    mdbFreeNode(node, 0);
+  }
+  mdbFreeNode(buffer, 0);
+  return result;
+}
+
+uint32 mdbBtreePrefetch(mdbBtree* t, const uint32* positions,
+    const uint32 count)
+{
+  uint32 i;
+
+  if (count == 0)
+  {
+    return 0;
+  }
+
+  /* the nodes read through the buffer pool are read in one batch ... */
+  if (t->pool != NULL && t->aio != NULL && t->wal == NULL && !BT_COMPRESSED(t))
+  {
+    return mdbBufferPrefetch(t->pool, t, positions, count);
+  }
+
+  /* ... the pages of the other ones are read ahead into the page cache
+   * (mapped file, logged and compressed nodes) */
+  if (t->fd >= 0 && t->direct < 0)
+  {
+    for (i = 0; i < count; i++)
+    {
+      posix_fadvise(t->fd, (off_t)MDB_OFFSET(positions[i]), t->nodeSize,
+          POSIX_FADV_WILLNEED);
+    }
+  }
+  return 0;
+}
+
+/*
+ * Multi-key B-tree search: all keys descend one level at a time, the child
+ * nodes the keys continue in are read in one batch (mdbBtreePrefetch), so
+ * the reads of a level are in flight at the same time.
+ */
+mdbError mdbBtreeSearchKeys(const char* const* keys, char* const* records,
+    mdbError* results, const uint32 count, mdbBtree* t)
+{
+  mdbBtreeNode **nodes;
+  mdbBtreeNode *next;
+  uint32 *children;
+  uint32 *positions;
+  uint32 active = count;
+  uint32 pending;
+  uint32 reader = 0;
+  uint32 i;
+  int found;
+
+  if (t->root == NULL)
+  {
+    return MDB_BTREE_NO_ROOT;
+  }
+
+  /* the pages of a copy-on-write B-tree have no latches below the root,
+   * the reader slot keeps them */
+  if (BT_SHADOW(t))
+  {
+    reader = mdbShadowEnter(t);
+  }
+
+  nodes = (mdbBtreeNode**) malloc(count * sizeof(mdbBtreeNode*));
+  children = (uint32*) malloc(count * sizeof(uint32));
+  positions = (uint32*) malloc(count * sizeof(uint32));
+
+  /* every key holds its own latch of its current node */
+  for (i = 0; i < count; i++)
+  {
+    nodes[i] = t->root;
+    mdbLatchNode(t->root, MDB_LATCH_SHARED);
+  }
+
+  while (active > 0)
+  {
+    pending = 0;
+
+    /* finds the keys in their current nodes (or the child to continue in) */
+    for (i = 0; i < count; i++)
+    {
+      if (nodes[i] == NULL)
+      {
+        continue;
+      }
+      children[i] = mdbBtreeFindKey(keys[i], nodes[i], &found);
+
+      /* B+-tree internal nodes only hold keys (see mdbBtreeSearchRecursive) */
+      if (found && BT_PLUS(t) && BT_INTERNAL(nodes[i]))
+      {
+        found = 0;
+        children[i]++;
+      }
+
+      if (found || BT_LEAF(nodes[i]))
+      {
+        if (found)
+        {
+          memcpy(records[i], BT_RECORD(nodes[i],children[i]),
+              BT_RECSIZE(nodes[i]));
+        }
+        results[i] = found ? MDB_NO_ERROR : MDB_BTREE_KEY_NOT_FOUND;
+        mdbUnlatchNode(nodes[i]);
+        if (nodes[i] != t->root)
+        {
+          mdbFreeNode(nodes[i], 0);
+        }
+        nodes[i] = NULL;
+        active--;
+        continue;
+      }
+      positions[pending++] = nodes[i]->children[children[i]];
+    }
+
+    /* the children of the next level are read at once ... */
+    mdbBtreePrefetch(t, positions, pending);
+
+    /* ... and taken from the buffer pool (latch coupling) */
+    pending = 0;
+    for (i = 0; i < count; i++)
+    {
+      if (nodes[i] != NULL)
+      {
+        next = t->ReadNode(positions[pending++], t);
+        mdbLatchNode(next, MDB_LATCH_SHARED);
+        mdbUnlatchNode(nodes[i]);
+        if (nodes[i] != t->root)
+        {
+          mdbFreeNode(nodes[i], 0);
+        }
+        nodes[i] = next;
+      }
+    }
+  }
+
+  if (BT_SHADOW(t))
+  {
+    mdbShadowLeave(t, reader);
+  }
+  free(positions);
+  free(children);
+  free(nodes);
+  return MDB_NO_ERROR;
+}
+
+/*
+ * Adds a node to the path of an insertion/deletion, returns its entry index
+ * (the node is latched exclusively by the caller)
+ */
+static int mdbBtreePathPush(mdbBtreePath* path, mdbBtreeNode* node,
+    const int parent, const uint32 slot, const uint8 dirty)
+{
+  mdbBtreePathEntry* entry = &path->entries[path->count];
+
+  entry->node = node;
+  entry->parent = parent;
+  entry->slot = slot;
+  entry->prev = -1;
+  entry->dirty = dirty;
+  entry->deleted = 0;
+  entry->latched = 1;
+
+  return (int)path->count++;
+}
+
+/* Reads the i-th child of a node and latches it exclusively (insertion,
+ * deletion) */
+static mdbBtreeNode* mdbBtreeLatchChild(const mdbBtreeNode* node,
+    const uint32 i)
+{
+  mdbBtreeNode* child = node->T->ReadNode(node->children[i], node->T);
+
+  mdbLatchNode(child, MDB_LATCH_EXCLUSIVE);
+  return child;
+}
+
+/* Releases a latched node which was not added to a path (the root stays
+ * loaded) */
+static void mdbBtreeReleaseNode(mdbBtreeNode* node)
+{
+  mdbUnlatchNode(node);
+  if (node != node->T->root)
+  {
+    mdbFreeNode(node, 0);
+  }
+}
+
+/*
+ * Unlatches a path entry which was passed without being changed: its child
+ * has room (or keys to spare), so the node is not changed by this thread
+ * anymore and its child keeps its position. Other writers may change the
+ * node from now on. The nodes of a packed B+-tree stay latched (the bounds
+ * of the subtrees are read from their ancestors), so do the nodes of a
+ * copy-on-write B-tree (every ancestor of a changed node gets a new page).
+ */
+static void mdbBtreePathPass(mdbBtreePath* path, const int e)
+{
+  mdbBtreePathEntry* entry = &path->entries[e];
+
+  if (entry->latched && !entry->dirty && !entry->deleted &&
+      !BT_PACKED(entry->node->T) && !BT_SHADOW(entry->node->T))
+  {
+    mdbUnlatchNode(entry->node);
+    entry->latched = 0;
+  }
+}
+
+/*
+ * Finds the separators bounding the subtree of a path entry in a packed
+ * B+-tree (keys of its ancestors, NULL if the subtree is not bounded)
+ */
+static void mdbBtreeBounds(const mdbBtreePath* path, int e, const char** low,
+    const char** high)
+{
+  const mdbBtreePathEntry* entry;
+  const mdbBtreeNode* parent;
+
+  *low = NULL;
+  *high = NULL;
+  if (!BT_PACKED(path->entries[e].node->T))
+  {
+    return;
+  }
+
+  for (; path->entries[e].parent >= 0 && (*low == NULL || *high == NULL);
+      e = path->entries[e].parent)
+  {
+    entry = &path->entries[e];
+    parent = path->entries[entry->parent].node;
+
+    if (*low == NULL && entry->slot > 0)
+    {
+      *low = BT_KEY(parent, entry->slot - 1);
+    }
+    if (*high == NULL && entry->slot < BT_COUNT(parent))
+    {
+      *high = BT_KEY(parent, entry->slot);
+    }
+  }
+}
+
+/* Length of the prefix shared by all keys of the subtree of a path entry
+ * (packed B+-trees, 0 otherwise) */
+static uint32 mdbBtreePrefix(const mdbBtreePath* path, const int e)
+{
+  const char *low, *high;
+
+  mdbBtreeBounds(path, e, &low, &high);
+  return mdbBtreeCommonPrefix(low, high);
+}
+
+/* Length of the prefix shared by all keys of the j-th subtree of a node
+ * ("low" and "high" bound the node) */
+static uint32 mdbBtreeChildPrefix(const mdbBtreeNode* node, const uint32 j,
+    const char* low, const char* high)
+{
+  if (!BT_PACKED(node->T))
+  {
+    return 0;
+  }
+  return mdbBtreeCommonPrefix((j > 0) ? BT_KEY(node, j - 1) : low,
+      (j < BT_COUNT(node)) ? BT_KEY(node, j) : high);
+}
+
+/*
+ * Tests whether a node can take another entry (insertion). A packed internal
+ * node needs room for the longest possible key on its page, a slotted leaf
+ * for a record with full-length fields.
+ */
+static int mdbBtreeHasRoom(const mdbBtreeNode* node, const uint32 prefix)
+{
+  if (BT_COUNT(node) >= (BT_ORDER(node) << 1) - 1)
+  {
+    return 0;
+  }
+  if (BT_LEAF(node))
+  {
+    return !BT_SLOTTED(node->T) || mdbBtreeSlottedSize(node) +
+        sizeof(uint32) + node->T->meta.record_size <= node->T->nodeSize;
+  }
+  if (!BT_PACKED(node->T))
+  {
+    return 1;
+  }
+  return mdbBtreeFits(node, prefix, 1, sizeof(uint32) + sizeof(uint16) +
+      node->T->meta.key_size - sizeof(uint32) - prefix);
+}
+
+/*
+ * Tests whether a node has to be re-balanced before an entry is removed from
+ * its subtree (deletion): less than T entries, a packed internal node less
+ * than two keys or less than half a page, a slotted leaf less than two
+ * records or less than T records on less than half a page
+ */
+static int mdbBtreeUnderfull(const mdbBtreeNode* node, const uint32 prefix)
+{
+  if (BT_PACKED(node->T) && BT_INTERNAL(node))
+  {
+    return BT_COUNT(node) < 2 ||
+        mdbBtreePackedSize(node, prefix) < (node->T->nodeSize >> 1);
+  }
+  if (BT_SLOTTED(node->T) && BT_LEAF(node))
+  {
+    return BT_COUNT(node) < 2 || (BT_COUNT(node) < BT_ORDER(node) &&
+        mdbBtreeSlottedSize(node) < (node->T->nodeSize >> 1));
+  }
+  return BT_COUNT(node) < BT_ORDER(node);
+}
+
+/*
+ * Writes back the modified nodes of a path and releases all of them (except
+ * the root). Every node is written exactly once, deeper nodes before their
+ * parents, so the positions returned by WriteNode (e.g. of new nodes) can
+ * be stored in the parents before the parents themselves are written. The
+ * same holds for the previous leaf of a new B+-tree leaf (next pointer).
+ * A node is unlatched once it is written, its parent is still latched
+ * (a new node was private until written, it was never latched). The root
+ * of a copy-on-write B-tree is published while it is latched, so the
+ * writes publish their roots in the order they were written.
+ */
+static void mdbBtreePathWrite(mdbBtreePath* path)
+{
+  mdbBtreePathEntry* entry;
+  mdbBtreePathEntry* parent;
+  uint32 position;
+  uint8 created;
+  int k;
+
+  /* children are always added to the path after their parents */
+  for (k = (int)path->count - 1; k >= 0; k--)
+  {
+    entry = &path->entries[k];
+    created = (entry->node->position == 0);
+
+    if (entry->deleted)
+    {
+      entry->node->T->DeleteNode(entry->node);
+    }
+    else if (entry->dirty)
+    {
+      position = entry->node->T->WriteNode(entry->node);
+      entry->node->position = position;
+
+      /* a passed parent (unlatched) may have been changed by another
+       * thread, but its child kept its position then */
+      if (entry->parent >= 0 && path->entries[entry->parent].latched)
+      {
+        parent = &path->entries[entry->parent];
+        if (parent->node->children[entry->slot] != position)
+        {
+          parent->node->children[entry->slot] = position;
+          parent->dirty = 1;
+        }
+      }
+      if (entry->prev >= 0 && path->entries[entry->prev].latched)
+      {
+        parent = &path->entries[entry->prev];
+        if (BT_NEXT(parent->node) != position)
+        {
+          BT_NEXT(parent->node) = position;
+          parent->dirty = 1;
+        }
+      }
+    }
+
+    if (k == 0 && BT_SHADOW(entry->node->T))
+    {
+      mdbShadowPublish(entry->node->T);
+    }
+    if (entry->latched && !created)
+    {
+      mdbUnlatchNode(entry->node);
+    }
+    if (entry->node != entry->node->T->root)
+    {
+      mdbFreeNode(entry->node, 0);
+    }
+  }
+  path->count = 0;
+}
+
+/*
+ * Inserts a separator (record or key) into a parent node, the new child
+ * pointer after it is set when the path is written back
+ */
+static void mdbBtreeAddSeparator(mdbBtreeNode* parent, const uint32 position,
+    const char* separator, const uint32 left)
+{
+  /* make space for the separator if needed */
+  if (position < BT_COUNT(parent))
+  {
+    BT_MOVERECORDS(parent, position + 1, position, BT_COUNT(parent) - position);
+    BT_MOVECHILDREN(parent, position + 2, position + 1,
+        BT_COUNT(parent) - position);
+  }
+
+  memcpy(BT_RECORD(parent, position), separator, BT_RECSIZE(parent));
+  BT_COUNT(parent) = BT_COUNT(parent) + 1;
+
+  parent->children[position] = left;
+  parent->children[position + 1] = 0L;
+}
+
+/*
+ * Removes the separator "median" and the child pointer after it from
+ * a parent node (after its children were merged)
+ */
+static void mdbBtreeRemoveSeparator(mdbBtreeNode* parent, const uint32 median)
+{
+  /* if there are records (and child pointers) to be shifted */
+  if ((BT_COUNT(parent) - median - 1) > 0)
+  {
+    /* shift the records after the median to left by one */
+    BT_MOVERECORDS(parent, median, median+1, BT_COUNT(parent) - median - 1);
+
+    /* shift the child pointers after right child to left by one */
+    BT_MOVECHILDREN(parent, median+1, median+2, BT_COUNT(parent) - median - 1);
+  }
+
+  BT_COUNT(parent) = BT_COUNT(parent) - 1;
+}
+
+/* Size of the i-th entry on the page of a packed internal node (its keys
+ * share at least the given prefix) or a slotted leaf */
+static uint32 mdbBtreeEntrySize(const mdbBtreeNode* node, const uint32 i,
+    const uint32 prefix)
+{
+  if (BT_LEAF(node))
+  {
+    return sizeof(uint32) + mdbBtreeRecordSize(node->T, BT_RECORD(node,i));
+  }
+  return sizeof(uint32) + sizeof(uint16) + BT_KEYLEN(BT_KEY(node,i)) - prefix;
+}
+
+/*
+ * Chooses the median of a full node: the middle record, for a packed
+ * internal node (slotted leaf) the key (record) which divides its page into
+ * halves of equal size. The left node of a split B+-tree leaf keeps the
+ * records before the median.
+ */
+static uint32 mdbBtreeSplitPosition(const mdbBtreeNode* node,
+    const uint32 prefix)
+{
+  const uint32 last = BT_COUNT(node) - (BT_LEAF(node) ? 1 : 2);
+  uint32 total = 0;
+  uint32 left = 0;
+  uint32 size;
+  uint32 median;
+
+  if (!BT_PACKED_PAGE(node))
+  {
+    return BT_ORDER(node) - 1;
+  }
+
+  for (median = 0; median < BT_COUNT(node); median++)
+  {
+    total += mdbBtreeEntrySize(node, median, prefix);
+  }
+  for (median = 0; median < last; median++)
+  {
+    size = mdbBtreeEntrySize(node, median, prefix);
+    if (2 * left + size >= total)
+    {
+      break;
+    }
+    left += size;
+  }
+
+  return (median > 0) ? median : 1;
+}
+
+/*
+ * Internal function for splitting a full node (the median record moves to
+ * the parent), returns the new right sibling (not written yet)
+ */
+mdbBtreeNode* mdbBtreeSplitNode(mdbBtreeNode* left, mdbBtreeNode* parent,
+    const uint32 position, const uint32 median)
+{
+  mdbBtreeNode* right = NULL;
+  mdbAllocateNode(&right, left->T);
+
+  /* copy the records and child pointers after the median from the left
+   * child node to the new right child node
+   */
+
+  BT_COPYRECORDS(right, 0, left, median + 1, BT_COUNT(left) - median - 1);
+  BT_COPYCHILDREN(right, 0, left, median + 1, BT_COUNT(left) - median);
+
+  *right->is_leaf = *left->is_leaf;
+  right->position = 0L;
+  BT_COUNT(right) = BT_COUNT(left) - median - 1;
+
+  /* update the left child node */
+  BT_COUNT(left) = median;
+
+  /* move the median record to the parent node (the new node gets its
+   * position when the path is written back) */
+  mdbBtreeAddSeparator(parent, position, BT_RECORD(left,median),
+      left->position);
+
+  return right;
+}
+
+/*
+ * Internal function for splitting a full B+-tree leaf: the right leaf gets
+ * the records from the median on (the upper T records), the key of its
+ * first record is copied to the parent (packed B+-tree: only its shortest
+ * prefix separating the leaves).
+ * Returns the new right leaf (not written yet, linked after the left leaf).
+ */
+mdbBtreeNode* mdbBtreeSplitLeaf(mdbBtreeNode* left, mdbBtreeNode* parent,
+    const uint32 position, const uint32 median)
+{
+  mdbBtreeNode* right = NULL;
+  mdbAllocateNode(&right, left->T);
+  *right->is_leaf = 1;
+  mdbLayoutNode(right);
+
+  BT_COPYRECORDS(right, 0, left, median, BT_COUNT(left) - median);
+  BT_COUNT(right) = BT_COUNT(left) - median;
+  BT_COUNT(left) = median;
+
+  BT_NEXT(right) = BT_NEXT(left);
+  BT_NEXT(left) = 0L;
+
+  mdbBtreeAddSeparator(parent, position, BT_KEY(right,0), left->position);
+  if (BT_PACKED(left->T))
+  {
+    mdbBtreeTruncateKey(BT_RECORD(parent, position),
+        BT_KEY(left, BT_COUNT(left) - 1));
+  }
+
+  return right;
+}
+
+/*
+ * Descends to the leaf of a key with latch coupling: the nodes are latched
+ * shared on the way down, the leaf is latched again, exclusively, while
+ * its parent is still latched (the leaf cannot be split or merged in the
+ * meantime). Returns NULL if the key was found in an internal node (found
+ * is set) or if the root stopped being a leaf before it was latched again.
+ */
+static mdbBtreeNode* mdbBtreeLatchLeaf(const char* key, mdbBtree* t,
+    int* found)
+{
+  mdbBtreeNode* node = t->root;
+  mdbBtreeNode* next = NULL;
+  uint32 i;
+
+  *found = 0;
+  mdbLatchNode(node, MDB_LATCH_SHARED);
+  if (BT_LEAF(node))
+  {
+    mdbUnlatchNode(node);
+    mdbLatchNode(node, MDB_LATCH_EXCLUSIVE);
+    if (BT_INTERNAL(node))
+    {
+      mdbUnlatchNode(node);
+      return NULL;
+    }
+  }
+
+  while (BT_INTERNAL(node))
+  {
+    i = mdbBtreeFindKey(key, node, found);
+
+    /* a B+-tree key equal to a separator is in the right subtree */
+    if (*found && !BT_PLUS(t))
+    {
+      mdbBtreeReleaseNode(node);
+      return NULL;
+    }
+    if (*found)
+    {
+      *found = 0;
+      i++;
+    }
+
+    next = t->ReadNode(node->children[i], t);
+    mdbLatchNode(next, MDB_LATCH_SHARED);
+    if (BT_LEAF(next))
+    {
+      mdbUnlatchNode(next);
+      mdbLatchNode(next, MDB_LATCH_EXCLUSIVE);
+    }
+    mdbBtreeReleaseNode(node);
+    node = next;
+  }
+  return node;
+}
+
+/*
+ * Insertion into a leaf with room for the record (mdbBtreeLatchLeaf), only
+ * the leaf is latched exclusively. Returns 0 if the leaf is full (or the
+ * root became an internal node), the insertion has to split nodes then.
+ */
+static int mdbBtreeInsertLeaf(const char* record, mdbBtree* t,
+    mdbError* result)
+{
+  const char* key = record + t->meta.key_position;
+  mdbBtreeNode* node;
+  int found;
+  uint32 i;
+
+  if ((node = mdbBtreeLatchLeaf(key, t, &found)) == NULL)
+  {
+    *result = MDB_BTREE_KEY_COLLISION;
+    return found;
+  }
+
+  i = mdbBtreeFindKey(key, node, &found);
+  if (found)
+  {
+    *result = MDB_BTREE_KEY_COLLISION;
+  }
+  else if (mdbBtreeHasRoom(node, 0))
+  {
+    if (i < BT_COUNT(node))
+    {
+      BT_MOVERECORDS(node, i+1, i, BT_COUNT(node) - i);
+    }
+    memcpy(BT_RECORD(node, i), record, BT_RECSIZE(node));
+    BT_COUNT(node) = BT_COUNT(node) + 1;
+    node->position = t->WriteNode(node);
+    *result = MDB_NO_ERROR;
+  }
+  else
+  {
+    mdbBtreeReleaseNode(node);
+    return 0;
+  }
+
+  mdbBtreeReleaseNode(node);
+  return 1;
+}
+
+/*
+ * B-tree insertion function
+ *
+ * A record which fits into its leaf is inserted by mdbBtreeInsertLeaf
+ * (not in a copy-on-write B-tree, the path to the leaf gets new pages).
+ * Otherwise full nodes are split on the way down, so the record can always
+ * be put into the leaf. The visited nodes are kept in a path and written
+ * back at the end, they are latched exclusively (the nodes passed without
+ * a split are released on the way).
+ * A packed internal node (slotted leaf) is full if the longest possible key
+ * (record) would not fit into its page anymore.
+ */
+static mdbError mdbBtreeInsertRecord(const char* record, mdbBtree* t)
+{
+  mdbBtreePath path;
+  mdbBtreeNode* node = NULL;
+  mdbBtreeNode* next = NULL;
+  mdbBtreeNode* right = NULL;
+  const char* key = record + t->meta.key_position;
+  mdbError result = MDB_NO_ERROR;
+  const int plus = BT_PLUS(t);
+  int cur, child, sibling, found, cmp;
+  uint32 prefix;
+  uint32 i;
+
+  if (t->root == NULL)
+  {
+    return MDB_BTREE_NO_ROOT;
+  }
+  if (!BT_SHADOW(t) && mdbBtreeInsertLeaf(record, t, &result))
+  {
+    return result;
+  }
+
+  path.count = 0;
+  mdbLatchNode(t->root, MDB_LATCH_EXCLUSIVE);
+  cur = mdbBtreePathPush(&path, t->root, -1, 0, 0);
+  node = t->root;
+
+  /* t->root node is full, split it. The root keeps its position in the file,
+   * its records move to a new left child node which gets a right sibling
+   */
+  if (!mdbBtreeHasRoom(t->root, 0))
+  {
+    mdbAllocateNode(&next, t);
+    memcpy(next->data, t->root->data, t->bufferSize);
+    mdbLayoutNode(next);
+    BT_COUNT(t->root) = 0;
+    *t->root->is_leaf = 0;
+    mdbLayoutNode(t->root);
+
+    right = (plus && BT_LEAF(next)) ?
+        mdbBtreeSplitLeaf(next, t->root, 0, mdbBtreeSplitPosition(next, 0)) :
+        mdbBtreeSplitNode(next, t->root, 0, mdbBtreeSplitPosition(next, 0));
+    path.entries[cur].dirty = 1;
+    child = mdbBtreePathPush(&path, next, cur, 0, 1);
+    sibling = mdbBtreePathPush(&path, right, cur, 1, 1);
+    path.entries[sibling].prev = (plus && BT_LEAF(next)) ? child : -1;
+
+    /* B+-tree separators belong to the right subtree */
+    cmp = mdbBtreeCmp(key, BT_KEY(t->root,0), t);
+    if (cmp == 0 && !plus)
+    {
+      mdbBtreePathWrite(&path);
+      return MDB_BTREE_KEY_COLLISION;
+    }
+    node = (cmp >= 0) ? right : next;
+    cur = (cmp >= 0) ? sibling : child;
+  }
+
+  while (1)
+  {
+    i = mdbBtreeFindKey(key, node, &found);
+
+    /* a B+-tree key equal to a separator is in the right subtree */
+    if (found && plus && BT_INTERNAL(node))
+    {
+      found = 0;
+      i++;
+    }
+
+    /* key already exists? */
+    if (found)
+    {
+      result = MDB_BTREE_KEY_COLLISION;
+      break;
+    }
+
+    /* if the current node is a leaf, insert the record into it */
+    if (BT_LEAF(node))
+    {
+      /* if needed, create space for the new record */
+      if (i < BT_COUNT(node))
+      {
+        BT_MOVERECORDS(node, i+1, i, BT_COUNT(node) - i);
+      }
+      memcpy(BT_RECORD(node, i), record, BT_RECSIZE(node));
+      BT_COUNT(node) = BT_COUNT(node) + 1;
+      path.entries[cur].dirty = 1;
+      break;
+    }
+
+    /* if node is an internal node continue with the subtree */
+    next = mdbBtreeLatchChild(node, i);
+    child = mdbBtreePathPush(&path, next, cur, i, 0);
+    prefix = mdbBtreePrefix(&path, child);
+
+    /* child node is full, split it */
+    if (!mdbBtreeHasRoom(next, prefix))
+    {
+      if (plus && BT_LEAF(next))
+      {
+        right = mdbBtreeSplitLeaf(next, node, i,
+            mdbBtreeSplitPosition(next, prefix));
+        sibling = mdbBtreePathPush(&path, right, cur, i + 1, 1);
+        path.entries[sibling].prev = child;
+      }
+      else
+      {
+        right = mdbBtreeSplitNode(next, node, i,
+            mdbBtreeSplitPosition(next, prefix));
+        sibling = mdbBtreePathPush(&path, right, cur, i + 1, 1);
+      }
+      path.entries[cur].dirty = 1;
+      path.entries[child].dirty = 1;
+
+      /* the current key changed and the current subtree maybe smaller than
+       * then the record's key, so determine the direction of the descent
+       * (left or right, B+-tree separators belong to the right subtree) */
+      cmp = mdbBtreeCmp(key, BT_KEY(node,i), t);
+      if (cmp == 0 && !plus)
+      {
+        result = MDB_BTREE_KEY_COLLISION;
+        break;
+      }
+      if (cmp > 0 || (cmp == 0 && plus))
+      {
+        next = right;
+        child = sibling;
+      }
+    }
+
+    mdbBtreePathPass(&path, cur);
+    node = next;
+    cur = child;
+  }
+
+  mdbBtreePathWrite(&path);
+  return result;
+}
+
+/* The insertion is a write of the B-tree versions (see mdbversion.c) */
+mdbError mdbBtreeInsert(const char* record, mdbBtree* t)
+{
+  mdbError result;
+
+  mdbVersionBegin(t->versions);
+  result = mdbBtreeInsertRecord(record, t);
+  mdbVersionEnd(t->versions);
+  return result;
+}
+
+/*
+ * Internal function for merging two child nodes with median from parent
+ * (the right child node has to be deleted by the caller)
+ */
+void mdbBtreeMergeNodes(mdbBtreeNode* left, mdbBtreeNode* right,
+    mdbBtreeNode* parent, const uint32 median)
+{
+  const uint32 count = BT_COUNT(left);
+
+  /* -----------------------------------------------------------------*/
+  /* update the left child node */
+  /* -----------------------------------------------------------------*/
+  /* copy the median key to the left child node */
+  BT_COPYRECORDS(left, count, parent, median, 1);
+
+  /* copy all records from the right child to the left child */
+  BT_COPYRECORDS(left, count + 1, right, 0, BT_COUNT(right));
+
+  /* if needed, copy all child pointers from the right to the left child */
+  if (BT_INTERNAL(right))
+  {
+    BT_COPYCHILDREN(left, count + 1, right, 0, BT_COUNT(right) + 1);
+  }
+
+  BT_COUNT(left) = count + 1 + BT_COUNT(right);
+  /* -----------------------------------------------------------------*/
+
+  /* update the parent node */
+  mdbBtreeRemoveSeparator(parent, median);
+}
+
+/*
+ * Internal function for merging two B+-tree leaves (the separator in the
+ * parent is dropped, the right leaf has to be deleted by the caller)
+ */
+void mdbBtreeMergeLeaves(mdbBtreeNode* left, mdbBtreeNode* right,
+    mdbBtreeNode* parent, const uint32 median)
+{
+  BT_COPYRECORDS(left, BT_COUNT(left), right, 0, BT_COUNT(right));
+  BT_COUNT(left) = BT_COUNT(left) + BT_COUNT(right);
+  BT_NEXT(left) = BT_NEXT(right);
+
+  mdbBtreeRemoveSeparator(parent, median);
+}
+
+/*
+ * Replaces an empty (internal) root by its only child: the child's data is
+ * copied into the root (which keeps its position) and the child is deleted
+ */
+static void mdbBtreeCollapseRoot(mdbBtreePath* path, const int child)
+{
+  mdbBtreeNode* root = path->entries[0].node;
+  mdbBtreeNode* node = path->entries[child].node;
+
+  /* the data of a mapped node is only its page */
+  memcpy(root->data, node->data,
+      node->mapped ? root->T->nodeSize : root->T->bufferSize);
+  mdbLayoutNode(root);
+  path->entries[child].deleted = 1;
+  path->entries[0].dirty = 1;
+}
+
+/*
+ * Tests whether two siblings (and the separator between them, except for
+ * B+-tree leaves) fit into one node. Siblings of a packed (slotted) B+-tree
+ * may have more entries than T - 1 ("low" and "high" bound the parent).
+ */
+static int mdbBtreeCanMerge(const mdbBtreeNode* left,
+    const mdbBtreeNode* right, const mdbBtreeNode* parent,
+    const uint32 median, const char* low, const char* high)
+{
+  const uint32 count = BT_COUNT(left) + BT_COUNT(right) +
+      ((BT_PLUS(left->T) && BT_LEAF(left)) ? 0 : 1);
+  uint32 prefix;
+
+  if (!BT_PACKED(left->T) && !BT_SLOTTED(left->T))
+  {
+    return 1;
+  }
+  if (count > (BT_ORDER(left) << 1) - 1)
+  {
+    return 0;
+  }
+  if (BT_LEAF(left))
+  {
+    return !BT_SLOTTED(left->T) || mdbBtreeSlottedSize(left) +
+        mdbBtreeSlottedSize(right) - MDB_BTREE_SLOTTED_HEADER <=
+        left->T->nodeSize;
+  }
+  if (!BT_PACKED(left->T))
+  {
+    return 1;
+  }
+
+  /* the merged node is bounded by the separators around both siblings */
+  prefix = mdbBtreeCommonPrefix((median > 0) ? BT_KEY(parent, median - 1) : low,
+      (median + 1 < BT_COUNT(parent)) ? BT_KEY(parent, median + 1) : high);
+
+  return mdbBtreePackedSize(left, prefix) + mdbBtreePackedSize(right, prefix) -
+      MDB_BTREE_PACKED_HEADER + sizeof(uint16) +
+      BT_KEYLEN(BT_KEY(parent, median)) - 2 * prefix <= left->T->nodeSize;
+}
+
+/* Tests whether the i-th key of a packed internal node can be replaced by a
+ * key of the given length ("low" and "high" bound the node) */
+static int mdbBtreeCanReplace(const mdbBtreeNode* node, const uint32 i,
+    const uint32 length, const char* low, const char* high)
+{
+  return mdbBtreeFits(node, mdbBtreeCommonPrefix(low, high), 0,
+      (int)length - (int)BT_KEYLEN(BT_KEY(node, i)));
+}
+
+/*
+ * Tests whether a rotation keeps the nodes of a packed B+-tree within their
+ * pages: the separator "median" of the parent moves down into the internal
+ * node "next" (i-th child), the nearest key of the sibling replaces it
+ */
+static int mdbBtreeCanRotate(const mdbBtreeNode* node, const uint32 i,
+    const uint32 median, const mdbBtreeNode* next, const mdbBtreeNode* sibling,
+    const char* low, const char* high)
+{
+  const char* up = (median < i) ? BT_KEY(sibling, BT_COUNT(sibling) - 1) :
+      BT_KEY(sibling, 0);
+  uint32 prefix;
+
+  if (!mdbBtreeCanReplace(node, median, BT_KEYLEN(up), low, high))
+  {
+    return 0;
+  }
+
+  /* the key moved up becomes a new bound of the node */
+  prefix = (median < i) ?
+      mdbBtreeCommonPrefix(up, (i < BT_COUNT(node)) ? BT_KEY(node, i) : high) :
+      mdbBtreeCommonPrefix((i > 0) ? BT_KEY(node, i - 1) : low, up);
+
+  return mdbBtreeFits(next, prefix, 1, sizeof(uint32) + sizeof(uint16) +
+      BT_KEYLEN(BT_KEY(node, median)) - prefix);
+}
+
+/* What is searched for during a deletion */
+#define MDB_BTREE_DELETE_KEY  0 /* the key to be deleted                   */
+#define MDB_BTREE_DELETE_MAX  1 /* the predecessor (max. of a subtree)      */
+#define MDB_BTREE_DELETE_MIN  2 /* the successor (min. of a subtree)        */
+
+/*
+ * Deletion from a leaf with records to spare (mdbBtreeLatchLeaf), only the
+ * leaf is latched exclusively. Returns 0 if the key is in an internal node
+ * or if the leaf would become underfull, the deletion has to re-balance
+ * the B-tree then.
+ */
+static int mdbBtreeDeleteLeaf(const char* key, mdbBtree* t,
+    mdbError* result)
+{
+  mdbBtreeNode* node;
+  int found;
+  uint32 i;
+
+  if ((node = mdbBtreeLatchLeaf(key, t, &found)) == NULL)
+  {
+    return 0;
+  }
+
+  /* the root leaf has no minimal number of records */
+  i = mdbBtreeFindKey(key, node, &found);
+  if (!found && BT_COUNT(node) > 0)
+  {
+    *result = MDB_BTREE_KEY_NOT_FOUND;
+  }
+  else if (found && (node == t->root || !mdbBtreeUnderfull(node, 0)))
+  {
+    if ((BT_COUNT(node) - i - 1) > 0)
+    {
+      BT_MOVERECORDS(node, i, i+1, BT_COUNT(node) - i - 1);
+    }
+    BT_COUNT(node) = BT_COUNT(node) - 1;
+    node->position = t->WriteNode(node);
+    *result = MDB_NO_ERROR;
+  }
+  else
+  {
+    mdbBtreeReleaseNode(node);
+    return 0;
+  }
+
+  mdbBtreeReleaseNode(node);
+  return 1;
+}
+
+/*
+ * B-tree deletion function
+ *
+ * A record whose leaf has records to spare is removed by mdbBtreeDeleteLeaf.
+ * Otherwise every subtree entered on the way down has at least T records,
+ * so a record can always be removed from a leaf. A key found in an internal
+ * node is replaced by its predecessor/successor, which is removed from the
+ * leaf at the end of the descent (B+-tree separators are only used for the
+ * descent and stay unchanged). The visited nodes are kept in a path and
+ * written back at the end, they are latched exclusively (the nodes passed
+ * without a change are released on the way). A copy-on-write B-tree always
+ * takes the path (see mdbBtreeInsertRecord).
+ *
+ * A packed (slotted) B+-tree is re-balanced only where the changed nodes
+ * still fit into their pages, otherwise the subtree is entered as it is
+ * (its nodes may have less than T - 1 entries).
+ */
+static mdbError mdbBtreeDeleteRecord(const char* key, mdbBtree* t)
+{
+  mdbBtreePath path;
+  mdbBtreeNode* node = NULL;
+  mdbBtreeNode* left = NULL;
+  mdbBtreeNode* right = NULL;
+  mdbBtreeNode* next = NULL;
+  mdbBtreeNode* holder = NULL;
+  mdbError result = MDB_NO_ERROR;
+  int mode = MDB_BTREE_DELETE_KEY;
+  const int plus = BT_PLUS(t);
+  const int packed = BT_PACKED(t);
+  const char *low, *high;
+  int cur, child, l, r, found, spare;
+  uint32 holder_position = 0;
+  uint32 i;
+
+  if (t->root == NULL)
+  {
+    return MDB_BTREE_NO_ROOT;
+  }
+  if (!BT_SHADOW(t) && mdbBtreeDeleteLeaf(key, t, &result))
+  {
+    return result;
+  }
+
+  mdbLatchNode(t->root, MDB_LATCH_EXCLUSIVE);
+  if (BT_COUNT(t->root) == 0 && BT_LEAF(t->root))
+  {
+    mdbUnlatchNode(t->root);
+    return MDB_BTREE_ROOT_IS_EMPTY;
+  }
+
+  path.count = 0;
+  cur = mdbBtreePathPush(&path, t->root, -1, 0, 0);
+  node = t->root;
+
+  /* an empty internal root (written by older versions) is replaced by its
+   * only child, the B-tree height decreases by one */
+  if (BT_COUNT(t->root) == 0)
+  {
+    next = mdbBtreeLatchChild(t->root, 0);
+    mdbBtreeCollapseRoot(&path, mdbBtreePathPush(&path, next, cur, 0, 0));
+  }
+
+  while (1)
+  {
+    found = 0;
+    if (mode == MDB_BTREE_DELETE_KEY)
+    {
+      i = mdbBtreeFindKey(key, node, &found);
+
+      /* a B+-tree key equal to a separator is in the right subtree */
+      if (found && plus && BT_INTERNAL(node))
+      {
+        found = 0;
+        i++;
+      }
+    }
+    else
+    {
+      i = (mode == MDB_BTREE_DELETE_MAX) ? BT_COUNT(node) : 0;
+    }
+
+    /* the record to be removed is in a leaf */
     if (BT_LEAF(node))
     {
-      return MDB_BTREE_KEY_NOT_FOUND;
+      if (mode == MDB_BTREE_DELETE_KEY && !found)
+      {
+        result = MDB_BTREE_KEY_NOT_FOUND;
+        break;
+      }
+      if (mode == MDB_BTREE_DELETE_MAX)
+      {
+        i = BT_COUNT(node) - 1;
+      }
+
+      /* the predecessor/successor replaces the deleted key */
+      if (holder != NULL)
+      {
+        memcpy(BT_RECORD(holder,holder_position), BT_RECORD(node,i),
+            BT_RECSIZE(node));
+      }
+
+      /* if there are records to be shifted */
+      if ((BT_COUNT(node) - i - 1) > 0)
+      {
+        /* shift the records after the i-th record to left by one */
+        BT_MOVERECORDS(node, i, i+1, BT_COUNT(node) - i - 1);
+      }
+      BT_COUNT(node) = BT_COUNT(node) - 1;
+      path.entries[cur].dirty = 1;
+      break;
+    }
+
+    /* key found in an internal node, remove the record without destroying
+     * the tree's balance */
+    if (found)
+    {
+      /*
+       * If possible (left child node before the key to be deleted
+       * contains at least T keys), replace the key to be deleted by
+       * its PREDECESSOR
+       */
+      left = mdbBtreeLatchChild(node, i);
+      l = mdbBtreePathPush(&path, left, cur, i, 0);
+
+      if (BT_COUNT(left) >= BT_ORDER(left))
+      {
+        holder = node;
+        holder_position = i;
+        path.entries[cur].dirty = 1;
+        mode = MDB_BTREE_DELETE_MAX;
+        node = left;
+        cur = l;
+        continue;
+      }
+
+      /*
+       * Otherwise, if possible (right child node before the key to be
+       * deleted contains at least T keys), replace the key to be deleted
+       * by its SUCCESSOR
+       */
+      right = mdbBtreeLatchChild(node, i + 1);
+      r = mdbBtreePathPush(&path, right, cur, i + 1, 0);
+
+      if (BT_COUNT(right) >= BT_ORDER(right))
+      {
+        holder = node;
+        holder_position = i;
+        path.entries[cur].dirty = 1;
+        mode = MDB_BTREE_DELETE_MIN;
+        node = right;
+        cur = r;
+        continue;
+      }
+
+      /* If both the left and right child nodes contains T - 1 keys,
+       * merge them with the key to be deleted as the median key
+       */
+      mdbBtreeMergeNodes(left, right, node, i);
+      path.entries[cur].dirty = 1;
+      path.entries[l].dirty = 1;
+      path.entries[r].deleted = 1;
+      next = left;
+      child = l;
+    }
+
+    /* otherwise, re-balance the tree if necessary and continue with
+     * the subtree */
+    else
+    {
+      next = mdbBtreeLatchChild(node, i);
+      child = mdbBtreePathPush(&path, next, cur, i, 0);
+      mdbBtreeBounds(&path, cur, &low, &high);
+
+      /* if new subtree has only T - 1 keys, re-balance the tree */
+      if (mdbBtreeUnderfull(next, mdbBtreeChildPrefix(node, i, low, high)))
+      {
+        left = right = NULL;
+
+        /* if a left sibling of the subtree root node
+         * exists and has a key to spare...
+         */
+        if (i > 0)
+        {
+          left = mdbBtreeLatchChild(node, i - 1);
+          spare = !mdbBtreeUnderfull(left,
+              mdbBtreeChildPrefix(node, i - 1, low, high));
+
+          if (spare && plus && BT_LEAF(next) && (!packed ||
+              mdbBtreeCanReplace(node, i - 1, mdbBtreeCommonPrefix(
+              BT_KEY(left, BT_COUNT(left) - 2),
+              BT_KEY(left, BT_COUNT(left) - 1)) + 1, low, high)))
+          {
+            /* B+-tree leaves: move the last record of the left sibling,
+             * its key becomes the new separator */
+            BT_MOVERECORDS(next, 1, 0, BT_COUNT(next));
+            BT_COPYRECORDS(next, 0, left, BT_COUNT(left) - 1, 1);
+            memcpy(BT_RECORD(node, i - 1), BT_KEY(next, 0), BT_RECSIZE(node));
+
+            BT_COUNT(next) = BT_COUNT(next) + 1;
+            BT_COUNT(left) = BT_COUNT(left) - 1;
+
+            if (packed)
+            {
+              mdbBtreeTruncateKey(BT_RECORD(node, i - 1),
+                  BT_KEY(left, BT_COUNT(left) - 1));
+            }
+
+            mdbBtreePathPush(&path, left, cur, i - 1, 1);
+            path.entries[child].dirty = 1;
+            path.entries[cur].dirty = 1;
+            node = next;
+            cur = child;
+            continue;
+          }
+
+          if (spare && (!plus || BT_INTERNAL(next)) && (!packed ||
+              mdbBtreeCanRotate(node, i, i - 1, next, left, low, high)))
+          {
+            /* ---------------------------------------------------------- *
+             * perform a rotate operation from the left sibling,          *
+             * through the parent node, into the subtree root node        *
+             * ---------------------------------------------------------- */
+
+            /* create space for the spared key/record */
+            BT_MOVERECORDS(next, 1, 0, BT_COUNT(next));
+
+            /* insert the current record into the subtree root node,
+             * and replace the current record by its predecessor
+             */
+            BT_COPYRECORDS(next, 0, node, i - 1, 1);
+            BT_COPYPREDECESSOR(node, i - 1, left);
+
+            /* if the children are internal nodes, move the left
+             * sibling's last child pointer to the subtree root node
+             */
+            if (BT_INTERNAL(next))
+            {
+              BT_MOVECHILDREN(next, 1, 0, BT_COUNT(next) + 1);
+              next->children[0] = left->children[BT_COUNT(left)];
+            }
+
+            /* update all nodes */
+            BT_COUNT(next) = BT_COUNT(next) + 1;
+            BT_COUNT(left) = BT_COUNT(left) - 1;
+
+            mdbBtreePathPush(&path, left, cur, i - 1, 1);
+            path.entries[child].dirty = 1;
+            path.entries[cur].dirty = 1;
+            /* ---------------------------------------------------------- */
+            node = next;
+            cur = child;
+            continue;
+          }
+        }
+
+        /* otherwise, if the right sibling of the
+         * subtree root has a key to spare...
+         */
+        if (i < BT_COUNT(node))
+        {
+          right = mdbBtreeLatchChild(node, i + 1);
+          spare = !mdbBtreeUnderfull(right,
+              mdbBtreeChildPrefix(node, i + 1, low, high));
+
+          if (spare && plus && BT_LEAF(next) && (!packed ||
+              mdbBtreeCanReplace(node, i, mdbBtreeCommonPrefix(
+              BT_KEY(right, 0), BT_KEY(right, 1)) + 1, low, high)))
+          {
+            /* B+-tree leaves: move the first record of the right sibling,
+             * the key of its new first record becomes the separator */
+            BT_COPYRECORDS(next, BT_COUNT(next), right, 0, 1);
+            BT_MOVERECORDS(right, 0, 1, BT_COUNT(right) - 1);
+            memcpy(BT_RECORD(node, i), BT_KEY(right, 0), BT_RECSIZE(node));
+
+            BT_COUNT(next) = BT_COUNT(next) + 1;
+            BT_COUNT(right) = BT_COUNT(right) - 1;
+
+            if (packed)
+            {
+              mdbBtreeTruncateKey(BT_RECORD(node, i),
+                  BT_KEY(next, BT_COUNT(next) - 1));
+            }
+
+            if (left != NULL)
+            {
+              mdbBtreeReleaseNode(left);
+            }
+            mdbBtreePathPush(&path, right, cur, i + 1, 1);
+            path.entries[child].dirty = 1;
+            path.entries[cur].dirty = 1;
+            node = next;
+            cur = child;
+            continue;
+          }
+
+          if (spare && (!plus || BT_INTERNAL(next)) && (!packed ||
+              mdbBtreeCanRotate(node, i, i, next, right, low, high)))
+          {
+            /* ---------------------------------------------------------- *
+             * perform a reverse rotate operation from the right sibling, *
+             * through the parent node, into the subtree root node        *
+             * ---------------------------------------------------------- */
+
+            /* insert the current record into the subtree root node */
+            BT_COPYRECORDS(next, BT_COUNT(next), node, i, 1);
+
+            /* replace the current record by its successor */
+            BT_COPYSUCCESSOR(node, i, right);
+
+            /* if the children are internal nodes, move the right
+             * sibling's first child pointer to the subtree root node
+             */
+            if (BT_INTERNAL(next))
+            {
+              next->children[BT_COUNT(next) + 1] = right->children[0];
+              BT_MOVECHILDREN(right, 0, 1, BT_COUNT(right));
+            }
+
+            /* shift all records of the right sibling to left by one */
+            BT_MOVERECORDS(right, 0, 1, BT_COUNT(right) - 1);
+
+            /* update all nodes */
+            BT_COUNT(next) = BT_COUNT(next) + 1;
+            BT_COUNT(right) = BT_COUNT(right) - 1;
+
+            if (left != NULL)
+            {
+              mdbBtreeReleaseNode(left);
+            }
+            mdbBtreePathPush(&path, right, cur, i + 1, 1);
+            path.entries[child].dirty = 1;
+            path.entries[cur].dirty = 1;
+            /* ---------------------------------------------------------- */
+            node = next;
+            cur = child;
+            continue;
+          }
+        }
+
+        /* otherwise, both the left and right siblings of the subtree
+         * root node contain T - 1 keys, so perform a merge where possible
+         * (packed B+-tree: if the merged node fits into its page)
+         */
+        if (left != NULL && mdbBtreeCanMerge(left, next, node, i - 1, low, high))
+        {
+          if (right != NULL)
+          {
+            mdbBtreeReleaseNode(right);
+          }
+          if (plus && BT_LEAF(next))
+          {
+            mdbBtreeMergeLeaves(left, next, node, i - 1);
+          }
+          else
+          {
+            mdbBtreeMergeNodes(left, next, node, i - 1);
+          }
+          path.entries[child].deleted = 1;
+          child = mdbBtreePathPush(&path, left, cur, i - 1, 1);
+          next = left;
+          path.entries[cur].dirty = 1;
+        }
+        else if (right != NULL &&
+            mdbBtreeCanMerge(next, right, node, i, low, high))
+        {
+          if (left != NULL)
+          {
+            mdbBtreeReleaseNode(left);
+          }
+          if (plus && BT_LEAF(next))
+          {
+            mdbBtreeMergeLeaves(next, right, node, i);
+          }
+          else
+          {
+            mdbBtreeMergeNodes(next, right, node, i);
+          }
+          path.entries[child].dirty = 1;
+          mdbBtreePathPush(&path, right, cur, i + 1, 0);
+          path.entries[path.count - 1].deleted = 1;
+          path.entries[cur].dirty = 1;
+        }
+        else
+        {
+          /* the subtree stays as it is */
+          if (left != NULL)
+          {
+            mdbBtreeReleaseNode(left);
+          }
+          if (right != NULL)
+          {
+            mdbBtreeReleaseNode(right);
+          }
+        }
+      }
+    }
+
+    /* the root lost its last record, the B-tree height decreases by one */
+    if (node == t->root && BT_COUNT(node) == 0)
+    {
+      mdbBtreeCollapseRoot(&path, child);
+      next = t->root;
+      child = 0;
+    }
+
+    mdbBtreePathPass(&path, cur);
+    node = next;
+    cur = child;
+  }
+
+  mdbBtreePathWrite(&path);
+  return result;
+}
+
+/* The deletion is a write of the B-tree versions (see mdbversion.c) */
+mdbError mdbBtreeDelete(const char* key, mdbBtree* t)
+{
+  mdbError result;
+
+  mdbVersionBegin(t->versions);
+  result = mdbBtreeDeleteRecord(key, t);
+  mdbVersionEnd(t->versions);
+  return result;
+}
+
+/*
+ * Descends from the current traversal node to its child at the current
+ * position (the child is latched shared, its ancestors stay latched). A
+ * scan is detected when the traversal moves on to the second child of a
+ * node: the next "readahead" children are read ahead (one batch), and
+ * again every time the previous window was entered. A backward scan
+ * starts at the last child of the node and reads the children on its left
+ * ahead, its current position in the child is the end of the child.
+ */
+static void mdbBtreeTraverseChild(mdbBtreeTraversal **t, const uint8 backward)
+{
+  mdbBtreeTraversal *tmp;
+  mdbBtreeNode *node = (*t)->node;
+  mdbBtree *tree = node->T;
+  const uint32 window = tree->readahead;
+  const uint32 position = (*t)->position;
+  uint32 count;
+
+  if (!backward && window > 0 && position > 0 &&
+      (position - 1) % window == 0 && position < BT_COUNT(node))
+  {
+    count = BT_COUNT(node) - position;
+    mdbBtreePrefetch(tree, &node->children[position + 1],
+        count < window ? count : window);
+  }
+  else if (backward && window > 0 && position > 0 &&
+      position < BT_COUNT(node) &&
+      (BT_COUNT(node) - position - 1) % window == 0)
+  {
+    count = position < window ? position : window;
+    mdbBtreePrefetch(tree, &node->children[position - count], count);
+  }
+
+  tmp = (mdbBtreeTraversal*)malloc(sizeof(mdbBtreeTraversal));
+  tmp->parent = *t;
+  tmp->node = tree->ReadNode(node->children[position], tree);
+  mdbLatchNode(tmp->node, MDB_LATCH_SHARED);
+  tmp->latched = 1;
+  tmp->position = backward ? BT_COUNT(tmp->node) : 0;
+  *t = tmp;
+}
+
+/* Goes back from the current traversal node to its parent */
+static void mdbBtreeTraverseParent(mdbBtreeTraversal **t)
+{
+  mdbBtreeTraversal *tmp = (*t)->parent;
+
+  mdbUnlatchNode((*t)->node);
+  mdbFreeNode((*t)->node, 0);
+  free(*t);
+  *t = tmp;
+}
+
+/* Ends a traversal at its root (the root is unlatched) */
+static mdbError mdbBtreeTraverseEnd(mdbBtreeTraversal **t)
+{
+  if ((*t)->latched)
+  {
+    mdbUnlatchNode((*t)->node);
+    (*t)->latched = 0;
+  }
+  return MDB_BTREE_NO_MORE_RECORDS;
+}
+
+/*
+ * The nodes on the path of a traversal stay latched shared between the
+ * calls (latch coupling: a node is latched before its parent may be
+ * released), the root is latched by the first call and unlatched when no
+ * more records are left (or by mdbBtreeTraverseReset)
+ */
+mdbError mdbBtreeTraverse(mdbBtreeTraversal **t, char *record)
+{
+  mdbBtree *tree = (*t)->node->T;
+
+  if (!(*t)->latched)
+  {
+    mdbLatchNode((*t)->node, MDB_LATCH_SHARED);
+    (*t)->latched = 1;
+  }
+
+  /* find left-most leaf node (first call, an internal node is only left
+   * as the current node by the end of the traversal) */
+  while (BT_INTERNAL((*t)->node) && (*t)->position == 0)
+  {
+    mdbBtreeTraverseChild(t, 0);
+  }
+
+  /* B+-tree: all records are in the leaves, continue with the left-most
+   * leaf of the next subtree (the position of an internal node is the
+   * index of the current child, the read-ahead follows the children) */
+  if (BT_PLUS(tree))
+  {
+    while ((*t)->position == *(*t)->node->record_count)
+    {
+      do
+      {
+        if ((*t)->parent == NULL)
+        {
+          /* no more records */
+          return mdbBtreeTraverseEnd(t);
+        }
+        mdbBtreeTraverseParent(t);
+      }
+      while ((*t)->position == *(*t)->node->record_count);
+
+      (*t)->position++;
+      while (BT_INTERNAL((*t)->node))
+      {
+        mdbBtreeTraverseChild(t, 0);
+      }
+    }
+  }
+
+  /* if there are still records to be returned from current leaf... */
+  if ((*t)->position < *(*t)->node->record_count)
+  {
+    memcpy(record,BT_RECORD((*t)->node,(*t)->position),BT_RECSIZE((*t)->node));
+    (*t)->position++;
+  }
+  /* else, go back to parent and return the parent record */
+  else
+  {
+    do
+    {
+      if ((*t)->parent == NULL)
+      {
+        /* no more records */
+        return mdbBtreeTraverseEnd(t);
+      }
+      mdbBtreeTraverseParent(t);
     }
-    /* otherwise, re-balance the tree if necessary and recurse to subtree */
-    else
-    {
-      next = node->T->ReadNode(node->children[i], node->T);
+    while ((*t)->position == *(*t)->node->record_count);
 
-      /* if new subtree has only T - 1 keys, re-balance the tree */
-      if (BT_COUNT(next) < BT_ORDER(node))
-      {
+    memcpy(record,BT_RECORD((*t)->node,(*t)->position),BT_RECSIZE((*t)->node));
+    (*t)->position++;
 
-        left = right = NULL;
+    /* load the right child */
+    if (BT_INTERNAL((*t)->node))
+    {
+      mdbBtreeTraverseChild(t, 0);
+    }
+  }
 
-        /* if a left sibling of the subtree root node
-         * exists and has a key to spare...
-         */
-        if (i > 0)
-        {
-          left = node->T->ReadNode(node->children[i - 1], node->T);
+  return MDB_NO_ERROR;
+}
 
-          if (BT_COUNT(left) >= BT_ORDER(node))
-          {
-            /* ---------------------------------------------------------- *
-             * perform a rotate operation from the left sibling,          *
-             * through the parent node, into the subtree root node        *
-             * ---------------------------------------------------------- */
+void mdbBtreeTraverseReset(mdbBtreeTraversal **t)
+{
+  while ((*t)->parent != NULL)
+  {
+    mdbBtreeTraverseParent(t);
+  }
+  mdbBtreeTraverseEnd(t);
+  (*t)->position = 0;
+}
 
-            /* create space for the spared key/record */
-            BT_MOVERECORDS(next, 1, 0, BT_COUNT(next));
+/*
+ * The position of a traversal lies between two records: a leaf position
+ * is the index of its next record, the position of an internal node is
+ * the index of the current child (the B-tree records on its left were
+ * returned by mdbBtreeTraverse). mdbBtreeTraversePrev returns the record
+ * before the position and moves the position in front of it, so the
+ * traversal can change its direction (the record is returned again).
+ */
+mdbError mdbBtreeTraversePrev(mdbBtreeTraversal **t, char *record)
+{
+  mdbBtree *tree = (*t)->node->T;
 
-            /* insert the current record into the subtree root node,
-             * and replace the current record by its predecessor
-             */
-            BT_COPYRECORDS(next, 0, node, i - 1, 1);
-            BT_COPYPREDECESSOR(node, i - 1, left);
+  if (!(*t)->latched)
+  {
+    mdbLatchNode((*t)->node, MDB_LATCH_SHARED);
+    (*t)->latched = 1;
+  }
 
-            /* if the children are internal nodes, move the left
-             * sibling's last child pointer to the subtree root node
-             */
-            if (BT_INTERNAL(next))
-            {
-              BT_MOVECHILDREN(next, 1, 0, BT_COUNT(next) + 1);
-              next->children[0] = left->children[BT_COUNT(left)];
-            }
+  /* the end of a traversal (or of its subtree, mdbBtreeTraverseLast)
+   * continues with the right-most leaf of its current child */
+  if (BT_INTERNAL((*t)->node) && (*t)->position > 0)
+  {
+    while (BT_INTERNAL((*t)->node))
+    {
+      mdbBtreeTraverseChild(t, 1);
+    }
+  }
 
-            /* update all nodes */
-            BT_COUNT(next) = BT_COUNT(next) + 1;
-            BT_COUNT(left) = BT_COUNT(left) - 1;
+  while ((*t)->position == 0 || BT_INTERNAL((*t)->node))
+  {
+    /* go back to the first ancestor with a child on the left */
+    do
+    {
+      if ((*t)->parent == NULL)
+      {
+        /* no more records */
+        return mdbBtreeTraverseEnd(t);
+      }
+      mdbBtreeTraverseParent(t);
+    }
+    while ((*t)->position == 0);
 
-            node->children[i - 1] = node->T->WriteNode(left);
-            node->children[i] = node->T->WriteNode(next);
-            node->position = node->T->WriteNode(node);
+    (*t)->position--;
 
-            free(left->data);
-            free(left);
-            /* ---------------------------------------------------------- */
-            goto MDB_BTREE_DELETE_RECURSE;
-          }
-        }
+    /* B-tree: the parent record between the two children comes first,
+     * the position moves to the end of the left child */
+    if (!BT_PLUS(tree))
+    {
+      memcpy(record, BT_RECORD((*t)->node, (*t)->position),
+          BT_RECSIZE((*t)->node));
+      mdbBtreeTraverseChild(t, 1);
+      return MDB_NO_ERROR;
+    }
 
-        /* otherwise, if the right sibling of the
-         * subtree root has a key to spare...
-         */
-        if (i < BT_COUNT(node))
-        {
-          right = node->T->ReadNode(node->children[i + 1], node->T);
+    /* B+-tree: the right-most leaf of the left subtree */
+    while (BT_INTERNAL((*t)->node))
+    {
+      mdbBtreeTraverseChild(t, 1);
+    }
+  }
 
-          if (BT_COUNT(right) >= BT_ORDER(node))
-          {
-            /* ---------------------------------------------------------- *
-             * perform a reverse rotate operation from the right sibling, *
-             * through the parent node, into the subtree root node        *
-             * ---------------------------------------------------------- */
+  (*t)->position--;
+  memcpy(record,BT_RECORD((*t)->node,(*t)->position),BT_RECSIZE((*t)->node));
+  return MDB_NO_ERROR;
+}
 
-            /* insert the current record into the subtree root node */
-            BT_COPYRECORDS(next, BT_COUNT(next), node, i, 1);
+void mdbBtreeTraverseLast(mdbBtreeTraversal **t)
+{
+  mdbBtreeTraverseReset(t);
+  mdbLatchNode((*t)->node, MDB_LATCH_SHARED);
+  (*t)->latched = 1;
+  (*t)->position = BT_COUNT((*t)->node);
+  while (BT_INTERNAL((*t)->node))
+  {
+    mdbBtreeTraverseChild(t, 1);
+  }
+}
 
-            /* replace the current record by its successor */
-            BT_COPYSUCCESSOR(node, i, right);
+/* Number of entries per node (bulk loading) for the given fill factor */
+static uint32 mdbBtreeFillCount(const uint32 order, const uint8 fill)
+{
+  const uint32 max = (order << 1) - 1;
+  uint32 count = (max * fill) / 100;
 
-            /* if the children are internal nodes, move the right
-             * sibling's first child pointer to the subtree root node
-             */
-            if (BT_INTERNAL(next))
-            {
-              next->children[BT_COUNT(next) + 1] = right->children[0];
-              BT_MOVECHILDREN(right, 0, 1, BT_COUNT(right));
-            }
+  if (count < order - 1) count = order - 1;
+  if (count > max) count = max;
 
-            /* shift all records of the right sibling to left by one */
-            BT_MOVERECORDS(right, 0, 1, BT_COUNT(right) - 1);
+  return count;
+}
 
-            /* update all nodes */
-            BT_COUNT(next) = BT_COUNT(next) + 1;
-            BT_COUNT(right) = BT_COUNT(right) - 1;
+/*
+ * Number of children of the next node of a packed internal level: the
+ * node gets separators (at most "max" children) until the size of its page
+ * would exceed the limit, the last node of the level gets at least two
+ * children. The sizes are calculated without the common prefix.
+ */
+static uint32 mdbBtreeBulkLoadPacked(const char* separators,
+    const uint32 count, const uint32 size, const uint32 max,
+    const uint32 limit)
+{
+  uint32 bytes = MDB_BTREE_PACKED_HEADER + sizeof(uint32);
+  uint32 k = 1;
 
-            node->children[i + 1] = node->T->WriteNode(right);
-            node->children[i] = node->T->WriteNode(next);
-            node->position = node->T->WriteNode(node);
+  while (k < count && k < max && bytes + sizeof(uint32) + sizeof(uint16) +
+      BT_KEYLEN(separators + (k - 1) * size) <= limit)
+  {
+    bytes += sizeof(uint32) + sizeof(uint16) +
+        BT_KEYLEN(separators + (k - 1) * size);
+    k++;
+  }
 
-            if (left != NULL)
-            {
-              free(left->data);
-              free(left);
-            }
-            free(right->data);
-            free(right);
-            /* ---------------------------------------------------------- */
-            goto MDB_BTREE_DELETE_RECURSE;
-          }
-        }
+  if (count - k == 1 && k > 2)
+  {
+    k--;
+  }
+  return k;
+}
 
-        /* otherwise, both the left and right siblings of the subtree
-         * root node contain T - 1 keys, so perform a merge where possible
-         */
-        if (left != NULL)
-        {
-          mdbBtreeMergeNodes(left, next, node, i-1);
-          next = left;
-        }
-        else
-        {
-          mdbBtreeMergeNodes(next, right, node, i);
-        }
+/*
+ * Builds the internal levels of a bulk loaded B-tree bottom-up. The given
+ * nodes (their positions and the separators between them) are distributed
+ * evenly over the nodes of the next level, whose positions and separators
+ * replace them in the same arrays. The last level is stored in the root
+ * node. The separators are records (B-tree) or keys (B+-tree). The nodes
+ * of a packed B+-tree are filled up to the fill factor of their pages.
+ */
+static void mdbBtreeBulkLoadLevels(mdbBtree* t, uint32* children,
+    char* separators, uint32 count, const uint8 fill)
+{
+  const uint32 order = t->meta.inner_order;
+  const uint32 size = BT_PLUS(t) ? t->meta.key_size : t->meta.record_size;
+  const uint32 per_node = mdbBtreeFillCount(order, fill);
+  const int packed = BT_PACKED(t);
+  uint32 limit = (uint32)(((uint64)t->nodeSize * fill) / 100);
+  mdbBtreeNode* node = NULL;
+  uint32 nodes, n, k, c;
+
+  if (limit < (t->nodeSize >> 1)) limit = t->nodeSize >> 1;
+  if (limit > t->nodeSize) limit = t->nodeSize;
+
+  /* until the nodes fit into the root node */
+  while (count > (order << 1) || (packed && mdbBtreeBulkLoadPacked(separators,
+      count, size, order << 1, t->nodeSize) < count))
+  {
+    /* every node gets between T and 2T children */
+    nodes = (count + per_node) / (per_node + 1);
+    if (!packed && count / nodes < order)
+    {
+      nodes = count / order;
+    }
+
+    for (n = 0, c = 0; c < count; n++)
+    {
+      k = packed ? mdbBtreeBulkLoadPacked(separators + c * size, count - c,
+          size, per_node + 1, limit) :
+          count / nodes + ((n < count % nodes) ? 1 : 0);
+
+      mdbAllocateNode(&node, t);
+      BT_COUNT(node) = k - 1;
+      memcpy(node->children, children + c, k * sizeof(uint32));
+      memcpy(node->records, separators + c * size, (k - 1) * size);
+
+      /* the arrays are reused for the next level (n <= c) */
+      children[n] = t->WriteNode(node);
+      mdbFreeNode(node, 0);
+      c += k;
+
+      /* the separator after the node moves to the next level */
+      if (c < count)
+      {
+        memmove(separators + n * size, separators + (c - 1) * size, size);
       }
+    }
+    count = n;
+  }
 
-      MDB_BTREE_DELETE_RECURSE:
+  *t->root->is_leaf = 0;
+  mdbLayoutNode(t->root);
+  BT_COUNT(t->root) = count - 1;
+  memcpy(t->root->children, children, count * sizeof(uint32));
+  memcpy(t->root->records, separators, (count - 1) * size);
+}
 
-      result = mdbBtreeDeleteRecursive(key, next);
-      return result;
-    }
+/*
+ * Evens out the last two leaves of a bulk loaded B-tree: the last leaf may
+ * have less than T - 1 records, so it is merged with the previous one (if
+ * everything fits into one node) or gets records from it. Returns 0 if the
+ * leaves were merged (the last leaf is not needed anymore).
+ */
+static int mdbBtreeBulkLoadFixLeaf(mdbBtreeNode* prev, mdbBtreeNode* leaf,
+    char* separator)
+{
+  const uint32 total = BT_COUNT(prev) + 1 + BT_COUNT(leaf);
+  uint32 left, moved;
+
+  if (BT_COUNT(leaf) >= BT_ORDER(leaf) - 1)
+  {
+    return 1;
   }
+
+  /* merge both leaves (with the separator between them) */
+  if (total <= (BT_ORDER(leaf) << 1) - 1)
+  {
+    memcpy(BT_RECORD(prev, BT_COUNT(prev)), separator, BT_RECSIZE(prev));
+    BT_COPYRECORDS(prev, BT_COUNT(prev) + 1, leaf, 0, BT_COUNT(leaf));
+    BT_COUNT(prev) = total;
+    return 0;
+  }
+
+  /* otherwise, move records of the previous leaf through the separator */
+  left = (total - 1) >> 1;
+  moved = BT_COUNT(prev) - left - 1;
+
+  BT_MOVERECORDS(leaf, moved + 1, 0, BT_COUNT(leaf));
+  BT_COPYRECORDS(leaf, 0, prev, left + 1, moved);
+  memcpy(BT_RECORD(leaf, moved), separator, BT_RECSIZE(leaf));
+  memcpy(separator, BT_RECORD(prev, left), BT_RECSIZE(prev));
+
+  BT_COUNT(leaf) = BT_COUNT(leaf) + moved + 1;
+  BT_COUNT(prev) = left;
+  return 1;
 }
 
 /*
- * B-tree deletion function
+ * The same for the last two leaves of a bulk loaded B+-tree (the separator
+ * is only a copy of the first key of the last leaf). Slotted leaves are
+ * evened out by the size of their pages.
  */
-mdbError mdbBtreeDelete(const char* key, mdbBtree* t)
+static int mdbBtreeBulkLoadFixPlusLeaf(mdbBtreeNode* prev, mdbBtreeNode* leaf,
+    char* separator)
 {
-  mdbBtreeNode *newRoot = NULL;
+  const uint32 total = BT_COUNT(prev) + BT_COUNT(leaf);
+  const uint32 max = (BT_ORDER(leaf) << 1) - 1;
+  const int slotted = BT_SLOTTED(prev->T);
+  uint32 left, right, size;
+  uint32 moved;
+
+  if (slotted ? !mdbBtreeUnderfull(leaf, 0) :
+      BT_COUNT(leaf) >= BT_ORDER(leaf) - 1)
+  {
+    return 1;
+  }
+
+  /* merge both leaves */
+  if (total <= max && (!slotted || mdbBtreeSlottedSize(prev) +
+      mdbBtreeSlottedSize(leaf) - MDB_BTREE_SLOTTED_HEADER <=
+      prev->T->nodeSize))
+  {
+    BT_COPYRECORDS(prev, BT_COUNT(prev), leaf, 0, BT_COUNT(leaf));
+    BT_COUNT(prev) = total;
+    BT_NEXT(prev) = BT_NEXT(leaf);
+    return 0;
+  }
 
-  if (t->root != NULL)
+  /* otherwise, move the last records of the previous leaf (slotted leaves:
+   * while the page of the last leaf stays smaller) */
+  moved = BT_COUNT(prev) - (total >> 1);
+  if (slotted)
   {
-    /* root node is empty and an internal node */
-    if (BT_COUNT(t->root) == 0)
+    left = mdbBtreeSlottedSize(prev);
+    right = mdbBtreeSlottedSize(leaf);
+
+    for (moved = 0; moved + 1 < BT_COUNT(prev) &&
+        BT_COUNT(leaf) + moved < max; moved++)
     {
-      if (BT_INTERNAL(t->root))
-      {
-        /* the B-tree height decreases by one and the root node's
-         * only child becomes the new root node
-         */
-        newRoot = t->ReadNode(t->root->children[0], t);
-        t->DeleteNode(t->root);
-        free(t->root->data);
-        free(t->root);
-        t->root = newRoot;
-        /* continue deletion from new root node */
-        return mdbBtreeDeleteRecursive(key, t->root);
-      }
-      else
+      size = mdbBtreeEntrySize(prev, BT_COUNT(prev) - moved - 1, 0);
+      if (right + size > left - size)
       {
-        return MDB_BTREE_ROOT_IS_EMPTY;
+        break;
       }
+      left -= size;
+      right += size;
     }
-    return mdbBtreeDeleteRecursive(key, t->root);
   }
-  else
+
+  BT_MOVERECORDS(leaf, moved, 0, BT_COUNT(leaf));
+  BT_COPYRECORDS(leaf, 0, prev, BT_COUNT(prev) - moved, moved);
+  memcpy(separator, BT_KEY(leaf, 0), prev->T->meta.key_size);
+
+  BT_COUNT(leaf) = BT_COUNT(leaf) + moved;
+  BT_COUNT(prev) = BT_COUNT(prev) - moved;
+
+  if (BT_PACKED(prev->T))
   {
-    return MDB_BTREE_NO_ROOT;
+    mdbBtreeTruncateKey(separator, BT_KEY(prev, BT_COUNT(prev) - 1));
   }
+  return 1;
 }
 
-mdbError mdbBtreeTraverse(mdbBtreeTraversal **t, char *record)
+/*
+ * Releases the pages of a failed bulk load: the written leaves and the
+ * positions reserved for the last two (B+-tree) leaves. The root node was
+ * not touched, so the tree stays empty.
+ */
+static void mdbBtreeBulkLoadRelease(mdbBtree* t, const uint32* children,
+    uint32 leaves, mdbBtreeNode* prev, mdbBtreeNode* leaf)
 {
-  mdbBtreeTraversal *tmp;
-  mdbBtree *tree = (*t)->node->T;
+  mdbBtreeNode* node;
+  uint32 i;
 
-  /* find left-most leaf node */
-  while (BT_INTERNAL((*t)->node))
+  for (i = 0; i < leaves; i++)
+  {
+    if ((node = t->ReadNode(children[i], t)) != NULL)
+    {
+      t->DeleteNode(node);
+      mdbFreeNode(node, 0);
+    }
+  }
+  if (prev != NULL && prev->position != 0)
+  {
+    t->DeleteNode(prev);
+  }
+  if (leaf->position != 0)
+  {
+    t->DeleteNode(leaf);
+  }
+}
+
+/*
+ * B-tree bulk loading function
+ *
+ * Builds an empty B-tree from records delivered in ascending key order by
+ * the record source. The leaves are filled (up to the fill factor, given in
+ * percent) and written one after another, while the separators between
+ * them are collected. The internal levels are then built bottom-up from the
+ * separators. The root node keeps its position in the file.
+ *
+ * A B-tree leaf is separated from the next one by a record, a B+-tree leaf
+ * by a copy of the first key of the next leaf (packed B+-tree: its shortest
+ * prefix separating the leaves). The B+-tree leaves are
+ * linked, so the position of a new leaf is reserved (written) when it is
+ * started and stored in the previous leaf. Slotted leaves are filled up to
+ * the fill factor of their pages.
+ */
+mdbError mdbBtreeBulkLoad(mdbBtree* t, mdbRecordSourcePtr source, void* cls,
+    uint8 fill)
+{
+  const int plus = BT_PLUS(t);
+  const uint32 size = t->meta.record_size;
+  const uint32 separator_size = plus ? t->meta.key_size : size;
+  const uint32 separator_key = plus ? 0 : t->meta.key_position;
+  const int slotted = BT_SLOTTED(t);
+  const uint32 per_node = slotted ? (t->meta.leaf_order << 1) - 1 :
+      mdbBtreeFillCount(t->meta.order, fill);
+  uint32 limit = (uint32)(((uint64)t->nodeSize * fill) / 100);
+  uint32 bytes = MDB_BTREE_SLOTTED_HEADER; /* page size of the leaf   */
+  uint32 entry = 0;
+  mdbBtreeNode* prev = NULL;      /* last full leaf (not written yet)  */
+  mdbBtreeNode* leaf = NULL;      /* leaf being filled                 */
+  uint32* children = NULL;        /* positions of the written leaves   */
+  char* separators = NULL;        /* separators between the leaves     */
+  uint32 leaves = 0;              /* number of written leaves          */
+  uint32 count = 0;               /* number of separators              */
+  uint32 capacity = 0;
+  mdbError result = MDB_NO_ERROR;
+  char* record;
+  char* last;
+
+  if (t->root == NULL)
   {
-    tmp = (mdbBtreeTraversal*)malloc(sizeof(mdbBtreeTraversal));
-    tmp->parent = *t;
-    tmp->position = 0;
-    tmp->node = tree->ReadNode((*t)->node->children[(*t)->position], tree);
-    *t = tmp;
+    return MDB_BTREE_NO_ROOT;
+  }
+  if (BT_COUNT(t->root) > 0 || BT_INTERNAL(t->root))
+  {
+    return MDB_BTREE_NOT_EMPTY;
   }
 
-  /* if there are still records to be returned from current leaf... */
-  if ((*t)->position < *(*t)->node->record_count)
+  if (limit < (t->nodeSize >> 1)) limit = t->nodeSize >> 1;
+  if (limit > t->nodeSize) limit = t->nodeSize;
+
+  record = (char*) malloc(size);
+  mdbAllocateNode(&leaf, t);
+  *leaf->is_leaf = 1;
+  mdbLayoutNode(leaf);
+
+  while (source(record, cls))
   {
-    memcpy(record,BT_RECORD((*t)->node,(*t)->position),BT_RECSIZE((*t)->node));
-    (*t)->position++;
+    /* the records have to be sorted (and the keys unique) */
+    last = (BT_COUNT(leaf) > 0) ? BT_KEY(leaf, BT_COUNT(leaf) - 1) :
+        ((count > 0) ? separators + (count - 1) * separator_size +
+        separator_key : NULL);
+
+    if (last != NULL && mdbBtreeCmp(record + t->meta.key_position, last, t) <= 0)
+    {
+      result = MDB_BTREE_NOT_SORTED;
+      break;
+    }
+
+    if (slotted)
+    {
+      entry = sizeof(uint32) + mdbBtreeRecordSize(t, record);
+    }
+    if (BT_COUNT(leaf) < per_node && (!slotted || bytes + entry <= limit))
+    {
+      memcpy(BT_RECORD(leaf, BT_COUNT(leaf)), record, size);
+      BT_COUNT(leaf) = BT_COUNT(leaf) + 1;
+      bytes += entry;
+      continue;
+    }
+
+    /* the leaf is full, the record (or its key) separates it from the
+     * next leaf */
+    if (count == capacity)
+    {
+      capacity = (capacity > 0) ? (capacity << 1) : 64;
+      children = (uint32*) realloc(children, (capacity + 1) * sizeof(uint32));
+      separators = (char*) realloc(separators, capacity * separator_size);
+    }
+    if (prev != NULL)
+    {
+      children[leaves++] = t->WriteNode(prev);
+      mdbFreeNode(prev, 0);
+    }
+    memcpy(separators + (count++) * separator_size,
+        record + t->meta.key_position - separator_key, separator_size);
+    if (BT_PACKED(t))
+    {
+      mdbBtreeTruncateKey(separators + (count - 1) * separator_size,
+          BT_KEY(leaf, BT_COUNT(leaf) - 1));
+    }
+
+    prev = leaf;
+    mdbAllocateNode(&leaf, t);
+    *leaf->is_leaf = 1;
+    mdbLayoutNode(leaf);
+
+    if (plus)
+    {
+      memcpy(BT_RECORD(leaf, 0), record, size);
+      BT_COUNT(leaf) = 1;
+      BT_NEXT(prev) = t->WriteNode(leaf);
+    }
+    bytes = MDB_BTREE_SLOTTED_HEADER + (plus ? entry : 0);
   }
-  /* else, go back to parent and return the parent record */
-  else
+
+  if (result == MDB_NO_ERROR)
   {
-    do
+    /* a single leaf becomes the root node */
+    if (prev == NULL)
     {
-      if ((*t)->parent == NULL)
+      memcpy(t->root->data, leaf->data, t->bufferSize);
+    }
+    else
+    {
+      if (!(plus ? mdbBtreeBulkLoadFixPlusLeaf : mdbBtreeBulkLoadFixLeaf)(prev,
+          leaf, separators + (count - 1) * separator_size))
       {
-        /* no more records */
-        return MDB_BTREE_NO_MORE_RECORDS;
+        count--;
+      }
+      children[leaves++] = t->WriteNode(prev);
+      if (leaves == count)
+      {
+        children[leaves++] = t->WriteNode(leaf);
+      }
+      else if (plus)
+      {
+        /* the reserved position of the merged leaf is not used */
+        t->DeleteNode(leaf);
       }
-      tmp = (*t)->parent;
-      free((*t)->node->data);
-      free(*t);
-      *t = tmp;
+      mdbBtreeBulkLoadLevels(t, children, separators, leaves, fill);
     }
-    while (tmp->position == *tmp->node->record_count);
-
-    memcpy(record,BT_RECORD((*t)->node,(*t)->position),BT_RECSIZE((*t)->node));
-    (*t)->position++;
-
-    /* load the right child */
-    if (BT_INTERNAL((*t)->node))
+    t->root->position = t->WriteNode(t->root);
+    if (BT_SHADOW(t))
     {
-      tmp = (mdbBtreeTraversal*)malloc(sizeof(mdbBtreeTraversal));
-      tmp->parent = *t;
-      tmp->position = 0;
-      tmp->node = tree->ReadNode((*t)->node->children[(*t)->position], tree);
-      *t = tmp;
+      mdbShadowPublish(t);
     }
   }
 
-  return MDB_NO_ERROR;
+  else
+  {
+    mdbBtreeBulkLoadRelease(t, children, leaves, prev, leaf);
+  }
+
+  if (prev != NULL)
+  {
+    mdbFreeNode(prev, 0);
+  }
+  mdbFreeNode(leaf, 0);
+  free(children);
+  free(separators);
+  free(record);
+
+  return result;
 }
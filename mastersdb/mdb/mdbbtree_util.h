@@ -26,6 +26,13 @@
  *  Added utility macros for code readability improvement.
  *  The BtreeNode structure now contains a pointer to the B-tree structure
  *    (for parameter count reduction).
+ * 17.10.2026
+ *  Records, keys and the order are taken from the node layout (B+-tree
+ *  internal nodes hold keys instead of records).
+ *  Added the B+-tree macros (BT_PLUS, BT_NEXT).
+ *  Added the packed key macros (BT_PACKED, BT_KEYLEN).
+ *  Added the slotted leaf macros (BT_SLOTTED, BT_PACKED_PAGE).
+ *  Added the copy-on-write macro (BT_SHADOW).
  */
 
 #ifndef MDBBTREE_UTIL_H_
@@ -40,11 +47,11 @@
   (tree)->nodeSize = 2 * ((tree)->meta.order + 1) * sizeof(uint32) + \
   (2 * (tree)->meta.order - 1) * (tree)->meta.record_size
 
-/* Returns a pointer to the i-th record of a node */
+/* Returns a pointer to the i-th record (B+-tree internal node: key) */
 #define BT_RECORD(node,i)   (node->records + (i) * BT_RECSIZE(node))
 
 /* Returns a pointer to the i-th key in a node */
-#define BT_KEY(node,i)      (BT_RECORD(node,i) + BT_KEYPOS(node))
+#define BT_KEY(node,i)      (BT_RECORD(node,i) + node->key_offset)
 
 /* Tests whether the given node is a leaf or internal node */
 #define BT_LEAF(node)       (*node->is_leaf > 0)
@@ -55,10 +62,34 @@
 
 /* B-tree node meta-data shortcuts */
 #define BT_KEYPOS(node)     node->T->meta.key_position
-#define BT_RECSIZE(node)    node->T->meta.record_size
-#define BT_ORDER(node)      node->T->meta.order
+#define BT_RECSIZE(node)    node->entry_size
+#define BT_ORDER(node)      node->order
 #define BT_ROOTPOS(node)    node->T->meta.root_position
 
+/* Tests whether a B-tree is a B+-tree */
+#define BT_PLUS(tree)       (((tree)->meta.flags & MDB_BTREE_PLUS) > 0)
+
+/* Tests whether the internal nodes of a B+-tree are packed */
+#define BT_PACKED(tree)     (((tree)->meta.flags & MDB_BTREE_PACKED) > 0)
+
+/* Tests whether the leaves of a B+-tree are slotted pages */
+#define BT_SLOTTED(tree)    (((tree)->meta.flags & MDB_BTREE_SLOTTED) > 0)
+
+/* Tests whether the nodes of a B-tree are stored compressed */
+#define BT_COMPRESSED(tree) (((tree)->meta.flags & MDB_BTREE_COMPRESSED) > 0)
+
+/* Tests whether a B-tree is copy-on-write */
+#define BT_SHADOW(tree)     (((tree)->meta.flags & MDB_BTREE_SHADOW) > 0)
+
+/* Tests whether a node has another layout on its page than in memory */
+#define BT_PACKED_PAGE(node) MDB_BTREE_PACKED_PAGE(node->T, BT_LEAF(node))
+
+/* Length of a STRING key (the characters follow the length) */
+#define BT_KEYLEN(k)        (*((const uint32*)(k)))
+
+/* Position of the next leaf (B+-tree leaves are linked) */
+#define BT_NEXT(node)       node->children[0]
+
 /* Tests whether the left key is greater, less or equal than the right one */
 #define BT_KEYCMP(k1,op,k2,node,size) \
   (node->T->CompareKeys((k1),(k2),size) op 0)
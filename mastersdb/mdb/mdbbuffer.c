@@ -0,0 +1,666 @@
+/*
+ * mdbbuffer.c
+ *
+ * Buffer pool (node cache) shared by all B-trees of a database
+ *
+ * Copyright (C) 2010, Dinko Hasanbasic (dinko.hasanbasic@gmail.com)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ * Revision history
+ * ----------------
+ * 17.10.2026
+ *  Initial version of file.
+ *  Implemented a fixed-size buffer pool with pin/unpin semantics and
+ *  clock (second chance) replacement.
+ *  The cached copies are updated with the whole node buffer (packed nodes).
+ *  Write-back: written nodes are only marked dirty, the checkpoints write
+ *  them sorted by position (mdbBufferPoolFlush).
+ *  Added mdbBufferPrefetch (batched asynchronous node reads).
+ *  The pool is shared by threads: a mutex guards the frames and the hash
+ *  table, the nodes are read without it. Every frame has a readers/writer
+ *  latch of its node (mdbLatchNode), the checkpoints write the nodes which
+ *  are not latched exclusively. A pool whose frames are all pinned grows
+ *  into reserved frames (MDB_BUFFER_POOL_GROWTH).
+ *  The frame latches prefer writers (mdbLatchInit), mdbBufferMarkDirty
+ *  latches the frame exclusively while it copies a private node into it.
+ *  A node being read is latched exclusively like a node being changed
+ *  (odd version, the optimistic readers wait for it), MDB_LATCH_LOAD keeps
+ *  no image of it.
+ *  Added mdbBufferFind: the optimistic readers find the cached nodes
+ *  without locking the pool and without pinning them. A frame keeps the
+ *  structure and buffer of its released node for its next node (the
+ *  smaller buffers are retired until the pool is freed), so the memory an
+ *  optimistic reader reads is never freed; a frame changes its version
+ *  when its node is released or replaced. The reference bit is a relaxed
+ *  atomic (mdbBufferFind sets it without the pool lock).
+ */
+
+#include "mdb.h"
+
+#include <stdlib.h>
+
+/* marks the end of a hash chain / an unused bucket */
+#define MDB_BUFFER_NIL  0xFFFFFFFF
+
+/* Returns the hash bucket of a node position */
+static uint32 mdbBufferHash(const mdbBufferPool *pool, const uint32 position)
+{
+  return (uint32)((position * 2654435761U) % pool->buckets_count);
+}
+
+/* Returns the index of the frame caching the given position (or NIL) */
+static uint32 mdbBufferLookup(const mdbBufferPool *pool, const uint32 position)
+{
+  uint32 f = pool->buckets[mdbBufferHash(pool, position)];
+
+  while (f != MDB_BUFFER_NIL && pool->frames[f].node->position != position)
+  {
+    f = pool->frames[f].next;
+  }
+  return f;
+}
+
+/* Removes a frame from its hash chain (the node stays in the frame) */
+static void mdbBufferUnlink(mdbBufferPool *pool, const uint32 f)
+{
+  uint32 *link = &pool->buckets[mdbBufferHash(pool,
+      pool->frames[f].node->position)];
+
+  while (*link != f)
+  {
+    link = &pool->frames[*link].next;
+  }
+  *link = pool->frames[f].next;
+  pool->frames[f].next = MDB_BUFFER_NIL;
+  pool->frames[f].cached = 0;
+
+  /* the node was deleted (or is released after it was written back) */
+  if (pool->frames[f].dirty)
+  {
+    pool->frames[f].dirty = 0;
+    pool->dirty--;
+  }
+}
+
+/* Frees a node structure with its buffer */
+static void mdbBufferDestroy(mdbBtreeNode *node)
+{
+  free(node->data);
+  free(node);
+}
+
+/* Keeps a released node until the pool is freed (see mdbBufferFind) */
+static void mdbBufferRetire(mdbBufferPool *pool, mdbBtreeNode *node)
+{
+  pool->retired = (mdbBtreeNode**)realloc(pool->retired,
+      (pool->retired_count + 1) * sizeof(mdbBtreeNode*));
+  pool->retired[pool->retired_count++] = node;
+}
+
+/*
+ * Releases the node of an unpinned frame, making the frame free. The node
+ * becomes the spare node of the frame: an optimistic reader may still
+ * read it, the new version of the frame tells the reader that the node
+ * was released.
+ */
+static void mdbBufferRelease(mdbBufferPool *pool, const uint32 f)
+{
+  mdbBufferFrame *frame = &pool->frames[f];
+
+  __atomic_add_fetch(&frame->latch.version, 2, __ATOMIC_SEQ_CST);
+  if (frame->cached)
+  {
+    mdbBufferUnlink(pool, f);
+  }
+  if (frame->spare != NULL)
+  {
+    mdbBufferRetire(pool, frame->spare);
+  }
+  frame->spare = frame->node;
+  __atomic_store_n(&frame->node, NULL, __ATOMIC_RELEASE);
+  __atomic_store_n(&frame->referenced, 0, __ATOMIC_RELAXED);
+}
+
+/*
+ * Returns the node structure of a node put into a free frame: the spare
+ * node of the frame is reused if its buffer is large enough. The frame is
+ * latched for the load (MDB_LATCH_LOAD) before the node can be found.
+ */
+static mdbBtreeNode* mdbBufferNode(mdbBufferPool *pool, const uint32 f,
+    mdbBtree *tree, const uint32 position)
+{
+  mdbBufferFrame *frame = &pool->frames[f];
+  mdbBtreeNode *node = frame->spare;
+
+  frame->spare = NULL;
+  if (node != NULL && frame->size >= tree->bufferSize)
+  {
+    memset(node->data, 0, tree->bufferSize);
+    mdbInitializeNode(node, tree, node->data);
+    node->mapped = 0;
+    node->tail = 0L;
+    node->tail_size = 0L;
+    node->tail_owner = 0L;
+  }
+  else
+  {
+    if (node != NULL)
+    {
+      mdbBufferRetire(pool, node);
+    }
+    mdbAllocateNode(&node, tree);
+    frame->size = tree->bufferSize;
+  }
+
+  node->position = position;
+  node->frame = frame;
+  mdbLatchNode(node, MDB_LATCH_LOAD);
+  return node;
+}
+
+static void mdbBufferFlushFrames(mdbBufferPool *pool);
+
+/*
+ * Finds a free frame, evicting an unpinned node if necessary (clock).
+ * If every frame is pinned, the pool may take one of its reserved frames
+ * (the threads sharing a node need its frame). Returns NIL if every frame
+ * is pinned and the pool does not grow.
+ */
+static uint32 mdbBufferVictim(mdbBufferPool *pool, const uint8 grow)
+{
+  uint32 scanned;
+  uint32 f;
+
+  /* two sweeps: the first one may only clear the reference bits */
+  for (scanned = 0; scanned < (pool->capacity << 1); scanned++)
+  {
+    f = pool->hand;
+    pool->hand = (pool->hand + 1) % pool->capacity;
+
+    if (pool->frames[f].node == NULL)
+    {
+      return f;
+    }
+    if (pool->frames[f].pins > 0)
+    {
+      continue;
+    }
+    if (__atomic_load_n(&pool->frames[f].referenced, __ATOMIC_RELAXED))
+    {
+      __atomic_store_n(&pool->frames[f].referenced, 0, __ATOMIC_RELAXED);
+      continue;
+    }
+
+    /* a dirty victim writes all dirty nodes back in one sorted batch, so
+     * the next victims are clean */
+    if (pool->frames[f].dirty)
+    {
+      mdbBufferFlushFrames(pool);
+    }
+    mdbBufferRelease(pool, f);
+    return f;
+  }
+
+  if (grow && pool->capacity < pool->reserved)
+  {
+    return pool->capacity++;
+  }
+  return MDB_BUFFER_NIL;
+}
+
+/* Puts a node into a free frame (found by its position from now on) */
+static void mdbBufferInsert(mdbBufferPool *pool, const uint32 f,
+    mdbBtreeNode *node, const uint32 pins)
+{
+  uint32 b = mdbBufferHash(pool, node->position);
+
+  node->frame = &pool->frames[f];
+  pool->frames[f].pins = pins;
+  __atomic_store_n(&pool->frames[f].referenced, 1, __ATOMIC_RELAXED);
+  pool->frames[f].cached = 1;
+  pool->frames[f].next = pool->buckets[b];
+  __atomic_store_n(&pool->frames[f].node, node, __ATOMIC_RELEASE);
+  __atomic_store_n(&pool->buckets[b], f, __ATOMIC_RELEASE);
+}
+
+/* Creates a buffer pool with the given number of frames */
+mdbError mdbBufferPoolCreate(mdbBufferPool **pool, uint32 capacity)
+{
+  mdbBufferPool *l_pool = (mdbBufferPool*)malloc(sizeof(mdbBufferPool));
+  uint32 i;
+
+  l_pool->capacity = capacity;
+  l_pool->reserved = capacity * MDB_BUFFER_POOL_GROWTH;
+  l_pool->buckets_count = capacity << 1;
+  l_pool->hand = 0;
+  l_pool->hits = 0;
+  l_pool->misses = 0;
+  l_pool->dirty = 0;
+  l_pool->written = 0;
+  l_pool->prefetched = 0;
+  l_pool->retired = NULL;
+  l_pool->retired_count = 0;
+
+  l_pool->frames =
+      (mdbBufferFrame*)calloc(l_pool->reserved, sizeof(mdbBufferFrame));
+  l_pool->buckets =
+      (uint32*)malloc(l_pool->buckets_count * sizeof(uint32));
+
+  for (i = 0; i < l_pool->reserved; i++)
+  {
+    l_pool->frames[i].next = MDB_BUFFER_NIL;
+    mdbLatchInit(&l_pool->frames[i].latch);
+  }
+  pthread_mutex_init(&l_pool->lock, NULL);
+  for (i = 0; i < l_pool->buckets_count; i++)
+  {
+    l_pool->buckets[i] = MDB_BUFFER_NIL;
+  }
+
+  *pool = l_pool;
+  return MDB_NO_ERROR;
+}
+
+/* Frees the buffer pool and all cached nodes (pinned ones included), the
+ * dirty nodes have to be written back first (mdbBufferPoolFlush) */
+mdbError mdbBufferPoolFree(mdbBufferPool *pool)
+{
+  uint32 f;
+
+  for (f = 0; f < pool->reserved; f++)
+  {
+    if (pool->frames[f].node != NULL)
+    {
+      mdbBufferRelease(pool, f);
+    }
+    if (pool->frames[f].spare != NULL)
+    {
+      mdbBufferDestroy(pool->frames[f].spare);
+    }
+    mdbLatchDestroy(&pool->frames[f].latch);
+  }
+  for (f = 0; f < pool->retired_count; f++)
+  {
+    mdbBufferDestroy(pool->retired[f]);
+  }
+  free(pool->retired);
+  pthread_mutex_destroy(&pool->lock);
+  free(pool->frames);
+  free(pool->buckets);
+  free(pool);
+
+  return MDB_NO_ERROR;
+}
+
+/* Pins the node of a frame (the node may have been cached by an already
+ * freed mdbBtree structure of the same B-tree, so it is re-bound; the
+ * threads sharing a node use the same mdbBtree structure) */
+static mdbBtreeNode* mdbBufferHit(mdbBufferPool *pool, const uint32 f,
+    mdbBtree *tree)
+{
+  pool->frames[f].pins++;
+  __atomic_store_n(&pool->frames[f].referenced, 1, __ATOMIC_RELAXED);
+  if (pool->frames[f].node->T != tree)
+  {
+    pool->frames[f].node->T = tree;
+  }
+  return pool->frames[f].node;
+}
+
+/*
+ * Returns the (pinned) node at the given position, reading it from the
+ * file only if it is not cached yet. When all frames are pinned (and the
+ * pool cannot grow anymore), a private (uncached) copy of the node is
+ * returned instead.
+ * A missing node gets its frame first and is read without holding the
+ * pool, its frame is latched exclusively until the node is loaded (the
+ * other threads pinning it wait for the latch).
+ */
+mdbBtreeNode* mdbBufferPin(mdbBufferPool *pool, const uint32 position,
+    mdbBtree *tree)
+{
+  mdbBtreeNode *node;
+  uint32 f;
+
+  pthread_mutex_lock(&pool->lock);
+  if ((f = mdbBufferLookup(pool, position)) != MDB_BUFFER_NIL)
+  {
+    pool->hits++;
+    node = mdbBufferHit(pool, f, tree);
+    pthread_mutex_unlock(&pool->lock);
+    return node;
+  }
+  pool->misses++;
+
+  if ((f = mdbBufferVictim(pool, 1)) != MDB_BUFFER_NIL)
+  {
+    node = mdbBufferNode(pool, f, tree, position);
+    mdbBufferInsert(pool, f, node, 1);
+  }
+  else
+  {
+    mdbAllocateNode(&node, tree);
+    node->position = position;
+  }
+  pthread_mutex_unlock(&pool->lock);
+
+  mdbLoadNode(node);
+  mdbUnlatchNode(node);
+
+  return node;
+}
+
+/*
+ * Finds the cached node at the given position for an optimistic reader:
+ * the pool is not locked and the node is not pinned, it may be released
+ * (or replaced) at any time. Returns the node and the version of its frame
+ * (the reader validates the version after reading the node, see
+ * mdbValidateNode), NULL if the node is not cached or is latched
+ * exclusively. The memory of a released node is never freed while the
+ * pool exists (spare and retired nodes), a hash chain changed meanwhile is
+ * followed at most as many steps as there are frames.
+ */
+mdbBtreeNode* mdbBufferFind(mdbBufferPool *pool, const uint32 position,
+    uint32 *version)
+{
+  mdbBufferFrame *frame = NULL;
+  mdbBtreeNode *node;
+  uint32 f = __atomic_load_n(&pool->buckets[mdbBufferHash(pool, position)],
+      __ATOMIC_ACQUIRE);
+  uint32 steps;
+
+  for (steps = 0; f != MDB_BUFFER_NIL && steps < pool->reserved; steps++)
+  {
+    frame = &pool->frames[f];
+    node = __atomic_load_n(&frame->node, __ATOMIC_ACQUIRE);
+    if (node != NULL && node->position == position)
+    {
+      break;
+    }
+    f = __atomic_load_n(&frame->next, __ATOMIC_ACQUIRE);
+  }
+  if (f == MDB_BUFFER_NIL || steps == pool->reserved)
+  {
+    return NULL;
+  }
+
+  /* the frame must still hold the node after the version was taken */
+  *version = __atomic_load_n(&frame->latch.version, __ATOMIC_ACQUIRE);
+  node = __atomic_load_n(&frame->node, __ATOMIC_ACQUIRE);
+  if ((*version & 1) || node == NULL || node->position != position ||
+      !__atomic_load_n(&frame->cached, __ATOMIC_ACQUIRE))
+  {
+    return NULL;
+  }
+
+  /* The reference bit is the only field of a frame written without the
+   * pool lock: it is a hint for the clock, a relaxed atomic is enough (a
+   * lost update only makes the node an earlier victim). It is only
+   * written when the clock cleared it. */
+  if (!__atomic_load_n(&frame->referenced, __ATOMIC_RELAXED))
+  {
+    __atomic_store_n(&frame->referenced, 1, __ATOMIC_RELAXED);
+  }
+  return node;
+}
+
+/* Releases a node obtained by mdbBufferPin */
+void mdbBufferUnpin(mdbBufferPool *pool, mdbBtreeNode *node)
+{
+  mdbBufferFrame *frame = node->frame;
+
+  pthread_mutex_lock(&pool->lock);
+  if (--frame->pins == 0 && !frame->cached)
+  {
+    /* the node was invalidated while it was pinned */
+    mdbBufferRelease(pool, frame - pool->frames);
+  }
+  pthread_mutex_unlock(&pool->lock);
+}
+
+/*
+ * Marks the cached copy of a written node as dirty. A private copy of a
+ * cached node is copied into the frame (the cached copy stays coherent).
+ * The frame keeps a copy of the B-tree structure, the B-tree which wrote
+ * the node may be freed before the node is written back. The copy latches
+ * the frame exclusively like any writer of the node (a thread using the
+ * cached node through another B-tree structure holds the frame latch):
+ * the pool lock is released meanwhile, a holder of the latch may wait
+ * for it, the pin keeps the node in its frame.
+ */
+int mdbBufferMarkDirty(mdbBufferPool *pool, mdbBtreeNode *node)
+{
+  mdbBufferFrame *frame = node->frame;
+  uint32 f;
+
+  pthread_mutex_lock(&pool->lock);
+  if (frame == NULL)
+  {
+    if ((f = mdbBufferLookup(pool, node->position)) == MDB_BUFFER_NIL)
+    {
+      pthread_mutex_unlock(&pool->lock);
+      return 0;
+    }
+    frame = &pool->frames[f];
+    frame->node->T = node->T;
+    frame->pins++;
+    pthread_mutex_unlock(&pool->lock);
+
+    /* odd version while the data changes (optimistic readers) */
+    pthread_rwlock_wrlock(&frame->latch.lock);
+    __atomic_add_fetch(&frame->latch.version, 1, __ATOMIC_SEQ_CST);
+    memcpy(frame->node->data, node->data, node->T->bufferSize);
+    mdbLayoutNode(frame->node);
+    __atomic_add_fetch(&frame->latch.version, 1, __ATOMIC_RELEASE);
+    pthread_rwlock_unlock(&frame->latch.lock);
+
+    pthread_mutex_lock(&pool->lock);
+    if (--frame->pins == 0 && !frame->cached)
+    {
+      /* the node was invalidated meanwhile */
+      mdbBufferRelease(pool, f);
+    }
+  }
+  if (!frame->cached)
+  {
+    pthread_mutex_unlock(&pool->lock);
+    return 0;
+  }
+
+  if (!frame->dirty)
+  {
+    frame->dirty = 1;
+    pool->dirty++;
+  }
+  frame->tree = *node->T;
+  pthread_mutex_unlock(&pool->lock);
+  return 1;
+}
+
+/* Orders the dirty nodes by their positions */
+static int mdbBufferComparePositions(const void *n1, const void *n2)
+{
+  uint32 p1 = (*(mdbBtreeNode* const*)n1)->position;
+  uint32 p2 = (*(mdbBtreeNode* const*)n2)->position;
+
+  return (p1 > p2) - (p1 < p2);
+}
+
+/*
+ * Writes the dirty nodes back in the order of their positions (the pages
+ * of adjacent nodes are written at once), the pool is locked. The nodes
+ * are written through copies of their node structures bound to the B-tree
+ * structures copied by mdbBufferMarkDirty. A node latched exclusively is
+ * being changed by a writer, it stays dirty until the next flush.
+ */
+static void mdbBufferFlushFrames(mdbBufferPool *pool)
+{
+  mdbBtreeNode *copies;
+  mdbBtreeNode **nodes;
+  mdbBtreeNode *node;
+  uint32 count = 0;
+  uint32 f;
+  uint32 i;
+
+  if (pool->dirty == 0)
+  {
+    return;
+  }
+
+  copies = (mdbBtreeNode*) malloc(pool->dirty * sizeof(mdbBtreeNode));
+  nodes = (mdbBtreeNode**) malloc(pool->dirty * sizeof(mdbBtreeNode*));
+
+  for (f = 0; f < pool->capacity; f++)
+  {
+    if (pool->frames[f].dirty &&
+        pthread_rwlock_tryrdlock(&pool->frames[f].latch.lock) == 0)
+    {
+      copies[count] = *pool->frames[f].node;
+      copies[count].T = &pool->frames[f].tree;
+      nodes[count] = &copies[count];
+      count++;
+    }
+  }
+  qsort(nodes, count, sizeof(mdbBtreeNode*), &mdbBufferComparePositions);
+  mdbStoreNodes(nodes, count);
+
+  for (i = 0; i < count; i++)
+  {
+    f = nodes[i]->frame - pool->frames;
+    node = pool->frames[f].node;
+
+    /* a compressed node may have got another tail */
+    node->tail = nodes[i]->tail;
+    node->tail_size = nodes[i]->tail_size;
+    node->tail_owner = nodes[i]->tail_owner;
+
+    pthread_rwlock_unlock(&pool->frames[f].latch.lock);
+    pool->frames[f].dirty = 0;
+  }
+  pool->dirty -= count;
+  pool->written += count;
+
+  free(nodes);
+  free(copies);
+}
+
+/* Writes the dirty nodes back, sorted by their positions */
+mdbError mdbBufferPoolFlush(mdbBufferPool *pool)
+{
+  pthread_mutex_lock(&pool->lock);
+  mdbBufferFlushFrames(pool);
+  pthread_mutex_unlock(&pool->lock);
+  return MDB_NO_ERROR;
+}
+
+/* Drops the cached copy of a node (e.g. after the node was deleted) */
+void mdbBufferInvalidate(mdbBufferPool *pool, const uint32 position)
+{
+  uint32 f;
+
+  pthread_mutex_lock(&pool->lock);
+  if ((f = mdbBufferLookup(pool, position)) != MDB_BUFFER_NIL)
+  {
+    if (pool->frames[f].pins > 0)
+    {
+      /* the node will be released by its last mdbBufferUnpin */
+      __atomic_add_fetch(&pool->frames[f].latch.version, 2, __ATOMIC_SEQ_CST);
+      mdbBufferUnlink(pool, f);
+    }
+    else
+    {
+      mdbBufferRelease(pool, f);
+    }
+  }
+  pthread_mutex_unlock(&pool->lock);
+}
+
+/* Completes a batched node read (called in the order the reads finish) */
+static void mdbBufferLoaded(mdbAioRequest *request, void *cls)
+{
+  (void)cls;
+  mdbPrepareNode((mdbBtreeNode*)request->cls);
+}
+
+/*
+ * Reads the uncached nodes at the given positions with one batch of
+ * asynchronous reads. The nodes are cached unpinned after the whole batch
+ * finished, at most half of the frames are filled by one batch. The nodes
+ * of compressed B-trees (no fixed page size) and of logged files are not
+ * read in batches. The batch is read without holding the pool, the frames
+ * of its nodes are latched exclusively in the meantime.
+ */
+uint32 mdbBufferPrefetch(mdbBufferPool *pool, mdbBtree *tree,
+    const uint32 *positions, const uint32 count)
+{
+  mdbAioRequest *requests;
+  mdbBtreeNode *node;
+  uint32 limit = pool->capacity >> 1;
+  uint32 n = 0;
+  uint32 i;
+  uint32 f;
+
+  if (tree->aio == NULL || tree->wal != NULL ||
+      (tree->meta.flags & MDB_BTREE_COMPRESSED))
+  {
+    return 0;
+  }
+
+  requests = (mdbAioRequest*) malloc(
+      (count < limit ? count : limit) * sizeof(mdbAioRequest));
+
+  /* the nodes get their frames first, latched exclusively (and pinned)
+   * until the batch finished */
+  pthread_mutex_lock(&pool->lock);
+  for (i = 0; i < count && n < limit; i++)
+  {
+    if (mdbBufferLookup(pool, positions[i]) != MDB_BUFFER_NIL)
+    {
+      continue;
+    }
+    if ((f = mdbBufferVictim(pool, 0)) == MDB_BUFFER_NIL)
+    {
+      break;
+    }
+
+    node = mdbBufferNode(pool, f, tree, positions[i]);
+    mdbBufferInsert(pool, f, node, 1);
+    requests[n].fd = MDB_NODE_FD(tree);
+    requests[n].offset = MDB_OFFSET(positions[i]);
+    requests[n].data = node->data;
+    requests[n].size = tree->nodeSize;
+    requests[n].write = 0;
+    requests[n].cls = node;
+    n++;
+  }
+  pool->prefetched += n;
+  pthread_mutex_unlock(&pool->lock);
+
+  if (n == 0)
+  {
+    free(requests);
+    return 0;
+  }
+  mdbAioSubmit(tree->aio, requests, n, &mdbBufferLoaded, NULL);
+
+  for (i = 0; i < n; i++)
+  {
+    mdbUnlatchNode((mdbBtreeNode*)requests[i].cls);
+    mdbBufferUnpin(pool, (mdbBtreeNode*)requests[i].cls);
+  }
+
+  free(requests);
+  return n;
+}
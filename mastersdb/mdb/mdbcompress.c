@@ -0,0 +1,463 @@
+/*
+ * mdbcompress.c
+ *
+ * Node compression (LZ codec, compressed node pages)
+ *
+ * Copyright (C) 2010, Dinko Hasanbasic (dinko.hasanbasic@gmail.com)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ * Revision history
+ * ----------------
+ * 17.10.2026
+ *  Initial version of file.
+ *  The pages of the nodes of compressed B-trees are stored compressed in a
+ *  head block and a variable-size tail (free blocks table).
+ *  The blocks are read and written with positioned I/O.
+ *  The blocks of a node are allocated and written under the free space
+ *  lock.
+ */
+
+#include "mdb.h"
+
+#include <stdlib.h>
+
+/*
+ * The codec is a byte-oriented LZ77 variant. The compressed data is a
+ * sequence of
+ *
+ *  [token][literal length...][literals][offset][match length...]
+ *
+ * The token holds the number of literals (high 4 bits) and the length of
+ * the match minus MDB_LZ_MIN_MATCH (low 4 bits); the value 15 is continued
+ * in the next bytes (255 = another byte follows). The offset (2 bytes,
+ * little endian) refers back into the decompressed data. The last sequence
+ * has only literals. Matches are found by a hash table of 4-byte strings,
+ * the long runs of the padded (zero) bytes of the pages become a few long
+ * matches.
+ */
+
+/* Shortest match, hash table size (bits) and farthest match (offset) */
+#define MDB_LZ_MIN_MATCH    4
+#define MDB_LZ_HASH_BITS    13
+#define MDB_LZ_MAX_OFFSET   0xFFFF
+
+/* Reads 4 bytes of the data (unaligned) */
+static uint32 mdbLzRead(const char *data)
+{
+  uint32 value;
+  memcpy(&value, data, sizeof(uint32));
+  return value;
+}
+
+/* Hash of 4 bytes of the data (multiplicative hashing) */
+static uint32 mdbLzHash(const char *data)
+{
+  return (mdbLzRead(data) * 2654435761U) >> (32 - MDB_LZ_HASH_BITS);
+}
+
+/* Writes a length continued from the token (255 = another byte follows),
+ * returns the new output position or 0 if the output is full */
+static uint32 mdbLzLength(char *dest, uint32 op, const uint32 capacity,
+    uint32 length)
+{
+  while (length >= 255)
+  {
+    if (op >= capacity) return 0L;
+    dest[op++] = (char)255;
+    length -= 255;
+  }
+  if (op >= capacity) return 0L;
+  dest[op++] = (char)length;
+  return op;
+}
+
+/* Writes a sequence (literals and a match, match length 0 = last sequence),
+ * returns the new output position or 0 if the output is full */
+static uint32 mdbLzSequence(char *dest, uint32 op, const uint32 capacity,
+    const char *literals, const uint32 count, const uint32 offset,
+    const uint32 length)
+{
+  const uint32 match = (length > 0) ? length - MDB_LZ_MIN_MATCH : 0L;
+  uint32 token = ((count < 15) ? count : 15) << 4;
+
+  token |= (match < 15) ? match : 15;
+  if (op >= capacity) return 0L;
+  dest[op++] = (char)token;
+
+  if (count >= 15 && (op = mdbLzLength(dest, op, capacity, count - 15)) == 0)
+  {
+    return 0L;
+  }
+  if (op + count > capacity) return 0L;
+  memcpy(dest + op, literals, count);
+  op += count;
+
+  if (length > 0)
+  {
+    if (op + 2 > capacity) return 0L;
+    dest[op++] = (char)(offset & 0xFF);
+    dest[op++] = (char)(offset >> 8);
+
+    if (match >= 15 && (op = mdbLzLength(dest, op, capacity, match - 15)) == 0)
+    {
+      return 0L;
+    }
+  }
+  return op;
+}
+
+/* Compresses data, returns the compressed size (0 = does not fit into the
+ * given capacity) */
+uint32 mdbCompress(const char *src, const uint32 size, char *dest,
+    const uint32 capacity)
+{
+  uint32 *table = (uint32*) calloc(1 << MDB_LZ_HASH_BITS, sizeof(uint32));
+  uint32 ip = 0L;
+  uint32 anchor = 0L;
+  uint32 op = 0L;
+  uint32 ref;
+  uint32 length;
+  uint32 h;
+
+  while (ip + MDB_LZ_MIN_MATCH <= size)
+  {
+    /* the table holds the positions + 1 (0 = empty entry) */
+    h = mdbLzHash(src + ip);
+    ref = table[h];
+    table[h] = ip + 1;
+
+    if (ref == 0L || ip + 1 - ref > MDB_LZ_MAX_OFFSET ||
+        mdbLzRead(src + ref - 1) != mdbLzRead(src + ip))
+    {
+      ip++;
+      continue;
+    }
+    ref--;
+
+    length = MDB_LZ_MIN_MATCH;
+    while (ip + length < size && src[ref + length] == src[ip + length])
+    {
+      length++;
+    }
+
+    op = mdbLzSequence(dest, op, capacity, src + anchor, ip - anchor,
+        ip - ref, length);
+    if (op == 0L)
+    {
+      break;
+    }
+    ip += length;
+    anchor = ip;
+  }
+
+  /* the remaining bytes are literals */
+  if (op > 0L || anchor == 0L)
+  {
+    op = mdbLzSequence(dest, op, capacity, src + anchor, size - anchor,
+        0L, 0L);
+  }
+
+  free(table);
+  return op;
+}
+
+/* Decompresses data, returns the decompressed size (0 = corrupted data or
+ * too small capacity) */
+uint32 mdbDecompress(const char *src, const uint32 size, char *dest,
+    const uint32 capacity)
+{
+  const unsigned char *in = (const unsigned char*)src;
+  uint32 ip = 0L;
+  uint32 op = 0L;
+  uint32 token;
+  uint32 count;
+  uint32 offset;
+  uint32 length;
+  uint32 b;
+
+  while (ip < size)
+  {
+    token = in[ip++];
+
+    count = token >> 4;
+    if (count == 15)
+    {
+      do
+      {
+        if (ip >= size) return 0L;
+        b = in[ip++];
+        count += b;
+      } while (b == 255);
+    }
+    if (ip + count > size || op + count > capacity) return 0L;
+    memcpy(dest + op, src + ip, count);
+    ip += count;
+    op += count;
+
+    /* the last sequence has no match */
+    if (ip == size)
+    {
+      break;
+    }
+
+    if (ip + 2 > size) return 0L;
+    offset = in[ip] | (in[ip + 1] << 8);
+    ip += 2;
+
+    length = token & 15;
+    if (length == 15)
+    {
+      do
+      {
+        if (ip >= size) return 0L;
+        b = in[ip++];
+        length += b;
+      } while (b == 255);
+    }
+    length += MDB_LZ_MIN_MATCH;
+
+    if (offset == 0L || offset > op || op + length > capacity) return 0L;
+
+    /* the match may overlap the bytes it produces (runs) */
+    for (; length > 0; length--, op++)
+    {
+      dest[op] = dest[op - offset];
+    }
+  }
+  return op;
+}
+
+/*
+ * A compressed node occupies a head block at its position and a tail: the
+ * blocks of the compressed page which do not fit into the head block.
+ *
+ *  head block: [compressed size][tail block][compressed page...]
+ *  tail:       [...compressed page]
+ *
+ * The tails are allocated in sizes of 1, 2, 4, ... blocks, so a node keeps
+ * its tail while the size of its compressed page does not change much, and
+ * the free blocks table only gets a few tail sizes. The position of a node
+ * never changes (the parents and the previous leaf are not updated). A page
+ * which does not get smaller is stored as it is (MDB_COMPRESS_STORED). The
+ * tail of a node is remembered in memory, the head block is only read
+ * before an update if the node was not loaded from the file.
+ */
+
+/* The compressed size of the head block marks a page stored as it is */
+#define MDB_COMPRESS_STORED   0x80000000UL
+
+/* Size of the head block header (compressed size and tail block) */
+#define MDB_COMPRESS_HEADER   (2 * sizeof(uint32))
+
+/* Size of the tail of a compressed page (bytes) */
+static uint32 mdbCompressTailSize(const uint32 size)
+{
+  uint32 blocks;
+  uint32 tail = 1L;
+
+  if (size <= MDB_PAGE_SIZE - MDB_COMPRESS_HEADER)
+  {
+    return 0L;
+  }
+
+  blocks = MDB_BLOCK(size - (MDB_PAGE_SIZE - MDB_COMPRESS_HEADER));
+  while (tail < blocks)
+  {
+    tail <<= 1;
+  }
+  return tail * MDB_PAGE_SIZE;
+}
+
+/* Reads blocks of a compressed node (log or positioned I/O) */
+static void mdbCompressRead(mdbBtree *tree, const uint32 position,
+    char *data, const uint32 size)
+{
+  if (tree->wal != NULL)
+  {
+    mdbWalRead(tree->wal, MDB_OFFSET(position), data, size);
+  }
+  else
+  {
+    mdbFileRead(MDB_NODE_FD(tree), MDB_OFFSET(position), data, size);
+  }
+}
+
+/* Writes blocks of a compressed node (log or positioned I/O) */
+static void mdbCompressWrite(mdbBtree *tree, const uint32 position,
+    const char *data, const uint32 size)
+{
+  if (tree->wal != NULL)
+  {
+    mdbWalWrite(tree->wal, MDB_OFFSET(position), data, size);
+  }
+  else
+  {
+    mdbFileWrite(MDB_NODE_FD(tree), MDB_OFFSET(position), data, size);
+  }
+}
+
+/* Returns the position of free blocks of the given size (new blocks are
+ * appended at the end of the file) */
+static uint32 mdbCompressAllocate(mdbBtree *tree, const uint32 size)
+{
+  uint32 position = mdbAllocateBlocks(tree, size);
+
+  if (position == 0L)
+  {
+    position = mdbSpaceEnd(tree);
+  }
+  return position;
+}
+
+/* Ensures that the tail of a node is known (read from its head block) */
+static void mdbCompressTail(mdbBtreeNode *node)
+{
+  uint32 *header;
+
+  if (node->tail_owner == node->position)
+  {
+    return;
+  }
+
+  node->tail = 0L;
+  node->tail_size = 0L;
+
+  if (node->position != 0L)
+  {
+    header = (uint32*) mdbBtreeAllocateBuffer(MDB_PAGE_SIZE);
+    memset(header, 0, MDB_COMPRESS_HEADER);
+    mdbCompressRead(node->T, node->position, (char*)header, MDB_PAGE_SIZE);
+
+    node->tail = header[1];
+    node->tail_size = (node->tail != 0L) ?
+        mdbCompressTailSize(header[0] & ~MDB_COMPRESS_STORED) : 0L;
+    free(header);
+  }
+  node->tail_owner = node->position;
+}
+
+/* Reads the page of a compressed node into its buffer */
+void mdbLoadCompressedNode(mdbBtreeNode *node)
+{
+  mdbBtree *tree = node->T;
+  const uint32 capacity = MDB_PAGE_SIZE +
+      mdbCompressTailSize(tree->nodeSize);
+  char *buffer = mdbBtreeAllocateBuffer(capacity);
+  uint32 *header = (uint32*)buffer;
+  uint32 size;
+  uint32 rest;
+
+  memset(buffer, 0, MDB_COMPRESS_HEADER);
+  mdbCompressRead(tree, node->position, buffer, MDB_PAGE_SIZE);
+
+  size = header[0] & ~MDB_COMPRESS_STORED;
+  if (size > tree->nodeSize)
+  {
+    size = 0L;
+  }
+
+  /* the rest of the compressed page follows in the tail */
+  if (MDB_COMPRESS_HEADER + size > MDB_PAGE_SIZE)
+  {
+    rest = MDB_PAGE_ALIGN(MDB_COMPRESS_HEADER + size - MDB_PAGE_SIZE);
+    mdbCompressRead(tree, header[1], buffer + MDB_PAGE_SIZE, rest);
+  }
+
+  if (header[0] & MDB_COMPRESS_STORED)
+  {
+    memcpy(node->data, buffer + MDB_COMPRESS_HEADER, tree->nodeSize);
+  }
+  else if (mdbDecompress(buffer + MDB_COMPRESS_HEADER, size, node->data,
+      tree->nodeSize) != tree->nodeSize)
+  {
+    /* a corrupted (or missing) page is an empty node */
+    memset(node->data, 0, tree->nodeSize);
+  }
+
+  node->tail = header[1];
+  node->tail_size = mdbCompressTailSize(size);
+  node->tail_owner = node->position;
+  free(buffer);
+}
+
+/* Compresses and writes the page of a node (a new node gets a position),
+ * returns the position of the node */
+uint32 mdbStoreCompressedNode(mdbBtreeNode *node, const char *page)
+{
+  mdbBtree *tree = node->T;
+  const uint32 capacity = MDB_PAGE_SIZE +
+      mdbCompressTailSize(tree->nodeSize);
+  char *buffer = mdbBtreeAllocateBuffer(capacity);
+  uint32 *header = (uint32*)buffer;
+  uint32 size;
+  uint32 tail_size;
+
+  mdbCompressTail(node);
+
+  /* the page is stored as it is if it does not get smaller */
+  memset(buffer, 0, capacity);
+  size = mdbCompress(page, tree->nodeSize, buffer + MDB_COMPRESS_HEADER,
+      tree->nodeSize - 1);
+  if (size == 0L)
+  {
+    size = tree->nodeSize;
+    memcpy(buffer + MDB_COMPRESS_HEADER, page, size);
+    header[0] = size | MDB_COMPRESS_STORED;
+  }
+  else
+  {
+    header[0] = size;
+  }
+
+  /* a tail of another size is replaced (written before the head block, so
+   * appended tails and head blocks do not overlap) */
+  mdbSpaceLock(tree);
+  tail_size = mdbCompressTailSize(size);
+  if (tail_size != node->tail_size)
+  {
+    mdbReleaseBlocks(tree, node->tail, node->tail_size);
+    node->tail = (tail_size > 0L) ? mdbCompressAllocate(tree, tail_size) : 0L;
+    node->tail_size = tail_size;
+  }
+  header[1] = node->tail;
+
+  if (tail_size > 0L)
+  {
+    mdbCompressWrite(tree, node->tail, buffer + MDB_PAGE_SIZE, tail_size);
+  }
+
+  if (node->position == 0L)
+  {
+    node->position = mdbCompressAllocate(tree, MDB_PAGE_SIZE);
+  }
+  mdbCompressWrite(tree, node->position, buffer, MDB_PAGE_SIZE);
+  mdbSpaceUnlock(tree);
+  node->tail_owner = node->position;
+
+  free(buffer);
+  return node->position;
+}
+
+/* Releases the head block and the tail of a compressed node */
+void mdbReleaseCompressedNode(mdbBtreeNode *node)
+{
+  mdbCompressTail(node);
+
+  mdbReleaseBlocks(node->T, node->tail, node->tail_size);
+  mdbReleaseBlocks(node->T, node->position, MDB_PAGE_SIZE);
+
+  node->tail = 0L;
+  node->tail_size = 0L;
+}
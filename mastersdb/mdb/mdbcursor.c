@@ -0,0 +1,572 @@
+/*
+ * mdbcursor.c
+ *
+ * Seekable B-tree cursors with range bounds
+ *
+ * Copyright (C) 2010, Dinko Hasanbasic (dinko.hasanbasic@gmail.com)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ * Revision history
+ * ----------------
+ * 17.10.2026
+ *  Initial version of file.
+ *  A cursor is a gap between two records of a B-tree (or B+-tree): it can
+ *  be placed before any key and moved in both directions, optionally
+ *  within a lower and an upper bound.
+ *  The nodes of the path of a cursor are latched shared.
+ *  The cursor reads copies of the nodes of its path instead of latching
+ *  them (optimistic, validated by the versions of the nodes), a cursor
+ *  whose path changed seeks its gap again.
+ *  A cursor can read a snapshot of the B-tree (mdbBtreeCursorSnapshot).
+ *  A cursor of a copy-on-write B-tree reads the root published when it was
+ *  opened (the B-tree as it was then, its nodes never change) and holds a
+ *  reader slot until it is closed (the pages of its root are not released
+ *  before).
+ *  Added mdbBtreeCursorLast (descending scans start at the end of the
+ *  range).
+ */
+
+#include "mdb.h"
+#include "mdbbtree_util.h"
+
+#include <stdlib.h>
+
+/*
+ * The cursor keeps the path from the root to a leaf (the nodes stay pinned
+ * while they are on the path, but they are not latched: the cursor reads
+ * their copies, see mdbCopyNode). The position of an internal node is the
+ * index of the child the path continues in, the position of the leaf is
+ * the gap: the index of the record the next step forward returns. In a
+ * B-tree the gap at the end of a subtree lies before the record of the
+ * parent which follows the subtree, the gap at its start after the record
+ * which precedes it.
+ * A child is only added to the path if its parent did not change since it
+ * was copied. Otherwise the cursor seeks the gap it stood in again, from
+ * the record next to the gap in the leaf it left.
+ */
+
+/* Returns a copy of a bound key */
+static char* mdbCursorCopyKey(const mdbBtree *t, const char *key)
+{
+  const mdbDatatype *type = t->key_type;
+  uint32 size = (type->header > 0) ?
+      type->header + BT_KEYLEN(key) * type->size : type->size;
+  char *copy = (char*) malloc(size);
+
+  memcpy(copy, key, size);
+  return copy;
+}
+
+/* Compares the key of a record with a key */
+static int mdbCursorCompare(const mdbBtree *t, const char *record,
+    const char *key)
+{
+  return mdbCompareValues(t->key_type, record + t->meta.key_position, key);
+}
+
+/* Releases the nodes of the path below the given level (the root node
+ * belongs to the cursor, the copies are kept for the next nodes) */
+static void mdbCursorRelease(mdbBtreeCursor *cursor, const uint32 level)
+{
+  while (cursor->depth > level)
+  {
+    cursor->depth--;
+    if (cursor->depth > 0)
+    {
+      mdbFreeNode(cursor->path[cursor->depth].node, 0);
+    }
+  }
+}
+
+/* Appends a node to the path (copied at the given version, the position is
+ * set by the caller), returns the new level or NULL if the node changed
+ * (the node is released) */
+static mdbBtreeCursorLevel* mdbCursorPush(mdbBtreeCursor *cursor,
+    mdbBtreeNode *node, const uint32 version)
+{
+  mdbBtreeCursorLevel *level = &cursor->path[cursor->depth];
+
+  if (level->buffer == NULL)
+  {
+    mdbAllocateNode(&level->buffer, cursor->tree);
+  }
+  if (cursor->snapshot != NULL)
+  {
+    level->copy = mdbSnapshotNode(cursor->snapshot, node, level->buffer);
+  }
+  else if ((level->copy = mdbCopyNode(level->buffer, node, version)) == NULL)
+  {
+    if (cursor->depth > 0)
+    {
+      mdbFreeNode(node, 0);
+    }
+    return NULL;
+  }
+
+  cursor->depth++;
+  level->node = node;
+  level->version = version;
+  level->position = 0;
+  return level;
+}
+
+/* Appends the child the path continues in (see mdbBtreeSearchOptimistic),
+ * returns NULL if the last node of the path changed (the nodes of a
+ * snapshot do not change) */
+static mdbBtreeCursorLevel* mdbCursorPushChild(mdbBtreeCursor *cursor)
+{
+  mdbBtreeCursorLevel *level = &cursor->path[cursor->depth - 1];
+  mdbBtree *t = cursor->tree;
+  mdbBtreeNode *child = t->ReadNode(
+      level->copy->children[level->position], t);
+  uint32 version = mdbNodeVersion(child);
+
+  if (cursor->snapshot == NULL &&
+      !mdbValidateNode(level->node, level->version))
+  {
+    mdbFreeNode(child, 0);
+    return NULL;
+  }
+  return mdbCursorPush(cursor, child, version);
+}
+
+/*
+ * Reads the children of the last internal node of the path ahead when a
+ * scan crosses into the next window of them (the read-ahead window of the
+ * B-tree, in the direction of the scan).
+ */
+static void mdbCursorReadAhead(mdbBtreeCursor *cursor, const uint8 backward)
+{
+  mdbBtreeCursorLevel *level = &cursor->path[cursor->depth - 1];
+  mdbBtree *t = cursor->tree;
+  const uint32 window = t->readahead;
+  uint32 first;
+
+  if (window == 0)
+  {
+    return;
+  }
+
+  if (!backward && level->position > 0 &&
+      (level->position - 1) % window == 0 &&
+      level->position < BT_COUNT(level->copy))
+  {
+    first = level->position + 1;
+    mdbBtreePrefetch(t, &level->copy->children[first],
+        BT_COUNT(level->copy) + 1 - first < window ?
+        BT_COUNT(level->copy) + 1 - first : window);
+  }
+  else if (backward && level->position < BT_COUNT(level->copy) &&
+      (BT_COUNT(level->copy) - level->position - 1) % window == 0 &&
+      level->position > 0)
+  {
+    first = level->position > window ? level->position - window : 0;
+    mdbBtreePrefetch(t, &level->copy->children[first],
+        level->position - first);
+  }
+}
+
+/*
+ * Extends the path from its last node down to a leaf: through the first
+ * children (gap at the start of the leaf) or the last ones (gap at the
+ * end of the leaf). Returns 0 if a node of the path changed.
+ */
+static int mdbCursorDescend(mdbBtreeCursor *cursor, const uint8 rightmost,
+    const uint8 readahead)
+{
+  mdbBtreeCursorLevel *level = &cursor->path[cursor->depth - 1];
+
+  while (BT_INTERNAL(level->copy))
+  {
+    if (readahead)
+    {
+      mdbCursorReadAhead(cursor, rightmost);
+    }
+    if ((level = mdbCursorPushChild(cursor)) == NULL)
+    {
+      return 0;
+    }
+    if (rightmost)
+    {
+      level->position = BT_COUNT(level->copy);
+    }
+  }
+  return 1;
+}
+
+/*
+ * Places the cursor before the first key which is greater than or equal
+ * to the given key ("after" set: greater than the key). Returns 0 if a
+ * node of the path changed.
+ */
+static int mdbCursorSeekPath(mdbBtreeCursor *cursor, const char *key,
+    const uint8 after)
+{
+  mdbBtree *t = cursor->tree;
+  mdbBtreeCursorLevel *level;
+  mdbBtreeNode *node;
+  uint32 i;
+  int found;
+
+  mdbCursorRelease(cursor, 0);
+  if ((level = mdbCursorPush(cursor, cursor->root,
+      mdbNodeVersion(cursor->root))) == NULL)
+  {
+    return 0;
+  }
+
+  for (;;)
+  {
+    node = level->copy;
+    i = mdbBtreeFindKey(key, node, &found);
+
+    if (BT_LEAF(node))
+    {
+      level->position = (found && after) ? i + 1 : i;
+      return 1;
+    }
+
+    if (found)
+    {
+      /* B+-tree: the records equal to the separator are on its right */
+      if (BT_PLUS(t))
+      {
+        i++;
+      }
+      /* B-tree: the gap before (after) the record of an internal node lies
+       * at the end (start) of the subtree on its left (right) */
+      else
+      {
+        level->position = after ? i + 1 : i;
+        return mdbCursorDescend(cursor, !after, 0);
+      }
+    }
+
+    level->position = i;
+    if ((level = mdbCursorPushChild(cursor)) == NULL)
+    {
+      return 0;
+    }
+  }
+}
+
+static void mdbCursorSeekKey(mdbBtreeCursor *cursor, const char *key,
+    const uint8 after)
+{
+  while (!mdbCursorSeekPath(cursor, key, after));
+}
+
+/*
+ * Moves the cursor over the next record, returns the record (NULL at the
+ * end of the B-tree, the cursor stays where it is)
+ */
+static const char* mdbCursorForward(mdbBtreeCursor *cursor)
+{
+  mdbBtreeCursorLevel *leaf;
+  mdbBtreeCursorLevel *level;
+  const char *record;
+  uint32 d;
+
+  for (;;)
+  {
+    leaf = &cursor->path[cursor->depth - 1];
+    d = cursor->depth - 1;
+
+    if (leaf->position < BT_COUNT(leaf->copy))
+    {
+      return BT_RECORD(leaf->copy, leaf->position++);
+    }
+
+    /* the nearest ancestor with a next child (B-tree: next record) */
+    while (d > 0 && cursor->path[d - 1].position ==
+        BT_COUNT(cursor->path[d - 1].copy))
+    {
+      d--;
+    }
+    if (d == 0)
+    {
+      return NULL;
+    }
+    memcpy(cursor->gap, BT_RECORD(leaf->copy, leaf->position - 1),
+        cursor->tree->meta.record_size);
+    mdbCursorRelease(cursor, d);
+    level = &cursor->path[d - 1];
+
+    if (BT_PLUS(cursor->tree))
+    {
+      level->position++;
+      if (mdbCursorDescend(cursor, 0, 1))
+      {
+        leaf = &cursor->path[cursor->depth - 1];
+        return BT_RECORD(leaf->copy, leaf->position++);
+      }
+    }
+    else
+    {
+      record = BT_RECORD(level->copy, level->position);
+      level->position++;
+      if (mdbCursorDescend(cursor, 0, 1))
+      {
+        return record;
+      }
+    }
+
+    /* the path changed: back to the gap after the last record of the leaf */
+    mdbCursorSeekKey(cursor, cursor->gap + cursor->tree->meta.key_position,
+        1);
+  }
+}
+
+/*
+ * Moves the cursor back over the previous record, returns the record (NULL
+ * at the start of the B-tree, the cursor stays where it is)
+ */
+static const char* mdbCursorBackward(mdbBtreeCursor *cursor)
+{
+  mdbBtreeCursorLevel *leaf;
+  mdbBtreeCursorLevel *level;
+  uint32 d;
+
+  for (;;)
+  {
+    leaf = &cursor->path[cursor->depth - 1];
+    d = cursor->depth - 1;
+
+    if (leaf->position > 0)
+    {
+      return BT_RECORD(leaf->copy, --leaf->position);
+    }
+
+    /* the nearest ancestor with a previous child (B-tree: previous
+     * record) */
+    while (d > 0 && cursor->path[d - 1].position == 0)
+    {
+      d--;
+    }
+    if (d == 0)
+    {
+      return NULL;
+    }
+    memcpy(cursor->gap, BT_RECORD(leaf->copy, 0),
+        cursor->tree->meta.record_size);
+    mdbCursorRelease(cursor, d);
+    level = &cursor->path[d - 1];
+    level->position--;
+
+    if (mdbCursorDescend(cursor, 1, 1))
+    {
+      if (BT_PLUS(cursor->tree))
+      {
+        leaf = &cursor->path[cursor->depth - 1];
+        return BT_RECORD(leaf->copy, --leaf->position);
+      }
+      return BT_RECORD(level->copy, level->position);
+    }
+
+    /* the path changed: back to the gap before the first record of the
+     * leaf */
+    mdbCursorSeekKey(cursor, cursor->gap + cursor->tree->meta.key_position,
+        0);
+  }
+}
+
+mdbError mdbBtreeCursorOpen(mdbBtreeCursor **cursor, mdbBtree *t,
+    const char *lower, const char *upper, const uint8 flags)
+{
+  mdbBtreeCursor *l_cursor;
+  uint32 i;
+
+  if (t->root == NULL)
+  {
+    return MDB_BTREE_NO_ROOT;
+  }
+
+  l_cursor = (mdbBtreeCursor*) malloc(sizeof(mdbBtreeCursor));
+  l_cursor->tree = t;
+  l_cursor->depth = 0;
+  l_cursor->flags = flags;
+  l_cursor->lower = (lower != NULL) ? mdbCursorCopyKey(t, lower) : NULL;
+  l_cursor->upper = (upper != NULL) ? mdbCursorCopyKey(t, upper) : NULL;
+  l_cursor->gap = (char*) malloc(t->meta.record_size);
+  l_cursor->snapshot = NULL;
+  l_cursor->reader = 0;
+  if (BT_SHADOW(t))
+  {
+    /* the pages of the root stay until the cursor is closed */
+    l_cursor->reader = mdbShadowEnter(t);
+    l_cursor->root = mdbShadowRoot(t);
+  }
+  else
+  {
+    l_cursor->root = t->root;
+  }
+  for (i = 0; i < MDB_BTREE_CURSOR_DEPTH; i++)
+  {
+    l_cursor->path[i].buffer = NULL;
+  }
+
+  mdbBtreeCursorSeek(l_cursor, NULL);
+
+  *cursor = l_cursor;
+  return MDB_NO_ERROR;
+}
+
+mdbError mdbBtreeCursorSnapshot(mdbBtreeCursor *cursor,
+    const mdbSnapshot *snapshot)
+{
+  /* the path read so far belongs to another version of the B-tree */
+  mdbCursorRelease(cursor, 0);
+  cursor->snapshot = snapshot;
+  return mdbBtreeCursorSeek(cursor, NULL);
+}
+
+mdbError mdbBtreeCursorSeek(mdbBtreeCursor *cursor, const char *key)
+{
+  const mdbDatatype *type = cursor->tree->key_type;
+  const uint8 flags = cursor->flags;
+  int cmp;
+
+  /* the keys before the range: start of the range */
+  if (cursor->lower != NULL && (key == NULL ||
+      (cmp = mdbCompareValues(type, key, cursor->lower)) < 0 ||
+      (cmp == 0 && (flags & MDB_CURSOR_LOWER_EXCLUSIVE))))
+  {
+    mdbCursorSeekKey(cursor, cursor->lower,
+        (flags & MDB_CURSOR_LOWER_EXCLUSIVE) != 0);
+  }
+  /* the keys after the range: end of the range */
+  else if (key != NULL && cursor->upper != NULL &&
+      mdbCompareValues(type, key, cursor->upper) > 0)
+  {
+    mdbCursorSeekKey(cursor, cursor->upper,
+        (flags & MDB_CURSOR_UPPER_EXCLUSIVE) == 0);
+  }
+  else if (key != NULL)
+  {
+    mdbCursorSeekKey(cursor, key, 0);
+  }
+  else
+  {
+    /* no lower bound: start of the B-tree */
+    do
+    {
+      mdbCursorRelease(cursor, 0);
+    }
+    while (mdbCursorPush(cursor, cursor->root,
+        mdbNodeVersion(cursor->root)) == NULL ||
+        !mdbCursorDescend(cursor, 0, 0));
+  }
+  return MDB_NO_ERROR;
+}
+
+mdbError mdbBtreeCursorLast(mdbBtreeCursor *cursor)
+{
+  mdbBtreeCursorLevel *level;
+
+  /* the upper bound: end of the range */
+  if (cursor->upper != NULL)
+  {
+    mdbCursorSeekKey(cursor, cursor->upper,
+        (cursor->flags & MDB_CURSOR_UPPER_EXCLUSIVE) == 0);
+    return MDB_NO_ERROR;
+  }
+
+  /* no upper bound: end of the B-tree */
+  do
+  {
+    mdbCursorRelease(cursor, 0);
+    if ((level = mdbCursorPush(cursor, cursor->root,
+        mdbNodeVersion(cursor->root))) != NULL)
+    {
+      level->position = BT_COUNT(level->copy);
+    }
+  }
+  while (level == NULL || !mdbCursorDescend(cursor, 1, 0));
+  return MDB_NO_ERROR;
+}
+
+mdbError mdbBtreeCursorNext(mdbBtreeCursor *cursor, char *record)
+{
+  const char *next = mdbCursorForward(cursor);
+  int cmp;
+
+  if (next == NULL)
+  {
+    return MDB_BTREE_NO_MORE_RECORDS;
+  }
+
+  /* the cursor does not leave the range */
+  if (cursor->upper != NULL &&
+      ((cmp = mdbCursorCompare(cursor->tree, next, cursor->upper)) > 0 ||
+      (cmp == 0 && (cursor->flags & MDB_CURSOR_UPPER_EXCLUSIVE))))
+  {
+    mdbCursorBackward(cursor);
+    return MDB_BTREE_NO_MORE_RECORDS;
+  }
+
+  memcpy(record, next, cursor->tree->meta.record_size);
+  return MDB_NO_ERROR;
+}
+
+mdbError mdbBtreeCursorPrev(mdbBtreeCursor *cursor, char *record)
+{
+  const char *prev = mdbCursorBackward(cursor);
+  int cmp;
+
+  if (prev == NULL)
+  {
+    return MDB_BTREE_NO_MORE_RECORDS;
+  }
+
+  /* the cursor does not leave the range */
+  if (cursor->lower != NULL &&
+      ((cmp = mdbCursorCompare(cursor->tree, prev, cursor->lower)) < 0 ||
+      (cmp == 0 && (cursor->flags & MDB_CURSOR_LOWER_EXCLUSIVE))))
+  {
+    mdbCursorForward(cursor);
+    return MDB_BTREE_NO_MORE_RECORDS;
+  }
+
+  memcpy(record, prev, cursor->tree->meta.record_size);
+  return MDB_NO_ERROR;
+}
+
+mdbError mdbBtreeCursorClose(mdbBtreeCursor *cursor)
+{
+  uint32 i;
+
+  mdbCursorRelease(cursor, 0);
+  for (i = 0; i < MDB_BTREE_CURSOR_DEPTH; i++)
+  {
+    if (cursor->path[i].buffer != NULL)
+    {
+      mdbFreeNode(cursor->path[i].buffer, 0);
+    }
+  }
+  if (cursor->root != cursor->tree->root)
+  {
+    mdbFreeNode(cursor->root, 0);
+  }
+  if (BT_SHADOW(cursor->tree))
+  {
+    mdbShadowLeave(cursor->tree, cursor->reader);
+  }
+  free(cursor->lower);
+  free(cursor->upper);
+  free(cursor->gap);
+  free(cursor);
+
+  return MDB_NO_ERROR;
+}
@@ -43,15 +43,174 @@
  *  Implemented mdbCreateTable function.
  * 10.08.2010
  *  Moved table specific code to new file: table.c.
+ * 17.10.2026
+ *  Each database now owns a buffer pool shared by all of its B-trees.
+ *  Added mdbInitializeBtree function.
+ *  The database files can be memory-mapped (MDB_OPEN_MMAP flag).
+ *  The whole B-tree descriptors are loaded (B-tree variant).
+ *  The B-trees use the free blocks table of the database header.
+ *  The system table descriptors are stored in the blocks after the header.
+ *  The B-tree nodes occupy whole pages, MDB_OPEN_DIRECT reads and writes
+ *  them with direct I/O (O_DIRECT descriptor, unbuffered stdio stream).
+ *  Implemented mdbCompareFloat and the order-preserving value encoding
+ *  (mdbEncodeValue, mdbDecodeValue, mdbCompareValues).
+ *  The B-tree descriptors are loaded before the B-trees are bound (node
+ *  buffer size of the packed B+-trees).
+ *  The nodes of compressed B-trees are not accessed in the mapped file.
+ *  Added the write-ahead log (MDB_OPEN_WAL): the database file is read and
+ *  written through the log, mdbCommitDatabase ends a transaction and the
+ *  log is recovered before the header is checked.
+ *  Added mdbCheckpointDatabase: the dirty nodes of the buffer pool are
+ *  written back when the database is closed and by a timer thread
+ *  (mdbCheckpointTimer) of the databases with a buffer pool whenever the
+ *  checkpoint interval has passed.
+ *  The database file is read and written with positioned I/O on its
+ *  descriptor, the direct I/O descriptor is kept separately.
+ *  The databases with a buffer pool own an asynchronous I/O queue (batched
+ *  node reads and checkpoint writes).
+ *  Added mdbSetReadAhead (read-ahead window of the B-tree scans).
+ *  The B-trees of a database share the lock of its free blocks table, the
+ *  latches of the system table B-trees are destroyed when it is closed.
+ *  The databases with a buffer pool keep the node versions of their
+ *  snapshots (mdbSnapshotOpen).
+ *  The copy-on-write B-trees are bound to the private node I/O of
+ *  mdbshadow.c (also in a mapped file). The commits and checkpoints write
+ *  the roots of the copy-on-write B-trees (mdbShadowWriteRoots) and
+ *  release their replaced pages, the database frees their states when it
+ *  is closed.
  */
 
+#ifndef _GNU_SOURCE
+  #define _GNU_SOURCE   /* O_DIRECT */
+#endif
+
 #include "mdb.h"
 
-/* TODO: implement the special comparison functions */
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+
+/* Loads an encoded (big-endian) value of the given size as a word */
+static uint32 mdbLoadWord(const char *value, const uint32 size)
+{
+  uint32 word = 0;
+  uint32 b;
+
+  for (b = 0; b < size; b++)
+  {
+    word = (word << 8) | (byte)value[b];
+  }
+  return word;
+}
+
+/* Stores the lowest bytes of a word as a big-endian value */
+static void mdbStoreWord(char *dest, const uint32 word, const uint32 size)
+{
+  uint32 b;
+
+  for (b = 0; b < size; b++)
+  {
+    dest[b] = (char)(word >> (8 * (size - 1 - b)));
+  }
+}
 
+/* The encoded FLOAT values are ordered like unsigned words */
 int mdbCompareFloat(const void* v1, const void* v2, size_t size)
 {
-  return 0;
+  uint32 w1 = mdbLoadWord((const char*)v1, sizeof(float));
+  uint32 w2 = mdbLoadWord((const char*)v2, sizeof(float));
+
+  (void)size;
+  return (w1 > w2) - (w1 < w2);
+}
+
+int mdbCompareValues(const mdbDatatype *type, const char *v1, const char *v2)
+{
+  uint32 size1, size2;
+  int cmp;
+
+  if (type->header > 0)
+  {
+    size1 = *((uint32*)v1);
+    size2 = *((uint32*)v2);
+    cmp = type->compare(v1 + type->header, v2 + type->header,
+        ((size1 < size2) ? size1 : size2) * type->size);
+
+    /* a value is greater than its prefixes */
+    return (cmp != 0) ? cmp : (size1 > size2) - (size1 < size2);
+  }
+  return type->compare(v1, v2, type->size);
+}
+
+/*
+ * Integers: the sign bit is flipped (negative values sort first) and the
+ * bytes are stored big-endian. FLOAT: the sign bit of a positive value is
+ * set, all bits of a negative value are flipped (larger magnitudes sort
+ * first), also stored big-endian.
+ */
+void mdbEncodeValue(const mdbDatatype *type, char *dest, const char *value)
+{
+  const uint32 sign = 1UL << (8 * type->size - 1);
+  uint32 word;
+  int8_t i8;
+  int16_t i16;
+  int32_t i32;
+
+  switch (type->encoding)
+  {
+    case MDB_ENCODING_INT:
+      switch (type->size)
+      {
+        case 1:  memcpy(&i8, value, 1);  word = (uint32)i8;  break;
+        case 2:  memcpy(&i16, value, 2); word = (uint32)i16; break;
+        default: memcpy(&i32, value, 4); word = (uint32)i32; break;
+      }
+      mdbStoreWord(dest, word ^ sign, type->size);
+      break;
+
+    case MDB_ENCODING_FLOAT:
+      memcpy(&word, value, sizeof(float));
+      mdbStoreWord(dest, (word & sign) ? ~word : (word | sign), sizeof(float));
+      break;
+
+    default:
+      memcpy(dest, value, (type->header > 0) ?
+          type->header + *((uint32*)value) * type->size : type->size);
+      break;
+  }
+}
+
+void mdbDecodeValue(const mdbDatatype *type, char *dest, const char *value)
+{
+  const uint32 sign = 1UL << (8 * type->size - 1);
+  uint32 word;
+  uint16 u16;
+  uint8 u8;
+
+  switch (type->encoding)
+  {
+    case MDB_ENCODING_INT:
+      word = mdbLoadWord(value, type->size) ^ sign;
+      switch (type->size)
+      {
+        case 1:  u8 = (uint8)word;   memcpy(dest, &u8, 1);  break;
+        case 2:  u16 = (uint16)word; memcpy(dest, &u16, 2); break;
+        default: memcpy(dest, &word, 4); break;
+      }
+      break;
+
+    case MDB_ENCODING_FLOAT:
+      word = mdbLoadWord(value, sizeof(float));
+      word = (word & sign) ? (word & ~sign) : ~word;
+      memcpy(dest, &word, sizeof(float));
+      break;
+
+    default:
+      memcpy(dest, value, (type->header > 0) ?
+          type->header + *((uint32*)value) * type->size : type->size);
+      break;
+  }
 }
 
 void mdbInitializeTypes(mdbDatabase *db)
@@ -60,32 +219,429 @@ void mdbInitializeTypes(mdbDatabase *db)
   db->datatypes = (mdbDatatype*)calloc(MDB_DATATYPE_COUNT, sizeof(mdbDatatype));
 
   db->datatypes[0] = (mdbDatatype) {
-    "\x005\0\0\0INT-8", 0, sizeof(byte), &memcmp
+    "\x005\0\0\0INT-8", 0, sizeof(byte), &memcmp, MDB_ENCODING_INT
   };
 
   db->datatypes[1] = (mdbDatatype) {
-    "\x006\0\0\0INT-16", 0, sizeof(uint16), &memcmp
+    "\x006\0\0\0INT-16", 0, sizeof(uint16), &memcmp, MDB_ENCODING_INT
   };
 
   db->datatypes[2] = (mdbDatatype) {
-    "\x006\0\0\0INT-32", 0, sizeof(uint32), &memcmp
+    "\x006\0\0\0INT-32", 0, sizeof(uint32), &memcmp, MDB_ENCODING_INT
   };
 
   db->datatypes[3] = (mdbDatatype) {
-    "\x005\0\0\0FLOAT" , 0, sizeof(float), &mdbCompareFloat
+    "\x005\0\0\0FLOAT" , 0, sizeof(float), &mdbCompareFloat,
+    MDB_ENCODING_FLOAT
   };
 
   db->datatypes[4] = (mdbDatatype) {
-    "\x006\0\0\0STRING", 4, sizeof(byte), (CompareKeysPtr)&strncmp
+    "\x006\0\0\0STRING", 4, sizeof(byte), &memcmp, MDB_ENCODING_NONE
   };
 }
 
-mdbError mdbCreateDatabase(mdbDatabase **db, const char *filename)
+/* Binds a B-tree to the database file and buffer pool */
+void mdbInitializeBtree(mdbDatabase *db, mdbBtree *tree)
+{
+  tree->file = db->file;
+  tree->pool = db->pool;
+  tree->map = db->map;
+  tree->header = &db->meta;
+  tree->fd = db->fd;
+  tree->direct = db->direct;
+  tree->wal = db->wal;
+  tree->aio = db->aio;
+  tree->space = &db->space;
+  tree->versions = db->versions;
+  tree->readahead = db->readahead;
+  tree->shadows = &db->shadows;
+
+  /* the nodes start at page boundaries and occupy whole pages */
+  tree->nodeSize = MDB_PAGE_ALIGN(tree->nodeSize);
+  mdbBtreeBufferSize(tree);
+
+  /* the pages of a copy-on-write B-tree are read into private nodes */
+  if (tree->meta.flags & MDB_BTREE_SHADOW)
+  {
+    mdbBtreeShadowPages(tree);
+  }
+  /* the mapped file replaces the buffer pool (compressed nodes are never
+   * accessed in place) */
+  else if (db->map != NULL && !(tree->meta.flags & MDB_BTREE_COMPRESSED))
+  {
+    tree->ReadNode = &mdbMmapReadNode;
+    tree->WriteNode = &mdbMmapWriteNode;
+    tree->DeleteNode = &mdbMmapDeleteNode;
+  }
+}
+
+/*
+ * Checkpoints the database whenever the checkpoint interval has passed
+ * since the last checkpoint (thread of mdbStartCheckpointTimer), the
+ * logged databases only copy the committed transactions into their files.
+ * The front end (mdbDatabase, its B-trees and the virtual machine) is used
+ * by one thread, the timer only touches what is synchronized for it: the
+ * buffer pool (its lock and the frame latches), the write-ahead log (its
+ * lock), the copy-on-write roots (shadow_sync), the file descriptor
+ * (positioned I/O) and the checkpoint times (timer lock).
+ */
+static void* mdbCheckpointTimer(void *arg)
+{
+  mdbDatabase *db = (mdbDatabase*)arg;
+  struct timespec deadline;
+
+  pthread_mutex_lock(&db->timer);
+  while (!db->timer_stop)
+  {
+    if (db->checkpoint_interval == 0)
+    {
+      pthread_cond_wait(&db->timer_cond, &db->timer);
+      continue;
+    }
+
+    deadline.tv_sec = (time_t)(db->checkpoint_time + db->checkpoint_interval);
+    deadline.tv_nsec = 0;
+    if (pthread_cond_timedwait(&db->timer_cond, &db->timer, &deadline) ==
+        ETIMEDOUT && !db->timer_stop)
+    {
+      pthread_mutex_unlock(&db->timer);
+      if (db->wal != NULL)
+      {
+        /* the dirty nodes belong to the running transaction */
+        mdbWalCheckpoint(db->wal);
+        pthread_mutex_lock(&db->timer);
+        db->checkpoint_time = (uint64)time(NULL);
+      }
+      else
+      {
+        mdbCheckpointDatabase(db);
+        pthread_mutex_lock(&db->timer);
+      }
+    }
+  }
+  pthread_mutex_unlock(&db->timer);
+  return NULL;
+}
+
+/* Starts the checkpoint timer of a database: only the dirty nodes of a
+ * buffer pool are written back by it, a mapped file is synchronized by
+ * mdbCheckpointDatabase on demand and when it is closed */
+static void mdbStartCheckpointTimer(mdbDatabase *db)
+{
+  if (!db->timer_running && db->pool != NULL && db->checkpoint_interval > 0)
+  {
+    db->timer_running = pthread_create(&db->checkpointer, NULL,
+        mdbCheckpointTimer, db) == 0;
+  }
+}
+
+/* Stops the checkpoint timer of a database (waits for its checkpoint) */
+static void mdbStopCheckpointTimer(mdbDatabase *db)
+{
+  if (db->timer_running)
+  {
+    pthread_mutex_lock(&db->timer);
+    db->timer_stop = 1;
+    pthread_cond_signal(&db->timer_cond);
+    pthread_mutex_unlock(&db->timer);
+
+    pthread_join(db->checkpointer, NULL);
+    db->timer_running = 0;
+  }
+}
+
+/* Sets up the node storage (buffer pool or mapped file) of a database, a
+ * new write-ahead log is created (an existing one is recovered) */
+static mdbError mdbOpenStorage(mdbDatabase *db, const char *filename,
+    const uint8 create)
+{
+  pthread_mutexattr_t attr;
+  mdbError ret;
+
+  /* the blocks are allocated by the threads sharing the database, the lock
+   * is held by the allocating functions and by their callers */
+  pthread_mutexattr_init(&attr);
+  pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+  pthread_mutex_init(&db->space, &attr);
+  pthread_mutexattr_destroy(&attr);
+
+  /* the commits write the roots of the copy-on-write B-trees */
+  pthread_mutex_init(&db->shadow_sync, NULL);
+  db->shadows = NULL;
+
+  /* the timer is started once the storage is set up */
+  pthread_mutex_init(&db->timer, NULL);
+  pthread_cond_init(&db->timer_cond, NULL);
+  db->timer_running = 0;
+  db->timer_stop = 0;
+
+  /* the stdio stream only opens and closes the file, the data is read and
+   * written with positioned I/O on its descriptor */
+  db->fd = fileno(db->file);
+  db->pool = NULL;
+  db->map = NULL;
+  db->wal = NULL;
+  db->direct = -1;
+  db->aio = NULL;
+  db->versions = NULL;
+  db->readahead = MDB_BTREE_READAHEAD;
+  db->checkpoint_interval = MDB_CHECKPOINT_INTERVAL;
+  db->checkpoint_time = (uint64)time(NULL);
+
+  /* the logged blocks are only written to the file by checkpoints, so the
+   * file is neither mapped nor accessed with direct I/O */
+  if (db->flags & MDB_OPEN_WAL)
+  {
+    if ((ret = mdbWalOpen(&db->wal, db->fd, filename, create)) !=
+        MDB_NO_ERROR)
+    {
+      return ret;
+    }
+    mdbVersionStoreCreate(&db->versions);
+    return mdbBufferPoolCreate(&db->pool, MDB_BUFFER_POOL_SIZE);
+  }
+
+  /* the log left by a crash is recovered (and removed) anyway */
+  if (!create)
+  {
+    mdbWalRecover(db->fd, filename);
+  }
+
+  if (db->flags & MDB_OPEN_MMAP)
+  {
+    return mdbMmapOpen(&db->map, db->file);
+  }
+
+  /* the buffer pool is the only cache of the nodes read with direct I/O */
+  if (db->flags & MDB_OPEN_DIRECT)
+  {
+    if ((db->direct = open(filename, O_RDWR | O_DIRECT)) < 0)
+    {
+      return MDB_CANNOT_OPEN_DIRECT;
+    }
+  }
+
+  /* the buffer pool reads and writes batches of nodes asynchronously */
+  mdbAioCreate(&db->aio, MDB_AIO_DEPTH);
+
+  /* the snapshots read the versions of the nodes latched by the writes */
+  mdbVersionStoreCreate(&db->versions);
+  return mdbBufferPoolCreate(&db->pool, MDB_BUFFER_POOL_SIZE);
+}
+
+/* Sets up the node storage of a database and starts its checkpoint timer
+ * (mdbCheckpointTimer, stopped by mdbCloseDatabase) */
+mdbError mdbInitializeStorage(mdbDatabase *db, const char *filename,
+    const uint8 create)
+{
+  mdbError ret;
+
+  if ((ret = mdbOpenStorage(db, filename, create)) != MDB_NO_ERROR)
+  {
+    return ret;
+  }
+
+  mdbStartCheckpointTimer(db);
+  return MDB_NO_ERROR;
+}
+
+/* Releases the node storage and the write-ahead log of a database */
+static void mdbReleaseStorage(mdbDatabase *db)
+{
+  mdbStopCheckpointTimer(db);
+  if (db->pool != NULL)
+  {
+    mdbBufferPoolFree(db->pool);
+  }
+  if (db->map != NULL)
+  {
+    mdbMmapClose(db->map);
+  }
+  if (db->wal != NULL)
+  {
+    mdbWalClose(db->wal);
+  }
+  if (db->aio != NULL)
+  {
+    mdbAioFree(db->aio);
+  }
+  if (db->versions != NULL)
+  {
+    mdbVersionStoreFree(db->versions);
+  }
+  if (db->direct >= 0)
+  {
+    close(db->direct);
+  }
+  pthread_mutex_destroy(&db->space);
+  pthread_mutex_destroy(&db->timer);
+  pthread_cond_destroy(&db->timer_cond);
+  mdbShadowFree(db);
+  pthread_mutex_destroy(&db->shadow_sync);
+}
+
+/* Reads data at the given position of the database file (positioned I/O
+ * or log) */
+void mdbDatabaseRead(mdbDatabase *db, const uint64 offset, void *data,
+    const uint32 size)
+{
+  if (db->wal != NULL)
+  {
+    mdbWalRead(db->wal, offset, data, size);
+  }
+  else
+  {
+    mdbFileRead(db->fd, offset, data, size);
+  }
+}
+
+/* Writes data at the given position of the database file (positioned I/O
+ * or log) */
+void mdbDatabaseWrite(mdbDatabase *db, const uint64 offset, const void *data,
+    const uint32 size)
+{
+  if (db->wal != NULL)
+  {
+    mdbWalWrite(db->wal, offset, data, size);
+  }
+  else
+  {
+    mdbFileWrite(db->fd, offset, data, size);
+  }
+}
+
+/* Returns the first block after the end of the database file */
+uint32 mdbDatabaseEnd(mdbDatabase *db)
 {
-  static char placeholder[180];
+  if (db->wal != NULL)
+  {
+    return mdbWalEnd(db->wal);
+  }
+  return mdbFileEnd(db->fd);
+}
+
+/* Makes the database file durable (mapped file or positioned I/O) */
+static void mdbDatabaseSync(mdbDatabase *db)
+{
+  if (db->map != NULL)
+  {
+    mdbMmapSync(db->map);
+  }
+  else
+  {
+    mdbFileSync(db->fd);
+  }
+}
+
+/* Ends the current transaction (the changes written since the previous
+ * commit are durable when the function returns) */
+mdbError mdbCommitDatabase(mdbDatabase *db)
+{
+  mdbError ret = MDB_NO_ERROR;
+  uint8 shadows = __atomic_load_n(&db->shadows, __ATOMIC_ACQUIRE) != NULL;
+  uint32 roots = 0;
+
+  /* the roots published by the copy-on-write B-trees are committed with
+   * the transaction (one commit of the roots at a time) */
+  if (shadows)
+  {
+    pthread_mutex_lock(&db->shadow_sync);
+    roots = mdbShadowWriteRoots(db);
+  }
+
+  /* the dirty nodes of the transaction are logged before the commit */
+  if (db->wal != NULL)
+  {
+    if (db->pool != NULL)
+    {
+      mdbBufferPoolFlush(db->pool);
+    }
+    ret = mdbWalCommit(db->wal);
+  }
+  else if (roots > 0)
+  {
+    mdbDatabaseSync(db);
+  }
+
+  if (shadows)
+  {
+    mdbShadowReclaim(db);
+    pthread_mutex_unlock(&db->shadow_sync);
+  }
+  return ret;
+}
+
+/* Writes the dirty nodes back (sorted by their positions) and makes the
+ * database file durable (the log is copied into it) */
+mdbError mdbCheckpointDatabase(mdbDatabase *db)
+{
+  uint8 shadows = __atomic_load_n(&db->shadows, __ATOMIC_ACQUIRE) != NULL;
+
+  if (shadows)
+  {
+    pthread_mutex_lock(&db->shadow_sync);
+    mdbShadowWriteRoots(db);
+  }
+
+  if (db->pool != NULL)
+  {
+    mdbBufferPoolFlush(db->pool);
+  }
+
+  if (db->wal != NULL)
+  {
+    mdbWalCommit(db->wal);
+    mdbWalCheckpoint(db->wal);
+  }
+  else
+  {
+    mdbDatabaseSync(db);
+  }
+
+  if (shadows)
+  {
+    mdbShadowReclaim(db);
+    pthread_mutex_unlock(&db->shadow_sync);
+  }
+
+  pthread_mutex_lock(&db->timer);
+  db->checkpoint_time = (uint64)time(NULL);
+  pthread_mutex_unlock(&db->timer);
+  return MDB_NO_ERROR;
+}
+
+void mdbSetCheckpointInterval(mdbDatabase *db, const uint32 seconds)
+{
+  /* the timer waits for the new interval */
+  pthread_mutex_lock(&db->timer);
+  db->checkpoint_interval = seconds;
+  pthread_cond_signal(&db->timer_cond);
+  pthread_mutex_unlock(&db->timer);
+
+  /* a database opened without an interval has no timer yet */
+  mdbStartCheckpointTimer(db);
+}
+
+void mdbSetReadAhead(mdbDatabase *db, const uint32 nodes)
+{
+  /* the window has to fit into the buffer pool next to the scanned path */
+  db->readahead = nodes < (MDB_BUFFER_POOL_SIZE >> 1) ?
+      nodes : (MDB_BUFFER_POOL_SIZE >> 1);
+  db->tables->readahead = db->readahead;
+  db->columns->readahead = db->readahead;
+  db->indexes->readahead = db->readahead;
+}
+
+mdbError mdbCreateDatabase(mdbDatabase **db, const char *filename,
+    uint32 flags)
+{
+  static char placeholder[MDB_HEADER_BLOCKS * MDB_BLOCK_SIZE];
 
   mdbDatabase *l_db = (mdbDatabase*)malloc(sizeof(mdbDatabase));
+  mdbError ret;
+
   mdbInitializeTypes(l_db);
+  l_db->flags = flags;
 
   /* creates the MastersDB header */
   memset(&l_db->meta, 0, sizeof(mdbDatabaseMeta));
@@ -95,36 +651,38 @@ mdbError mdbCreateDatabase(mdbDatabase **db, const char *filename)
   /* writes the MastersDB header and meta-data to a file */
   if ((l_db->file = fopen(filename, "w+b")) != NULL)
   {
-    fwrite(placeholder, 180, 1, l_db->file);
+    if ((ret = mdbInitializeStorage(l_db, filename, 1)) != MDB_NO_ERROR)
+    {
+      mdbReleaseStorage(l_db);
+      fclose(l_db->file);
+      free(l_db);
+      return ret;
+    }
+    mdbDatabaseWrite(l_db, 0L, placeholder, sizeof(placeholder));
 
     mdbCreateSystemTables(l_db);
 
-    /* positions of the database system tables (B-tree + root node) */
-    l_db->tables->meta.root_position =
-        sizeof(mdbDatabaseMeta) + 3 * sizeof(mdbBtreeMeta);
+    /* positions of the system table root nodes (the roots of .Tables and
+     * .Columns were already written by the insertions) */
+    l_db->indexes->root->position =
+        l_db->indexes->WriteNode(l_db->indexes->root);
 
-    l_db->columns->meta.root_position =
-        l_db->tables->meta.root_position + l_db->tables->nodeSize;
-
-    l_db->indexes->meta.root_position =
-        l_db->columns->meta.root_position + l_db->columns->nodeSize;
-    l_db->indexes->root->position = l_db->indexes->meta.root_position;
+    l_db->tables->meta.root_position = l_db->tables->root->position;
+    l_db->columns->meta.root_position = l_db->columns->root->position;
+    l_db->indexes->meta.root_position = l_db->indexes->root->position;
 
     /* writes all meta data to the empty database */
-    fseek(l_db->file, 0, SEEK_SET);
-
-    fwrite(&(l_db->meta), sizeof(mdbDatabaseMeta), 1, l_db->file);
+    mdbDatabaseWrite(l_db, 0L, &(l_db->meta), sizeof(mdbDatabaseMeta));
 
-    fwrite(&(l_db->tables->meta), sizeof(mdbBtreeMeta), 1, l_db->file);
-    fwrite(&(l_db->columns->meta), sizeof(mdbBtreeMeta), 1, l_db->file);
-    fwrite(&(l_db->indexes->meta), sizeof(mdbBtreeMeta), 1, l_db->file);
+    mdbDatabaseWrite(l_db, MDB_OFFSET(MDB_SYSTEM_DESCRIPTOR(0)),
+        &(l_db->tables->meta), sizeof(mdbBtreeMeta));
+    mdbDatabaseWrite(l_db, MDB_OFFSET(MDB_SYSTEM_DESCRIPTOR(1)),
+        &(l_db->columns->meta), sizeof(mdbBtreeMeta));
+    mdbDatabaseWrite(l_db, MDB_OFFSET(MDB_SYSTEM_DESCRIPTOR(2)),
+        &(l_db->indexes->meta), sizeof(mdbBtreeMeta));
 
-    fwrite(l_db->tables->root->data,
-        l_db->tables->nodeSize, 1, l_db->file);
-    fwrite(l_db->columns->root->data,
-        l_db->columns->nodeSize,1, l_db->file);
-    fwrite(l_db->indexes->root->data,
-        l_db->indexes->nodeSize,1, l_db->file);
+    /* the empty database is the first transaction of its log */
+    mdbCommitDatabase(l_db);
   }
   else
   {
@@ -136,15 +694,18 @@ mdbError mdbCreateDatabase(mdbDatabase **db, const char *filename)
   return MDB_NO_ERROR;
 }
 
-mdbError mdbOpenDatabase(mdbDatabase **db, const char *filename)
+mdbError mdbOpenDatabase(mdbDatabase **db, const char *filename,
+    uint32 flags)
 {
   mdbDatabase *l_db = (mdbDatabase*)malloc(sizeof(mdbDatabase));
-  uint32 size_test = sizeof(mdbDatabaseMeta) + 3 * sizeof(mdbBtreeMeta);
+  uint64 size_test = MDB_OFFSET(MDB_HEADER_BLOCKS);
   mdbBtree *T;
   mdbBtreeMeta meta;
+  mdbError error;
   int ret;
 
   mdbInitializeTypes(l_db);
+  l_db->flags = flags;
 
   /* creates the MastersDB header */
   memset(&l_db->meta, 0, sizeof(mdbDatabaseMeta));
@@ -152,20 +713,31 @@ mdbError mdbOpenDatabase(mdbDatabase **db, const char *filename)
   /* reads the MastersDB header and meta-data from a file */
   if ((l_db->file = fopen(filename, "r+b")) != NULL)
   {
+    /* the committed transactions of the log are recovered first (the file
+     * of a new database can be empty before the first checkpoint) */
+    if ((error = mdbInitializeStorage(l_db, filename, 0)) != MDB_NO_ERROR)
+    {
+      mdbReleaseStorage(l_db);
+      fclose(l_db->file);
+      free(l_db);
+      return error;
+    }
+
     /* checks the file size */
-    if (fseek(l_db->file, size_test, SEEK_SET) != 0)
+    if (mdbDatabaseEnd(l_db) < MDB_BLOCK(size_test))
     {
+      mdbReleaseStorage(l_db);
       fclose(l_db->file);
       free(l_db);
       return MDB_INVALID_FILE;
     }
 
     /* reads the header and checks the magic number and version */
-    fseek(l_db->file, 0L, SEEK_SET);
-    ret = fread(&l_db->meta, sizeof(mdbDatabaseMeta), 1, l_db->file);
+    mdbDatabaseRead(l_db, 0L, &l_db->meta, sizeof(mdbDatabaseMeta));
     if (l_db->meta.magic_number != MDB_MAGIC_NUMBER ||
         l_db->meta.mdb_version != MDB_VERSION)
     {
+      mdbReleaseStorage(l_db);
       fclose(l_db->file);
       free(l_db);
       return MDB_INVALID_FILE;
@@ -174,26 +746,29 @@ mdbError mdbOpenDatabase(mdbDatabase **db, const char *filename)
     /* allocates and loads the B-tree of each system table */
 
     /* ------- .TABLES ------- */
-    ret = fread(&meta, sizeof(mdbBtreeMeta), 1, l_db->file);
+    mdbDatabaseRead(l_db, MDB_OFFSET(MDB_SYSTEM_DESCRIPTOR(0)), &meta,
+        sizeof(mdbBtreeMeta));
     ret = mdbBtreeCreate(&T, meta.order, meta.record_size, meta.key_position);
-    T->file = l_db->file;
-    T->meta.root_position = meta.root_position;
+    T->meta = meta;
+    mdbInitializeBtree(l_db, T);
     T->key_type = &l_db->datatypes[4];
     l_db->tables = T;
 
     /* ------ .COLUMNS ------- */
-    ret = fread(&meta, sizeof(mdbBtreeMeta), 1, l_db->file);
+    mdbDatabaseRead(l_db, MDB_OFFSET(MDB_SYSTEM_DESCRIPTOR(1)), &meta,
+        sizeof(mdbBtreeMeta));
     ret = mdbBtreeCreate(&T, meta.order, meta.record_size, meta.key_position);
-    T->file = l_db->file;
-    T->meta.root_position = meta.root_position;
+    T->meta = meta;
+    mdbInitializeBtree(l_db, T);
     T->key_type = &l_db->datatypes[4];
     l_db->columns = T;
 
     /* ------ .INDEXES ------- */
-    ret = fread(&meta, sizeof(mdbBtreeMeta), 1, l_db->file);
+    mdbDatabaseRead(l_db, MDB_OFFSET(MDB_SYSTEM_DESCRIPTOR(2)), &meta,
+        sizeof(mdbBtreeMeta));
     ret = mdbBtreeCreate(&T, meta.order, meta.record_size, meta.key_position);
-    T->file = l_db->file;
-    T->meta.root_position = meta.root_position;
+    T->meta = meta;
+    mdbInitializeBtree(l_db, T);
     T->key_type = &l_db->datatypes[4];
     l_db->indexes = T;
 
@@ -222,19 +797,28 @@ mdbError mdbCloseDatabase(mdbDatabase *db)
 {
   mdbError ret;
 
+  /* no checkpoint may run while the B-trees are freed */
+  mdbStopCheckpointTimer(db);
+
   /* saves the system table root nodes */
-  fseek(db->file, 0L, SEEK_SET);
-  fwrite(&(db->meta), sizeof(mdbDatabaseMeta), 1, db->file);
+  mdbDatabaseWrite(db, 0L, &(db->meta), sizeof(mdbDatabaseMeta));
 
   /* frees all dynamically allocated structures */
   ret = mdbFreeNode(db->tables->root, 1);
   ret = mdbFreeNode(db->columns->root, 1);
   ret = mdbFreeNode(db->indexes->root, 1);
 
+  mdbLatchDestroy(&db->tables->latch);
+  mdbLatchDestroy(&db->columns->latch);
+  mdbLatchDestroy(&db->indexes->latch);
   free (db->tables);
   free (db->columns);
   free (db->indexes);
 
+  /* the dirty nodes are written back, the log is copied into the file */
+  mdbCheckpointDatabase(db);
+  mdbReleaseStorage(db);
+
   /* the file can now be closed */
   fclose(db->file);
 
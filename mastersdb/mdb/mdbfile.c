@@ -0,0 +1,108 @@
+/*
+ * mdbfile.c
+ *
+ * Positioned file I/O (pread/pwrite on file descriptors)
+ *
+ * Copyright (C) 2010, Dinko Hasanbasic (dinko.hasanbasic@gmail.com)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ * Revision history
+ * ----------------
+ * 17.10.2026
+ *  Initial version of file.
+ *  The database files (and logs) are read and written at explicit offsets,
+ *  no file position is shared by the users of a descriptor.
+ */
+
+#include "mdb.h"
+
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+/*
+ * The stdio stream of a database file is only used to open and close it,
+ * all blocks are transferred with pread/pwrite on its descriptor (or on the
+ * O_DIRECT descriptor of the node pages). A transfer is repeated until all
+ * bytes are done, interrupted calls are restarted.
+ */
+
+uint32 mdbFileRead(const int fd, const uint64 offset, void *data,
+    const uint32 size)
+{
+  char *dest = (char*)data;
+  uint32 done = 0;
+  ssize_t ret;
+
+  while (done < size)
+  {
+    ret = pread(fd, dest + done, size - done, (off_t)(offset + done));
+    if (ret < 0 && errno == EINTR)
+    {
+      continue;
+    }
+    if (ret <= 0)
+    {
+      break;
+    }
+    done += (uint32)ret;
+  }
+
+  /* the data after the end of the file is empty */
+  if (done < size)
+  {
+    memset(dest + done, 0, size - done);
+  }
+  return done;
+}
+
+uint32 mdbFileWrite(const int fd, const uint64 offset, const void *data,
+    const uint32 size)
+{
+  const char *src = (const char*)data;
+  uint32 done = 0;
+  ssize_t ret;
+
+  while (done < size)
+  {
+    ret = pwrite(fd, src + done, size - done, (off_t)(offset + done));
+    if (ret < 0 && errno == EINTR)
+    {
+      continue;
+    }
+    if (ret <= 0)
+    {
+      break;
+    }
+    done += (uint32)ret;
+  }
+  return done;
+}
+
+uint32 mdbFileEnd(const int fd)
+{
+  struct stat st;
+
+  if (fstat(fd, &st) != 0)
+  {
+    return 0;
+  }
+  return MDB_BLOCK(st.st_size);
+}
+
+void mdbFileSync(const int fd)
+{
+  fdatasync(fd);
+}
@@ -0,0 +1,343 @@
+/*
+ * mdbmmap.c
+ *
+ * Memory-mapped node storage (alternative Read/Write/DeleteNode functions)
+ *
+ * Copyright (C) 2010, Dinko Hasanbasic (dinko.hasanbasic@gmail.com)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ * Revision history
+ * ----------------
+ * 17.10.2026
+ *  Initial version of file.
+ *  Nodes are accessed in place in the mapped database file.
+ *  The blocks of deleted nodes are reused (free lists).
+ *  The mapping covers the 64-bit file range (block numbers) up to
+ *  MDB_MMAP_RESERVE (256 GB), larger files are not mapped.
+ *  Packed internal nodes (and the root of a packed B+-tree, whose buffer
+ *  has to hold an unpacked internal node) are private copies.
+ *  Slotted leaves are private copies as well.
+ *  Added mdbMmapSync (checkpoints).
+ *  The other writes to the file are positioned (no stdio buffer to flush).
+ *  Every block of the mapping has a latch (mdbMmapLatch), the mapped nodes
+ *  are latched like the cached ones. The mapping grows under a lock, new
+ *  nodes are appended under the free space lock. A range is only used once
+ *  it is mapped, not when the file is large enough (its latches are
+ *  created with the mapping).
+ *  The mapped nodes are read optimistically, the block of a new node
+ *  changes the version of its latch when it is written.
+ *  A private root (new B-tree) is not switched to the mapped block when it
+ *  is written, it keeps the latch of its B-tree.
+ */
+
+#include "mdb.h"
+
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+ * The address range of a database file (MDB_MMAP_RESERVE) is reserved when
+ * the file is mapped, so the mapping can grow in place (MAP_FIXED) and
+ * pointers to mapped nodes stay valid while new nodes are appended. A file
+ * cannot grow beyond the reserved range: it is not opened if it is larger,
+ * and a write beyond it stops the process (the addresses after the range
+ * may belong to other mappings).
+ *
+ * The mapped nodes are shared by the threads: each block of the mapping
+ * has a latch. The latches of a chunk are created when the chunk is mapped
+ * and stay at their addresses until the file is un-mapped.
+ */
+
+/* Maps the file range [map->mapped, size) into the reserved range (the
+ * mapping lock is held) */
+static int mdbMmapGrow(mdbMmap *map, uint64 size)
+{
+  mdbLatch *latches;
+  uint64 end;
+  uint64 c;
+  uint32 i;
+  void *addr;
+
+  /* the mapping always grows by whole chunks */
+  end = ((size + MDB_MMAP_CHUNK - 1) / MDB_MMAP_CHUNK) * MDB_MMAP_CHUNK;
+  if (end > map->reserved) end = map->reserved;
+  if (end <= map->mapped) return 0;
+
+  addr = mmap(map->base + map->mapped, end - map->mapped,
+      PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, map->fd, map->mapped);
+
+  if (addr == MAP_FAILED)
+  {
+    return -1;
+  }
+
+  for (c = map->mapped / MDB_MMAP_CHUNK; c < end / MDB_MMAP_CHUNK; c++)
+  {
+    latches = (mdbLatch*) malloc(MDB_MMAP_LATCHES * sizeof(mdbLatch));
+    for (i = 0; i < MDB_MMAP_LATCHES; i++)
+    {
+      mdbLatchInit(&latches[i]);
+    }
+    __atomic_store_n(&map->latches[c], latches, __ATOMIC_RELEASE);
+  }
+  __atomic_store_n(&map->mapped, end, __ATOMIC_RELEASE);
+  return 0;
+}
+
+/* Re-reads the file size (after positioned writes to the file) */
+static void mdbMmapRefresh(mdbMmap *map)
+{
+  struct stat st;
+
+  fstat(map->fd, &st);
+  __atomic_store_n(&map->size, (uint64)st.st_size, __ATOMIC_RELEASE);
+}
+
+/* Ensures that the file range [0, end) exists in the file and is mapped
+ * (the size grows before the mapping and its latches) */
+static void mdbMmapEnsure(mdbMmap *map, uint64 end)
+{
+  if (end <= __atomic_load_n(&map->size, __ATOMIC_ACQUIRE) &&
+      end <= __atomic_load_n(&map->mapped, __ATOMIC_ACQUIRE)) return;
+
+  if (end > map->reserved)
+  {
+    fprintf(stderr, "MastersDB: mapped file larger than %llu bytes\n",
+        (unsigned long long)map->reserved);
+    abort();
+  }
+
+  pthread_mutex_lock(&map->lock);
+  mdbMmapRefresh(map);
+
+  if (end > map->size && ftruncate(map->fd, end) == 0)
+  {
+    __atomic_store_n(&map->size, end, __ATOMIC_RELEASE);
+  }
+  mdbMmapGrow(map, map->size);
+  pthread_mutex_unlock(&map->lock);
+}
+
+/* Maps the database file (the mapping grows with the file) */
+mdbError mdbMmapOpen(mdbMmap **map, FILE *file)
+{
+  mdbMmap *l_map;
+  struct stat st;
+  void *base;
+
+  if (fstat(fileno(file), &st) != 0 || (uint64)st.st_size > MDB_MMAP_RESERVE)
+  {
+    return MDB_CANNOT_MAP_FILE;
+  }
+
+  /* reserve the address space for the largest file which can be mapped */
+  base = mmap(NULL, MDB_MMAP_RESERVE, PROT_NONE,
+      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+  if (base == MAP_FAILED)
+  {
+    return MDB_CANNOT_MAP_FILE;
+  }
+  l_map = (mdbMmap*)malloc(sizeof(mdbMmap));
+
+  l_map->base = (char*)base;
+  l_map->reserved = MDB_MMAP_RESERVE;
+  l_map->mapped = 0;
+  l_map->size = 0;
+  l_map->file = file;
+  l_map->fd = fileno(file);
+  l_map->latches = (mdbLatch**) calloc(MDB_MMAP_RESERVE / MDB_MMAP_CHUNK,
+      sizeof(mdbLatch*));
+  pthread_mutex_init(&l_map->lock, NULL);
+
+  *map = l_map;
+  return MDB_NO_ERROR;
+}
+
+/* Un-maps the database file */
+mdbError mdbMmapClose(mdbMmap *map)
+{
+  uint64 c;
+  uint32 i;
+
+  mdbMmapSync(map);
+  munmap(map->base, map->reserved);
+
+  for (c = 0; c < map->mapped / MDB_MMAP_CHUNK; c++)
+  {
+    for (i = 0; i < MDB_MMAP_LATCHES; i++)
+    {
+      mdbLatchDestroy(&map->latches[c][i]);
+    }
+    free(map->latches[c]);
+  }
+  free(map->latches);
+  pthread_mutex_destroy(&map->lock);
+  free(map);
+
+  return MDB_NO_ERROR;
+}
+
+/* Writes the changed pages of the mapped file to the disk */
+void mdbMmapSync(mdbMmap *map)
+{
+  msync(map->base, map->mapped, MS_SYNC);
+}
+
+/* Tests whether a node needs a private copy: packed internal nodes and
+ * slotted leaves are unpacked, the root of such a B-tree may become one */
+static int mdbMmapPrivate(const mdbBtree* tree, const uint32 position,
+    const char *data)
+{
+  return MDB_BTREE_PACKED_PAGE(tree, ((const uint32*)data)[1]) ||
+      ((tree->meta.flags & (MDB_BTREE_PACKED | MDB_BTREE_SLOTTED)) &&
+      position == tree->meta.root_position);
+}
+
+/* Returns a node whose data points directly into the mapped file (private
+ * copy of the packed nodes, see mdbMmapPrivate) */
+mdbBtreeNode* mdbMmapReadNode(const uint32 position, mdbBtree* tree)
+{
+  mdbBtreeNode *node;
+  char *data;
+
+  mdbMmapEnsure(tree->map, MDB_OFFSET(position) + tree->nodeSize);
+  data = tree->map->base + MDB_OFFSET(position);
+
+  if (mdbMmapPrivate(tree, position, data))
+  {
+    mdbAllocateNode(&node, tree);
+    node->position = position;
+    if (MDB_BTREE_PACKED_PAGE(tree, ((uint32*)data)[1]))
+    {
+      mdbBtreeUnpackNode(node, data);
+    }
+    else
+    {
+      memcpy(node->data, data, tree->nodeSize);
+      mdbLayoutNode(node);
+    }
+    return node;
+  }
+
+  node = (mdbBtreeNode*) malloc(sizeof(mdbBtreeNode));
+  mdbInitializeNode(node, tree, data);
+  node->position = position;
+  node->frame = NULL;
+  node->mapped = 1;
+
+  return node;
+}
+
+/*
+ * Writes a node to the mapped file. Nodes accessed in place are already
+ * up to date, private nodes are copied (new ones are appended at the end
+ * of the file and accessed in place afterwards). The block of a new node
+ * changes the version of its latch: an optimistic reader following a
+ * stale child position may be reading the block.
+ */
+uint32 mdbMmapWriteNode(mdbBtreeNode* node)
+{
+  mdbMmap *map = node->T->map;
+  mdbLatch *latch = NULL;
+  char *data;
+
+  if (node->mapped)
+  {
+    return node->position;
+  }
+
+  /* the free space stays locked until the new block is part of the file,
+   * so the next new node is appended after it */
+  if (node->position == 0)
+  {
+    mdbSpaceLock(node->T);
+    if ((node->position = mdbAllocateBlock(node->T)) == 0)
+    {
+      node->position = mdbSpaceEnd(node->T);
+    }
+    mdbMmapEnsure(map, MDB_OFFSET(node->position) + node->T->nodeSize);
+    mdbSpaceUnlock(node->T);
+
+    latch = mdbMmapLatch(map, node->position);
+    __atomic_add_fetch(&latch->version, 1, __ATOMIC_SEQ_CST);
+  }
+
+  mdbMmapEnsure(map, MDB_OFFSET(node->position) + node->T->nodeSize);
+  data = map->base + MDB_OFFSET(node->position);
+
+  /* packed nodes and the root stay private copies (the root may be written
+   * before its position is known, and it is latched by the B-tree as long
+   * as it is private, see mdbLatchNode: it cannot change its latch while a
+   * write holds it) */
+  if (mdbMmapPrivate(node->T, node->position, node->data) ||
+      node == node->T->root)
+  {
+    if (MDB_BTREE_PACKED_PAGE(node->T, *node->is_leaf))
+    {
+      mdbBtreePackNode(node, data);
+    }
+    else
+    {
+      memcpy(data, node->data, node->T->nodeSize);
+    }
+  }
+  else
+  {
+    memcpy(data, node->data, node->T->nodeSize);
+
+    /* from now on the node is accessed in place */
+    free(node->data);
+    mdbInitializeNode(node, node->T, data);
+    node->mapped = 1;
+  }
+
+  if (latch != NULL)
+  {
+    __atomic_add_fetch(&latch->version, 1, __ATOMIC_RELEASE);
+  }
+  return node->position;
+}
+
+/* Deletes a node from the mapped file (its block is reused later) */
+void mdbMmapDeleteNode(mdbBtreeNode* node)
+{
+  mdbReleaseBlock(node->T, node->position);
+}
+
+/* Returns the address of a file range (the file and mapping grow if needed) */
+char* mdbMmapAddress(mdbMmap *map, const uint64 offset, const uint32 size)
+{
+  mdbMmapEnsure(map, offset + size);
+  return map->base + offset;
+}
+
+/* Returns the latch of the node at the given position of a mapped file
+ * (the block is mapped first if needed) */
+mdbLatch* mdbMmapLatch(mdbMmap *map, const uint32 position)
+{
+  mdbLatch *latches = __atomic_load_n(&map->latches[position /
+      MDB_MMAP_LATCHES], __ATOMIC_ACQUIRE);
+
+  if (latches == NULL)
+  {
+    mdbMmapEnsure(map, MDB_OFFSET(position) + MDB_BLOCK_SIZE);
+    latches = __atomic_load_n(&map->latches[position / MDB_MMAP_LATCHES],
+        __ATOMIC_ACQUIRE);
+  }
+  return &latches[position % MDB_MMAP_LATCHES];
+}
@@ -0,0 +1,191 @@
+/*
+ * mdboverflow.c
+ *
+ * Overflow pages (values stored out of line)
+ *
+ * Copyright (C) 2010, Dinko Hasanbasic (dinko.hasanbasic@gmail.com)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ * Revision history
+ * ----------------
+ * 17.10.2026
+ *  Initial version of file.
+ *  Long values of the variable-length columns are stored in chains of
+ *  overflow pages, the records keep their length, first page and prefix.
+ *  A page is allocated and written under the free space lock.
+ */
+
+#include "mdb.h"
+
+/*
+ * An overflow page is one block: the position (block number) of the next
+ * page of the chain (0 = last page) followed by MDB_OVERFLOW_PAGE_DATA bytes
+ * of the value. The pages are taken from the free list of their size or
+ * appended to the file, and written immediately (a chain is complete before
+ * the record referring to it gets inserted).
+ *
+ * A value stored out of line occupies MDB_OVERFLOW_SIZE bytes of a record:
+ *
+ *  [length (elements)][first overflow page][first MDB_OVERFLOW_PREFIX bytes]
+ *
+ * Values which fit into the prefix have no overflow pages (first page 0),
+ * so short values of a long column cost no extra I/O.
+ */
+
+/* Returns the position of a new overflow page (free block or end of file) */
+static uint32 mdbOverflowAllocate(mdbBtree *tree)
+{
+  uint32 position = mdbAllocateBlocks(tree, MDB_PAGE_SIZE);
+
+  if (position == 0L)
+  {
+    /* the page is written before the next one is allocated, so the end of
+     * the file moves on */
+    position = mdbSpaceEnd(tree);
+  }
+  return position;
+}
+
+/* Stores data in a new chain of overflow pages, returns the first page */
+uint32 mdbOverflowWrite(mdbBtree *tree, const char *data, const uint32 size)
+{
+  char *page = (char*) calloc(1, MDB_PAGE_SIZE);
+  uint32 first = 0L;
+  uint32 prev = 0L;
+  uint32 position;
+  uint32 done = 0L;
+  uint32 len;
+
+  while (done < size)
+  {
+    len = size - done;
+    if (len > MDB_OVERFLOW_PAGE_DATA)
+    {
+      len = MDB_OVERFLOW_PAGE_DATA;
+    }
+
+    /* the page is the last one of the chain until the next one exists (an
+     * appended page is written before another thread appends) */
+    mdbSpaceLock(tree);
+    position = mdbOverflowAllocate(tree);
+    *((uint32*)page) = 0L;
+    memcpy(page + sizeof(uint32), data + done, len);
+    mdbSpaceWrite(tree, MDB_OFFSET(position), page, MDB_PAGE_SIZE);
+    mdbSpaceUnlock(tree);
+
+    if (prev == 0L)
+    {
+      first = position;
+    }
+    else
+    {
+      mdbSpaceWrite(tree, MDB_OFFSET(prev), &position, sizeof(uint32));
+    }
+    prev = position;
+    done += len;
+  }
+
+  free(page);
+  return first;
+}
+
+/* Reads data from a chain of overflow pages */
+void mdbOverflowRead(mdbBtree *tree, uint32 position, char *data,
+    uint32 size)
+{
+  char *page = (char*) malloc(MDB_PAGE_SIZE);
+  uint32 len;
+
+  while (position != 0L && size > 0)
+  {
+    len = (size > MDB_OVERFLOW_PAGE_DATA) ? MDB_OVERFLOW_PAGE_DATA : size;
+
+    mdbSpaceRead(tree, MDB_OFFSET(position), page,
+        sizeof(uint32) + len);
+    memcpy(data, page + sizeof(uint32), len);
+
+    position = *((uint32*)page);
+    data += len;
+    size -= len;
+  }
+
+  free(page);
+}
+
+/* Releases the pages of a chain of overflow pages */
+void mdbOverflowFree(mdbBtree *tree, uint32 position)
+{
+  uint32 next;
+
+  while (position != 0L)
+  {
+    /* the link is overwritten by the free list */
+    mdbSpaceRead(tree, MDB_OFFSET(position), &next, sizeof(uint32));
+    mdbReleaseBlocks(tree, position, MDB_PAGE_SIZE);
+    position = next;
+  }
+}
+
+/* Stores a variable-length value out of line (in the record: its length,
+ * first overflow page and prefix), at most "length" elements */
+void mdbStoreLongValue(mdbBtree *tree, const mdbDatatype *type,
+    const uint32 length, char *dest, const char *value)
+{
+  uint32 count = *((uint32*)value);
+  uint32 size;
+  uint32 first = 0L;
+
+  if (count > length)
+  {
+    count = length;
+  }
+  size = count * type->size;
+
+  memset(dest, 0, MDB_OVERFLOW_SIZE);
+  *((uint32*)dest) = count;
+
+  if (size > MDB_OVERFLOW_PREFIX)
+  {
+    first = mdbOverflowWrite(tree, value + type->header + MDB_OVERFLOW_PREFIX,
+        size - MDB_OVERFLOW_PREFIX);
+    size = MDB_OVERFLOW_PREFIX;
+  }
+  memcpy(dest + sizeof(uint32), &first, sizeof(uint32));
+  memcpy(dest + 2 * sizeof(uint32), value + type->header, size);
+}
+
+/* Restores a value stored out of line (length header and value) */
+void mdbLoadLongValue(mdbBtree *tree, const mdbDatatype *type, char *dest,
+    const char *field)
+{
+  uint32 count = *((uint32*)field);
+  uint32 size = count * type->size;
+  uint32 first;
+
+  memcpy(&first, field + sizeof(uint32), sizeof(uint32));
+  *((uint32*)dest) = count;
+
+  if (size > MDB_OVERFLOW_PREFIX)
+  {
+    memcpy(dest + type->header, field + 2 * sizeof(uint32),
+        MDB_OVERFLOW_PREFIX);
+    mdbOverflowRead(tree, first, dest + type->header + MDB_OVERFLOW_PREFIX,
+        size - MDB_OVERFLOW_PREFIX);
+  }
+  else
+  {
+    memcpy(dest + type->header, field + 2 * sizeof(uint32), size);
+  }
+}
@@ -0,0 +1,456 @@
+/*
+ * mdbshadow.c
+ *
+ * Copy-on-write (shadow paging) B-trees
+ *
+ * Copyright (C) 2010, Dinko Hasanbasic (dinko.hasanbasic@gmail.com)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ * Revision history
+ * ----------------
+ * 17.10.2026
+ *  Initial version of file.
+ *  Append-only B-trees: a write (insertion or deletion) never changes a
+ *  page of the B-tree, every node it changes is written to a new page (so
+ *  are its ancestors up to the root). The new root position is published
+ *  when the write ends, the searches and cursors read the B-tree from the
+ *  root published last without latching its nodes.
+ *  The replaced pages are released once no reader (reader slots) and no
+ *  descriptor which may be on the disk refers to them (mdbShadowEnter,
+ *  mdbShadowReclaim). The roots are written to the descriptors by the
+ *  commits and checkpoints (mdbShadowWriteRoots), not by every write.
+ */
+
+#include "mdb.h"
+#include "mdbbtree_util.h"
+
+#include <stdlib.h>
+#include <sched.h>
+
+/*
+ * The pages of a copy-on-write B-tree never change while they are part of
+ * a published root, so a reader which took a root position reads the same
+ * B-tree as long as it likes. The writers change private copies of the
+ * pages (mdbShadowReadNode) and hold the root latch from the start of a
+ * write until its root is published (mdbBtreePathWrite), the writes of a
+ * B-tree are serialized.
+ *
+ * Every publish starts a new epoch. A page replaced by a write is retired
+ * with the epoch of its publish and released when
+ *  - every reader took its root in that epoch or later (a reader stores
+ *    the epoch in a slot before it reads the root position), and
+ *  - the descriptors written to the file (the durable one and the one a
+ *    commit may be writing) do not refer to it: the page was written after
+ *    the root of the descriptor or replaced before it.
+ * The descriptors are written by the commits and checkpoints of the
+ * database, after the pages of their roots are durable (or in the same
+ * transaction of the log): a crash leaves the root of the last commit.
+ */
+
+/* Initial capacity of the replaced pages and of the written pages table */
+#define MDB_SHADOW_PAGES  256
+
+/* Returns the slot of a page in the table of the written pages */
+static uint32 mdbShadowBornSlot(const mdbShadow *shadow,
+    const uint32 position)
+{
+  uint32 s = (position * 2654435761UL) & (shadow->born_capacity - 1);
+
+  while (shadow->born_keys[s] != 0 && shadow->born_keys[s] != position)
+  {
+    s = (s + 1) & (shadow->born_capacity - 1);
+  }
+  return s;
+}
+
+/* Empties the table of the written pages, keeps the pages written after the
+ * durable root (the table grows if it is half full) */
+static void mdbShadowBornRebuild(mdbShadow *shadow, const uint32 capacity)
+{
+  uint32 *keys = shadow->born_keys;
+  uint64 *epochs = shadow->born_epochs;
+  uint32 old = shadow->born_capacity;
+  uint32 s;
+  uint32 n;
+
+  shadow->born_keys = (uint32*) calloc(capacity, sizeof(uint32));
+  shadow->born_epochs = (uint64*) malloc(capacity * sizeof(uint64));
+  shadow->born_capacity = capacity;
+  shadow->born_count = 0;
+
+  for (s = 0; s < old; s++)
+  {
+    if (keys[s] != 0 && epochs[s] > shadow->durable)
+    {
+      n = mdbShadowBornSlot(shadow, keys[s]);
+      shadow->born_keys[n] = keys[s];
+      shadow->born_epochs[n] = epochs[s];
+      shadow->born_count++;
+    }
+  }
+  free(keys);
+  free(epochs);
+}
+
+/* Records the epoch in which a page was written (the lock is held) */
+static void mdbShadowBorn(mdbShadow *shadow, const uint32 position,
+    const uint64 epoch)
+{
+  uint32 s;
+
+  if (2 * (shadow->born_count + 1) > shadow->born_capacity)
+  {
+    mdbShadowBornRebuild(shadow, 2 * shadow->born_capacity);
+  }
+
+  s = mdbShadowBornSlot(shadow, position);
+  if (shadow->born_keys[s] == 0)
+  {
+    shadow->born_keys[s] = position;
+    shadow->born_count++;
+  }
+  shadow->born_epochs[s] = epoch;
+}
+
+/* Retires a page replaced by the running write (once per page) */
+static void mdbShadowRetire(mdbShadow *shadow, const uint32 position)
+{
+  mdbShadowPage *page;
+  uint32 s;
+  uint32 i;
+
+  pthread_mutex_lock(&shadow->lock);
+  for (i = shadow->retired_count - shadow->replaced;
+      i < shadow->retired_count; i++)
+  {
+    if (shadow->retired[i].position == position)
+    {
+      pthread_mutex_unlock(&shadow->lock);
+      return;
+    }
+  }
+
+  if (shadow->retired_count == shadow->retired_capacity)
+  {
+    shadow->retired_capacity *= 2;
+    shadow->retired = (mdbShadowPage*) realloc(shadow->retired,
+        shadow->retired_capacity * sizeof(mdbShadowPage));
+  }
+
+  s = mdbShadowBornSlot(shadow, position);
+  page = &shadow->retired[shadow->retired_count++];
+  page->position = position;
+  page->born = (shadow->born_keys[s] != 0) ? shadow->born_epochs[s] : 0;
+  page->retired = 0;
+  shadow->replaced++;
+  pthread_mutex_unlock(&shadow->lock);
+}
+
+/* Tests whether a page refers to the root of an epoch */
+#define MDB_SHADOW_REACHABLE(page,epoch) \
+  ((page)->born <= (epoch) && (epoch) < (page)->retired)
+
+/* Releases the retired pages no reader and no written descriptor can reach
+ * (the lock is held) */
+static void mdbShadowRelease(mdbShadow *shadow)
+{
+  mdbShadowPage *page;
+  uint64 oldest = shadow->epoch;
+  uint64 epoch;
+  uint32 kept = 0;
+  uint32 i;
+
+  for (i = 0; i < MDB_SHADOW_READERS; i++)
+  {
+    epoch = __atomic_load_n(&shadow->readers[i], __ATOMIC_SEQ_CST);
+    if (epoch != 0 && epoch < oldest)
+    {
+      oldest = epoch;
+    }
+  }
+
+  for (i = 0; i < shadow->retired_count; i++)
+  {
+    page = &shadow->retired[i];
+    if (page->retired == 0 || page->retired > oldest ||
+        MDB_SHADOW_REACHABLE(page, shadow->durable) ||
+        MDB_SHADOW_REACHABLE(page, shadow->written))
+    {
+      shadow->retired[kept++] = *page;
+      continue;
+    }
+
+    if (shadow->binding.pool != NULL)
+    {
+      mdbBufferInvalidate(shadow->binding.pool, page->position);
+    }
+    mdbReleaseBlock(&shadow->binding, page->position);
+  }
+  shadow->retired_count = kept;
+}
+
+mdbError mdbBtreeShadowPages(mdbBtree* tree)
+{
+  mdbShadow *shadow;
+
+  /* the links of the B+-tree leaves would change with every leaf, the
+   * compressed nodes share their tails with the pages they replace */
+  if (BT_PLUS(tree) || BT_COMPRESSED(tree))
+  {
+    return MDB_NO_ERROR;
+  }
+
+  tree->meta.flags |= MDB_BTREE_SHADOW;
+
+  tree->ReadNode = &mdbShadowReadNode;
+  tree->WriteNode = &mdbShadowWriteNode;
+  tree->DeleteNode = &mdbShadowDeleteNode;
+
+  if (tree->shadow != NULL)
+  {
+    return MDB_NO_ERROR;
+  }
+
+  /* the state keeps the file binding of the B-tree, its pages can be
+   * released after the B-tree was freed */
+  shadow = (mdbShadow*) calloc(1, sizeof(mdbShadow));
+  shadow->binding.nodeSize = tree->nodeSize;
+  shadow->binding.pool = tree->pool;
+  shadow->binding.map = tree->map;
+  shadow->binding.header = tree->header;
+  shadow->binding.fd = tree->fd;
+  shadow->binding.direct = tree->direct;
+  shadow->binding.wal = tree->wal;
+  shadow->binding.space = tree->space;
+  pthread_mutex_init(&shadow->lock, NULL);
+
+  /* the loaded root is durable (epoch 1) */
+  shadow->meta = tree->meta;
+  shadow->descriptor = tree->descriptor;
+  shadow->epoch = 1;
+  shadow->written = 1;
+  shadow->durable = 1;
+  shadow->retired_capacity = MDB_SHADOW_PAGES;
+  shadow->retired = (mdbShadowPage*) malloc(MDB_SHADOW_PAGES *
+      sizeof(mdbShadowPage));
+  shadow->born_capacity = MDB_SHADOW_PAGES;
+  shadow->born_keys = (uint32*) calloc(MDB_SHADOW_PAGES, sizeof(uint32));
+  shadow->born_epochs = (uint64*) malloc(MDB_SHADOW_PAGES * sizeof(uint64));
+  tree->shadow = shadow;
+
+  /* the database writes the roots and frees the state */
+  if (tree->shadows != NULL)
+  {
+    mdbSpaceLock(tree);
+    shadow->next = *tree->shadows;
+    __atomic_store_n(tree->shadows, shadow, __ATOMIC_RELEASE);
+    mdbSpaceUnlock(tree);
+  }
+
+  return MDB_NO_ERROR;
+}
+
+mdbBtreeNode* mdbShadowReadNode(const uint32 position, mdbBtree* tree)
+{
+  mdbBtreeNode *node = mdbReadNode(position, tree);
+  mdbBtreeNode *copy;
+
+  /* an uncached node is private already */
+  if (node->frame == NULL)
+  {
+    return node;
+  }
+
+  /* the cached page stays in the buffer pool for the next readers, its
+   * frame may still be loading (read ahead by another thread) */
+  mdbAllocateNode(&copy, tree);
+  while (mdbCopyNode(copy, node, mdbNodeVersion(node)) == NULL);
+  mdbFreeNode(node, 0);
+
+  return copy;
+}
+
+uint32 mdbShadowWriteNode(mdbBtreeNode* node)
+{
+  mdbShadow *shadow = node->T->shadow;
+  uint32 position;
+
+  /* the page of the node is replaced, the new page is part of the next
+   * published root */
+  if (node->position != 0)
+  {
+    mdbShadowRetire(shadow, node->position);
+  }
+  node->position = 0L;
+  position = mdbStoreNode(node);
+
+  pthread_mutex_lock(&shadow->lock);
+  mdbShadowBorn(shadow, position, shadow->epoch + 1);
+  pthread_mutex_unlock(&shadow->lock);
+  return position;
+}
+
+void mdbShadowDeleteNode(mdbBtreeNode* node)
+{
+  /* the readers of older roots may still read the page */
+  if (node->position != 0)
+  {
+    mdbShadowRetire(node->T->shadow, node->position);
+  }
+}
+
+uint32 mdbShadowEnter(mdbBtree* tree)
+{
+  mdbShadow *shadow = tree->shadow;
+  uint64 expected;
+  uint64 epoch;
+  uint32 r;
+
+  /* the root read after the slot was taken is the root of the stored
+   * epoch or a newer one (the root is published before its epoch) */
+  for (;;)
+  {
+    for (r = 0; r < MDB_SHADOW_READERS; r++)
+    {
+      expected = 0;
+      epoch = __atomic_load_n(&shadow->epoch, __ATOMIC_SEQ_CST);
+      if (__atomic_load_n(&shadow->readers[r], __ATOMIC_RELAXED) == 0 &&
+          __atomic_compare_exchange_n(&shadow->readers[r], &expected, epoch,
+          0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+      {
+        return r;
+      }
+    }
+    sched_yield();
+  }
+}
+
+void mdbShadowLeave(mdbBtree* tree, const uint32 reader)
+{
+  __atomic_store_n(&tree->shadow->readers[reader], 0, __ATOMIC_RELEASE);
+}
+
+mdbBtreeNode* mdbShadowRoot(mdbBtree* tree)
+{
+  return tree->ReadNode(__atomic_load_n(&tree->meta.root_position,
+      __ATOMIC_SEQ_CST), tree);
+}
+
+void mdbShadowPublish(mdbBtree* tree)
+{
+  mdbShadow *shadow = tree->shadow;
+  uint32 i;
+
+  if (tree->root->position == tree->meta.root_position)
+  {
+    return;
+  }
+
+  pthread_mutex_lock(&shadow->lock);
+  shadow->meta = tree->meta;
+  shadow->meta.root_position = tree->root->position;
+  shadow->descriptor = tree->descriptor;
+
+  /* the root of the new epoch is visible before the epoch */
+  __atomic_store_n(&tree->meta.root_position, shadow->meta.root_position,
+      __ATOMIC_SEQ_CST);
+  __atomic_store_n(&shadow->epoch, shadow->epoch + 1, __ATOMIC_SEQ_CST);
+
+  for (i = shadow->retired_count - shadow->replaced;
+      i < shadow->retired_count; i++)
+  {
+    shadow->retired[i].retired = shadow->epoch;
+  }
+  shadow->replaced = 0;
+
+  mdbShadowRelease(shadow);
+  pthread_mutex_unlock(&shadow->lock);
+}
+
+uint32 mdbShadowWriteRoots(mdbDatabase* db)
+{
+  mdbShadow *first = __atomic_load_n(&db->shadows, __ATOMIC_ACQUIRE);
+  mdbShadow *shadow;
+  uint32 count = 0;
+
+  /* the descriptors refer to the roots published so far, which count as
+   * written from now on (their pages stay until the commit ends) */
+  for (shadow = first; shadow != NULL; shadow = shadow->next)
+  {
+    pthread_mutex_lock(&shadow->lock);
+    if (shadow->epoch > shadow->written && shadow->descriptor != 0)
+    {
+      shadow->synced = shadow->meta;
+      shadow->written = shadow->epoch;
+      count++;
+    }
+    pthread_mutex_unlock(&shadow->lock);
+  }
+  if (count == 0)
+  {
+    return 0;
+  }
+
+  /* the pages reach the disk before the descriptors (the log commits them
+   * together) */
+  if (db->wal == NULL)
+  {
+    mdbFileSync(db->fd);
+  }
+  for (shadow = first; shadow != NULL; shadow = shadow->next)
+  {
+    pthread_mutex_lock(&shadow->lock);
+    if (shadow->written > shadow->durable)
+    {
+      mdbSpaceWrite(&shadow->binding, MDB_OFFSET(shadow->descriptor),
+          &shadow->synced, sizeof(mdbBtreeMeta));
+    }
+    pthread_mutex_unlock(&shadow->lock);
+  }
+  return count;
+}
+
+void mdbShadowReclaim(mdbDatabase* db)
+{
+  mdbShadow *shadow;
+
+  for (shadow = __atomic_load_n(&db->shadows, __ATOMIC_ACQUIRE);
+      shadow != NULL; shadow = shadow->next)
+  {
+    pthread_mutex_lock(&shadow->lock);
+    if (shadow->written > shadow->durable)
+    {
+      shadow->durable = shadow->written;
+      mdbShadowBornRebuild(shadow, shadow->born_capacity);
+    }
+    mdbShadowRelease(shadow);
+    pthread_mutex_unlock(&shadow->lock);
+  }
+}
+
+void mdbShadowFree(mdbDatabase* db)
+{
+  mdbShadow *shadow;
+
+  while ((shadow = db->shadows) != NULL)
+  {
+    db->shadows = shadow->next;
+    pthread_mutex_destroy(&shadow->lock);
+    free(shadow->retired);
+    free(shadow->born_keys);
+    free(shadow->born_epochs);
+    free(shadow);
+  }
+}
@@ -0,0 +1,224 @@
+/*
+ * mdbspace.c
+ *
+ * Free space management (reuse of deleted nodes, free blocks table)
+ *
+ * Copyright (C) 2010, Dinko Hasanbasic (dinko.hasanbasic@gmail.com)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ * Revision history
+ * ----------------
+ * 17.10.2026
+ *  Initial version of file.
+ *  The free blocks of each block (node) size are kept in a linked list,
+ *  the free blocks table of the database header holds the list heads.
+ *  Blocks of other sizes than the node size can be allocated (overflow
+ *  pages), mdbSpaceRead and mdbSpaceWrite are public.
+ *  The file of a database with a write-ahead log is accessed through the
+ *  log, added mdbSpaceEnd.
+ *  The file is read and written with positioned I/O (mdbFileRead,
+ *  mdbFileWrite).
+ *  The free blocks table and the end of the file are locked by the threads
+ *  allocating blocks (mdbSpaceLock, mdbSpaceUnlock).
+ */
+
+#include "mdb.h"
+
+#include <stddef.h>
+
+/*
+ * A deleted node stores the position (block number) of the next free node
+ * of the same size in its first 4 bytes. An entry of the free blocks table
+ * holds the node size and the position of the first free node (0 = unused
+ * entry), so every B-tree node size of a database gets its own free list.
+ * The changed table entries and links are written immediately, the file
+ * always describes the current free lists.
+ */
+
+/* Reads data at the given file position (log, mapped file or positioned
+ * I/O) */
+void mdbSpaceRead(mdbBtree *tree, const uint64 offset, void *data,
+    const uint32 size)
+{
+  if (tree->wal != NULL)
+  {
+    mdbWalRead(tree->wal, offset, data, size);
+  }
+  else if (tree->map != NULL)
+  {
+    memcpy(data, mdbMmapAddress(tree->map, offset, size), size);
+  }
+  else
+  {
+    mdbFileRead(tree->fd, offset, data, size);
+  }
+}
+
+/* Writes data at the given file position (log, mapped file or positioned
+ * I/O) */
+void mdbSpaceWrite(mdbBtree *tree, const uint64 offset,
+    const void *data, const uint32 size)
+{
+  if (tree->wal != NULL)
+  {
+    mdbWalWrite(tree->wal, offset, data, size);
+  }
+  else if (tree->map != NULL)
+  {
+    memcpy(mdbMmapAddress(tree->map, offset, size), data, size);
+  }
+  else
+  {
+    mdbFileWrite(tree->fd, offset, data, size);
+  }
+}
+
+/* Returns the first block after the end of the file (blocks appended to
+ * the log count as written) */
+uint32 mdbSpaceEnd(mdbBtree *tree)
+{
+  if (tree->wal != NULL)
+  {
+    return mdbWalEnd(tree->wal);
+  }
+  return mdbFileEnd(tree->fd);
+}
+
+/* Locks the free blocks table (recursive: held by the allocating functions
+ * and by their callers until the appended blocks are written) */
+void mdbSpaceLock(mdbBtree *tree)
+{
+  if (tree->space != NULL)
+  {
+    pthread_mutex_lock(tree->space);
+  }
+}
+
+/* Unlocks the free blocks table */
+void mdbSpaceUnlock(mdbBtree *tree)
+{
+  if (tree->space != NULL)
+  {
+    pthread_mutex_unlock(tree->space);
+  }
+}
+
+/* Writes an entry of the free blocks table to the database header */
+static void mdbSpaceStoreEntry(mdbBtree *tree, const uint32 e)
+{
+  mdbSpaceWrite(tree,
+      offsetof(mdbDatabaseMeta, free_space) + e * sizeof(mdbFreeEntry),
+      &tree->header->free_space[e], sizeof(mdbFreeEntry));
+}
+
+/* Returns the table entry of the given block size (or MDB_FREE_ENTRIES) */
+static uint32 mdbSpaceFindEntry(const mdbDatabaseMeta *header,
+    const uint32 size)
+{
+  uint32 e;
+
+  for (e = 0; e < MDB_FREE_ENTRIES; e++)
+  {
+    if (header->free_space[e].size == size)
+    {
+      break;
+    }
+  }
+  return e;
+}
+
+/* Returns the position of a free block for a new node (0 = append) */
+uint32 mdbAllocateBlock(mdbBtree *tree)
+{
+  return mdbAllocateBlocks(tree, tree->nodeSize);
+}
+
+/* Adds the block of a deleted node to the free list of its size */
+void mdbReleaseBlock(mdbBtree *tree, const uint32 position)
+{
+  mdbReleaseBlocks(tree, position, tree->nodeSize);
+}
+
+/* Returns the position of free blocks of the given size (0 = append) */
+uint32 mdbAllocateBlocks(mdbBtree *tree, const uint32 size)
+{
+  mdbFreeEntry *entry;
+  uint32 position;
+  uint32 e;
+
+  if (tree->header == NULL)
+  {
+    return 0L;
+  }
+
+  mdbSpaceLock(tree);
+  e = mdbSpaceFindEntry(tree->header, size);
+  if (e == MDB_FREE_ENTRIES || tree->header->free_space[e].position == 0L)
+  {
+    mdbSpaceUnlock(tree);
+    return 0L;
+  }
+
+  /* the first block of the list is reused, the next one becomes first */
+  entry = &tree->header->free_space[e];
+  position = entry->position;
+  mdbSpaceRead(tree, MDB_OFFSET(position), &entry->position, sizeof(uint32));
+
+  /* an empty list releases its table entry */
+  if (entry->position == 0L)
+  {
+    entry->size = 0L;
+  }
+  mdbSpaceStoreEntry(tree, e);
+  mdbSpaceUnlock(tree);
+
+  return position;
+}
+
+/* Adds blocks of the given size to the free list of their size */
+void mdbReleaseBlocks(mdbBtree *tree, const uint32 position,
+    const uint32 size)
+{
+  mdbFreeEntry *entry;
+  uint32 e;
+
+  if (tree->header == NULL || position == 0L)
+  {
+    return;
+  }
+
+  mdbSpaceLock(tree);
+  e = mdbSpaceFindEntry(tree->header, size);
+  if (e == MDB_FREE_ENTRIES)
+  {
+    /* a new list needs an unused entry (if there is none, the block is
+     * lost until the database gets reorganized) */
+    e = mdbSpaceFindEntry(tree->header, 0L);
+    if (e == MDB_FREE_ENTRIES)
+    {
+      mdbSpaceUnlock(tree);
+      return;
+    }
+    tree->header->free_space[e].size = size;
+    tree->header->free_space[e].position = 0L;
+  }
+
+  /* the block becomes the first block of the list */
+  entry = &tree->header->free_space[e];
+  mdbSpaceWrite(tree, MDB_OFFSET(position), &entry->position, sizeof(uint32));
+  entry->position = position;
+  mdbSpaceStoreEntry(tree, e);
+  mdbSpaceUnlock(tree);
+}
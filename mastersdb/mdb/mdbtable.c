@@ -25,6 +25,33 @@
  *  Moved table-specific code from database.c.
  * 13.08.2010
  *  mdbLoadTable re-factoring (they name argument is now the key).
+ * 17.10.2026
+ *  B-trees are bound to the database by mdbInitializeBtree.
+ *  New tables are stored in B+-trees if the database was opened with the
+ *  MDB_OPEN_BPLUS flag (the variant is kept in the B-tree descriptor).
+ *  The B-tree descriptors are referenced by block numbers.
+ *  The new B-tree is bound to the database before its root node gets
+ *  allocated (page sized nodes).
+ *  The system tables and new tables with a STRING key are stored in
+ *  B+-trees with packed internal nodes (prefix compressed keys).
+ *  mdbCreateTable sets the key data type of the new B-tree.
+ *  The variable-length columns of tables stored in B+-trees are stored with
+ *  their actual length (slotted leaves, mdbTableField).
+ *  The long values of the variable-length columns (but the key) are stored
+ *  out of line (mdbColumnOverflows, mdbColumnSize).
+ *  New tables store compressed nodes if the database was opened with the
+ *  MDB_OPEN_COMPRESS flag (larger nodes, mdbBtreeCompressNodes).
+ *  The B-tree descriptors are read and written by mdbDatabaseRead and
+ *  mdbDatabaseWrite (write-ahead log).
+ *  mdbLoadTable looks the columns up with one multi-key search (the column
+ *  nodes are read in batches).
+ *  mdbCreateTable stores the root node and the descriptor of a new table
+ *  in free blocks under the free space lock, its errors discard the new
+ *  B-tree (mdbDiscardTable). mdbLoadTable fails if a column is missing.
+ *  New tables are copy-on-write B-trees if the database was opened with
+ *  the MDB_OPEN_SHADOW flag (mdbBtreeShadowPages), their nodes occupy one
+ *  page (every write copies its path). The B-trees of the tables know
+ *  their descriptor blocks.
  */
 
 #include "mdb.h"
@@ -37,6 +64,10 @@ mdbError mdbCreateSystemTables(mdbDatabase *db)
   static const uint32 tbl_recordlens[3] = {
       sizeof(mdbTable), sizeof(mdbColumn), sizeof(mdbIndex)
   };
+  static const uint32 tbl_keylens[3] = {
+      sizeof(((mdbTable*)0)->name), sizeof(((mdbColumn*)0)->id),
+      sizeof(((mdbIndex*)0)->id)
+  };
   static const char *col_names[3][5] = {
       { "Name", "Columns", "B-tree", "", "" },
       { "Identifier", "Type", "Indexed", "Name", "Length", },
@@ -67,19 +98,22 @@ mdbError mdbCreateSystemTables(mdbDatabase *db)
   /* create the system table meta-data */
   for (t = 0; t < 3; t++)
   {
-    /* initialize the table structure */
-    ret = mdbBtreeCreate(tbl[t], 0L, tbl_recordlens[t], 0L);
-    (*(tbl[t]))->file = db->file;
+    /* initialize the table structure (B+-tree, packed STRING keys) */
+    ret = mdbBtreeCreatePlus(tbl[t], 0L, tbl_recordlens[t], 0L,
+        tbl_keylens[t]);
+    mdbInitializeBtree(db, *tbl[t]);
+    ret = mdbBtreePackKeys(*tbl[t]);
     ret = mdbAllocateNode(&((*tbl[t])->root), (*tbl[t]));
 
     *((*tbl[t])->root->is_leaf) = 1L;
+    mdbLayoutNode((*tbl[t])->root);
     (*tbl[t])->key_type = &db->datatypes[4];
 
     len = strlen(tbl_names[t]);
     strcpy(tbl_rec[t].name + 4, tbl_names[t]);
     *((uint32*)tbl_rec[t].name) = len;
     tbl_rec[t].columns = tbl_columns[t];
-    tbl_rec[t].btree = sizeof(mdbDatabaseMeta) + t * sizeof(mdbBtreeMeta);
+    tbl_rec[t].btree = MDB_SYSTEM_DESCRIPTOR(t);
     ret = mdbBtreeInsert((char*)&tbl_rec[t], db->tables);
   }
 
@@ -112,6 +146,70 @@ mdbError mdbCreateSystemTables(mdbDatabase *db)
   return MDB_NO_ERROR;
 }
 
+/* Tests whether the values of the c-th column of a table are stored out of
+ * line (overflow pages) */
+int mdbColumnOverflows(const mdbDatabase *db, const mdbColumn *col,
+    const uint8 c)
+{
+  const mdbDatatype *type = &db->datatypes[col->type];
+
+  /* the key is always stored in the record */
+  return c > 0 && type->header > 0 &&
+      type->header + col->length * type->size > MDB_OVERFLOW_THRESHOLD;
+}
+
+/* Size of the values of the c-th column of a table in its records */
+uint32 mdbColumnSize(const mdbDatabase *db, const mdbColumn *col,
+    const uint8 c)
+{
+  const mdbDatatype *type = &db->datatypes[col->type];
+
+  if (mdbColumnOverflows(db, col, c))
+  {
+    return MDB_OVERFLOW_SIZE;
+  }
+  return (type->header > 0) ? type->header + col->length * type->size :
+      type->size;
+}
+
+/* Adds a column to the record layout of a table (the columns follow each
+ * other), a variable-length column is a field of the B-tree records.
+ * Returns the offset of the next column. */
+static uint32 mdbTableField(const mdbDatabase *db, const mdbColumn *col,
+    const uint8 c, const uint32 offset, mdbBtreeField *fields,
+    uint32 *count)
+{
+  const mdbDatatype *type = &db->datatypes[col->type];
+
+  /* values stored out of line have a fixed size in the record */
+  if (type->header == 0 || mdbColumnOverflows(db, col, c))
+  {
+    return offset + mdbColumnSize(db, col, c);
+  }
+
+  if (*count < MDB_BTREE_FIELDS)
+  {
+    fields[*count].offset = offset;
+    fields[*count].size = type->header + col->length * type->size;
+    fields[*count].header = type->header;
+    fields[*count].width = type->size;
+    (*count)++;
+  }
+  return offset + type->header + col->length * type->size;
+}
+
+/* Frees the B-tree of a table which was not created, returns the error */
+static mdbError mdbDiscardTable(mdbBtree *T, const mdbError ret)
+{
+  if (T->root != NULL)
+  {
+    mdbFreeNode(T->root, 0);
+  }
+  mdbLatchDestroy(&T->latch);
+  free(T);
+  return ret;
+}
+
 /* Creates a table and stores its B-tree and root node in the database */
 mdbError mdbCreateTable(
     mdbDatabase *db,
@@ -128,25 +226,119 @@ mdbError mdbCreateTable(
   uint32 len = 0;
   mdbTable tbl;
   mdbBtree *T;
+  mdbDatatype *type;
+  mdbBtreeField fields[MDB_BTREE_FIELDS];
+  uint32 field_count = 0;
+  uint32 offset = 0;
+  uint32 order = 0;
+
+  /* the variable-length fields of the records */
+  for (c = 0; c < num_columns; c++)
+  {
+    offset = mdbTableField(db, cb(c, cls), c, offset, fields,
+        &field_count);
+  }
+
+  /* the key is the first column */
+  col = cb(0, cls);
+  type = &db->datatypes[col->type];
+
+  /* compressed nodes are larger, a node only occupies the blocks of its
+   * compressed page (the order fits the records into MDB_COMPRESS_NODE_SIZE,
+   * otherwise the optimal order is used) */
+  if (db->flags & MDB_OPEN_COMPRESS)
+  {
+    order = (MDB_COMPRESS_NODE_SIZE + record_size - 8) /
+        ((record_size + 4) * 2);
+    order = (order > 1) ? order : 0L;
+  }
+
+  /* a write of a copy-on-write B-tree copies every node of its path, the
+   * nodes occupy one page */
+  if ((db->flags & MDB_OPEN_SHADOW) &&
+      !(db->flags & (MDB_OPEN_BPLUS | MDB_OPEN_COMPRESS)))
+  {
+    order = (MDB_PAGE_SIZE + record_size - 8) / ((record_size + 4) * 2);
+    order = (order > 1) ? order : 0L;
+  }
 
   /* calculate the record size and optimal B-tree order for it */
-  ret = mdbBtreeCreate(&T, 0L, record_size, 0L);
-  ret = mdbAllocateNode(&(T->root), T);
-  *(T->root->is_leaf) = 1L;
+  if (db->flags & MDB_OPEN_BPLUS)
+  {
+    len = (type->header > 0) ? type->header + col->length * type->size :
+        type->size;
+    ret = mdbBtreeCreatePlus(&T, order, record_size, 0L, len);
+  }
+  else
+  {
+    ret = mdbBtreeCreate(&T, order, record_size, 0L);
+  }
+  if (ret != MDB_NO_ERROR)
+  {
+    return ret;
+  }
+  mdbInitializeBtree(db, T);
+  T->key_type = type;
 
-  /* saves the B-tree descriptor and root node */
-  fseek(db->file, 0L, SEEK_END);
-  tbl.btree = ftell(db->file);
-  T->meta.root_position = tbl.btree + sizeof(mdbBtreeMeta);
-  T->root->position = T->meta.root_position;
+  /* the STRING keys of a B+-tree are packed in its internal nodes (after
+   * the node size is known) */
+  if (type->header > 0 && (ret = mdbBtreePackKeys(T)) != MDB_NO_ERROR)
+  {
+    return mdbDiscardTable(T, ret);
+  }
 
-  fwrite(&(T->meta), sizeof(mdbBtreeMeta), 1, db->file);
-  fwrite(T->root->data, T->nodeSize, 1, db->file);
+  /* the variable-length fields are stored with their actual length in the
+   * leaves of a B+-tree */
+  mdbBtreeSetFields(T, fields, field_count);
+  if ((ret = mdbBtreeSlotRecords(T)) != MDB_NO_ERROR)
+  {
+    return mdbDiscardTable(T, ret);
+  }
 
-  /* saves the table and column meta data */
+  if ((db->flags & MDB_OPEN_COMPRESS) &&
+      (ret = mdbBtreeCompressNodes(T)) != MDB_NO_ERROR)
+  {
+    return mdbDiscardTable(T, ret);
+  }
+
+  /* the writes of a copy-on-write B-tree publish their roots in its
+   * descriptor */
+  if ((db->flags & MDB_OPEN_SHADOW) &&
+      (ret = mdbBtreeShadowPages(T)) != MDB_NO_ERROR)
+  {
+    return mdbDiscardTable(T, ret);
+  }
+
+  if ((ret = mdbAllocateNode(&(T->root), T)) != MDB_NO_ERROR)
+  {
+    return mdbDiscardTable(T, ret);
+  }
+  *(T->root->is_leaf) = 1L;
+  mdbLayoutNode(T->root);
+
+  /* saves the root node and the B-tree descriptor in free blocks (or
+   * appended, the free space stays locked until both are written) */
+  mdbSpaceLock(T);
+  T->meta.root_position = mdbStoreNode(T->root);
+  if ((tbl.btree = mdbAllocateBlocks(T, MDB_BLOCK_SIZE)) == 0L)
+  {
+    tbl.btree = mdbSpaceEnd(T);
+  }
+  T->descriptor = tbl.btree;
+  mdbDatabaseWrite(db, MDB_OFFSET(tbl.btree), &(T->meta),
+      sizeof(mdbBtreeMeta));
+  mdbSpaceUnlock(T);
+
+  /* saves the table and column meta data (an existing table keeps its
+   * B-tree, the new blocks are released) */
   tbl.columns = num_columns;
   memcpy(tbl.name, name, *((uint32*)name) + 4);
-  ret = mdbBtreeInsert((char*)&tbl, db->tables);
+  if ((ret = mdbBtreeInsert((char*)&tbl, db->tables)) != MDB_NO_ERROR)
+  {
+    mdbReleaseBlocks(T, tbl.btree, MDB_BLOCK_SIZE);
+    T->DeleteNode(T->root);
+    return mdbDiscardTable(T, ret);
+  }
 
   len = *((uint32*)name);
 
@@ -156,10 +348,12 @@ mdbError mdbCreateTable(
     strncpy(col->id + 4, name + 4, len);
     sprintf(col->id + 4 + len, "%03u", c);
     *((uint32*)col->id) = len + 3;
-    ret = mdbBtreeInsert((char*)col, db->columns);
+    if ((ret = mdbBtreeInsert((char*)col, db->columns)) != MDB_NO_ERROR)
+    {
+      return mdbDiscardTable(T, ret);
+    }
   }
 
-  T->file = db->file;
   *btree = T;
 
   return MDB_NO_ERROR;
@@ -178,9 +372,16 @@ mdbError mdbLoadTable(
   uint8 c;
   uint8 key_type;
   mdbTable tbl;
-  mdbColumn col;
+  mdbColumn *cols;
+  char *keys;
+  const char *key_list[256];
+  char *record_list[256];
+  mdbError results[256];
   mdbBtree *T;
   mdbBtreeMeta meta;
+  mdbBtreeField fields[MDB_BTREE_FIELDS];
+  uint32 field_count = 0;
+  uint32 offset = 0;
 
   /* load the table meta data */
   ret = mdbBtreeSearch(name, (char*)&tbl, db->tables);
@@ -191,28 +392,52 @@ mdbError mdbLoadTable(
     strncpy(key + 4, tbl.name + 4, len);
     *((uint32*)key) = len + 3;
 
+    /* the column records are searched at once */
+    cols = (mdbColumn*) malloc(tbl.columns * sizeof(mdbColumn));
+    keys = (char*) malloc(tbl.columns * sizeof(key));
     for (c = 0; c < tbl.columns; c++)
     {
       sprintf(key + 4 + len, "%03u%c", c, '\0');
-      ret = mdbBtreeSearch(key, (char*)&col, db->columns);
+      memcpy(keys + c * sizeof(key), key, sizeof(key));
+      key_list[c] = keys + c * sizeof(key);
+      record_list[c] = (char*)&cols[c];
+    }
+    mdbBtreeSearchKeys(key_list, record_list, results, tbl.columns,
+        db->columns);
+    free(keys);
 
+    /* a table without all of its columns cannot be loaded */
+    for (c = 0; c < tbl.columns; c++)
+    {
+      if (results[c] != MDB_NO_ERROR)
+      {
+        free(cols);
+        return MDB_TABLE_NOT_FOUND;
+      }
+    }
+
+    for (c = 0; c < tbl.columns; c++)
+    {
       /* column call-back */
-      cb(&col, cls);
+      cb(&cols[c], cls);
+      offset = mdbTableField(db, &cols[c], c, offset, fields, &field_count);
 
       if (c == 0)
       {
-        key_type = col.type;
+        key_type = cols[c].type;
       }
     }
+    free(cols);
 
     /* load the table B-tree descriptor */
-    fseek(db->file, tbl.btree, SEEK_SET);
-    ret = fread(&meta, sizeof(mdbBtreeMeta), 1, db->file);
+    mdbDatabaseRead(db, MDB_OFFSET(tbl.btree), &meta, sizeof(mdbBtreeMeta));
     ret = mdbBtreeCreate(&T,meta.order,meta.record_size,meta.key_position);
 
-    /* initialize the mdbBtree structure */
-    T->file = db->file;
-    T->meta.root_position = meta.root_position;
+    /* initialize the mdbBtree structure (B-tree variant, root position) */
+    T->meta = meta;
+    T->descriptor = tbl.btree;
+    mdbInitializeBtree(db, T);
+    mdbBtreeSetFields(T, fields, field_count);
     T->key_type = &(db->datatypes[key_type]);
 
     /* load the table's B-tree root node */
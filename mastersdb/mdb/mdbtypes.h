@@ -24,6 +24,44 @@
  *  Initial version of file.
  * 02.09.2010
  *  Removed the mdbTable structure. It will be handled by the virtual machine.
+ * 17.10.2026
+ *  Added the buffer pool structures (mdbBufferFrame, mdbBufferPool).
+ *  Added the memory-mapped file structure (mdbMmap).
+ *  Added the B-tree path structures (mdbBtreePathEntry, mdbBtreePath).
+ *  Added the record source call-back function (mdbRecordSourcePtr).
+ *  Added the B+-tree fields (flags, key_size, inner_order) to mdbBtreeMeta
+ *  and the per-node layout fields to mdbBtreeNode.
+ *  The B-trees refer to the database header (free blocks table).
+ *  The file positions stored in the file are block numbers.
+ *  Added the direct I/O file descriptors (mdbBtree, mdbDatabase).
+ *  Added the value encoding to mdbDatatype (order-preserving keys).
+ *  Added the node buffer size to mdbBtree (packed internal nodes).
+ *  Added the variable-length fields of the records (mdbBtreeField) to
+ *  mdbBtree and the leaf order to mdbBtreeMeta (slotted leaves).
+ *  Added the tail of a compressed node to mdbBtreeNode.
+ *  Added the write-ahead log structure (mdbWal) and the block image tables
+ *  of its transactions (mdbWalTable).
+ *  The buffer pool frames keep dirty nodes (write-back), the database holds
+ *  the checkpoint interval and the checkpoint timer thread.
+ *  The B-trees and databases read and write the file with its descriptor
+ *  (positioned I/O), the direct I/O descriptor is a separate field.
+ *  Added the asynchronous I/O structures (mdbAioRequest, mdbAio).
+ *  Added the read-ahead window of the scans (mdbBtree, mdbDatabase).
+ *  Added the B-tree cursor structures (mdbBtreeCursorLevel, mdbBtreeCursor).
+ *  Added the node latches (mdbBufferFrame, the uncached root in mdbBtree),
+ *  the lock of the buffer pool, of the batches of asynchronous I/O and of
+ *  the free blocks table.
+ *  The blocks of a mapped file have latches (mdbMmap).
+ *  The node latches are versioned (mdbLatch), a cursor level keeps the
+ *  copy of its node and its version.
+ *  The buffer pool frames keep their released nodes (spare, retired), the
+ *  optimistic readers read the frames without pinning them.
+ *  Added the multi-version structures (mdbNodeImage, mdbSnapshot,
+ *  mdbVersionStore) and the snapshot read by a cursor.
+ *  Added the descriptor block of a B-tree and the root read by a cursor
+ *  (copy-on-write B-trees), the copy-on-write states (mdbShadowPage,
+ *  mdbShadow) of the B-trees and databases, the reader slot of the
+ *  cursors.
  */
 
 #ifndef MDBTYPES_H_
@@ -41,6 +79,14 @@ typedef uint32 (*BtreeWriteNodePtr)(mdbBtreeNode* node);
 /* B-tree node deletion function */
 typedef void (*BtreeDeleteNodePtr)(mdbBtreeNode* node);
 
+/* B-tree record source (mdbBtreeBulkLoad): copies the next record (in key
+ * order) into "record", returns 0 if there are no more records */
+typedef int (*mdbRecordSourcePtr)(char* record, void* cls);
+
+/* Asynchronous I/O completion call-back (mdbAioSubmit), called for each
+ * finished request in the order of completion */
+typedef void (*mdbAioCompletePtr)(mdbAioRequest* request, void* cls);
+
 /* MastersDB table column retrieval call-back function (mdbCreateTable)*/
 typedef mdbColumn* (*mdbColumnRetrievalPtr)(uint8 c, void* cls);
 
@@ -52,8 +98,34 @@ struct mdbBtreeMeta
 {
   uint32 record_size;     /* size of a record                       */
   uint32 key_position;    /* position of the primary key            */
-  uint32 root_position;   /* position of the root node in the file  */
+  uint32 root_position;   /* position (block) of the root node      */
   uint32 order;           /* B-tree order (minimal children count)  */
+  uint32 flags;           /* B-tree variant (MDB_BTREE_*)           */
+  uint32 key_size;        /* size of a key (B+-tree internal nodes) */
+  uint32 inner_order;     /* order of the B+-tree internal nodes    */
+  uint32 leaf_order;      /* order of the leaves (slotted: memory)  */
+};
+
+/* Most variable-length fields of a record stored with their actual length
+ * (further fields keep their full size) */
+#define MDB_BTREE_FIELDS  16
+
+/* Variable-length field of a record (length header followed by the value) */
+struct mdbBtreeField
+{
+  uint32 offset;          /* position of the field in a record      */
+  uint32 size;            /* maximal size (header and value)        */
+  uint16 header;          /* size of the length header              */
+  uint16 width;           /* size of one element of the value       */
+};
+
+/* Latch of a node shared by threads: the version changes with every
+ * exclusive latch (odd while the node is latched exclusively), so readers
+ * can also copy the node without latching it and validate the copy */
+struct mdbLatch
+{
+  pthread_rwlock_t lock;  /* readers/writer lock                    */
+  uint32 version;         /* number of exclusive latches (x 2)      */
 };
 
 /* B-tree structure */
@@ -61,12 +133,29 @@ struct mdbBtree
 {
   mdbBtreeMeta meta;              /* node meta-data                        */
   uint32 nodeSize;                /* size of a node                        */
+  uint32 bufferSize;              /* size of a node in memory (unpacked)   */
   mdbBtreeNode* root;             /* pointer to root node (preloaded)      */
   const mdbDatatype *key_type;    /* Data type of the B-tree key           */
   BtreeLoadNodePtr ReadNode;      /* node retrieval implementation         */
   BtreeWriteNodePtr WriteNode;    /* node write-out implementation         */
   BtreeDeleteNodePtr DeleteNode;  /* node deletion implementation          */
   FILE *file;                     /* The file which containing the B-tree  */
+  mdbBufferPool *pool;            /* node cache (NULL if not cached)       */
+  mdbMmap *map;                   /* mapped file (NULL if not mapped)      */
+  mdbDatabaseMeta *header;        /* free blocks table (NULL if not used)  */
+  int fd;                         /* positioned I/O of the file            */
+  int direct;                     /* direct node I/O (-1 if not used)      */
+  mdbWal *wal;                    /* write-ahead log (NULL if not used)    */
+  mdbAio *aio;                    /* batched node I/O (NULL if not used)   */
+  pthread_mutex_t *space;         /* free blocks lock (NULL if not used)   */
+  mdbVersionStore *versions;      /* node versions (NULL if not used)      */
+  mdbLatch latch;                 /* latch of an uncached root node        */
+  uint32 descriptor;              /* block of the descriptor (0: not kept) */
+  uint32 readahead;               /* children read ahead by scans (0: off) */
+  mdbBtreeField fields[MDB_BTREE_FIELDS]; /* variable-length record fields */
+  uint32 field_count;             /* number of variable-length fields      */
+  mdbShadow *shadow;              /* copy-on-write state (NULL if not used)*/
+  mdbShadow **shadows;            /* copy-on-write states of the database  */
 };
 
 /* B-tree node structure */
@@ -79,6 +168,14 @@ struct mdbBtreeNode
   uint32 *children;       /* pointer to child pointer array         */
   char *records;          /* pointer to records                     */
   uint32 position;        /* position of node (data file)           */
+  uint32 order;           /* order of the node (leaf or internal)   */
+  uint32 entry_size;      /* size of a record (or B+-tree key)      */
+  uint32 key_offset;      /* position of the key in an entry        */
+  mdbBufferFrame *frame;  /* buffer pool frame (NULL if private)    */
+  uint8 mapped;           /* data points into the mapped file       */
+  uint32 tail;            /* tail blocks of a compressed node       */
+  uint32 tail_size;       /* size of the tail (bytes)               */
+  uint32 tail_owner;      /* position the tail is known for         */
 };
 
 /* B-tree traversal structure */
@@ -87,21 +184,277 @@ struct mdbBtreeTraversal
   mdbBtreeNode* node;         /* current B-tree node              */
   mdbBtreeTraversal* parent;  /* parent B-tree node (linked list) */
   uint32 position;            /* current record position          */
+  uint8 latched;              /* node is latched (running scan)   */
+};
+
+/* Maximal height of a B-tree (cursor path, 32-bit positions) */
+#define MDB_BTREE_CURSOR_DEPTH  36
+
+/* Node of a cursor path */
+struct mdbBtreeCursorLevel
+{
+  mdbBtreeNode* node;         /* the node (pinned)                */
+  mdbBtreeNode* copy;         /* copy read by the cursor          */
+  mdbBtreeNode* buffer;       /* private node holding the copy    */
+  uint32 version;             /* version of the copied node       */
+  uint32 position;            /* child index (leaf: gap index)    */
+};
+
+/* B-tree cursor (gap between two records, optionally in a key range) */
+struct mdbBtreeCursor
+{
+  mdbBtree* tree;             /* the B-tree                       */
+  mdbBtreeCursorLevel path[MDB_BTREE_CURSOR_DEPTH]; /* root to leaf */
+  uint32 depth;               /* number of nodes on the path      */
+  char* lower;                /* lower bound key (NULL if none)   */
+  char* upper;                /* upper bound key (NULL if none)   */
+  uint8 flags;                /* exclusive bounds (MDB_CURSOR_*)  */
+  char* gap;                  /* record next to the gap of a left */
+                              /* leaf (restores the cursor)       */
+  const mdbSnapshot* snapshot; /* snapshot read (NULL: current)   */
+  mdbBtreeNode* root;         /* root of the path (copy-on-write: */
+                              /* the root published at the open)  */
+  uint32 reader;              /* reader slot (copy-on-write)      */
+};
+
+/* Maximal number of nodes in a path (two per level, 32-bit positions) */
+#define MDB_BTREE_PATH_SIZE  72
+
+/* B-tree path entry (node visited or created by an insertion/deletion) */
+struct mdbBtreePathEntry
+{
+  mdbBtreeNode* node;         /* the node                         */
+  int parent;                 /* parent entry (-1 for the root)   */
+  uint32 slot;                /* child pointer index in parent    */
+  int prev;                   /* previous leaf entry (B+-tree)    */
+  uint8 dirty;                /* node has to be written back      */
+  uint8 deleted;              /* node was removed from the B-tree */
+  uint8 latched;              /* node is latched exclusively      */
+};
+
+/* B-tree path (root-to-leaf nodes of an insertion/deletion) */
+struct mdbBtreePath
+{
+  mdbBtreePathEntry entries[MDB_BTREE_PATH_SIZE];
+  uint32 count;               /* number of used entries           */
+};
+
+/* Buffer pool frame (holds one cached B-tree node) */
+struct mdbBufferFrame
+{
+  mdbBtreeNode *node;           /* cached node (NULL if frame is free)*/
+  mdbBtreeNode *spare;          /* released node (reused by the frame)*/
+  uint32 size;                  /* buffer size of the frame's nodes */
+  uint32 pins;                  /* number of current node users     */
+  uint32 next;                  /* next frame in the hash chain     */
+  uint8 referenced;             /* clock bit (relaxed atomic)       */
+  uint8 cached;                 /* node can be found by its position*/
+  uint8 dirty;                  /* node differs from its page       */
+  mdbBtree tree;                /* B-tree of a dirty node (copy)    */
+  mdbLatch latch;               /* latch of the node                */
+};
+
+/* Buffer pool (fixed-size node cache, keyed by node position) */
+struct mdbBufferPool
+{
+  mdbBufferFrame *frames;       /* the frames                       */
+  uint32 *buckets;              /* hash table (position -> frame)   */
+  uint32 capacity;              /* number of frames                 */
+  uint32 reserved;              /* number of allocated frames       */
+  uint32 buckets_count;         /* number of hash buckets           */
+  uint32 hand;                  /* clock hand (next eviction check) */
+  uint32 hits;                  /* number of cache hits             */
+  uint32 misses;                /* number of cache misses           */
+  uint32 dirty;                 /* number of dirty frames           */
+  uint32 written;               /* number of nodes written back     */
+  uint32 prefetched;            /* number of nodes read in batches  */
+  mdbBtreeNode **retired;       /* released nodes too small to reuse */
+  uint32 retired_count;         /* number of retired nodes          */
+  pthread_mutex_t lock;         /* guards the frames and the table  */
+};
+
+/* Memory-mapped database file */
+struct mdbMmap
+{
+  char *base;                   /* start of the reserved range      */
+  uint64 reserved;              /* size of the reserved range       */
+  uint64 mapped;                /* size of the mapped part          */
+  uint64 size;                  /* (known) size of the file         */
+  FILE *file;                   /* the mapped file (stdio stream)   */
+  int fd;                       /* the mapped file (descriptor)     */
+  mdbLatch **latches;           /* latches of the blocks (chunks)   */
+  pthread_mutex_t lock;         /* held while the mapping grows     */
+};
+
+/* Hash table of the block images of a log (block -> image) */
+struct mdbWalTable
+{
+  uint32 *keys;                 /* blocks (MDB_WAL_NIL: empty)      */
+  uint64 *values;               /* log offsets (index of an image)  */
+  uint32 capacity;              /* size of the table (power of 2)   */
+  uint32 count;                 /* number of blocks                 */
+};
+
+/* Write-ahead log of a database file */
+struct mdbWal
+{
+  int fd;                       /* the log (descriptor)             */
+  int data;                     /* the database file (descriptor)   */
+  char *path;                   /* file name of the log             */
+  char *buffer;                 /* records not written to the log   */
+  uint32 used;                  /* size of the buffered records     */
+  uint64 end;                   /* end of the log (with the buffer) */
+  uint64 written;               /* end of the written log           */
+  uint64 synced;                /* end of the synced log            */
+  uint32 checksum;              /* checksum of the last record      */
+  uint32 salt;                  /* checksum seed of the current log */
+  uint32 blocks;                /* size of the database (blocks)    */
+  mdbWalTable logged;           /* committed images (log offsets)   */
+  mdbWalTable spilled;          /* uncommitted logged images        */
+  mdbWalTable pending;          /* images of the transaction        */
+  char *images;                 /* the pending images (in memory)   */
+  uint32 images_capacity;       /* number of image buffers          */
+  uint32 commits;               /* number of commits                */
+  uint32 syncs;                 /* number of log syncs              */
+  uint8 syncing;                /* a commit is syncing the log      */
+  pthread_mutex_t lock;         /* guards the log                   */
+  pthread_cond_t synced_cond;   /* signalled after each sync        */
+};
+
+/* Asynchronous read or write of a file range */
+struct mdbAioRequest
+{
+  int fd;                       /* the file (descriptor)            */
+  uint64 offset;                /* position of the range            */
+  char *data;                   /* buffer of the range              */
+  uint32 size;                  /* size of the range                */
+  uint8 write;                  /* write (1) or read (0)            */
+  uint32 done;                  /* bytes transferred (when finished)*/
+  void *cls;                    /* user data of the request         */
+};
+
+/* Asynchronous I/O of a database: io_uring queue, or worker threads which
+ * execute positioned I/O when io_uring is not available */
+struct mdbAio
+{
+  int ring;                     /* io_uring descriptor (-1 if none) */
+  uint32 depth;                 /* requests in flight at most       */
+  void *sq_ring;                /* submission queue ring (mapped)   */
+  size_t sq_ring_size;
+  void *cq_ring;                /* completion queue ring (mapped)   */
+  size_t cq_ring_size;
+  void *sqes;                   /* submission queue entries (mapped)*/
+  size_t sqes_size;
+  uint32 *sq_head;              /* submission queue (in the ring)   */
+  uint32 *sq_tail;
+  uint32 *sq_mask;
+  uint32 *sq_array;
+  uint32 *cq_head;              /* completion queue (in the ring)   */
+  uint32 *cq_tail;
+  uint32 *cq_mask;
+  void *cqes;                   /* completion queue entries         */
+  pthread_t *threads;           /* worker threads (no io_uring)     */
+  uint32 thread_count;          /* number of worker threads         */
+  mdbAioRequest *queue;         /* requests of the current batch    */
+  uint32 queued;                /* size of the current batch        */
+  uint32 next;                  /* next request to be started       */
+  uint32 *completed;            /* finished requests (in order)     */
+  uint32 completed_count;       /* number of finished requests      */
+  uint8 stop;                   /* the workers have to exit         */
+  pthread_mutex_t lock;         /* guards the batch of the workers  */
+  pthread_mutex_t submit;       /* one batch is executed at a time  */
+  pthread_cond_t work_cond;     /* signalled when a batch starts    */
+  pthread_cond_t done_cond;     /* signalled after each request     */
+  uint32 batches;               /* number of submitted batches      */
+  uint64 requests;              /* number of submitted requests     */
+};
+
+/* Image of a node kept for the snapshots older than its change */
+struct mdbNodeImage
+{
+  char *data;                   /* node data before the change      */
+  uint32 position;              /* position of the node             */
+  uint64 saved;                 /* clock of the write changing it   */
+  mdbNodeImage *next;           /* next (older) image of the bucket */
+};
+
+/* Snapshot of a database */
+struct mdbSnapshot
+{
+  mdbVersionStore *store;       /* the versions of the database     */
+  uint64 clock;                 /* writes ended before the snapshot */
+  mdbSnapshot *next;            /* next (older) open snapshot       */
+};
+
+/* Node versions of a database: the writes changing a node while snapshots
+ * are open keep its image (hash table by position, newest images first) */
+struct mdbVersionStore
+{
+  pthread_mutex_t lock;         /* guards the snapshots and images  */
+  pthread_rwlock_t gate;        /* held by the writes (shared) and  */
+                                /* while a snapshot opens           */
+  uint64 clock;                 /* number of started writes         */
+  mdbSnapshot *snapshots;       /* open snapshots (newest first)    */
+  uint32 active;                /* number of open snapshots         */
+  mdbNodeImage **buckets;       /* hash table of the node images    */
+  uint32 images;                /* number of kept images            */
+};
+
+/* Page replaced by a write of a copy-on-write B-tree */
+struct mdbShadowPage
+{
+  uint32 position;              /* the page (block number)          */
+  uint64 born;                  /* publish which wrote the page     */
+                                /* (0: before the last commit)      */
+  uint64 retired;               /* publish which replaced the page  */
+};
+
+/* Number of reader slots of a copy-on-write B-tree (searches and cursors
+ * running at once) */
+#define MDB_SHADOW_READERS  128
+
+/* Published roots and replaced pages of a copy-on-write B-tree (owned by
+ * the database, the B-tree may be freed before it) */
+struct mdbShadow
+{
+  mdbShadow *next;              /* next copy-on-write B-tree        */
+  mdbBtree binding;             /* file binding of the B-tree (node */
+                                /* size, free blocks, pool, log)    */
+  pthread_mutex_t lock;         /* guards the fields below          */
+  mdbBtreeMeta meta;            /* descriptor of the published root */
+  mdbBtreeMeta synced;          /* descriptor written by a commit   */
+  uint32 descriptor;            /* block of the descriptor          */
+  uint64 epoch;                 /* number of published roots        */
+  uint64 written;               /* root of the written descriptor   */
+  uint64 durable;               /* root of the durable descriptor   */
+  uint64 readers[MDB_SHADOW_READERS]; /* epochs seen by the readers */
+                                /* (0: free slot)                   */
+  mdbShadowPage *retired;       /* replaced pages, oldest first     */
+  uint32 retired_count;         /* number of replaced pages         */
+  uint32 retired_capacity;      /* capacity of the replaced pages   */
+  uint32 replaced;              /* replaced by the running write    */
+  uint32 *born_keys;            /* hash table of the pages written  */
+  uint64 *born_epochs;          /* since the last commit (publish)  */
+  uint32 born_capacity;         /* capacity of the hash table       */
+  uint32 born_count;            /* number of pages in the table     */
 };
 
 /* MastersDB free entry (element of free entry table) */
 struct mdbFreeEntry
 {
   uint32 size;                  /* Size of free block (in bytes)    */
-  uint32 position;              /* Position of free block in file   */
+  uint32 position;              /* First free block (block number)  */
 };
 
+/* Number of entries of the free blocks table (block sizes with free lists) */
+#define MDB_FREE_ENTRIES  16
+
 /* MastersDB database meta data */
 struct mdbDatabaseMeta
 {
   uint16 magic_number;          /* MastersDB format magic number    */
   uint16 mdb_version;           /* MastersDB version                */
-  mdbFreeEntry free_space[16];  /* Free blocks table                */
+  mdbFreeEntry free_space[MDB_FREE_ENTRIES]; /* Free blocks table   */
 };
 
 /* MastersDB database runtFirstname information */
@@ -112,7 +465,26 @@ struct mdbDatabase
   mdbBtree *columns;
   mdbBtree *indexes;
   mdbDatatype *datatypes;
+  mdbBufferPool *pool;
+  mdbMmap *map;
+  mdbWal *wal;
+  uint32 flags;
   FILE *file;
+  int fd;                       /* positioned I/O of the file       */
+  int direct;                   /* direct node I/O (-1 if not used) */
+  mdbAio *aio;                  /* batched node I/O (NULL if none)  */
+  mdbVersionStore *versions;    /* node versions (NULL if none)     */
+  uint32 readahead;             /* read-ahead window of the B-trees */
+  pthread_mutex_t space;        /* guards the free blocks table     */
+  uint32 checkpoint_interval;   /* seconds between checkpoints      */
+  uint64 checkpoint_time;       /* time of the last checkpoint      */
+  pthread_t checkpointer;        /* checkpoint timer thread          */
+  pthread_mutex_t timer;        /* guards the timer and its times   */
+  pthread_cond_t timer_cond;    /* wakes the timer (interval, stop) */
+  uint8 timer_running;          /* the timer thread was started     */
+  uint8 timer_stop;             /* the timer thread has to end      */
+  mdbShadow *shadows;           /* copy-on-write B-trees (states)   */
+  pthread_mutex_t shadow_sync;  /* serializes the commits of roots  */
 };
 
 /* MastersDB data type */
@@ -121,6 +493,7 @@ struct mdbDatatype {
   byte header;            /* length of header information (0 if not used)   */
   byte size;              /* size of the value, 0 for varying-size types    */
   CompareKeysPtr compare; /* pointer to comparison function                 */
+  byte encoding;          /* value encoding in the records (MDB_ENCODING_*) */
 };
 
 /* MastersDB table record */
@@ -128,7 +501,7 @@ struct mdbTable
 {
   char name[59];                /* Table name                       */
   byte columns;                 /* Number of columns                */
-  uint32 btree;                 /* Pointer to B-tree in the file    */
+  uint32 btree;                 /* Block of the B-tree descriptor   */
 };
 
 /* MastersDB field record */
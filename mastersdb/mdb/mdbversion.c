@@ -0,0 +1,271 @@
+/*
+ * mdbversion.c
+ *
+ * Multi-version concurrency control (snapshots of a database)
+ *
+ * Copyright (C) 2010, Dinko Hasanbasic (dinko.hasanbasic@gmail.com)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ * Revision history
+ * ----------------
+ * 17.10.2026
+ *  Initial version of file.
+ *  Page level versions: a write (insertion or deletion) keeps the image of
+ *  every node it latches exclusively while a snapshot which still needs the
+ *  node is open. A snapshot reads the first image of a node kept after it
+ *  was opened, or the node itself if no write changed it since then. The
+ *  images are released when the snapshots which need them are closed.
+ */
+
+#include "mdb.h"
+
+#include <stdlib.h>
+
+/*
+ * Every write increments the clock when it begins, a snapshot takes the
+ * clock when it opens. The writes hold the gate shared, a snapshot opens
+ * while it holds the gate exclusively: the writes which began before it
+ * have ended (their clocks are not greater than the clock of the snapshot)
+ * and the writes which begin after it see it open (their clocks are
+ * greater). An image kept by a write is stamped with the clock read while
+ * the node is latched, so the images kept after a snapshot opened are
+ * exactly the ones stamped with a greater clock.
+ */
+
+/* Returns the hash bucket of a node position */
+static uint32 mdbVersionHash(const uint32 position)
+{
+  return (uint32)((position * 2654435761U) % MDB_VERSION_BUCKETS);
+}
+
+/* Releases the images which no open snapshot reads (the ones kept before
+ * the oldest snapshot opened, all of them if no snapshot is open) */
+static void mdbVersionRelease(mdbVersionStore *store)
+{
+  mdbSnapshot *oldest = store->snapshots;
+  mdbNodeImage **link;
+  mdbNodeImage *image;
+  uint32 b;
+
+  while (oldest != NULL && oldest->next != NULL)
+  {
+    oldest = oldest->next;
+  }
+
+  for (b = 0; b < MDB_VERSION_BUCKETS && store->images > 0; b++)
+  {
+    link = &store->buckets[b];
+    while ((image = *link) != NULL)
+    {
+      if (oldest == NULL || image->saved <= oldest->clock)
+      {
+        *link = image->next;
+        free(image->data);
+        free(image);
+        store->images--;
+      }
+      else
+      {
+        link = &image->next;
+      }
+    }
+  }
+}
+
+mdbError mdbVersionStoreCreate(mdbVersionStore **store)
+{
+  mdbVersionStore *l_store =
+      (mdbVersionStore*) malloc(sizeof(mdbVersionStore));
+  pthread_rwlockattr_t attr;
+
+  pthread_mutex_init(&l_store->lock, NULL);
+
+  /* a snapshot waiting for the running writes is not overtaken by the
+   * writes beginning after it */
+  pthread_rwlockattr_init(&attr);
+#ifdef __GLIBC__
+  pthread_rwlockattr_setkind_np(&attr,
+      PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+#endif
+  pthread_rwlock_init(&l_store->gate, &attr);
+  pthread_rwlockattr_destroy(&attr);
+
+  l_store->clock = 0;
+  l_store->snapshots = NULL;
+  l_store->active = 0;
+  l_store->images = 0;
+  l_store->buckets = (mdbNodeImage**) calloc(MDB_VERSION_BUCKETS,
+      sizeof(mdbNodeImage*));
+
+  *store = l_store;
+  return MDB_NO_ERROR;
+}
+
+mdbError mdbVersionStoreFree(mdbVersionStore *store)
+{
+  mdbVersionRelease(store);
+  pthread_rwlock_destroy(&store->gate);
+  pthread_mutex_destroy(&store->lock);
+  free(store->buckets);
+  free(store);
+
+  return MDB_NO_ERROR;
+}
+
+void mdbVersionBegin(mdbVersionStore *store)
+{
+  if (store != NULL)
+  {
+    pthread_rwlock_rdlock(&store->gate);
+    __atomic_add_fetch(&store->clock, 1, __ATOMIC_SEQ_CST);
+  }
+}
+
+void mdbVersionEnd(mdbVersionStore *store)
+{
+  if (store != NULL)
+  {
+    pthread_rwlock_unlock(&store->gate);
+  }
+}
+
+void mdbVersionSave(mdbBtreeNode *node)
+{
+  mdbVersionStore *store = node->T->versions;
+  mdbNodeImage *image;
+  uint32 b;
+
+  /* the snapshots open while no write holds the gate, so no snapshot can
+   * open during the write (but they can be closed) */
+  if (store == NULL || __atomic_load_n(&store->active, __ATOMIC_ACQUIRE) == 0)
+  {
+    return;
+  }
+
+  pthread_mutex_lock(&store->lock);
+  if (store->snapshots == NULL)
+  {
+    pthread_mutex_unlock(&store->lock);
+    return;
+  }
+  b = mdbVersionHash(node->position);
+  image = store->buckets[b];
+  while (image != NULL && image->position != node->position)
+  {
+    image = image->next;
+  }
+
+  /* the newest snapshot has an image of the node already */
+  if (image != NULL && image->saved > store->snapshots->clock)
+  {
+    pthread_mutex_unlock(&store->lock);
+    return;
+  }
+
+  image = (mdbNodeImage*) malloc(sizeof(mdbNodeImage));
+  image->data = (char*) malloc(node->T->bufferSize);
+  memcpy(image->data, node->data, node->T->bufferSize);
+  image->position = node->position;
+  image->saved = __atomic_load_n(&store->clock, __ATOMIC_SEQ_CST);
+  image->next = store->buckets[b];
+  store->buckets[b] = image;
+  store->images++;
+  pthread_mutex_unlock(&store->lock);
+}
+
+mdbError mdbSnapshotOpen(mdbSnapshot **snapshot, mdbDatabase *db)
+{
+  mdbVersionStore *store = db->versions;
+  mdbSnapshot *l_snapshot;
+
+  /* the nodes of mapped databases are changed in place (no images) */
+  if (store == NULL)
+  {
+    return MDB_CANNOT_OPEN_SNAPSHOT;
+  }
+
+  l_snapshot = (mdbSnapshot*) malloc(sizeof(mdbSnapshot));
+  l_snapshot->store = store;
+
+  pthread_rwlock_wrlock(&store->gate);
+  pthread_mutex_lock(&store->lock);
+  l_snapshot->clock = store->clock;
+  l_snapshot->next = store->snapshots;
+  store->snapshots = l_snapshot;
+  __atomic_add_fetch(&store->active, 1, __ATOMIC_RELEASE);
+  pthread_mutex_unlock(&store->lock);
+  pthread_rwlock_unlock(&store->gate);
+
+  *snapshot = l_snapshot;
+  return MDB_NO_ERROR;
+}
+
+mdbError mdbSnapshotClose(mdbSnapshot *snapshot)
+{
+  mdbVersionStore *store = snapshot->store;
+  mdbSnapshot **link;
+
+  pthread_mutex_lock(&store->lock);
+  link = &store->snapshots;
+  while (*link != snapshot)
+  {
+    link = &(*link)->next;
+  }
+  *link = snapshot->next;
+  __atomic_sub_fetch(&store->active, 1, __ATOMIC_RELEASE);
+  mdbVersionRelease(store);
+  pthread_mutex_unlock(&store->lock);
+
+  free(snapshot);
+  return MDB_NO_ERROR;
+}
+
+mdbBtreeNode* mdbSnapshotNode(const mdbSnapshot *snapshot,
+    mdbBtreeNode *node, mdbBtreeNode *copy)
+{
+  mdbVersionStore *store = snapshot->store;
+  mdbBtreeNode *read;
+  mdbNodeImage *image;
+  mdbNodeImage *found = NULL;
+
+  /* the node is copied before its images are looked up: a write changing
+   * it after the copy keeps its image later, and if no image was kept
+   * after the snapshot opened, the copy is the node of the snapshot */
+  while ((read = mdbCopyNode(copy, node, mdbNodeVersion(node))) == NULL);
+
+  pthread_mutex_lock(&store->lock);
+  for (image = store->buckets[mdbVersionHash(node->position)];
+      image != NULL; image = image->next)
+  {
+    /* the oldest image kept after the snapshot opened */
+    if (image->position == node->position && image->saved > snapshot->clock)
+    {
+      found = image;
+    }
+  }
+
+  /* the images are only released with the snapshots which need them */
+  if (found != NULL)
+  {
+    memcpy(copy->data, found->data, node->T->bufferSize);
+    copy->T = node->T;
+    copy->position = node->position;
+    mdbLayoutNode(copy);
+    read = copy;
+  }
+  pthread_mutex_unlock(&store->lock);
+
+  return read;
+}
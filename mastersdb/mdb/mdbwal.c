@@ -0,0 +1,756 @@
+/*
+ * mdbwal.c
+ *
+ * Write-ahead log (redo records of the database blocks, group commit)
+ *
+ * Copyright (C) 2010, Dinko Hasanbasic (dinko.hasanbasic@gmail.com)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ * Revision history
+ * ----------------
+ * 17.10.2026
+ *  Initial version of file.
+ *  The blocks written to a database file opened with MDB_OPEN_WAL are
+ *  appended to its log, the database file is only written by checkpoints.
+ *  A transaction keeps the latest image of every block it writes and logs
+ *  it once, when it commits (a large one logs its images earlier, they
+ *  keep the log from being restarted by a checkpoint until it commits).
+ *  The records are checked with CRC32C (eight bytes at a time).
+ *  The log and the database file are accessed with positioned I/O
+ *  (mdbfile.c), the log is opened with the descriptor of the database.
+ */
+
+#include "mdb.h"
+
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+
+#ifdef __SSE4_2__
+#include <nmmintrin.h>
+#endif
+
+/*
+ * The log (file name of the database + "-wal") starts with a header (magic
+ * number, version, salt and format) followed by records:
+ *
+ *  [block][type][checksum][reserved] + block image (MDB_WAL_PAGE records)
+ *
+ * A record of the type MDB_WAL_PAGE holds the new image of a whole block of
+ * the database file, a record of the type MDB_WAL_COMMIT ends a
+ * transaction. The checksum of a record continues the checksum of the
+ * previous one (the first record continues the salt), so a torn or stale
+ * record ends the log.
+ *
+ * A transaction keeps the images of the blocks it writes in memory (the
+ * pending table), every write of a block changes its image and the commit
+ * logs each image once. A transaction writing more than MDB_WAL_PENDING
+ * blocks logs its images before it commits (the spilled table), they are
+ * only replayed if its commit record follows them.
+ *
+ * Nothing is written to the database file between two checkpoints: the
+ * blocks which have committed images in the log are read from the log (the
+ * logged table holds the position of the latest image of each block). A
+ * commit writes the buffered records and syncs the log; transactions
+ * committing while the log is synced wait for the running sync and share
+ * the next one (group commit). A checkpoint copies the latest committed
+ * images into the database file, syncs it and starts a new log. Opening a
+ * database replays the committed transactions of its log (recovery).
+ */
+
+/* Log header and record types */
+#define MDB_WAL_MAGIC       0x57424444UL    /* "DDBW" */
+#define MDB_WAL_FORMAT      2               /* CRC32C checksums */
+#define MDB_WAL_PAGE        1
+#define MDB_WAL_COMMIT      2
+
+/* Size of the log header and of a record header */
+#define MDB_WAL_HEADER      (4 * sizeof(uint32))
+#define MDB_WAL_RECORD      (4 * sizeof(uint32))
+
+/* Size of the record buffer (records written to the log at once) */
+#define MDB_WAL_BUFFER      (64 * (MDB_WAL_RECORD + MDB_PAGE_SIZE))
+
+/* Empty entry of a hash table */
+#define MDB_WAL_NIL         0xFFFFFFFFUL
+
+/* CRC32C (Castagnoli) polynomial, reversed */
+#define MDB_WAL_CRC32C      0x82F63B78UL
+
+/* Tables of the CRC32C computed eight bytes at a time (slicing-by-8) */
+static uint32 mdbWalCrc[8][256];
+static pthread_once_t mdbWalCrcOnce = PTHREAD_ONCE_INIT;
+
+static void mdbWalCrcInit(void)
+{
+  uint32 crc;
+  uint32 i;
+  uint32 j;
+
+  for (i = 0; i < 256; i++)
+  {
+    crc = i;
+    for (j = 0; j < 8; j++)
+    {
+      crc = (crc >> 1) ^ (MDB_WAL_CRC32C & (0U - (crc & 1)));
+    }
+    mdbWalCrc[0][i] = crc;
+  }
+  for (i = 0; i < 256; i++)
+  {
+    for (j = 1; j < 8; j++)
+    {
+      mdbWalCrc[j][i] = (mdbWalCrc[j - 1][i] >> 8) ^
+          mdbWalCrc[0][mdbWalCrc[j - 1][i] & 0xFF];
+    }
+  }
+}
+
+/* Continues a checksum (CRC32C, the SSE4.2 instruction if available) */
+static uint32 mdbWalChecksum(uint32 checksum, const char *data,
+    const uint32 size)
+{
+  const unsigned char *p = (const unsigned char*)data;
+  uint32 crc = ~checksum;
+  uint32 left = size;
+  uint64 word;
+
+  while (left >= sizeof(uint64))
+  {
+    memcpy(&word, p, sizeof(uint64));
+#ifdef __SSE4_2__
+    crc = (uint32)_mm_crc32_u64(crc, word);
+#else
+    word ^= crc;
+    crc = mdbWalCrc[7][word & 0xFF] ^
+        mdbWalCrc[6][(word >> 8) & 0xFF] ^
+        mdbWalCrc[5][(word >> 16) & 0xFF] ^
+        mdbWalCrc[4][(word >> 24) & 0xFF] ^
+        mdbWalCrc[3][(word >> 32) & 0xFF] ^
+        mdbWalCrc[2][(word >> 40) & 0xFF] ^
+        mdbWalCrc[1][(word >> 48) & 0xFF] ^
+        mdbWalCrc[0][word >> 56];
+#endif
+    p += sizeof(uint64);
+    left -= sizeof(uint64);
+  }
+  while (left-- > 0)
+  {
+    crc = (crc >> 8) ^ mdbWalCrc[0][(crc ^ *p++) & 0xFF];
+  }
+  return ~crc;
+}
+
+/* Returns the slot of a block in a hash table (its entry or an empty one) */
+static uint32 mdbWalSlot(const mdbWalTable *table, const uint32 block)
+{
+  uint32 s = (block * 2654435761UL) & (table->capacity - 1);
+
+  while (table->keys[s] != MDB_WAL_NIL && table->keys[s] != block)
+  {
+    s = (s + 1) & (table->capacity - 1);
+  }
+  return s;
+}
+
+/* Empties a hash table (a capacity of 0 keeps the current one) */
+static void mdbWalReset(mdbWalTable *table, const uint32 capacity)
+{
+  if (capacity > 0)
+  {
+    free(table->keys);
+    free(table->values);
+    table->capacity = capacity;
+    table->keys = (uint32*) malloc(capacity * sizeof(uint32));
+    table->values = (uint64*) malloc(capacity * sizeof(uint64));
+  }
+  memset(table->keys, 0xFF, table->capacity * sizeof(uint32));
+  table->count = 0;
+}
+
+/* Stores the image of a block in a hash table */
+static void mdbWalIndex(mdbWalTable *table, const uint32 block,
+    const uint64 value)
+{
+  uint32 *keys = table->keys;
+  uint64 *values = table->values;
+  uint32 capacity = table->capacity;
+  uint32 s;
+  uint32 i;
+
+  /* the table is kept at most half full */
+  if (2 * (table->count + 1) > capacity)
+  {
+    table->keys = NULL;
+    table->values = NULL;
+    mdbWalReset(table, capacity << 1);
+    for (i = 0; i < capacity; i++)
+    {
+      if (keys[i] != MDB_WAL_NIL)
+      {
+        s = mdbWalSlot(table, keys[i]);
+        table->keys[s] = keys[i];
+        table->values[s] = values[i];
+        table->count++;
+      }
+    }
+    free(keys);
+    free(values);
+  }
+
+  s = mdbWalSlot(table, block);
+  if (table->keys[s] == MDB_WAL_NIL)
+  {
+    table->keys[s] = block;
+    table->count++;
+  }
+  table->values[s] = value;
+}
+
+/* Writes the buffered records to the log */
+static void mdbWalFlush(mdbWal *wal)
+{
+  if (wal->used > 0)
+  {
+    mdbFileWrite(wal->fd, wal->written, wal->buffer, wal->used);
+    wal->written += wal->used;
+    wal->used = 0;
+  }
+}
+
+/* Appends a record (block image or commit) to the log, returns the log
+ * position of the image */
+static uint64 mdbWalAppend(mdbWal *wal, const uint32 block,
+    const uint32 type, const char *data)
+{
+  const uint32 size = (type == MDB_WAL_PAGE) ? MDB_PAGE_SIZE : 0;
+  const uint64 offset = wal->end + MDB_WAL_RECORD;
+  uint32 header[4];
+
+  if (wal->used + MDB_WAL_RECORD + size > MDB_WAL_BUFFER)
+  {
+    mdbWalFlush(wal);
+  }
+
+  header[0] = block;
+  header[1] = type;
+  header[3] = 0;
+  wal->checksum = mdbWalChecksum(wal->checksum, (char*)header,
+      2 * sizeof(uint32));
+  wal->checksum = mdbWalChecksum(wal->checksum, data, size);
+  header[2] = wal->checksum;
+
+  memcpy(wal->buffer + wal->used, header, MDB_WAL_RECORD);
+  memcpy(wal->buffer + wal->used + MDB_WAL_RECORD, data, size);
+  wal->used += MDB_WAL_RECORD + size;
+  wal->end += MDB_WAL_RECORD + size;
+
+  return offset;
+}
+
+/* Reads a block image of the log (record buffer or log file) */
+static void mdbWalReadImage(mdbWal *wal, const uint64 offset, char *data)
+{
+  if (offset >= wal->written)
+  {
+    memcpy(data, wal->buffer + (offset - wal->written), MDB_PAGE_SIZE);
+  }
+  else
+  {
+    mdbFileRead(wal->fd, offset, data, MDB_PAGE_SIZE);
+  }
+}
+
+/* Reads the current image of a block (transaction, log or database) */
+static void mdbWalReadBlock(mdbWal *wal, const uint32 block, char *data)
+{
+  uint32 s = mdbWalSlot(&wal->pending, block);
+
+  if (wal->pending.keys[s] != MDB_WAL_NIL)
+  {
+    memcpy(data, wal->images + wal->pending.values[s] * MDB_PAGE_SIZE,
+        MDB_PAGE_SIZE);
+    return;
+  }
+
+  s = mdbWalSlot(&wal->spilled, block);
+  if (wal->spilled.keys[s] != MDB_WAL_NIL)
+  {
+    mdbWalReadImage(wal, wal->spilled.values[s], data);
+    return;
+  }
+
+  /* blocks after the end of the database file are empty */
+  s = mdbWalSlot(&wal->logged, block);
+  if (wal->logged.keys[s] != MDB_WAL_NIL)
+  {
+    mdbWalReadImage(wal, wal->logged.values[s], data);
+  }
+  else
+  {
+    mdbFileRead(wal->data, MDB_OFFSET(block), data, MDB_PAGE_SIZE);
+  }
+}
+
+/* Logs the pending images of the transaction before it commits (they are
+ * replayed only if its commit record follows them) */
+static void mdbWalSpill(mdbWal *wal)
+{
+  uint32 s;
+
+  for (s = 0; s < wal->pending.capacity; s++)
+  {
+    if (wal->pending.keys[s] != MDB_WAL_NIL)
+    {
+      mdbWalIndex(&wal->spilled, wal->pending.keys[s],
+          mdbWalAppend(wal, wal->pending.keys[s], MDB_WAL_PAGE,
+          wal->images + wal->pending.values[s] * MDB_PAGE_SIZE));
+    }
+  }
+  mdbWalReset(&wal->pending, 0);
+}
+
+/* Returns the image of a block kept by the transaction, a new image holds
+ * the current contents of the block unless it is written as a whole */
+static char* mdbWalImage(mdbWal *wal, const uint32 block, const int whole)
+{
+  uint32 s = mdbWalSlot(&wal->pending, block);
+  char *image;
+
+  if (wal->pending.keys[s] != MDB_WAL_NIL)
+  {
+    return wal->images + wal->pending.values[s] * MDB_PAGE_SIZE;
+  }
+
+  if (wal->pending.count >= MDB_WAL_PENDING)
+  {
+    mdbWalSpill(wal);
+  }
+  if (wal->pending.count == wal->images_capacity)
+  {
+    wal->images_capacity = (wal->images_capacity > 0) ?
+        (wal->images_capacity << 1) : 64;
+    wal->images = (char*) realloc(wal->images,
+        (size_t)wal->images_capacity * MDB_PAGE_SIZE);
+  }
+
+  image = wal->images + (uint64)wal->pending.count * MDB_PAGE_SIZE;
+  if (!whole)
+  {
+    mdbWalReadBlock(wal, block, image);
+  }
+  mdbWalIndex(&wal->pending, block, wal->pending.count);
+  return image;
+}
+
+/* Starts a new (empty) log */
+static void mdbWalStart(mdbWal *wal)
+{
+  uint32 header[4];
+
+  wal->salt = wal->salt * 1103515245UL + 12345UL;
+  header[0] = MDB_WAL_MAGIC;
+  header[1] = MDB_VERSION;
+  header[2] = wal->salt;
+  header[3] = MDB_WAL_FORMAT;
+
+  ftruncate(wal->fd, 0);
+  mdbFileWrite(wal->fd, 0, header, MDB_WAL_HEADER);
+  mdbFileSync(wal->fd);
+
+  wal->checksum = wal->salt;
+  wal->written = wal->synced = wal->end = MDB_WAL_HEADER;
+  wal->used = 0;
+  mdbWalReset(&wal->logged, 0);
+}
+
+/* Replays the committed transactions of the log into the database file */
+static void mdbWalReplay(mdbWal *wal)
+{
+  char *page = (char*) malloc(MDB_PAGE_SIZE);
+  uint32 *pending = NULL;
+  uint64 *positions = NULL;
+  uint32 count = 0;
+  uint32 capacity = 0;
+  uint32 header[4];
+  uint32 checksum;
+  uint64 offset = MDB_WAL_HEADER;
+  uint32 i;
+
+  if (mdbFileRead(wal->fd, 0, header, MDB_WAL_HEADER) != MDB_WAL_HEADER ||
+      header[0] != MDB_WAL_MAGIC || header[1] != MDB_VERSION ||
+      header[3] != MDB_WAL_FORMAT)
+  {
+    free(page);
+    return;
+  }
+  wal->salt = header[2];
+  checksum = header[2];
+
+  while (mdbFileRead(wal->fd, offset, header, MDB_WAL_RECORD) ==
+      MDB_WAL_RECORD)
+  {
+    checksum = mdbWalChecksum(checksum, (char*)header, 2 * sizeof(uint32));
+
+    if (header[1] == MDB_WAL_PAGE)
+    {
+      if (mdbFileRead(wal->fd, offset + MDB_WAL_RECORD, page,
+          MDB_PAGE_SIZE) != MDB_PAGE_SIZE ||
+          (checksum = mdbWalChecksum(checksum, page, MDB_PAGE_SIZE)) !=
+          header[2])
+      {
+        break;
+      }
+      if (count == capacity)
+      {
+        capacity = (capacity > 0) ? (capacity << 1) : 256;
+        pending = (uint32*) realloc(pending, capacity * sizeof(uint32));
+        positions = (uint64*) realloc(positions, capacity * sizeof(uint64));
+      }
+      pending[count] = header[0];
+      positions[count++] = offset + MDB_WAL_RECORD;
+      offset += MDB_WAL_RECORD + MDB_PAGE_SIZE;
+    }
+    else if (header[1] == MDB_WAL_COMMIT && checksum == header[2])
+    {
+      /* the images of a committed transaction are applied in log order */
+      for (i = 0; i < count; i++)
+      {
+        if (mdbFileRead(wal->fd, positions[i], page, MDB_PAGE_SIZE) ==
+            MDB_PAGE_SIZE)
+        {
+          mdbFileWrite(wal->data, MDB_OFFSET(pending[i]), page,
+              MDB_PAGE_SIZE);
+        }
+      }
+      count = 0;
+      offset += MDB_WAL_RECORD;
+    }
+    else
+    {
+      break;
+    }
+  }
+
+  mdbFileSync(wal->data);
+  free(pending);
+  free(positions);
+  free(page);
+}
+
+/* Opens (creates) the log of a database, the committed transactions of an
+ * existing log are recovered */
+mdbError mdbWalOpen(mdbWal **wal, const int fd, const char *filename,
+    const uint8 create)
+{
+  mdbWal *l_wal = (mdbWal*) malloc(sizeof(mdbWal));
+
+  l_wal->path = (char*) malloc(strlen(filename) + 5);
+  sprintf(l_wal->path, "%s-wal", filename);
+
+  l_wal->fd = open(l_wal->path, O_RDWR | O_CREAT | (create ? O_TRUNC : 0),
+      0644);
+  if (l_wal->fd < 0)
+  {
+    free(l_wal->path);
+    free(l_wal);
+    return MDB_CANNOT_OPEN_WAL;
+  }
+
+  pthread_once(&mdbWalCrcOnce, mdbWalCrcInit);
+
+  l_wal->data = fd;
+  l_wal->buffer = (char*) malloc(MDB_WAL_BUFFER);
+  memset(&l_wal->logged, 0, sizeof(mdbWalTable));
+  memset(&l_wal->spilled, 0, sizeof(mdbWalTable));
+  memset(&l_wal->pending, 0, sizeof(mdbWalTable));
+  l_wal->images = NULL;
+  l_wal->images_capacity = 0;
+  l_wal->salt = (uint32)time(NULL) ^ (uint32)getpid();
+  l_wal->commits = 0;
+  l_wal->syncs = 0;
+  l_wal->syncing = 0;
+  pthread_mutex_init(&l_wal->lock, NULL);
+  pthread_cond_init(&l_wal->synced_cond, NULL);
+  mdbWalReset(&l_wal->logged, 1024);
+  mdbWalReset(&l_wal->spilled, 64);
+  mdbWalReset(&l_wal->pending, 256);
+
+  if (!create)
+  {
+    mdbWalReplay(l_wal);
+  }
+  mdbWalStart(l_wal);
+
+  l_wal->blocks = mdbFileEnd(l_wal->data);
+
+  *wal = l_wal;
+  return MDB_NO_ERROR;
+}
+
+/* Recovers the log of a database opened without one (if it exists) */
+mdbError mdbWalRecover(const int fd, const char *filename)
+{
+  mdbWal *wal;
+  char *path = (char*) malloc(strlen(filename) + 5);
+
+  sprintf(path, "%s-wal", filename);
+  if (access(path, F_OK) == 0 &&
+      mdbWalOpen(&wal, fd, filename, 0) == MDB_NO_ERROR)
+  {
+    mdbWalClose(wal);
+  }
+  free(path);
+
+  return MDB_NO_ERROR;
+}
+
+/* Checkpoints the log and removes it */
+mdbError mdbWalClose(mdbWal *wal)
+{
+  mdbWalCheckpoint(wal);
+
+  close(wal->fd);
+  unlink(wal->path);
+
+  pthread_mutex_destroy(&wal->lock);
+  pthread_cond_destroy(&wal->synced_cond);
+  free(wal->path);
+  free(wal->buffer);
+  free(wal->logged.keys);
+  free(wal->logged.values);
+  free(wal->spilled.keys);
+  free(wal->spilled.values);
+  free(wal->pending.keys);
+  free(wal->pending.values);
+  free(wal->images);
+  free(wal);
+
+  return MDB_NO_ERROR;
+}
+
+/* Reads data of the database file (the images of the transaction and the
+ * logged blocks are read first) */
+void mdbWalRead(mdbWal *wal, const uint64 offset, void *data,
+    const uint32 size)
+{
+  char *page = NULL;
+  char *dest = (char*)data;
+  uint32 block = (uint32)(offset >> MDB_BLOCK_SHIFT);
+  uint32 skip = (uint32)(offset & (MDB_PAGE_SIZE - 1));
+  uint32 left = size;
+  uint32 len;
+
+  pthread_mutex_lock(&wal->lock);
+  while (left > 0)
+  {
+    len = MDB_PAGE_SIZE - skip;
+    len = (left < len) ? left : len;
+
+    if (len == MDB_PAGE_SIZE)
+    {
+      mdbWalReadBlock(wal, block, dest);
+    }
+    else
+    {
+      if (page == NULL)
+      {
+        page = (char*) malloc(MDB_PAGE_SIZE);
+      }
+      mdbWalReadBlock(wal, block, page);
+      memcpy(dest, page + skip, len);
+    }
+
+    dest += len;
+    left -= len;
+    skip = 0;
+    block++;
+  }
+  pthread_mutex_unlock(&wal->lock);
+
+  free(page);
+}
+
+/* Writes data of the database file: the images of the blocks kept by the
+ * transaction are changed (the commit logs them) */
+void mdbWalWrite(mdbWal *wal, const uint64 offset, const void *data,
+    const uint32 size)
+{
+  const char *src = (const char*)data;
+  uint32 block = (uint32)(offset >> MDB_BLOCK_SHIFT);
+  uint32 skip = (uint32)(offset & (MDB_PAGE_SIZE - 1));
+  uint32 left = size;
+  uint32 len;
+
+  pthread_mutex_lock(&wal->lock);
+  while (left > 0)
+  {
+    len = MDB_PAGE_SIZE - skip;
+    len = (left < len) ? left : len;
+
+    memcpy(mdbWalImage(wal, block, len == MDB_PAGE_SIZE) + skip, src, len);
+    if (block >= wal->blocks)
+    {
+      wal->blocks = block + 1;
+    }
+
+    src += len;
+    left -= len;
+    skip = 0;
+    block++;
+  }
+  pthread_mutex_unlock(&wal->lock);
+}
+
+/* Returns the first block after the end of the database file (including
+ * the blocks only written to the log) */
+uint32 mdbWalEnd(mdbWal *wal)
+{
+  uint32 blocks;
+
+  pthread_mutex_lock(&wal->lock);
+  blocks = wal->blocks;
+  pthread_mutex_unlock(&wal->lock);
+
+  return blocks;
+}
+
+/* Logs the images of the transaction, they become the committed images of
+ * their blocks once the commit record follows them */
+static void mdbWalLogImages(mdbWal *wal)
+{
+  uint32 s;
+
+  for (s = 0; s < wal->spilled.capacity; s++)
+  {
+    if (wal->spilled.keys[s] != MDB_WAL_NIL)
+    {
+      mdbWalIndex(&wal->logged, wal->spilled.keys[s],
+          wal->spilled.values[s]);
+    }
+  }
+  mdbWalReset(&wal->spilled, 0);
+
+  for (s = 0; s < wal->pending.capacity; s++)
+  {
+    if (wal->pending.keys[s] != MDB_WAL_NIL)
+    {
+      mdbWalIndex(&wal->logged, wal->pending.keys[s],
+          mdbWalAppend(wal, wal->pending.keys[s], MDB_WAL_PAGE,
+          wal->images + wal->pending.values[s] * MDB_PAGE_SIZE));
+    }
+  }
+  mdbWalReset(&wal->pending, 0);
+}
+
+/* Ends a transaction: the log is synced before the function returns (one
+ * sync for all transactions committing meanwhile) */
+mdbError mdbWalCommit(mdbWal *wal)
+{
+  uint64 target;
+  uint64 end;
+
+  pthread_mutex_lock(&wal->lock);
+  mdbWalLogImages(wal);
+  mdbWalAppend(wal, wal->commits++, MDB_WAL_COMMIT, NULL);
+  mdbWalFlush(wal);
+  target = wal->end;
+
+  while (wal->synced < target)
+  {
+    if (wal->syncing)
+    {
+      /* a sync is running, the next one syncs this commit too */
+      pthread_cond_wait(&wal->synced_cond, &wal->lock);
+      continue;
+    }
+
+    /* the log is synced without holding the lock, further commits are
+     * appended meanwhile */
+    wal->syncing = 1;
+    end = wal->written;
+    pthread_mutex_unlock(&wal->lock);
+
+    mdbFileSync(wal->fd);
+
+    pthread_mutex_lock(&wal->lock);
+    wal->synced = (end > wal->synced) ? end : wal->synced;
+    wal->syncing = 0;
+    wal->syncs++;
+    pthread_cond_broadcast(&wal->synced_cond);
+  }
+  end = wal->end;
+  pthread_mutex_unlock(&wal->lock);
+
+  /* a long log is copied into the database file */
+  if (end > MDB_WAL_CHECKPOINT_SIZE)
+  {
+    mdbWalCheckpoint(wal);
+  }
+  return MDB_NO_ERROR;
+}
+
+/* Copies the latest committed block images of the log into the database
+ * file and starts a new log; the log of a transaction which has logged
+ * images already is kept (the copied images are read from the database
+ * file again) */
+mdbError mdbWalCheckpoint(mdbWal *wal)
+{
+  char *page = (char*) malloc(MDB_PAGE_SIZE);
+  uint32 s;
+
+  pthread_mutex_lock(&wal->lock);
+  while (wal->syncing)
+  {
+    pthread_cond_wait(&wal->synced_cond, &wal->lock);
+  }
+  mdbWalFlush(wal);
+
+  if (wal->logged.count > 0)
+  {
+    /* the log must be durable before the database file changes */
+    if (wal->synced < wal->written)
+    {
+      mdbFileSync(wal->fd);
+      wal->synced = wal->written;
+    }
+
+    for (s = 0; s < wal->logged.capacity; s++)
+    {
+      if (wal->logged.keys[s] != MDB_WAL_NIL &&
+          mdbFileRead(wal->fd, wal->logged.values[s], page, MDB_PAGE_SIZE) ==
+          MDB_PAGE_SIZE)
+      {
+        mdbFileWrite(wal->data, MDB_OFFSET(wal->logged.keys[s]), page,
+            MDB_PAGE_SIZE);
+      }
+    }
+    mdbFileSync(wal->data);
+  }
+
+  if (wal->spilled.count == 0)
+  {
+    mdbWalStart(wal);
+  }
+  else
+  {
+    mdbWalReset(&wal->logged, 0);
+  }
+  pthread_mutex_unlock(&wal->lock);
+
+  free(page);
+  return MDB_NO_ERROR;
+}
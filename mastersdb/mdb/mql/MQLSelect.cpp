@@ -30,6 +30,8 @@
  * 08.09.2010
  *  Added support for processing cross table joins.
  *  Re-factoring of bytecode generation.
+ * 17.10.2026
+ *  A descending select scans its (outer) table with PRVREC.
  */
 
 #include "MQLSelect.h"
@@ -41,6 +43,7 @@ MQLSelect::MQLSelect()
 {
   MDB_DEFAULT = ".Default";
   where = NULL;
+  descending = false;
 }
 
 /*
@@ -179,6 +182,7 @@ void MQLSelect::Reset()
   tables.clear();
   destColumns.clear();
   joins.clear();
+  descending = false;
 
   if (where != NULL) {
     delete where;
@@ -351,8 +355,9 @@ void MQLSelect::GenerateBytecode()
 
       loop_start[level] = VM->getCodePointer();
 
-      // NEXT RECORD
-      VM->AddInstruction(mdbVirtualMachine::NXTREC, *iter);
+      // NEXT RECORD (the outer table of a descending select: PREVIOUS)
+      VM->AddInstruction((descending && level == 0) ?
+          mdbVirtualMachine::PRVREC : mdbVirtualMachine::NXTREC, *iter);
       // NO OPERATION (place-holder for JUMP ON FAILURE)
       VM->AddInstruction(mdbVirtualMachine::NOP,
           mdbVirtualMachine::MVI_SUCCESS);
@@ -389,8 +394,9 @@ void MQLSelect::GenerateBytecode()
   {
     // saves the loop start
     loop_start[0] = VM->getCodePointer();
-    // NEXT RECORD
-    VM->AddInstruction(mdbVirtualMachine::NXTREC, tables.begin()->second->tp);
+    // NEXT RECORD (descending select: PREVIOUS RECORD)
+    VM->AddInstruction(descending ? mdbVirtualMachine::PRVREC :
+        mdbVirtualMachine::NXTREC, tables.begin()->second->tp);
     // NO OPERATION (place-holder for JUMP ON FAILURE)
     VM->AddInstruction(mdbVirtualMachine::NOP,
         mdbVirtualMachine::MVI_SUCCESS);
@@ -30,6 +30,8 @@
  *  Added mdbCondition structure.
  * 08.09.2010
  *  Added support for processing cross table joins.
+ * 17.10.2026
+ *  Added the descending flag (SELECT .. DESC).
  */
 
 #ifndef MQLSELECT_H_
@@ -95,6 +97,7 @@ private:
   uint16 dptr;
   mdbOperation *where;
   set<uint8> joins;
+  bool descending;                  // outer table scanned backwards
 
   uint16 loop_start[mdbVirtualMachine::MDB_VM_TABLES_SIZE];
 
@@ -124,6 +127,11 @@ public:
     this->dptr = dptr;
   }
 
+  void setDescending(bool descending)
+  {
+    this->descending = descending;
+  }
+
   void setOperation(mdbOperation *oper)
   {
     where = oper;
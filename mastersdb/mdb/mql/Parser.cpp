@@ -164,6 +164,10 @@ void Parser::MQLSelectStatement() {
 			Get();
 			MQLConditions();
 		}
+		if (la->kind == 19) {
+			Get();
+			select->setDescending(true); 
+		}
 		select->setDataPointer(dp);
 		select->GenerateBytecode();
 		
@@ -260,7 +264,7 @@ void Parser::MQLValue() {
 			Get();
 			s = TokenToString();
 			data = (char*)malloc(sizeof(uint32));
-			*data = atoi(s->c_str());
+			*((uint32*)data) = (uint32)atoi(s->c_str());
 			
 		} else if (la->kind == 4) {
 			Get();
@@ -22,6 +22,8 @@
  * ----------------
  * 03.09.2010
  *  Initial version of file.
+ * 17.10.2026
+ *  The result records store all values in place (no overflow pages).
  */
 
 #ifndef MDBQUERYRESULTS_H_
@@ -37,7 +39,11 @@ class mdbQueryResults: public MDB::mdbVirtualTable
 private:
   vector<char*> records;
 public:
-  mdbQueryResults(mdbDatabase *db) : mdbVirtualTable(db) { };
+  // the result records are kept in memory (no overflow pages)
+  mdbQueryResults(mdbDatabase *db) : mdbVirtualTable(db)
+  {
+    overflow = false;
+  };
   uint32 GetRecordCount();
   uint32 GetRecordSize();
   void NewRecord();
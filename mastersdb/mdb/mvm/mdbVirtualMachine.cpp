@@ -53,6 +53,10 @@
  *  - CMP    : Compare().
  * 10.09.2010
  *  Implemented: BOOL   : Boolean().
+ * 17.10.2026
+ *  Compare() works on the encoded values (mdbCompareValues), the constant
+ *  operand is encoded for the data type of the left operand.
+ *  Implemented: PRVREC : PreviousRecord().
  */
 
 #include "mdbVirtualMachine.h"
@@ -153,6 +157,7 @@ void mdbVirtualMachine::Decode()
     case INSVAL:  InsertValue(); break;
     case INSREC:  InsertRecord(); break;
     case NXTREC:  NextRecord(); break;
+    case PRVREC:  PreviousRecord(); break;
     case CPYREC:  CopyRecord(); break;
     case CPYVAL:  CopyValue(); break;
     case NEWREC:  NewRecord(); break;
@@ -308,7 +313,7 @@ void mdbVirtualMachine::Compare()
   mdbDatatype *type;
   char *left_val;
   char *right_val;
-  uint32 size;
+  char constant[sizeof(uint32)];
   int cmpval;
   uint16 result;
 
@@ -325,26 +330,24 @@ void mdbVirtualMachine::Compare()
       (tables[tbl_left]->getColumn(memory[col_left]))->type;
   left_val = tables[tbl_left]->getValue(memory[col_left]);
 
-  // determine the value of the right operand
-  right_val = (param & 0x08) ? memory[col_right] :
-      tables[tbl_right]->getValue(memory[col_right]);
-
-  // compares the two values based on their type
-  if (type->header > 0)
+  // determine the value of the right operand (constants are encoded like
+  // the column values)
+  if (param & 0x08)
   {
-    size = *((uint32*)left_val);
-    if (size > *((uint32*)right_val))
+    right_val = memory[col_right];
+    if (type->header == 0)
     {
-      size = *((uint32*)right_val);
+      mdbEncodeValue(type, constant, right_val);
+      right_val = constant;
     }
-    left_val += type->header;
-    right_val += type->header;
   }
   else
   {
-    size = type->size;
+    right_val = tables[tbl_right]->getValue(memory[col_right]);
   }
-  cmpval = type->compare(left_val, right_val, size);
+
+  // compares the two values based on their type
+  cmpval = mdbCompareValues(type, left_val, right_val);
 
   result = MVI_FAILURE;
 
@@ -433,6 +436,16 @@ void mdbVirtualMachine::NextRecord()
   _push(tables[data]->NextRecord() ? MVI_SUCCESS : MVI_FAILURE);
 }
 
+/*
+ * Retrieves the previous record of the tables[DATA] virtual table, the
+ * first call returns its last record (descending scan, read backwards
+ * from the B-tree). The result is placed on stack like by NXTREC.
+ */
+void mdbVirtualMachine::PreviousRecord()
+{
+  _push(tables[data]->PreviousRecord() ? MVI_SUCCESS : MVI_FAILURE);
+}
+
 /*
  * Allocates a new result record. If there was a record allocated before,
  * it is added to the result records store.
@@ -540,6 +553,7 @@ void mdbVirtualMachine::_decode(uint16 instr, string &s)
     case INSVAL:  s.append("INSVAL\t"); break;
     case INSREC:  s.append("INSREC\t"); break;
     case NXTREC:  s.append("NXTREC\t"); break;
+    case PRVREC:  s.append("PRVREC\t"); break;
     case CPYREC:  s.append("CPYREC\t"); break;
     case CPYVAL:  s.append("CPYVAL\t"); break;
     case NEWREC:  s.append("NEWREC\t"); break;
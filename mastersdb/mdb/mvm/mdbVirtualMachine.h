@@ -50,6 +50,8 @@
  *  Added two new instructions: RSTTBL and CMP.
  * 10.09.2010
  *  Added new instruction: BOOL.
+ * 17.10.2026
+ *  Added new instruction: PRVREC.
  */
 
 #ifndef MASTERSDBVM_H_
@@ -141,6 +143,7 @@ public:
     INSVAL, // INSERT VALUE
     INSREC, // INSERT RECORD
     NXTREC, // NEXT RECORD
+    PRVREC, // PREVIOUS RECORD (descending scan)
     CPYREC, // COPY RECORD (to result store)
     CPYVAL, // COPY VALUE (to result store)
     NEWREC, // NEW RESULT RECORD
@@ -255,6 +258,7 @@ private:
   void InsertValue();
   void InsertRecord();
   void NextRecord();
+  void PreviousRecord();
   void CopyRecord();
   void CopyValue();
   void NewRecord();
@@ -24,6 +24,18 @@
  *  Initial version of file.
  * 06.09.2010
  *  Added the ResetRecords method.
+ * 17.10.2026
+ *  Traversal nodes are released before the table B-tree is freed.
+ *  Added the BulkLoad method.
+ *  addValue(value) stores the value in the encoding of its data type.
+ *  Long column values are stored in overflow pages (storeValue), getValue
+ *  restores them when they are used (unloadValues).
+ *  ResetRecords ends the traversal (its latched nodes are released).
+ *  Reset destroys the latch of the table B-tree.
+ *  The records are scanned with a cursor on a snapshot of the statement
+ *  (OpenCursor), released by Reset.
+ *  Added the PreviousRecord and LastRecords methods: the records are
+ *  returned in descending order straight from the B-tree.
  */
 
 #include "mdbVirtualTable.h"
@@ -47,10 +59,12 @@ mdbVirtualTable::mdbVirtualTable(mdbDatabase *db)
 {
   this->db = db;
   T = NULL;
-  traversal = NULL;
+  cursor = NULL;
+  snapshot = NULL;
   record = NULL;
   cp = 0;
   record_size = 0;
+  overflow = true;
 }
 
 mdbVirtualTable::~mdbVirtualTable()
@@ -63,19 +77,30 @@ void mdbVirtualTable::addColumn(mdbColumn *column)
   mdbColumn *col = new mdbColumn;
   memcpy(col, column, sizeof(mdbColumn));
 
+  uint8 c = columns.size();
+
   columns.push_back(col);
-  cmap[string(col->name + 4, *((uint32*)col->name))] = columns.size() - 1;
+  cmap[string(col->name + 4, *((uint32*)col->name))] = c;
   cpos.push_back(record_size);
 
-  if (db->datatypes[column->type].header > 0)
+  // long values are restored into a buffer of their own
+  if (overflow && mdbColumnOverflows(db, col, c))
   {
-    record_size += db->datatypes[col->type].header +
-        col->length * db->datatypes[col->type].size;
+    values.push_back(new char[db->datatypes[col->type].header +
+        col->length * db->datatypes[col->type].size]);
   }
   else
   {
-    record_size += db->datatypes[col->type].size;
+    values.push_back(NULL);
   }
+  loaded.push_back(false);
+  stored.push_back(false);
+
+  record_size += (overflow) ? mdbColumnSize(db, col, c) :
+      ((db->datatypes[col->type].header > 0) ?
+      db->datatypes[col->type].header +
+      col->length * db->datatypes[col->type].size :
+      db->datatypes[col->type].size);
 }
 
 void mdbVirtualTable::addColumn(
@@ -109,7 +134,11 @@ void mdbVirtualTable::addValue(char *col_name, char *value)
 
   if (record == NULL) record = new char[record_size];
 
-  if (db->datatypes[columns[c]->type].header > 0)
+  if (values[c] != NULL)
+  {
+    storeValue(c, value);
+  }
+  else if (db->datatypes[columns[c]->type].header > 0)
   {
     memcpy(record + cpos[c],
         value,
@@ -124,12 +153,42 @@ void mdbVirtualTable::addValue(char *col_name, char *value)
 char* mdbVirtualTable::getValue(char *col_name)
 {
   uint8 c = cmap[string(col_name + 4, *((uint32*)col_name))];
-  return (record + cpos[c]);
+  return getValue(c);
 }
 
 char* mdbVirtualTable::getValue(uint8 column)
 {
-  return (record + cpos[column]);
+  if (values[column] == NULL)
+  {
+    return (record + cpos[column]);
+  }
+
+  // the overflow pages are only read if the value is used
+  if (!loaded[column])
+  {
+    mdbLoadLongValue(T, &db->datatypes[columns[column]->type],
+        values[column], record + cpos[column]);
+    loaded[column] = true;
+  }
+  return values[column];
+}
+
+void mdbVirtualTable::storeValue(uint8 c, char *value)
+{
+  mdbStoreLongValue(T, &db->datatypes[columns[c]->type], columns[c]->length,
+      record + cpos[c], value);
+  loaded[c] = false;
+  stored[c] = true;
+}
+
+void mdbVirtualTable::unloadValues()
+{
+  uint32 c;
+
+  for (c = 0; c < loaded.size(); c++)
+  {
+    loaded[c] = false;
+  }
 }
 
 uint8 mdbVirtualTable::getColumnCount()
@@ -142,13 +201,14 @@ void mdbVirtualTable::addValue(char *value)
   if (record == NULL) record = new char[record_size];
 
   // TODO: Raise error if value size > column maximum length
-  if (db->datatypes[columns[cp]->type].header > 0)
+  if (values[cp] != NULL)
   {
-    memcpy(record + cpos[cp], value, *((uint32*)value) + 4);
+    storeValue(cp, value);
   }
   else
   {
-    memcpy(record + cpos[cp], value, db->datatypes[columns[cp]->type].size);
+    mdbEncodeValue(&db->datatypes[columns[cp]->type], record + cpos[cp],
+        value);
   }
 
   cp = (cp < (columns.size()-1)) ? (cp + 1) : 0;
@@ -172,7 +232,52 @@ void mdbVirtualTable::CreateTable(char *name)
 void mdbVirtualTable::InsertRecord()
 {
   mdbError ret;
+  uint32 c;
+  uint32 first;
+
   ret = mdbBtreeInsert(record, T);
+
+  // the overflow pages written for a rejected record are released
+  for (c = 0; c < stored.size(); c++)
+  {
+    if (stored[c] && ret != MDB_NO_ERROR)
+    {
+      memcpy(&first, record + cpos[c] + sizeof(uint32), sizeof(uint32));
+      mdbOverflowFree(T, first);
+    }
+    stored[c] = false;
+  }
+}
+
+mdbError mdbVirtualTable::BulkLoad(mdbRecordSourcePtr source, void *cls,
+    uint8 fill)
+{
+  if (T == NULL)
+  {
+    return MDB_TABLE_NOT_FOUND;
+  }
+  return mdbBtreeBulkLoad(T, source, cls, fill);
+}
+
+/*
+ * The scans of a statement read the snapshot taken by its first scan, and
+ * the cursor latches no node between two records: the writers are not
+ * blocked while a long statement runs. The nodes of a mapped database are
+ * changed in place (no snapshots), its cursor reads the latest version of
+ * each node (a copy-on-write B-tree is read as it was when the cursor was
+ * opened anyway).
+ */
+void mdbVirtualTable::OpenCursor()
+{
+  if (snapshot == NULL)
+  {
+    mdbSnapshotOpen(&snapshot, db);
+  }
+  mdbBtreeCursorOpen(&cursor, T, NULL, NULL, 0);
+  if (snapshot != NULL)
+  {
+    mdbBtreeCursorSnapshot(cursor, snapshot);
+  }
 }
 
 bool mdbVirtualTable::NextRecord()
@@ -180,29 +285,50 @@ bool mdbVirtualTable::NextRecord()
   mdbError ret;
 
   // if this is the first call...
-  if (traversal == NULL)
+  if (cursor == NULL)
+  {
+    OpenCursor();
+  }
+
+  ret = mdbBtreeCursorNext(cursor, record);
+  unloadValues();
+  return (ret != MDB_BTREE_NO_MORE_RECORDS);
+}
+
+bool mdbVirtualTable::PreviousRecord()
+{
+  mdbError ret;
+
+  // the first call starts with the last record
+  if (cursor == NULL)
   {
-    traversal = (mdbBtreeTraversal*)malloc(sizeof(mdbBtreeTraversal));
-    traversal->node = T->root;
-    traversal->parent = NULL;
-    traversal->position = 0;
+    LastRecords();
   }
 
-  ret = mdbBtreeTraverse(&traversal, record);
+  ret = mdbBtreeCursorPrev(cursor, record);
+  unloadValues();
   return (ret != MDB_BTREE_NO_MORE_RECORDS);
 }
 
+void mdbVirtualTable::LastRecords()
+{
+  if (cursor == NULL)
+  {
+    OpenCursor();
+  }
+  mdbBtreeCursorLast(cursor);
+}
+
+/*
+ * The next scan starts over, it still reads the snapshot of the statement
+ * (e.g. the inner table of a join)
+ */
 void mdbVirtualTable::ResetRecords()
 {
-  if (traversal != NULL)
+  if (cursor != NULL)
   {
-    while (traversal->parent != NULL)
-    {
-      mdbFreeNode(traversal->node, 0);
-      free(traversal);
-      traversal = traversal->parent;
-    }
-    traversal->position = 0;
+    mdbBtreeCursorClose(cursor);
+    cursor = NULL;
   }
 }
 
@@ -210,9 +336,17 @@ void mdbVirtualTable::Reset()
 {
   uint32 c;
 
+  // the cursor nodes must be released while the B-tree still exists
+  ResetRecords();
+  if (snapshot != NULL)
+  {
+    mdbSnapshotClose(snapshot);
+  }
+
   if (T != NULL)
   {
     mdbFreeNode(T->root, 1);
+    mdbLatchDestroy(&T->latch);
     free(T);
   }
 
@@ -221,22 +355,24 @@ void mdbVirtualTable::Reset()
     for (c = 0; c < columns.size(); c++)
     {
       delete columns[c];
+      delete[] values[c];
     }
   }
 
-  ResetRecords();
-
-  free(traversal);
   delete[] record;
 
   T = NULL;
-  traversal = NULL;
+  cursor = NULL;
+  snapshot = NULL;
   record = NULL;
   cp = 0;
   record_size = 0;
   columns.clear();
   cmap.clear();
   cpos.clear();
+  values.clear();
+  loaded.clear();
+  stored.clear();
 }
 
 }
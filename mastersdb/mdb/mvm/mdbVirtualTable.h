@@ -24,6 +24,11 @@
  *  Initial version of file.
  * 06.09.2010
  *  Added the ResetRecords method.
+ * 17.10.2026
+ *  Added the BulkLoad and getRecordSize methods.
+ *  Long column values are stored out of line (overflow pages) and
+ *  restored by getValue.
+ *  The records are scanned with a cursor on a snapshot (OpenCursor).
   */
 
 #ifndef MDBVIRTUALTABLE_H_
@@ -57,11 +62,20 @@ private:
   vector<uint32> cpos;          // column value positions in the record
   mdbColumnMap cmap;            // used for mapping column names to indexes
   mdbBtree *T;                  // the table B-tree
-  mdbBtreeTraversal *traversal; // used for traversing the B-tree
+  mdbBtreeCursor *cursor;       // used for scanning the B-tree
+  mdbSnapshot *snapshot;        // snapshot read by the scans of a statement
   uint8 cp;                     // current column
+  vector<char*> values;         // restored long values (NULL = in record)
+  vector<bool> loaded;          // long value of the current record restored
+  vector<bool> stored;          // long value stored since the last insert
+
+  void storeValue(uint8 c, char *value);
+  void unloadValues();
+  void OpenCursor();
 protected:
   char *record;                 // used for storing the current record
   uint32 record_size;           // size of a record
+  bool overflow;                // long values are stored out of line
 public:
   mdbVirtualTable(mdbDatabase *db);
 
@@ -89,13 +103,22 @@ public:
 
   uint8 getColumnCount();
 
+  uint32 getRecordSize()
+  {
+    return record_size;
+  }
+
   void addValue(char *value);
 
   void LoadTable(char *name);
   void CreateTable(char *name);
 
   void InsertRecord();
+  mdbError BulkLoad(mdbRecordSourcePtr source, void *cls, uint8 fill);
   bool NextRecord();
+  bool PreviousRecord();
+
+  void LastRecords();
 
   void ResetRecords();
 